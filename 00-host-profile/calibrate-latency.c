@@ -0,0 +1,451 @@
+#include "../util/util.h"
+#include "../util/machine_const.h"
+#include "../util/topology.h"
+#include "../util/host_profile.h"
+#include "../util/sample_guard.h"
+#include "../util/freq_tag.h"
+#include "../util/hw_knobs.h"
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
+#define MAX_LATENCY 1024			 /* Histogram size; larger latencies are clamped */
+#define NUM_REGIONS 8				 /* Sets on the same slice and set are searched for in disjoint regions */
+#define MAX_GAP 65536				 /* Histogram size for the time between samples */
+#define GAP_ITERATIONS 100			 /* Gap loop iterations per sample */
+#define SHARE_UNCORE_STEP 6			 /* Uncore ratio decrease (x100 MHz) the core share is measured with */
+
+// Cache levels we build a latency histogram for
+enum Level { L1, L2, LLC_LOCAL, LLC_REMOTE, DRAM, NUM_LEVELS };
+static const char *level_names[NUM_LEVELS] = {"l1", "l2", "llc_local", "llc_remote", "dram"};
+
+// Keys of the latency profile that are only written when they could be
+// measured: the values of a previous calibration are dropped
+static const char *const calibrated_keys[] = {"core_mhz", "uncore_mhz", "core_share_pct", NULL};
+
+static uint32_t histograms[NUM_LEVELS][MAX_LATENCY];
+static uint32_t gap_histogram[MAX_GAP];
+
+static inline void record(enum Level level, uint32_t latency)
+{
+	histograms[level][latency < MAX_LATENCY ? latency : MAX_LATENCY - 1]++;
+}
+
+static inline void access_ev(struct Node *ev)
+{
+	// Access EV multiple times
+	for (int j = 0; j < 4; j++) {
+		struct Node *curr_node = ev;
+		while (curr_node && curr_node->next && curr_node->next->next) {
+			maccess(curr_node->address);
+			maccess(curr_node->next->address);
+			maccess(curr_node->next->next->address);
+			maccess(curr_node->address);
+			maccess(curr_node->next->address);
+			maccess(curr_node->next->next->address);
+			curr_node = curr_node->next;
+		}
+	}
+}
+
+/*
+ * L1 hits: load the same address over and over.
+ */
+static void measure_l1(struct Node *set, int samples)
+{
+	maccess(set->address);
+	for (int i = 0; i < samples; i++) {
+		record(L1, time_load(set->address));
+	}
+}
+
+/*
+ * L2 hits: cycle through more addresses than the L1 has ways, all mapping to
+ * the same L1/L2 set, but fewer than the L2 has ways.
+ */
+static void measure_l2(struct Node *set, int samples)
+{
+	struct Node *curr_node = set;
+	for (int i = 0; i < samples; i++) {
+		record(L2, time_load(curr_node->address));
+		curr_node = curr_node->next ? curr_node->next : set;
+	}
+}
+
+/*
+ * LLC hits: evict the monitoring set from the private caches with the EV and
+ * then time each address of the monitoring set once (as the receivers do).
+ * The EV must be in a different slice than the monitoring set, otherwise the
+ * two sets do not fit in the LLC sets they share.
+ */
+static void measure_llc(enum Level level, struct Node *ms, struct Node *ev, int samples)
+{
+	int i = 0;
+	while (i < samples) {
+		_mm_lfence();
+		access_ev(ev);
+		for (struct Node *curr_node = ms; curr_node != NULL && i < samples; curr_node = curr_node->next, i++) {
+			record(level, time_load(curr_node->address));
+		}
+	}
+}
+
+/*
+ * DRAM accesses: flush each address right before timing it.
+ */
+static void measure_dram(struct Node *set, int samples)
+{
+	struct Node *curr_node = set;
+	for (int i = 0; i < samples; i++) {
+		_mm_clflush(curr_node->address);
+		_mm_mfence();
+		record(DRAM, time_load(curr_node->address));
+		curr_node = curr_node->next ? curr_node->next : set;
+	}
+}
+
+/*
+ * Time between samples: the same loop as the receivers' monitoring loops
+ * (lfence; rdtsc; load; rdtscp over a monitoring set), recording the time
+ * between the starts of consecutive samples.
+ */
+static void measure_gaps(struct Node *set, long iterations)
+{
+	struct Node *curr_node = set;
+	uint32_t prev = (uint32_t)get_time();
+	for (long i = 0; i < iterations; i++) {
+		uint32_t start;
+		asm volatile(
+			"lfence\n\t"
+			"rdtsc\n\t"				/* eax = TSC (timestamp counter) */
+			"movl %%eax, %0\n\t"	/* start = eax */
+			"movq (%1), %%r9\n\t"	/* r9 = *(curr_node->address); LOAD */
+			"rdtscp\n\t"
+			: "=rm"(start) /* output */
+			: "r"(curr_node->address)
+			: "rax", "rcx", "rdx", "r9", "memory");
+		uint32_t gap = start - prev;
+		gap_histogram[gap < MAX_GAP ? gap : MAX_GAP - 1]++;
+		prev = start;
+		curr_node = curr_node->next ? curr_node->next : set;
+	}
+}
+
+/*
+ * Returns the p-th percentile (0-100) of a histogram with size buckets.
+ */
+static uint32_t histogram_percentile(uint32_t *histogram, int size, double p)
+{
+	uint64_t total = 0, seen = 0;
+	for (int t = 0; t < size; t++) {
+		total += histogram[t];
+	}
+	for (int t = 0; t < size; t++) {
+		seen += histogram[t];
+		if (seen * 100.0 >= p * total) {
+			return t;
+		}
+	}
+	return size - 1;
+}
+
+/*
+ * Measures the share of the remote LLC hit latency (what the monitors time)
+ * spent in the core clock domain, which util/freq_tag.py needs to rescale the
+ * traces. At a fixed core frequency, the latency in TSC cycles is
+ * a + b / uncore_mhz: it is measured at the current uncore frequency and with
+ * the uncore ratio pinned SHARE_UNCORE_STEP lower, and the share is a over the
+ * latency at the current frequency. The uncore ratio is restored afterwards.
+ * Returns the share in percent, or -1 if the uncore frequency could not be
+ * measured or changed.
+ */
+static int measure_core_share(struct freq_tag *freq, int cpu, struct Node *ms, struct Node *ev, int samples)
+{
+	if (freq->backend != FREQ_MSR) {
+		return -1;
+	}
+
+	uint32_t latency[2], core_mhz[2], uncore_mhz[2];
+	for (int step = 0; step < 2; step++) {
+		if (step == 1) {
+			int ratio = (int)(uncore_mhz[0] + 50) / 100 - SHARE_UNCORE_STEP;
+			if (ratio <= 0 || hw_knobs_set_uncore_ratio(cpu, ratio, ratio) < 0) {
+				return -1;
+			}
+		}
+		struct freq_counters start, end;
+		memset(histograms[LLC_REMOTE], 0, sizeof(histograms[LLC_REMOTE]));
+		freq_tag_read(freq, &start);
+		measure_llc(LLC_REMOTE, ms, ev, samples);
+		freq_tag_read(freq, &end);
+		freq_tag_between(freq, &start, &end, &core_mhz[step], &uncore_mhz[step]);
+		latency[step] = histogram_percentile(histograms[LLC_REMOTE], MAX_LATENCY, 50);
+	}
+	hw_knobs_restore();
+
+	printf("core share: llc_remote median %" PRIu32 " at %" PRIu32 "/%" PRIu32 " MHz, %" PRIu32 " at %" PRIu32
+		   "/%" PRIu32 " MHz (core/uncore)\n",
+		   latency[0], core_mhz[0], uncore_mhz[0], latency[1], core_mhz[1], uncore_mhz[1]);
+	if (uncore_mhz[1] == 0 || uncore_mhz[1] >= uncore_mhz[0] || latency[1] <= latency[0]) {
+		fprintf(stderr, "Warning: the uncore frequency did not change the latency, the core share is not calibrated\n");
+		return -1;
+	}
+	double uncore_part = (latency[1] - latency[0]) / (1.0 / uncore_mhz[1] - 1.0 / uncore_mhz[0]) / uncore_mhz[0];
+	double share = 1 - uncore_part / latency[0];
+	if (share < 0) {
+		share = 0;
+	}
+	return (int)(share * 100 + 0.5);
+}
+
+/*
+ * Fits the boundary between two adjacent latency clusters.
+ *
+ * Returns the threshold t (latency <= t belongs to the lower cluster) that
+ * misclassifies the fewest samples of the two histograms. Ties are broken by
+ * taking the middle of the best range.
+ */
+static uint32_t fit_boundary(uint32_t *lower, uint32_t *upper)
+{
+	uint32_t from = histogram_percentile(lower, MAX_LATENCY, 50);
+	uint32_t to = histogram_percentile(upper, MAX_LATENCY, 50);
+	if (to <= from) {
+		return from;
+	}
+
+	// Misclassified = lower samples above t + upper samples at or below t
+	uint64_t lower_above = 0, upper_below = 0;
+	for (uint32_t t = from + 1; t < MAX_LATENCY; t++) {
+		lower_above += lower[t];
+	}
+	for (uint32_t t = 0; t <= from; t++) {
+		upper_below += upper[t];
+	}
+
+	uint64_t best_cost = lower_above + upper_below;
+	uint32_t best_first = from, best_last = from;
+	for (uint32_t t = from + 1; t < to; t++) {
+		lower_above -= lower[t];
+		upper_below += upper[t];
+		uint64_t cost = lower_above + upper_below;
+		if (cost < best_cost) {
+			best_cost = cost;
+			best_first = best_last = t;
+		} else if (cost == best_cost && best_last == t - 1) {
+			best_last = t;
+		}
+	}
+	return (best_first + best_last) / 2;
+}
+
+int main(int argc, char **argv)
+{
+	// Check arguments
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "Wrong Input! Enter desired core ID, remote slice ID and (optionally) samples per level!\n");
+		fprintf(stderr, "Enter: %s <core_ID> <remote_slice_ID> [samples]\n", argv[0]);
+		exit(1);
+	}
+
+	// Parse core ID
+	int core_ID;
+	sscanf(argv[1], "%d", &core_ID);
+	if (core_ID > NUM_CHA - 1 || core_ID < 0 || cha_to_cpu(core_ID) < 0) {
+		fprintf(stderr, "Wrong core! core_ID should be a CHA with an active core in [0, %d]!\n", NUM_CHA - 1);
+		exit(1);
+	}
+
+	// Parse remote slice number
+	int remote_slice;
+	sscanf(argv[2], "%d", &remote_slice);
+	if (remote_slice > LLC_CACHE_SLICES - 1 || remote_slice < 0 || remote_slice == core_ID) {
+		fprintf(stderr, "Wrong slice! remote_slice_ID should be in [0, %d] and differ from core_ID!\n", LLC_CACHE_SLICES - 1);
+		exit(1);
+	}
+
+	// Parse samples per level
+	int samples = 100000;
+	if (argc == 4) {
+		sscanf(argv[3], "%d", &samples);
+		if (samples <= 0) {
+			fprintf(stderr, "Wrong samples! samples should be greater than 0!\n");
+			exit(1);
+		}
+	}
+
+	// Pin the program to the desired core
+	pin_cpu(cha_to_cpu(core_ID));
+
+	// Set the scheduling priority to high to avoid interruptions
+	// (lower priorities cause more favorable scheduling, and -20 is the max)
+	setpriority(PRIO_PROCESS, 0, -20);
+
+	// Allocate large buffer (pool of addresses)
+	void *buffer = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+	if (buffer == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	// Write data to the buffer so that any copy-on-write
+	// mechanisms will give us our own copies of the pages.
+	memset(buffer, 0, BUF_SIZE);
+
+	// Using fixed cache sets for the calibration
+	int set_ID = 5;
+	int set_size = 16;
+	int l2_set_size = L1_CACHE_WAYS + L1_CACHE_WAYS / 2; // more than the L1 ways, fewer than the L2 ways
+
+	// Prepare the sets (all share the same L1/L2 set)
+	// Sets in the same slice are searched for in different regions of the
+	// buffer so that they do not contain the same addresses
+	char *region = (char *)buffer;
+	uint64_t region_size = BUF_SIZE / NUM_REGIONS;
+	struct Node *l2_set = NULL, *local_ms = NULL, *remote_ms = NULL;
+	struct Node *local_ev = NULL, *remote_ev = NULL;
+	append_l2_congruent_set(&l2_set, region, core_ID, set_ID, l2_set_size);
+	append_l2_congruent_set(&local_ms, region + region_size, core_ID, set_ID, set_size);
+	append_l2_congruent_set(&local_ev, region + 2 * region_size, core_ID, set_ID, set_size);
+	append_l2_congruent_set(&remote_ms, region + 3 * region_size, remote_slice, set_ID, set_size);
+	append_l2_congruent_set(&remote_ev, region + 4 * region_size, remote_slice, set_ID, set_size);
+
+	// Warm up
+	measure_llc(LLC_LOCAL, local_ms, remote_ev, samples);
+
+	// Measure the share of the latency that depends on the core frequency
+	struct freq_tag freq;
+	freq_tag_init(&freq, cha_to_cpu(core_ID));
+	int core_share_pct = measure_core_share(&freq, cha_to_cpu(core_ID), remote_ms, local_ev, samples);
+	memset(histograms, 0, sizeof(histograms));
+
+	// Measure each level, and the frequencies the thresholds are valid at
+	// (the traces are normalized to them, see util/freq_tag.h)
+	struct freq_counters freq_start, freq_end;
+	uint32_t core_mhz, uncore_mhz;
+	freq_tag_read(&freq, &freq_start);
+	measure_l1(l2_set, samples);
+	measure_l2(l2_set, samples);
+	measure_llc(LLC_LOCAL, local_ms, remote_ev, samples);
+	measure_llc(LLC_REMOTE, remote_ms, local_ev, samples);
+	measure_dram(remote_ms, samples);
+	freq_tag_read(&freq, &freq_end);
+	freq_tag_between(&freq, &freq_start, &freq_end, &core_mhz, &uncore_mhz);
+	freq_tag_close(&freq);
+
+	// Fit the boundaries between adjacent levels
+	uint32_t medians[NUM_LEVELS];
+	uint32_t thresholds[NUM_LEVELS - 1];
+	for (int level = 0; level < NUM_LEVELS; level++) {
+		medians[level] = histogram_percentile(histograms[level], MAX_LATENCY, 50);
+	}
+	for (int level = 0; level < NUM_LEVELS - 1; level++) {
+		thresholds[level] = fit_boundary(histograms[level], histograms[level + 1]);
+	}
+
+	// Measure the time between samples of an uninterrupted loop; the excess
+	// over the fastest iteration rarely exceeds a DRAM access, while an
+	// interrupt or SMI costs thousands of cycles
+	struct irq_snapshot *irqs_before = malloc(sizeof(*irqs_before));
+	struct irq_snapshot *irqs_after = malloc(sizeof(*irqs_after));
+	int irqs_ok = irq_snapshot_take(cha_to_cpu(core_ID), irqs_before) == 0;
+	measure_gaps(local_ms, (long)samples * GAP_ITERATIONS);
+	irqs_ok = irqs_ok && irq_snapshot_take(cha_to_cpu(core_ID), irqs_after) == 0;
+
+	uint32_t gap_period = 0;
+	while (gap_period < MAX_GAP - 1 && gap_histogram[gap_period] == 0) {
+		gap_period++;
+	}
+	uint32_t gap_p999 = histogram_percentile(gap_histogram, MAX_GAP, 99.9);
+	uint32_t gap_bound = 4 * (gap_p999 - gap_period);
+	if (gap_bound < 2 * medians[DRAM]) {
+		gap_bound = 2 * medians[DRAM];
+	}
+	uint64_t gaps_detected = 0;
+	for (uint32_t t = gap_period + gap_bound + 1; t < MAX_GAP; t++) {
+		gaps_detected += gap_histogram[t];
+	}
+
+	// Sanity check: the clusters must be ordered
+	for (int level = 1; level < NUM_LEVELS; level++) {
+		if (medians[level] <= medians[level - 1]) {
+			fprintf(stderr, "Warning: %s median (%" PRIu32 ") is not above %s median (%" PRIu32 ")\n",
+					level_names[level], medians[level], level_names[level - 1], medians[level - 1]);
+		}
+	}
+
+	// Write the histograms (for plotting)
+	FILE *histogram_file = fopen("out/latency-histogram.out", "w");
+	if (histogram_file == NULL) {
+		perror("fopen out/latency-histogram.out");
+		exit(1);
+	}
+	for (int t = 0; t < MAX_LATENCY; t++) {
+		fprintf(histogram_file, "%d", t);
+		for (int level = 0; level < NUM_LEVELS; level++) {
+			fprintf(histogram_file, " %" PRIu32, histograms[level][t]);
+		}
+		fprintf(histogram_file, "\n");
+	}
+	fclose(histogram_file);
+
+	// Write the latency profile of this host
+	// (the keys other tools store in it, such as the cooldown_cycles of the
+	// side-channel monitors, are kept)
+	FILE *profile = host_profile_begin(HOST_PROFILE_LATENCY);
+	if (profile == NULL) {
+		perror("host_profile_begin");
+		exit(1);
+	}
+	fprintf(profile, "# Written by calibrate-latency on core %d (remote slice %d)\n", core_ID, remote_slice);
+	for (int level = 0; level < NUM_LEVELS; level++) {
+		fprintf(profile, "%s_median %" PRIu32 "\n", level_names[level], medians[level]);
+	}
+	for (int level = 0; level < NUM_LEVELS - 1; level++) {
+		fprintf(profile, "%s_%s_thres %" PRIu32 "\n", level_names[level], level_names[level + 1], thresholds[level]);
+	}
+	fprintf(profile, "gap_bound %" PRIu32 "\n", gap_bound);
+	if (core_mhz > 0) {
+		fprintf(profile, "core_mhz %" PRIu32 "\n", core_mhz);
+	}
+	if (uncore_mhz > 0) {
+		fprintf(profile, "uncore_mhz %" PRIu32 "\n", uncore_mhz);
+	}
+	if (core_share_pct >= 0) {
+		fprintf(profile, "core_share_pct %d\n", core_share_pct);
+	}
+	if (host_profile_commit(HOST_PROFILE_LATENCY, profile, calibrated_keys) != 0) {
+		fprintf(stderr, "Error: could not write the latency profile\n");
+		exit(1);
+	}
+
+	// Print a summary
+	printf("level\t\tp5\tp50\tp95\n");
+	for (int level = 0; level < NUM_LEVELS; level++) {
+		printf("%-10s\t%" PRIu32 "\t%" PRIu32 "\t%" PRIu32 "\n", level_names[level],
+			   histogram_percentile(histograms[level], MAX_LATENCY, 5), medians[level],
+			   histogram_percentile(histograms[level], MAX_LATENCY, 95));
+	}
+	for (int level = 0; level < NUM_LEVELS - 1; level++) {
+		printf("%s/%s boundary: %" PRIu32 "\n", level_names[level], level_names[level + 1], thresholds[level]);
+	}
+	printf("sample period: %" PRIu32 " (p99.9 %" PRIu32 "), gap bound: %" PRIu32 "\n", gap_period, gap_p999, gap_bound);
+	printf("gaps detected: %" PRIu64 "\n", gaps_detected);
+	if (irqs_ok) {
+		irq_snapshot_report(stdout, "", irqs_before, irqs_after);
+	}
+
+	// Clean up
+	munmap(buffer, BUF_SIZE);
+	free(irqs_before);
+	free(irqs_after);
+	struct Node *curr_node, *tmp = NULL;
+	for (curr_node = l2_set; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+	for (curr_node = local_ms; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+	for (curr_node = remote_ms; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+	for (curr_node = local_ev; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+	for (curr_node = remote_ev; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+
+	return 0;
+}
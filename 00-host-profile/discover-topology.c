@@ -0,0 +1,260 @@
+#include "../util/util.h"
+#include "../util/machine_const.h"
+#include "../util/host_profile.h"
+#include "../util/topology.h"
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
+#define SET_SIZE 16					 /* Addresses per slice (all in the same L1/L2 set) */
+#define MIN_MARGIN 4				 /* Cycles between the two closest slices below which a mapping is ambiguous */
+#define MATRIX_FILE "out/latency-matrix.out"
+
+/*
+ * Each CPU under test gets its own L2 set (so that SMT siblings do not evict
+ * each other's sets) and, for every slice, a set of addresses on that slice.
+ */
+struct probe {
+	int cpu;
+	int core_id; /* Physical core (SMT siblings share it) */
+	int set_ID;
+	struct Node *sets[NUM_CHA];
+	uint32_t medians[NUM_CHA];
+	int cha;
+	uint32_t margin; /* Median latency of the second closest slice minus the closest */
+	pthread_t thread;
+};
+
+static pthread_barrier_t barrier;
+static int rounds = 200;
+
+static int compare_uint32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int read_sysfs_int(const char *path, int *value)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return -1;
+	}
+	int ok = fscanf(f, "%d", value) == 1;
+	fclose(f);
+	return ok ? 0 : -1;
+}
+
+/*
+ * Returns a topology attribute (e.g., physical_package_id) of an online cpu,
+ * or -1 if the cpu is offline or does not exist (offline cpus have no
+ * topology directory).
+ */
+static int cpu_topology(int cpu, const char *attribute)
+{
+	char path[128];
+	int value;
+	sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, attribute);
+	return read_sysfs_int(path, &value) == 0 ? value : -1;
+}
+
+/*
+ * Measures the LLC hit latency of every slice from the cpu of the probe and
+ * picks the slice with the lowest median: the one on the same tile.
+ */
+static void *probe_cpu(void *arg)
+{
+	struct probe *p = (struct probe *)arg;
+	pin_cpu(p->cpu);
+	uint32_t *samples = malloc(sizeof(*samples) * rounds * SET_SIZE);
+	pthread_barrier_wait(&barrier);
+
+	for (int slice = 0; slice < NUM_CHA; slice++) {
+		// The sets of the next two slices (same L1/L2 set) are the EV
+		struct Node *ev_a = p->sets[(slice + 1) % NUM_CHA], *ev_b = p->sets[(slice + 2) % NUM_CHA];
+		int n = 0;
+		for (int r = 0; r < rounds; r++) {
+			struct Node *curr_node;
+			for (curr_node = p->sets[slice]; curr_node != NULL; curr_node = curr_node->next) {
+				maccess(curr_node->address);
+			}
+
+			// Evict from the private caches (the lines stay in the LLC)
+			for (int j = 0; j < 2; j++) {
+				for (curr_node = ev_a; curr_node != NULL; curr_node = curr_node->next) {
+					maccess(curr_node->address);
+				}
+				for (curr_node = ev_b; curr_node != NULL; curr_node = curr_node->next) {
+					maccess(curr_node->address);
+				}
+			}
+			_mm_lfence();
+
+			for (curr_node = p->sets[slice]; curr_node != NULL; curr_node = curr_node->next) {
+				samples[n++] = time_load(curr_node->address);
+			}
+		}
+		qsort(samples, n, sizeof(*samples), compare_uint32);
+		p->medians[slice] = samples[n / 2];
+	}
+	free(samples);
+
+	// The closest slice is on our tile
+	int best = 0, second = -1;
+	for (int slice = 1; slice < NUM_CHA; slice++) {
+		if (p->medians[slice] < p->medians[best]) {
+			second = best;
+			best = slice;
+		} else if (second < 0 || p->medians[slice] < p->medians[second]) {
+			second = slice;
+		}
+	}
+	p->cha = best;
+	p->margin = p->medians[second] - p->medians[best];
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	// Check arguments
+	if (argc > 2) {
+		fprintf(stderr, "Wrong Input! Enter (optionally) the rounds per slice!\n");
+		fprintf(stderr, "Enter: %s [rounds]\n", argv[0]);
+		exit(1);
+	}
+
+	// Parse rounds
+	if (argc == 2) {
+		sscanf(argv[1], "%d", &rounds);
+		if (rounds <= 0) {
+			fprintf(stderr, "Wrong rounds! rounds should be greater than 0!\n");
+			exit(1);
+		}
+	}
+
+	// The memory is allocated (and the slices are measured) on the socket of
+	// cpu 0, as in the experiments
+	pin_cpu(0);
+	int package = cpu_topology(0, "physical_package_id");
+	static struct probe probes[TOPOLOGY_MAX_CPUS];
+	int nr_probes = 0;
+	for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++) {
+		if (cpu_topology(cpu, "physical_package_id") == package) {
+			probes[nr_probes].cpu = cpu;
+			probes[nr_probes].core_id = cpu_topology(cpu, "core_id");
+			probes[nr_probes].set_ID = 5 + 2 * nr_probes;
+			nr_probes++;
+		}
+	}
+
+	// Set the scheduling priority to high to avoid interruptions
+	// (lower priorities cause more favorable scheduling, and -20 is the max)
+	setpriority(PRIO_PROCESS, 0, -20);
+
+	// Allocate large buffer (pool of addresses)
+	void *buffer = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+	if (buffer == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	// Write data to the buffer so that any copy-on-write
+	// mechanisms will give us our own copies of the pages.
+	memset(buffer, 0, BUF_SIZE);
+
+	// Prepare the sets (the slice hash does not depend on the CPU mapping)
+	printf("Preparing the sets of %d cpus on package %d\n", nr_probes, package);
+	for (int i = 0; i < nr_probes; i++) {
+		for (int slice = 0; slice < NUM_CHA; slice++) {
+			append_l2_congruent_set(&probes[i].sets[slice], buffer, slice, probes[i].set_ID, SET_SIZE);
+		}
+	}
+
+	// Probe all cpus in parallel
+	pthread_barrier_init(&barrier, NULL, nr_probes);
+	for (int i = 0; i < nr_probes; i++) {
+		if (pthread_create(&probes[i].thread, NULL, probe_cpu, &probes[i]) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (int i = 0; i < nr_probes; i++) {
+		pthread_join(probes[i].thread, NULL);
+	}
+
+	// Map each CHA to the lowest cpu on its tile
+	int cha_cpu[NUM_CHA], cha_core_id[NUM_CHA];
+	for (int cha = 0; cha < NUM_CHA; cha++) {
+		cha_cpu[cha] = -1;
+	}
+	int conflicts = 0;
+	printf("cpu\tcha\tlocal\tmargin\tbuilt-in cha\n");
+	for (int i = 0; i < nr_probes; i++) {
+		struct probe *p = &probes[i];
+		int builtin = -1;
+		for (int cha = 0; cha < NUM_CHA; cha++) {
+			if (cha_id_to_cpu[cha] == p->cpu) {
+				builtin = cha;
+			}
+		}
+		printf("%d\t%d\t%" PRIu32 "\t%" PRIu32 "\t%d%s\n", p->cpu, p->cha, p->medians[p->cha], p->margin, builtin,
+			   p->margin < MIN_MARGIN ? "\t(ambiguous)" : "");
+		if (cha_cpu[p->cha] < 0) {
+			cha_cpu[p->cha] = p->cpu;
+			cha_core_id[p->cha] = p->core_id;
+		} else if (cha_core_id[p->cha] != p->core_id) {
+			conflicts++;
+		}
+	}
+	if (conflicts > 0) {
+		fprintf(stderr, "Warning: %d cpus of different cores map to the same CHA as another cpu; re-run with more rounds on an idle machine\n", conflicts);
+	}
+
+	// Write the topology profile of this host
+	FILE *profile = host_profile_open(HOST_PROFILE_TOPOLOGY, "w");
+	if (profile == NULL) {
+		perror("host_profile_open");
+		exit(1);
+	}
+	fprintf(profile, "# Written by discover-topology (package %d, %d rounds per slice)\n", package, rounds);
+	for (int cha = 0; cha < NUM_CHA; cha++) {
+		fprintf(profile, "cha_%d_cpu %d\n", cha, cha_cpu[cha]);
+	}
+	for (int i = 0; i < nr_probes; i++) {
+		fprintf(profile, "cpu_%d_cha %d\n", probes[i].cpu, probes[i].cha);
+	}
+	fclose(profile);
+
+	// Write the cpu to slice latency matrix (used by infer-layout.py)
+	FILE *matrix = fopen(MATRIX_FILE, "w");
+	if (matrix == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	fprintf(matrix, "# cpu cha then the median latency to slices 0 to %d (%d rounds per slice)\n", NUM_CHA - 1, rounds);
+	for (int i = 0; i < nr_probes; i++) {
+		fprintf(matrix, "%d %d", probes[i].cpu, probes[i].cha);
+		for (int slice = 0; slice < NUM_CHA; slice++) {
+			fprintf(matrix, " %" PRIu32, probes[i].medians[slice]);
+		}
+		fprintf(matrix, "\n");
+	}
+	fclose(matrix);
+	printf("Wrote the latency matrix to %s\n", MATRIX_FILE);
+
+	// Clean up
+	munmap(buffer, BUF_SIZE);
+	pthread_barrier_destroy(&barrier);
+	for (int i = 0; i < nr_probes; i++) {
+		for (int slice = 0; slice < NUM_CHA; slice++) {
+			struct Node *curr_node, *tmp = NULL;
+			for (curr_node = probes[i].sets[slice]; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+		}
+	}
+
+	return 0;
+}
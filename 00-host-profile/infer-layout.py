@@ -0,0 +1,233 @@
+"""
+Infer the die layout (the 2D tile coordinates of each CHA) from the cpu to
+slice latency matrix written by bin/discover-topology.
+
+An uncontended LLC hit travels from the core to the slice and back on the
+mesh, so its latency grows with the number of vertical and horizontal hops
+between the two tiles. We place the CHAs on a rows x cols grid (tiles without
+a CHA are holes) so that the latencies are best explained, in the least
+squares sense, by
+
+    L[cpu][slice] - L[cpu][local slice] = a + bh * horizontal hops + bv * vertical hops
+
+for every pair of distinct tiles. The search is a simulated annealing over the
+placements, restarted from several random placements. A layout is only defined up
+to reflections, so the result is reflected to put the CHA IDs in increasing
+order down the columns, left to right, as on our machine.
+
+The layout is written to the layout profile of this host, which the C tools
+(util/topology.c) and the analytical model (04-analytical-model/config.py)
+read.
+"""
+import argparse
+import math
+import os
+import random
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'util'))
+from host_profile import LAYOUT, write_host_profile
+
+
+def read_matrix(path):
+    """Return {cha: [median latency to each slice]}, using the first cpu of each CHA."""
+    matrix = {}
+    with open(path) as f:
+        for line in f:
+            if line.startswith('#') or not line.strip():
+                continue
+            fields = [int(x) for x in line.split()]
+            cha, latencies = fields[1], fields[2:]
+            if cha not in matrix:
+                matrix[cha] = latencies
+    return matrix
+
+
+class Placement:
+    """A placement of the CHAs on the grid and the sums of the least-squares fit."""
+
+    def __init__(self, deltas, sources, nr_chas, rows, cols, cells):
+        self.deltas = deltas
+        self.sources = sources
+        self.is_source = [cha in deltas for cha in range(nr_chas)]
+        self.nr_chas = nr_chas
+        self.cols = cols
+        self.cell = list(cells)
+        self.occupant = [-1] * (rows * cols)
+        for cha, cell in enumerate(self.cell):
+            self.occupant[cell] = cha
+        # The (source, slice) pairs whose hops depend on the cell of each CHA
+        self.pairs = [[(src, cha) for src in sources if src != cha] +
+                      ([(cha, s) for s in range(nr_chas) if s != cha] if self.is_source[cha] else [])
+                      for cha in range(nr_chas)]
+        self.sums = [0.0] * 9
+        self._add({pair for pairs in self.pairs for pair in pairs}, 1)
+
+    def _add(self, pairs, sign):
+        n, sh, sv, shh, svv, shv, sd, shd, svd = self.sums
+        for src, s in pairs:
+            a, b = self.cell[src], self.cell[s]
+            h = abs(a % self.cols - b % self.cols)
+            v = abs(a // self.cols - b // self.cols)
+            d = self.deltas[src][s]
+            n += sign
+            sh += sign * h
+            sv += sign * v
+            shh += sign * h * h
+            svv += sign * v * v
+            shv += sign * h * v
+            sd += sign * d
+            shd += sign * h * d
+            svd += sign * v * d
+        self.sums = [n, sh, sv, shh, svv, shv, sd, shd, svd]
+
+    def fit(self):
+        """Return (bh, bv, a) and the sum of squared residuals (without the
+        constant part, which does not depend on the placement)."""
+        n, sh, sv, shh, svv, shv, sd, shd, svd = self.sums
+        # Centered (co)variances: the intercept a absorbs the means
+        chh, cvv, chv = shh - sh * sh / n, svv - sv * sv / n, shv - sh * sv / n
+        chd, cvd = shd - sh * sd / n, svd - sv * sd / n
+        det = chh * cvv - chv * chv
+        if det <= 1e-9:
+            return None, math.inf
+        bh = (cvv * chd - chv * cvd) / det
+        bv = (chh * cvd - chv * chd) / det
+        if bh <= 0 or bv <= 0:
+            # More hops cannot be faster
+            return None, math.inf
+        a = (sd - bh * sh - bv * sv) / n
+        return (bh, bv, a), -(bh * chd + bv * cvd)
+
+    def move(self, cha, cell):
+        """Move cha to cell (swapping with its occupant, if any). Returns the
+        undo information."""
+        other = self.occupant[cell]
+        pairs = self.pairs[cha]
+        if other >= 0 and other != cha:
+            pairs = pairs + [pair for pair in self.pairs[other] if cha not in pair]
+        self._add(pairs, -1)
+        old = self.cell[cha]
+        self.cell[cha] = cell
+        self.occupant[cell] = cha
+        self.occupant[old] = other
+        if other >= 0:
+            self.cell[other] = old
+        self._add(pairs, 1)
+        return cha, old
+
+    def undo(self, undo):
+        self.move(*undo)
+
+
+def anneal(deltas, nr_chas, rows, cols, iterations, rng):
+    """Return the best placement (list of cells) found from a random start, and its cost."""
+    cells = rng.sample(range(rows * cols), nr_chas)
+    p = Placement(deltas, sorted(deltas), nr_chas, rows, cols, cells)
+    _, cost = p.fit()
+    best, best_cost = list(p.cell), cost
+
+    # The temperature decays geometrically from the variance of the latency
+    # deltas. Some runs still end up in a local minimum (typically, the die
+    # transposed when the two hop costs are close), hence the restarts
+    n, sd = p.sums[0], p.sums[6]
+    sdd = sum(deltas[src][s] ** 2 for src in deltas for s in range(nr_chas) if s != src)
+    t0 = max(sdd / n - (sd / n) ** 2, 1.0)
+    for i in range(iterations):
+        temperature = t0 * (1e-3 ** (i / iterations))
+        undo = p.move(rng.randrange(nr_chas), rng.randrange(rows * cols))
+        _, new_cost = p.fit()
+        if new_cost <= cost or (cost < math.inf and new_cost < math.inf and
+                                rng.random() < math.exp((cost - new_cost) / temperature)):
+            cost = new_cost
+            if cost < best_cost:
+                best, best_cost = list(p.cell), cost
+        else:
+            p.undo(undo)
+    return best, best_cost
+
+
+def canonical(cells, rows, cols):
+    """Return the reflection of the placement whose CHA IDs best increase down
+    the columns, left to right."""
+    def reflect(cell, flip_rows, flip_cols):
+        r, c = cell // cols, cell % cols
+        r = rows - 1 - r if flip_rows else r
+        c = cols - 1 - c if flip_cols else c
+        return r * cols + c
+
+    def column_major(cell):
+        return (cell % cols) * rows + cell // cols
+
+    candidates = [[reflect(cell, fr, fc) for cell in cells] for fr in (False, True) for fc in (False, True)]
+    # By the rearrangement inequality, the sum is largest when the column-major
+    # index increases with the CHA ID
+    return max(candidates, key=lambda c: sum(cha * column_major(cell) for cha, cell in enumerate(c)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Infer the die layout from the latency matrix of discover-topology')
+    parser.add_argument('--matrix', default='out/latency-matrix.out', help='Latency matrix (default: %(default)s)')
+    parser.add_argument('--rows', type=int, default=5, help='Rows of tiles on the die (default: %(default)s)')
+    parser.add_argument('--cols', type=int, default=6, help='Columns of tiles on the die (default: %(default)s)')
+    parser.add_argument('--restarts', type=int, default=8, help='Annealing restarts (default: %(default)s)')
+    parser.add_argument('--iterations', type=int, default=10000,
+                        help='Moves per restart (default: %(default)s)')
+    parser.add_argument('--seed', type=int, default=0, help='Random seed (default: %(default)s)')
+    parser.add_argument('--dry-run', action='store_true', help='Print the layout without writing the profile')
+    args = parser.parse_args()
+
+    matrix = read_matrix(args.matrix)
+    if not matrix:
+        print('Error: no measurements in {}'.format(args.matrix))
+        sys.exit(1)
+    nr_chas = len(next(iter(matrix.values())))
+    if nr_chas > args.rows * args.cols:
+        print('Error: {} CHAs do not fit on a {}x{} grid'.format(nr_chas, args.rows, args.cols))
+        sys.exit(1)
+    deltas = {cha: [lat - latencies[cha] for lat in latencies] for cha, latencies in matrix.items()}
+    print('{} CHAs, {} with a core, on a {}x{} grid'.format(nr_chas, len(deltas), args.rows, args.cols))
+
+    rng = random.Random(args.seed)
+    results = [anneal(deltas, nr_chas, args.rows, args.cols, args.iterations, rng) for _ in range(args.restarts)]
+    cells, _ = min(results, key=lambda r: r[1])
+    cells = canonical(cells, args.rows, args.cols)
+    agree = sum(canonical(c, args.rows, args.cols) == cells for c, _ in results)
+
+    p = Placement(deltas, sorted(deltas), nr_chas, args.rows, args.cols, cells)
+    (bh, bv, a), _ = p.fit()
+    residuals = []
+    for src in p.sources:
+        for s in range(nr_chas):
+            if s != src:
+                h = abs(cells[src] % args.cols - cells[s] % args.cols)
+                v = abs(cells[src] // args.cols - cells[s] // args.cols)
+                residuals.append(deltas[src][s] - (a + bh * h + bv * v))
+    rms = math.sqrt(sum(r * r for r in residuals) / len(residuals))
+
+    layout = [[-1] * args.cols for _ in range(args.rows)]
+    for cha, cell in enumerate(cells):
+        layout[cell // args.cols][cell % args.cols] = cha
+    print('Fit: {:.2f} cycles per horizontal hop, {:.2f} per vertical hop, {:.2f} to leave the tile, '
+          'rms residual {:.2f} cycles'.format(bh, bv, a, rms))
+    print('{} of {} restarts found this layout'.format(agree, args.restarts))
+    print('DIE_LAYOUT = [')
+    print(',\n'.join('    [{}]'.format(', '.join(str(cha) for cha in row)) for row in layout))
+    print(']')
+    if agree < 2 and args.restarts > 1:
+        print('Warning: the restarts disagree; re-run with more --restarts or --iterations')
+
+    if not args.dry_run:
+        values = {'rows': args.rows, 'cols': args.cols}
+        for cha, cell in enumerate(cells):
+            values['cha_{}_row'.format(cha)] = cell // args.cols
+            values['cha_{}_col'.format(cha)] = cell % args.cols
+        values['horizontal_hop_cycles_x100'] = round(bh * 100)
+        values['vertical_hop_cycles_x100'] = round(bv * 100)
+        values['rms_residual_cycles_x100'] = round(rms * 100)
+        path = write_host_profile(LAYOUT, values, 'Written by infer-layout.py from {}'.format(args.matrix))
+        print('Wrote the layout profile to {}'.format(path))
+
+
+if __name__ == '__main__':
+    main()
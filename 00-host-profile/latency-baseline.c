@@ -0,0 +1,367 @@
+#include "../util/util.h"
+#include "../util/machine_const.h"
+#include "../util/host_profile.h"
+#include "../util/topology.h"
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
+#define SET_SIZE 16					 /* Addresses per slice (all in the same L1/L2 set) */
+#define MAX_LATENCY 1024			 /* Histogram size; larger latencies are clamped */
+#define MAX_PARALLEL 8				 /* Paths measured at once, at most */
+#define MAX_LINKS 128				 /* Directed links of the mesh (4 per tile) */
+
+// Percentiles written for each path (the 25th and 75th give the noise floor)
+#define NUM_PERCENTILES 7
+static const double percentiles[NUM_PERCENTILES] = {0, 5, 25, 50, 75, 95, 99};
+
+// Directions of the links leaving a tile
+enum Link { LINK_UP, LINK_DOWN, LINK_LEFT, LINK_RIGHT, NUM_LINK_DIRS };
+
+/*
+ * A core to slice path. The EV that evicts the monitoring set from the private
+ * caches is on the local slice of the core, which uses no mesh link; for the
+ * local path itself, it is on the closest other slice.
+ */
+struct path {
+	int core;
+	int slice;
+	int ev_slice;
+	int hops;
+	uint64_t links[MAX_LINKS / 64]; /* Links used by the loads and the EV */
+	uint32_t histogram[MAX_LATENCY];
+};
+
+/*
+ * Each worker has its own L2 set, so that the sets of the paths measured at
+ * once never share LLC sets.
+ */
+struct worker {
+	int set_ID;
+	struct Node *sets[NUM_CHA];
+	struct path *path;
+	pthread_t thread;
+};
+
+static struct path paths[NUM_CHA * NUM_CHA];
+static struct worker workers[MAX_PARALLEL];
+static pthread_barrier_t barrier;
+static int samples = 10000;
+
+static void add_link(uint64_t *links, int row, int col, enum Link dir)
+{
+	int id = (row * DIE_COLS + col) * NUM_LINK_DIRS + dir;
+	links[id / 64] |= 1ULL << (id % 64);
+}
+
+/*
+ * Adds the links of a flow from one tile to another. As in the analytical
+ * model (get_config_contention), flows go vertically first, to the row of the
+ * destination, and then horizontally.
+ * Returns the number of hops.
+ */
+static int add_route(uint64_t *links, int from, int to)
+{
+	int row, col, to_row, to_col;
+	if (cha_to_tile(from, &row, &col) != 0 || cha_to_tile(to, &to_row, &to_col) != 0) {
+		fprintf(stderr, "The die layout does not place CHA %d or %d!\n", from, to);
+		exit(1);
+	}
+	int hops = abs(to_row - row) + abs(to_col - col);
+	for (; row != to_row; row += to_row > row ? 1 : -1) {
+		add_link(links, row, col, to_row > row ? LINK_DOWN : LINK_UP);
+	}
+	for (; col != to_col; col += to_col > col ? 1 : -1) {
+		add_link(links, row, col, to_col > col ? LINK_RIGHT : LINK_LEFT);
+	}
+	return hops;
+}
+
+static int hops_between(int a, int b)
+{
+	uint64_t links[MAX_LINKS / 64] = {0};
+	return add_route(links, a, b);
+}
+
+static void init_path(struct path *p, int core, int slice)
+{
+	memset(p, 0, sizeof(*p));
+	p->core = core;
+	p->slice = slice;
+	p->ev_slice = core;
+	if (slice == core) {
+		p->ev_slice = -1;
+		for (int s = 0; s < NUM_CHA; s++) {
+			if (s != core && (p->ev_slice < 0 || hops_between(core, s) < hops_between(core, p->ev_slice))) {
+				p->ev_slice = s;
+			}
+		}
+	}
+
+	// Requests go from the core to the slice and data comes back
+	p->hops = add_route(p->links, core, slice);
+	add_route(p->links, slice, core);
+	add_route(p->links, core, p->ev_slice);
+	add_route(p->links, p->ev_slice, core);
+}
+
+/*
+ * Two paths can be measured at once if they do not share a mesh link, a core
+ * or a slice (including the slices of their EVs).
+ */
+static int paths_conflict(const struct path *a, const struct path *b)
+{
+	for (int i = 0; i < MAX_LINKS / 64; i++) {
+		if (a->links[i] & b->links[i]) {
+			return 1;
+		}
+	}
+	return a->core == b->core || a->slice == b->slice || a->slice == b->ev_slice || a->ev_slice == b->slice ||
+		   a->ev_slice == b->ev_slice;
+}
+
+/*
+ * Returns the p-th percentile (0-100) of a histogram with size buckets.
+ */
+static uint32_t histogram_percentile(const uint32_t *histogram, int size, double p)
+{
+	uint64_t total = 0, seen = 0;
+	for (int t = 0; t < size; t++) {
+		total += histogram[t];
+	}
+	for (int t = 0; t < size; t++) {
+		seen += histogram[t];
+		if (seen * 100.0 >= p * total) {
+			return t;
+		}
+	}
+	return size - 1;
+}
+
+/*
+ * Evicts the monitoring set from the private caches with the EV and then times
+ * each address of the monitoring set once (as the receivers do), n times in
+ * total. The histogram is only updated if record is set.
+ */
+static void measure(struct worker *w, int n, int record)
+{
+	struct path *p = w->path;
+	struct Node *ms = w->sets[p->slice], *ev = w->sets[p->ev_slice];
+	int i = 0;
+	while (i < n) {
+		for (int j = 0; j < 2; j++) {
+			for (struct Node *curr_node = ev; curr_node != NULL; curr_node = curr_node->next) {
+				maccess(curr_node->address);
+			}
+		}
+		_mm_lfence();
+		for (struct Node *curr_node = ms; curr_node != NULL && i < n; curr_node = curr_node->next, i++) {
+			uint32_t latency = time_load(curr_node->address);
+			if (record) {
+				p->histogram[latency < MAX_LATENCY ? latency : MAX_LATENCY - 1]++;
+			}
+		}
+	}
+}
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	pin_cpu(cha_to_cpu(w->path->core));
+
+	// Warm up, then measure all paths of the round at the same time
+	measure(w, samples / 10, 0);
+	pthread_barrier_wait(&barrier);
+	measure(w, samples, 1);
+
+	return NULL;
+}
+
+/*
+ * Measures the LLC hit latency of every core to slice path on a quiet mesh.
+ * Paths that share no mesh link (according to the routing of the analytical
+ * model) are measured at the same time, up to parallel at once.
+ */
+int main(int argc, char **argv)
+{
+	// Check arguments
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "Wrong Input! Enter output filename and (optionally) the samples per path and the paths measured at once!\n");
+		fprintf(stderr, "Enter: %s <output_filename> [samples] [parallel]\n", argv[0]);
+		exit(1);
+	}
+
+	// Parse samples
+	if (argc >= 3) {
+		sscanf(argv[2], "%d", &samples);
+		if (samples <= 0) {
+			fprintf(stderr, "Wrong samples! samples should be greater than 0!\n");
+			exit(1);
+		}
+	}
+
+	// Parse parallelism
+	int parallel = 4;
+	if (argc == 4) {
+		sscanf(argv[3], "%d", &parallel);
+		if (parallel <= 0 || parallel > MAX_PARALLEL) {
+			fprintf(stderr, "Wrong parallel! parallel should be in [1, %d]!\n", MAX_PARALLEL);
+			exit(1);
+		}
+	}
+
+	// Prepare output file
+	FILE *output_file = fopen(argv[1], "w");
+	if (output_file == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+
+	// Every core (CHA with an active core) to every slice
+	int nr_paths = 0;
+	for (int core = 0; core < NUM_CHA; core++) {
+		if (cha_to_cpu(core) < 0) {
+			continue;
+		}
+		for (int slice = 0; slice < NUM_CHA; slice++) {
+			init_path(&paths[nr_paths++], core, slice);
+		}
+	}
+
+	// Set the scheduling priority to high to avoid interruptions
+	// (lower priorities cause more favorable scheduling, and -20 is the max)
+	setpriority(PRIO_PROCESS, 0, -20);
+
+	// Allocate large buffer (pool of addresses)
+	void *buffer = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+	if (buffer == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	// Write data to the buffer so that any copy-on-write
+	// mechanisms will give us our own copies of the pages.
+	memset(buffer, 0, BUF_SIZE);
+
+	// Prepare the sets of each worker
+	for (int w = 0; w < parallel; w++) {
+		workers[w].set_ID = 5 + 2 * w;
+		for (int slice = 0; slice < NUM_CHA; slice++) {
+			append_l2_congruent_set(&workers[w].sets[slice], buffer, slice, workers[w].set_ID, SET_SIZE);
+		}
+	}
+
+	// Measure the paths in rounds of paths that do not conflict (first fit)
+	static int done[NUM_CHA * NUM_CHA];
+	int nr_done = 0, nr_rounds = 0;
+	printf("Measuring %d paths, up to %d at once\n", nr_paths, parallel);
+	while (nr_done < nr_paths) {
+		int nr_workers = 0;
+		for (int i = 0; i < nr_paths && nr_workers < parallel; i++) {
+			int conflict = done[i];
+			for (int w = 0; w < nr_workers && !conflict; w++) {
+				conflict = paths_conflict(&paths[i], workers[w].path);
+			}
+			if (!conflict) {
+				workers[nr_workers++].path = &paths[i];
+				done[i] = 1;
+			}
+		}
+
+		pthread_barrier_init(&barrier, NULL, nr_workers);
+		for (int w = 0; w < nr_workers; w++) {
+			if (pthread_create(&workers[w].thread, NULL, run_worker, &workers[w]) != 0) {
+				perror("pthread_create");
+				exit(1);
+			}
+		}
+		for (int w = 0; w < nr_workers; w++) {
+			pthread_join(workers[w].thread, NULL);
+		}
+		pthread_barrier_destroy(&barrier);
+
+		nr_done += nr_workers;
+		nr_rounds++;
+	}
+	printf("Measured %d paths in %d rounds\n", nr_paths, nr_rounds);
+
+	// Write the percentiles of each path; the noise floor of a path is its
+	// interquartile range
+	fprintf(output_file, "# core slice hops min p5 p25 median p75 p95 p99 noise\n");
+	for (int i = 0; i < nr_paths; i++) {
+		struct path *p = &paths[i];
+		uint32_t pct[NUM_PERCENTILES];
+		for (int l = 0; l < NUM_PERCENTILES; l++) {
+			pct[l] = histogram_percentile(p->histogram, MAX_LATENCY, percentiles[l]);
+		}
+		fprintf(output_file, "%d %d %d", p->core, p->slice, p->hops);
+		for (int l = 0; l < NUM_PERCENTILES; l++) {
+			fprintf(output_file, " %" PRIu32, pct[l]);
+		}
+		fprintf(output_file, " %" PRIu32 "\n", pct[4] - pct[2]);
+	}
+	fclose(output_file);
+
+	// Write the histograms (for plotting)
+	FILE *histogram_file = fopen("out/latency-baseline-histogram.out", "w");
+	if (histogram_file == NULL) {
+		perror("fopen out/latency-baseline-histogram.out");
+		exit(1);
+	}
+	fprintf(histogram_file, "# core slice latency count\n");
+	for (int i = 0; i < nr_paths; i++) {
+		for (int t = 0; t < MAX_LATENCY; t++) {
+			if (paths[i].histogram[t] > 0) {
+				fprintf(histogram_file, "%d %d %d %" PRIu32 "\n", paths[i].core, paths[i].slice, t, paths[i].histogram[t]);
+			}
+		}
+	}
+	fclose(histogram_file);
+
+	// Write the baseline profile of this host
+	FILE *profile = host_profile_open(HOST_PROFILE_BASELINE, "w");
+	if (profile == NULL) {
+		perror("host_profile_open");
+		exit(1);
+	}
+	fprintf(profile, "# Written by latency-baseline (%d samples per path, up to %d paths at once)\n", samples, parallel);
+	for (int i = 0; i < nr_paths; i++) {
+		struct path *p = &paths[i];
+		uint32_t p25 = histogram_percentile(p->histogram, MAX_LATENCY, 25);
+		uint32_t p75 = histogram_percentile(p->histogram, MAX_LATENCY, 75);
+		fprintf(profile, "path_%d_%d_median %" PRIu32 "\n", p->core, p->slice,
+				histogram_percentile(p->histogram, MAX_LATENCY, 50));
+		fprintf(profile, "path_%d_%d_noise %" PRIu32 "\n", p->core, p->slice, p75 - p25);
+	}
+	fclose(profile);
+
+	// Print the matrix of medians
+	printf("median\t");
+	for (int slice = 0; slice < NUM_CHA; slice++) {
+		printf("\t%d", slice);
+	}
+	printf("\n");
+	for (int i = 0; i < nr_paths; i++) {
+		if (paths[i].slice == 0) {
+			printf("core %d\t", paths[i].core);
+		}
+		printf("\t%" PRIu32, histogram_percentile(paths[i].histogram, MAX_LATENCY, 50));
+		if (paths[i].slice == NUM_CHA - 1) {
+			printf("\n");
+		}
+	}
+
+	// Clean up
+	munmap(buffer, BUF_SIZE);
+	for (int w = 0; w < parallel; w++) {
+		for (int slice = 0; slice < NUM_CHA; slice++) {
+			struct Node *curr_node, *tmp = NULL;
+			for (curr_node = workers[w].sets[slice]; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+		}
+	}
+
+	return 0;
+}
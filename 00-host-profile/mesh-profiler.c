@@ -0,0 +1,215 @@
+#include "../util/pmon_utils.h"
+#include "../util/imc_pmon.h"
+#include "../util/msr_transport.h"
+#include "../util/pmon_events.h"
+#include "../util/topology.h"
+#include <inttypes.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_RINGS 4
+#define NUM_DIRECTIONS 4
+
+static const char *ring_names[NUM_RINGS] = {"ad", "iv", "ak", "bl"}; /* Indexed by enum Ring */
+static const char *direction_names[NUM_DIRECTIONS] = {"up", "down", "left", "right"};
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static int parse_rings(char *arg, enum Ring rings[NUM_RINGS])
+{
+	int nr_rings = 0;
+	for (char *name = strtok(arg, ","); name != NULL; name = strtok(NULL, ",")) {
+		int r;
+		for (r = 0; r < NUM_RINGS && strcmp(name, ring_names[r]) != 0; r++);
+		if (r == NUM_RINGS || nr_rings == NUM_RINGS) {
+			return -1;
+		}
+		rings[nr_rings++] = r;
+	}
+	return nr_rings;
+}
+
+/*
+ * Samples the ring-in-use counters of all CHAs every period and writes the
+ * utilization of each ring direction at each tile, i.e., the in-use count
+ * over the uncore clock ticks it was counted for. A CHA has only 4 counters,
+ * so the rings are multiplexed (one ring per period, see pmon_events.h), and
+ * a line per tile and ring is written after each round over the rings.
+ *
+ * The DRAM traffic of each round (CAS commands of each IMC channel and
+ * requests of each M2M, see imc_pmon.h) is read in the same bursts and
+ * written to <output_filename>.mem, as "time_us box reads writes" lines.
+ */
+int main(int argc, char **argv)
+{
+	// Check arguments
+	if (argc != 4 && argc != 5) {
+		fprintf(stderr, "Wrong Input! Enter output filename, sampling period (us), duration (s) and (optionally) the rings to sample!\n");
+		fprintf(stderr, "Enter: %s <output_filename> <period_us> <duration_s> [ad,iv,ak,bl]\n", argv[0]);
+		exit(1);
+	}
+
+	// Parse sampling period
+	int period_us;
+	sscanf(argv[2], "%d", &period_us);
+	if (period_us <= 0) {
+		fprintf(stderr, "Wrong period! period_us should be greater than 0!\n");
+		exit(1);
+	}
+
+	// Parse duration
+	double duration;
+	sscanf(argv[3], "%lf", &duration);
+	if (duration <= 0) {
+		fprintf(stderr, "Wrong duration! duration_s should be greater than 0!\n");
+		exit(1);
+	}
+	uint64_t nr_periods = (uint64_t)(duration * 1000000 / period_us);
+
+	// Parse rings
+	enum Ring rings[NUM_RINGS] = {AD, IV, AK, BL};
+	int nr_rings = NUM_RINGS;
+	if (argc == 5 && (nr_rings = parse_rings(argv[4], rings)) <= 0) {
+		fprintf(stderr, "Wrong rings! rings should be a comma-separated list of ad, iv, ak and bl!\n");
+		exit(1);
+	}
+
+	// Prepare output file
+	FILE *output_file = fopen(argv[1], "w");
+	if (output_file == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	fprintf(output_file, "# time_us ring cha up down left right\n");
+	char mem_filename[256];
+	snprintf(mem_filename, sizeof(mem_filename), "%s.mem", argv[1]);
+	FILE *mem_file = fopen(mem_filename, "w");
+	if (mem_file == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	fprintf(mem_file, "# time_us box reads writes\n");
+
+	// Multiplex the directions of the rings (each ring is one group)
+	const char *event_names[NUM_RINGS * NUM_DIRECTIONS];
+	static char name_storage[NUM_RINGS * NUM_DIRECTIONS][16];
+	for (int r = 0; r < nr_rings; r++) {
+		for (int d = 0; d < NUM_DIRECTIONS; d++) {
+			sprintf(name_storage[r * NUM_DIRECTIONS + d], "%s_%s", ring_names[rings[r]], direction_names[d]);
+			event_names[r * NUM_DIRECTIONS + d] = name_storage[r * NUM_DIRECTIONS + d];
+		}
+	}
+	static struct pmon_mux mux;
+	if (pmon_mux_init(&mux, event_names, nr_rings * NUM_DIRECTIONS) != nr_rings) {
+		fprintf(stderr, "Could not set up the ring events!\n");
+		exit(1);
+	}
+
+	// Any cpu of the socket gives access to its uncore counters
+	static struct msr_transport transport;
+	static struct msr_batch batch;
+	msr_transport_open(&transport, 0, MSR_BACKEND_AUTO);
+	msr_batch_init(&batch, &transport);
+	static struct imc_pmon imc;
+	imc_pmon_open(&imc, &transport);
+	pmon_mux_attach_imc(&mux, &imc);
+	printf("Sampling %d ring(s) on %d CHAs every %d us through %s\n", nr_rings, NUM_CHA, period_us,
+		   msr_backend_name(transport.backend));
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	// Program the first ring and start counting
+	pmon_mux_start(&mux, &batch);
+
+	struct timespec start, next;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	next = start;
+
+	static double sums[NUM_RINGS][NUM_CHA][NUM_DIRECTIONS];
+	uint64_t rounds = 0, burst_cycles = 0, n;
+	uint64_t dram_reads = 0, dram_writes = 0;
+	long time_us = 0;
+	for (n = 0; n < nr_periods && !stop; n++) {
+		// Wait for the end of the period
+		next.tv_nsec += period_us * 1000L;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		// Freeze, read the counters, program the next ring and unfreeze,
+		// all in one burst
+		pmon_mux_rotate(&mux, &batch);
+		burst_cycles += transport.last_submit_cycles;
+		if (mux.current != 0) {
+			continue;
+		}
+
+		// Store the utilization of each tile over the round
+		time_us = (next.tv_sec - start.tv_sec) * 1000000L + (next.tv_nsec - start.tv_nsec) / 1000;
+		for (int r = 0; r < nr_rings; r++) {
+			for (int cha = 0; cha < NUM_CHA; cha++) {
+				fprintf(output_file, "%ld %s %d", time_us, ring_names[rings[r]], cha);
+				for (int d = 0; d < NUM_DIRECTIONS; d++) {
+					double utilization = pmon_mux_rate(&mux, cha, r * NUM_DIRECTIONS + d);
+					sums[rings[r]][cha][d] += utilization;
+					fprintf(output_file, " %.4f", utilization);
+				}
+				fprintf(output_file, "\n");
+			}
+		}
+		char prefix[32];
+		sprintf(prefix, "%ld ", time_us);
+		imc_pmon_write(&imc, mem_file, prefix);
+		dram_reads += imc_pmon_cas_reads(&imc);
+		dram_writes += imc_pmon_cas_writes(&imc);
+		pmon_mux_clear(&mux);
+		rounds++;
+	}
+
+	// Stop counting
+	pmon_mux_stop(&mux, &batch);
+
+	// Print the average utilization of each tile (and its coordinates)
+	printf("Sampled %" PRIu64 " periods in %" PRIu64 " rounds (%" PRIu64 " cycles per readout burst on average)\n", n,
+		   rounds, n > 0 ? burst_cycles / n : 0);
+	printf("ring\tcha\ttile\tup\tdown\tleft\tright\n");
+	for (int r = 0; r < nr_rings && rounds > 0; r++) {
+		for (int cha = 0; cha < NUM_CHA; cha++) {
+			int row, col;
+			if (cha_to_tile(cha, &row, &col) == 0) {
+				printf("%s\t%d\t(%d,%d)", ring_names[rings[r]], cha, row, col);
+			} else {
+				printf("%s\t%d\t-", ring_names[rings[r]], cha);
+			}
+			for (int d = 0; d < NUM_DIRECTIONS; d++) {
+				printf("\t%.4f", sums[rings[r]][cha][d] / rounds);
+			}
+			printf("\n");
+		}
+	}
+
+	// Print the DRAM traffic (each CAS command moves a line)
+	if (imc.nr_channels > 0 && time_us > 0) {
+		printf("DRAM traffic over %d channels: %" PRIu64 " lines read (%.1f MB/s), %" PRIu64
+			   " lines written (%.1f MB/s)\n", imc.nr_channels, dram_reads,
+			   (double)dram_reads * IMC_PMON_LINE_BYTES / time_us, dram_writes,
+			   (double)dram_writes * IMC_PMON_LINE_BYTES / time_us);
+	}
+
+	// Clean up
+	imc_pmon_close(&imc);
+	msr_transport_close(&transport);
+	fclose(output_file);
+	fclose(mem_file);
+
+	return 0;
+}
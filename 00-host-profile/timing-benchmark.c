@@ -0,0 +1,247 @@
+#include "../util/util.h"
+#include "../util/machine_const.h"
+#include "../util/topology.h"
+#include "../util/host_profile.h"
+#include "../util/timing.h"
+#include <math.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
+#define NUM_REGIONS 8				 /* Sets on the same slice and set are searched for in disjoint regions */
+#define NUM_BACKENDS 3
+
+// What we time with each backend
+enum Measurement { OVERHEAD, L1, LLC_LOCAL, LLC_REMOTE, NUM_MEASUREMENTS };
+static const char *measurement_names[NUM_MEASUREMENTS] = {"overhead", "l1", "llc_local", "llc_remote"};
+
+struct stats {
+	uint32_t median;
+	double mean;
+	double stddev;
+};
+
+static inline void access_ev(struct Node *ev)
+{
+	// Access EV multiple times
+	for (int j = 0; j < 4; j++) {
+		struct Node *curr_node = ev;
+		while (curr_node && curr_node->next && curr_node->next->next) {
+			maccess(curr_node->address);
+			maccess(curr_node->next->address);
+			maccess(curr_node->next->next->address);
+			maccess(curr_node->address);
+			maccess(curr_node->next->address);
+			maccess(curr_node->next->next->address);
+			curr_node = curr_node->next;
+		}
+	}
+}
+
+static int compare_uint32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Median, and mean and standard deviation of the samples up to the 99.9th
+ * percentile (the rest are mostly interrupts). Sorts the samples.
+ */
+static struct stats get_stats(uint32_t *samples, int n)
+{
+	struct stats s;
+	qsort(samples, n, sizeof(*samples), compare_uint32);
+	s.median = samples[n / 2];
+
+	int kept = n - n / 1000;
+	double sum = 0, sum_sq = 0;
+	for (int i = 0; i < kept; i++) {
+		sum += samples[i];
+		sum_sq += (double)samples[i] * samples[i];
+	}
+	s.mean = sum / kept;
+	s.stddev = sqrt(fmax(sum_sq / kept - s.mean * s.mean, 0));
+	return s;
+}
+
+static void measure(const struct timing *t, enum Measurement m, uint32_t *samples, int n,
+					struct Node *l1_set, struct Node *ms, struct Node *ev)
+{
+	int i = 0;
+	switch (m) {
+	case OVERHEAD:
+		for (i = 0; i < n; i++) {
+			samples[i] = timing_empty(t);
+		}
+		break;
+	case L1:
+		maccess(l1_set->address);
+		for (i = 0; i < n; i++) {
+			samples[i] = timing_load(t, l1_set->address);
+		}
+		break;
+	default:
+		// Evict the monitoring set from the private caches with the EV and
+		// time each address once (as the receivers do)
+		while (i < n) {
+			_mm_lfence();
+			access_ev(ev);
+			for (struct Node *curr_node = ms; curr_node != NULL && i < n; curr_node = curr_node->next, i++) {
+				samples[i] = timing_load(t, curr_node->address);
+			}
+		}
+		break;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	// Check arguments
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "Wrong Input! Enter desired core ID, remote slice ID and (optionally) samples per measurement!\n");
+		fprintf(stderr, "Enter: %s <core_ID> <remote_slice_ID> [samples]\n", argv[0]);
+		exit(1);
+	}
+
+	// Parse core ID
+	int core_ID;
+	sscanf(argv[1], "%d", &core_ID);
+	if (core_ID > NUM_CHA - 1 || core_ID < 0 || cha_to_cpu(core_ID) < 0) {
+		fprintf(stderr, "Wrong core! core_ID should be a CHA with an active core in [0, %d]!\n", NUM_CHA - 1);
+		exit(1);
+	}
+
+	// Parse remote slice number
+	int remote_slice;
+	sscanf(argv[2], "%d", &remote_slice);
+	if (remote_slice > LLC_CACHE_SLICES - 1 || remote_slice < 0 || remote_slice == core_ID) {
+		fprintf(stderr, "Wrong slice! remote_slice_ID should be in [0, %d] and differ from core_ID!\n", LLC_CACHE_SLICES - 1);
+		exit(1);
+	}
+
+	// Parse samples per measurement
+	int samples = 100000;
+	if (argc == 4) {
+		sscanf(argv[3], "%d", &samples);
+		if (samples <= 0) {
+			fprintf(stderr, "Wrong samples! samples should be greater than 0!\n");
+			exit(1);
+		}
+	}
+
+	// Pin the program to the desired core
+	pin_cpu(cha_to_cpu(core_ID));
+
+	// Set the scheduling priority to high to avoid interruptions
+	// (lower priorities cause more favorable scheduling, and -20 is the max)
+	setpriority(PRIO_PROCESS, 0, -20);
+
+	// Set up the backends (the rdpmc ones fall back to TSC if unavailable)
+	struct timing backends[NUM_BACKENDS] = {{.backend = TIMING_TSC, .fd = -1}};
+	timing_init(&backends[1], TIMING_EVENT_CYCLES);
+	timing_init(&backends[2], TIMING_EVENT_L1D_PEND_MISS);
+
+	// Allocate large buffer (pool of addresses)
+	void *buffer = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+	if (buffer == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	// Write data to the buffer so that any copy-on-write
+	// mechanisms will give us our own copies of the pages.
+	memset(buffer, 0, BUF_SIZE);
+
+	// Prepare the sets (same as calibrate-latency)
+	int set_ID = 5;
+	int set_size = 16;
+	char *region = (char *)buffer;
+	uint64_t region_size = BUF_SIZE / NUM_REGIONS;
+	struct Node *local_ms = NULL, *remote_ms = NULL, *local_ev = NULL, *remote_ev = NULL;
+	append_l2_congruent_set(&local_ms, region, core_ID, set_ID, set_size);
+	append_l2_congruent_set(&local_ev, region + region_size, core_ID, set_ID, set_size);
+	append_l2_congruent_set(&remote_ms, region + 2 * region_size, remote_slice, set_ID, set_size);
+	append_l2_congruent_set(&remote_ev, region + 3 * region_size, remote_slice, set_ID, set_size);
+
+	uint32_t *buf = (uint32_t *)malloc(sizeof(*buf) * samples);
+	struct stats results[NUM_BACKENDS][NUM_MEASUREMENTS];
+	double separation[NUM_BACKENDS];
+
+	// Warm up
+	measure(&backends[0], LLC_LOCAL, buf, samples, local_ms, local_ms, remote_ev);
+
+	int best = 0;
+	for (int b = 0; b < NUM_BACKENDS; b++) {
+		for (int m = 0; m < NUM_MEASUREMENTS; m++) {
+			struct Node *ms = m == LLC_REMOTE ? remote_ms : local_ms;
+			struct Node *ev = m == LLC_REMOTE ? local_ev : remote_ev;
+			measure(&backends[b], m, buf, samples, local_ms, ms, ev);
+			results[b][m] = get_stats(buf, samples);
+		}
+
+		// How well the backend separates local and remote LLC hits: the
+		// difference of the means over the pooled standard deviation
+		struct stats *local = &results[b][LLC_LOCAL], *remote = &results[b][LLC_REMOTE];
+		double pooled = sqrt((local->stddev * local->stddev + remote->stddev * remote->stddev) / 2);
+		separation[b] = (remote->mean - local->mean) / fmax(pooled, 1e-9);
+
+		if (backends[b].backend != TIMING_TSC || b == 0) {
+			if (separation[b] > separation[best]) {
+				best = b;
+			}
+		}
+	}
+
+	// Print a summary
+	printf("backend\t\t\tmeasurement\tmedian\tmean\tstddev\n");
+	for (int b = 0; b < NUM_BACKENDS; b++) {
+		for (int m = 0; m < NUM_MEASUREMENTS; m++) {
+			printf("%-20s\t%-10s\t%" PRIu32 "\t%.1f\t%.2f\n", timing_name(&backends[b]), measurement_names[m],
+				   results[b][m].median, results[b][m].mean, results[b][m].stddev);
+		}
+		printf("%-20s\tlocal/remote LLC separation: %.2f\n", timing_name(&backends[b]), separation[b]);
+	}
+	printf("Best backend: %s\n", timing_name(&backends[best]));
+
+	// Write the timing profile of this host
+	FILE *profile = host_profile_open(HOST_PROFILE_TIMING, "w");
+	if (profile == NULL) {
+		perror("host_profile_open");
+		exit(1);
+	}
+	fprintf(profile, "# Written by timing-benchmark on core %d (remote slice %d)\n", core_ID, remote_slice);
+	fprintf(profile, "backend %d\n", backends[best].backend);
+	fprintf(profile, "event %d\n", backends[best].event);
+	for (int b = 0; b < NUM_BACKENDS; b++) {
+		if (b > 0 && backends[b].backend == TIMING_TSC) {
+			continue;
+		}
+		char name[32];
+		strcpy(name, timing_name(&backends[b]));
+		for (char *p = name; *p != '\0'; p++) {
+			if (*p == '-') {
+				*p = '_';
+			}
+		}
+		fprintf(profile, "%s_overhead %" PRIu32 "\n", name, results[b][OVERHEAD].median);
+		fprintf(profile, "%s_separation_x100 %d\n", name, (int)(separation[b] * 100));
+	}
+	fclose(profile);
+
+	// Clean up
+	for (int b = 0; b < NUM_BACKENDS; b++) {
+		timing_close(&backends[b]);
+	}
+	munmap(buffer, BUF_SIZE);
+	free(buf);
+	struct Node *curr_node, *tmp = NULL;
+	for (curr_node = local_ms; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+	for (curr_node = remote_ms; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+	for (curr_node = local_ev; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+	for (curr_node = remote_ev; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+
+	return 0;
+}
@@ -1,19 +1,36 @@
+import argparse
+import os
 import subprocess
+import sys
 from collections import namedtuple
 
 import numpy as np
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'util'))
+from host_profile import LATENCY, load_die_layout, load_host_profile
+from sample_guard import gap_mask
+
 Placement = namedtuple('Placement', 'tx_core tx_slice_a tx_slice_b rx_core rx_ms_slice rx_ev_slice')
 
 DIVIDER = '=' * 40
-
-DIE_LAYOUT = [
+SWEEP_PLACEMENTS = 'out/sweep-placements.txt'
+
+# Latency thresholds of this host (see 00-host-profile); the defaults were
+# measured on our machine
+LATENCY_PROFILE = load_host_profile(LATENCY, {
+    'l2_llc_local_thres': 40,
+    'llc_remote_dram_thres': 100,
+})
+
+# Die layout of this host (see 00-host-profile/infer-layout.py); the default
+# is our machine
+DIE_LAYOUT = load_die_layout([
     [0, 4, 9, 13, 17, 22],
     [-1, 5, 10, 14, 18, -1],
     [1, 6, 11, 15, 19, 23],
     [2, 7, 12, -1, 20, 24],
     [3, 8, -1, 16, 21, 25]
-]
+])
 
 
 def print_coord(slice_id):
@@ -44,13 +61,37 @@ def test_placement(p):
     subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
 
 
+def run_placements(placements, sweep):
+    """Run the experiments of a list of placements.
+
+    Without sweep, each placement runs through run-single.sh (new processes and
+    eviction sets for every trace). With sweep, all placements run in one
+    bin/sweep process, which builds the sets of every slice once and keeps the
+    transmitter alive between placements. Both write the same traces.
+    """
+    if not sweep:
+        for p in placements:
+            test_placement(p)
+        return
+
+    with open(SWEEP_PLACEMENTS, 'w') as f:
+        f.write('# tx_core tx_slice_a tx_slice_b rx_core rx_ms_slice rx_ev_slice\n')
+        for p in placements:
+            f.write(' '.join(str(x) for x in p) + '\n')
+    cmd = ['sudo', './bin/sweep', SWEEP_PLACEMENTS, 'data']
+    subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
 def load_trace(filepath):
-    return np.genfromtxt(filepath, delimiter=' ')
+    """Load a receiver trace, dropping the samples tagged as hit by interrupts."""
+    trace = np.genfromtxt(filepath, delimiter=' ')
+    return trace[gap_mask(filepath, len(trace))]
 
 
 def filter_trace(trace, percentile=10):
-    upper_thresh = 100
-    lower_thresh = 40
+    """Keep only the LLC hits (drop private cache hits and DRAM accesses)."""
+    upper_thresh = LATENCY_PROFILE['llc_remote_dram_thres']
+    lower_thresh = LATENCY_PROFILE['l2_llc_local_thres']
     return trace[np.logical_and(trace > lower_thresh, trace < upper_thresh)]
 
 
@@ -64,7 +105,7 @@ def get_latency_diff(p):
     return round(tx_on_mean - tx_off_mean, 1)
 
 
-def lane_scheduling_case_study():
+def lane_scheduling_case_study(sweep):
     """Reproduce Figure 6a from the paper.
 
     This case study demonstrates the lane scheduling policy.
@@ -78,19 +119,21 @@ def lane_scheduling_case_study():
     rx_core = 9
     rx_ms_slice = 13
     rx_ev_slice = rx_core  # use a local EV slice
+    placements = []
     for tx_core in row_0:
         if tx_core == rx_core:
             continue
         tx_slice_b = tx_core  # use a local EV slice
         for tx_slice_a in row_0:
-            p = Placement(tx_core, tx_slice_a, tx_slice_b, rx_core, rx_ms_slice, rx_ev_slice)
-            test_placement(p)
-            diff = get_latency_diff(p)
-            print(f'{print_coord(p.tx_core)}->{print_coord(p.tx_slice_a)}:\t{diff:4.1f}')
+            placements.append(Placement(tx_core, tx_slice_a, tx_slice_b, rx_core, rx_ms_slice, rx_ev_slice))
+    run_placements(placements, sweep)
+    for p in placements:
+        diff = get_latency_diff(p)
+        print(f'{print_coord(p.tx_core)}->{print_coord(p.tx_slice_a)}:\t{diff:4.1f}')
     print(f'{DIVIDER}\n')
 
 
-def priority_arbitration_case_study():
+def priority_arbitration_case_study(sweep):
     """Reproduce Figure 6b from the paper.
 
     This case study demonstrates the priority arbitration policy.
@@ -105,6 +148,7 @@ def priority_arbitration_case_study():
     rx_core = 0
     rx_ms_slice = 22
     rx_ev_slice = rx_core  # use a local EV slice
+    placements = []
     for tx_core in row_0:
         # Do not pin the tx and rx to the same core
         if tx_core == rx_core:
@@ -112,16 +156,22 @@ def priority_arbitration_case_study():
 
         tx_slice_b = tx_core  # Use the local slice
         for tx_slice_a in row_0:
-            p = Placement(tx_core, tx_slice_a, tx_slice_b, rx_core, rx_ms_slice, rx_ev_slice)
-            test_placement(p)
-            diff = get_latency_diff(p)
-            print(f'{print_coord(p.tx_core)}->{print_coord(p.tx_slice_a)}:\t{diff:4.1f}')
+            placements.append(Placement(tx_core, tx_slice_a, tx_slice_b, rx_core, rx_ms_slice, rx_ev_slice))
+    run_placements(placements, sweep)
+    for p in placements:
+        diff = get_latency_diff(p)
+        print(f'{print_coord(p.tx_core)}->{print_coord(p.tx_slice_a)}:\t{diff:4.1f}')
     print(f'{DIVIDER}\n')
 
 
 def main():
-    lane_scheduling_case_study()
-    priority_arbitration_case_study()
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--sweep', action='store_true',
+                        help='Run all placements of a case study in one bin/sweep process instead of run-single.sh')
+    args = parser.parse_args()
+
+    lane_scheduling_case_study(args.sweep)
+    priority_arbitration_case_study(args.sweep)
 
 
 if __name__ == '__main__':
@@ -1,5 +1,7 @@
 #include "../util/machine_const.h"
+#include "../util/topology.h"
 #include "../util/util.h"
+#include "../util/sample_guard.h"
 #include <semaphore.h>
 #include <sys/resource.h>
 #include <sys/mman.h>
@@ -82,7 +84,7 @@ int main(int argc, char **argv)
 	memset(buffer, 0, BUF_SIZE);
 
 	// Pin the monitoring program to the desired core
-	int cpu = cha_id_to_cpu[core_ID];
+	int cpu = cha_to_cpu(core_ID);
 
 	pin_cpu(cpu);
 
@@ -213,6 +215,11 @@ int main(int argc, char **argv)
 	uint64_t *samples_x = (uint64_t *)malloc(sizeof(*samples_x) * repetitions);
 	uint32_t *samples_y = (uint32_t *)malloc(sizeof(*samples_y) * repetitions);
 
+	// Prepare the gap detection (samples hit by interrupts are tagged in rx_out.log.gaps)
+	static struct gap_log gaps;
+	static struct irq_snapshot irqs_before, irqs_after;
+	gap_log_init(&gaps, gap_bound_from_profile(), GAP_SETTLE_SAMPLES);
+
 	// Release setup mutex
 	sem_post(setup_sem);
 	sem_close(setup_sem);
@@ -244,11 +251,17 @@ int main(int argc, char **argv)
 	}
 
 	// Time LLC loads
+	int irqs_ok = irq_snapshot_take(cpu, &irqs_before) == 0;
 	current = monitoring_set;
+	gap_log_arm(&gaps, (uint32_t)get_time());
 	for (i = 0; i < repetitions; i++) {
 
 		if (i % (monitoring_set_size/1) == 0) { // evict on every repetition right now
 			access_ev(ev);
+
+			// The eviction pass is far longer than gap_bound, which is
+			// calibrated on a loop without it: do not count it as a gap
+			gap_log_resume(&gaps, (uint32_t)get_time());
 		}
 
 		// Time accesses to the monitoring set
@@ -274,7 +287,10 @@ int main(int argc, char **argv)
 			: "=rm"(samples_x[i]), "=rm"(samples_y[i]), "+rm"(current) /*output*/
 			:
 			: "rax", "rcx", "rdx", "r8", "memory");
+
+		gap_check(&gaps, i, (uint32_t)samples_x[i]);
 	}
+	irqs_ok = irqs_ok && irq_snapshot_take(cpu, &irqs_after) == 0;
 
 	printf("Starting file write\n");
 	// Store the samples to disk
@@ -283,6 +299,13 @@ int main(int argc, char **argv)
 	}
 	printf("Ending file write\n");
 
+	// Store the tagged ranges
+	gap_log_write(&gaps, "rx_out.log.gaps", irqs_ok ? &irqs_before : NULL, irqs_ok ? &irqs_after : NULL);
+	printf("Gaps detected: %d\n", gaps.count);
+	if (irqs_ok) {
+		irq_snapshot_report(stdout, "", &irqs_before, &irqs_after);
+	}
+
 	// Free the buffers and file
 	munmap(buffer, BUF_SIZE);
 	fclose(output_file); 
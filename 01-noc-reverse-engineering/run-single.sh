@@ -4,6 +4,7 @@
 # Two traces are generated and placed in $OUTPUT_DIR:
 # tx_on.log: receiver latency trace with the transmitter producing traffic on the network
 # tx_off.log: receiver latency trace with a fake transmitter that spins without producing network traffic 
+# Each trace comes with a .gaps file listing the samples hit by interrupts
 
 TX_CORE=$1
 TX_SLICE_A=$2
@@ -30,6 +31,7 @@ sudo ./bin/receiver $RX_CORE $RX_MS_SLICE $RX_EV_SLICE
 
 sudo killall -9 transmitter &> /dev/null
 sudo mv rx_out.log $OUTPUT_DIR/tx_on.log
+sudo mv rx_out.log.gaps $OUTPUT_DIR/tx_on.log.gaps
 
 sleep 0.5
 # Run with fake transmitter
@@ -38,3 +40,4 @@ sudo ./bin/receiver $RX_CORE $RX_MS_SLICE $RX_EV_SLICE
 
 sudo killall -9 transmitter-no-loads &> /dev/null
 sudo mv rx_out.log $OUTPUT_DIR/tx_off.log
+sudo mv rx_out.log.gaps $OUTPUT_DIR/tx_off.log.gaps
@@ -0,0 +1,527 @@
+#include "../util/machine_const.h"
+#include "../util/topology.h"
+#include "../util/util.h"
+#include "../util/sample_guard.h"
+#include "../util/imc_pmon.h"
+#include "../util/hw_knobs.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
+#define MAX_PLACEMENTS 4096
+#define MAX_KNOB_CONFIGS 16
+#define REPETITIONS 10000			 /* Samples per trace (as in receiver.c) */
+#define WARMUP_CYCLES 500000		 /* Time given to the transmitter to warm up (as in receiver.c) */
+
+// Sets of the transmitter (as in transmitter.c)
+#define TX_EV_SIZE 20
+#define TX_LLC_SET 10
+#define TX_SECOND_SET_OFFSET 9
+
+// Sets of the receiver (as in receiver.c)
+#define RX_SET_SIZE 16
+#define RX_LLC_SET 5
+
+struct placement {
+	int tx_core;
+	int tx_slice_a;
+	int tx_slice_b;
+	int rx_core;
+	int rx_ms_slice;
+	int rx_ev_slice;
+};
+
+/*
+ * Prefetcher and uncore frequency setting under which the placements are
+ * measured (see hw_knobs.h); -1 leaves a knob as it is.
+ */
+struct knob_config {
+	const char *name;
+	long prefetch;		/* Bits written to MSR_MISC_FEATURE_CONTROL on every cpu */
+	int uncore_ratio;	/* Uncore frequency the socket is pinned to (x 100 MHz) */
+};
+
+enum tx_mode { TX_SPIN, TX_LOADS, TX_QUIT };
+
+/*
+ * What the transmitter thread should do. The main thread (the receiver)
+ * writes a command and bumps seq; the transmitter acknowledges it by copying
+ * seq to ack once it runs on the right core with the right sets.
+ */
+struct tx_command {
+	volatile int mode;
+	volatile int core;
+	volatile int slice_a;
+	volatile int slice_b;
+	volatile uint64_t seq;
+	volatile uint64_t ack;
+};
+
+static struct tx_command command;
+
+// Sets of every slice, built once
+static struct Node *tx_evs[NUM_CHA];
+static struct Node *rx_sets[NUM_CHA];
+
+// DRAM traffic counters. They are in PCI config space, so their batches
+// need no MSR device
+static struct msr_transport transport;
+static struct msr_batch batch;
+static struct imc_pmon imc;
+
+static uint64_t samples_x[REPETITIONS];
+static uint32_t samples_y[REPETITIONS];
+
+static inline void access_ev(struct Node *ev)
+{
+	// Access EV multiple times
+	for (int j = 0; j < 4; j++) {
+		struct Node *curr_node = ev;
+		while (curr_node && curr_node->next && curr_node->next->next) {
+			maccess(curr_node->address);
+			maccess(curr_node->next->address);
+			maccess(curr_node->next->next->address);
+			maccess(curr_node->address);
+			maccess(curr_node->next->address);
+			maccess(curr_node->next->next->address);
+			curr_node = curr_node->next;
+		}
+	}
+}
+
+/*
+ * Finds ev_size addresses in the given slice and the same L1/L2/LLC sets as
+ * the first address of that slice in llc_set (generate_ev_array in
+ * transmitter.c).
+ */
+static void generate_ev_array(uint64_t *ev, int ev_size, int llc_slice, int llc_set, void *buffer)
+{
+	uint64_t offset = find_next_address_on_slice_and_set(buffer, llc_slice, llc_set);
+	ev[0] = (uint64_t)buffer + offset;
+
+	uint64_t index3 = get_cache_set_index(ev[0], 3);
+	uint64_t index2 = get_cache_set_index(ev[0], 2);
+	uint64_t index1 = get_cache_set_index(ev[0], 1);
+	for (int i = 1; i < ev_size; i++) {
+		uint64_t candidate_addr = ev[i - 1] + LLC_INDEX_STRIDE;
+		while (index1 != get_cache_set_index(candidate_addr, 1) ||
+			   index2 != get_cache_set_index(candidate_addr, 2) ||
+			   index3 != get_cache_set_index(candidate_addr, 3) ||
+			   llc_slice != get_cache_slice_index((void *)candidate_addr)) {
+			candidate_addr += LLC_INDEX_STRIDE;
+		}
+		ev[i] = candidate_addr;
+	}
+}
+
+/*
+ * Builds the EV of the transmitter on a slice: two L2 sets, each split over
+ * the two LLC sets it maps to, interleaved (as in transmitter.c).
+ */
+static struct Node *build_tx_ev(int slice, void *buffer)
+{
+	int llc_set_2 = (TX_LLC_SET + L2_CACHE_SETS) % LLC_CACHE_SETS_PER_SLICE; // The set 0 in L2 maps to sets 0 and 1024 in LLC
+	uint64_t ev1[TX_EV_SIZE], ev2[TX_EV_SIZE];
+	generate_ev_array(ev1, (TX_EV_SIZE + 1) / 2, slice, TX_LLC_SET, buffer);
+	generate_ev_array(&ev1[(TX_EV_SIZE + 1) / 2], TX_EV_SIZE / 2, slice, llc_set_2, buffer);
+	generate_ev_array(ev2, (TX_EV_SIZE + 1) / 2, slice, TX_LLC_SET + TX_SECOND_SET_OFFSET, buffer);
+	generate_ev_array(&ev2[(TX_EV_SIZE + 1) / 2], TX_EV_SIZE / 2, slice, llc_set_2 + TX_SECOND_SET_OFFSET, buffer);
+
+	struct Node *ev = NULL;
+	for (int i = 0; i < TX_EV_SIZE; i++) {
+		append_string_to_linked_list(&ev, (void *)ev1[i]);
+		append_string_to_linked_list(&ev, (void *)ev2[i]);
+	}
+	return ev;
+}
+
+/*
+ * Builds the set of the receiver on a slice. It is the monitoring set when
+ * the receiver monitors the slice (its addresses are linked for pointer
+ * chasing) and the EV when the receiver evicts with it (as in receiver.c,
+ * where both are searched for from the same set).
+ */
+static struct Node *build_rx_set(int slice, void *buffer)
+{
+	struct Node *set = NULL;
+	append_l2_congruent_set(&set, buffer, slice, RX_LLC_SET, RX_SET_SIZE);
+
+	// Set up pointer chasing: *addr1 = addr2; *addr2 = addr3; and so on, with
+	// the last address pointing back to the first one
+	struct Node *curr_node;
+	for (curr_node = set; curr_node->next != NULL; curr_node = curr_node->next) {
+		*(void **)curr_node->address = curr_node->next->address;
+	}
+	*(void **)curr_node->address = set->address;
+	return set;
+}
+
+static void *run_transmitter(void *arg)
+{
+	uint64_t seen = 0;
+	int core = -1;
+	struct Node *ev_a = NULL, *ev_b = NULL;
+
+	while (1) {
+		// Pick up a new command (one volatile load per pass over the EVs)
+		if (command.seq != seen) {
+			seen = command.seq;
+			if (command.mode == TX_QUIT) {
+				break;
+			}
+			if (command.core != core) {
+				core = command.core;
+				pin_cpu(cha_to_cpu(core));
+			}
+			ev_a = command.mode == TX_LOADS ? tx_evs[command.slice_a] : NULL;
+			ev_b = command.mode == TX_LOADS ? tx_evs[command.slice_b] : NULL;
+			__sync_synchronize();
+			command.ack = seen;
+		}
+
+		// Load each eviction set alternately
+		// Send all loads concurrently (no serialization)
+		for (struct Node *current = ev_a; current != NULL; current = current->next) {
+			asm volatile("movq (%0), %%rax" ::"r"(current->address)
+						 : "rax");
+		}
+		for (struct Node *current = ev_b; current != NULL; current = current->next) {
+			asm volatile("movq (%0), %%rax" ::"r"(current->address)
+						 : "rax");
+		}
+	}
+
+	return NULL;
+}
+
+static void send_command(int mode, int core, int slice_a, int slice_b)
+{
+	command.mode = mode;
+	command.core = core;
+	command.slice_a = slice_a;
+	command.slice_b = slice_b;
+	__sync_synchronize();
+	uint64_t seq = ++command.seq;
+	while (command.ack != seq) {
+		_mm_pause();
+	}
+}
+
+/*
+ * Takes one receiver trace (as receiver.c does) and writes it, with its gaps
+ * file and the DRAM traffic during the trace (<name>.mem, if the IMC counters
+ * are available), to <dir>/<name>.
+ */
+static void take_trace(const struct placement *p, const char *dir, const char *name)
+{
+	int cpu = cha_to_cpu(p->rx_core);
+	struct Node *ev = rx_sets[p->rx_ev_slice];
+	void **monitoring_set = (void **)rx_sets[p->rx_ms_slice]->address;
+
+	// Wait a bit (give time to the transmitter to warm up)
+	uint64_t cycles = get_time(), end = cycles + WARMUP_CYCLES;
+	while (cycles < end) {
+		cycles = get_time();
+	}
+
+	// Read monitoring set from memory into cache
+	void **current = monitoring_set;
+	for (int i = 0; i < RX_SET_SIZE; i++) {
+		asm volatile("movq (%0), %0"
+					 : "+rm"(current) /* output */ ::"memory");
+	}
+
+	// Time LLC loads
+	static struct gap_log gaps;
+	static struct irq_snapshot irqs_before, irqs_after;
+	gap_log_init(&gaps, gap_bound_from_profile(), GAP_SETTLE_SAMPLES);
+	int irqs_ok = irq_snapshot_take(cpu, &irqs_before) == 0;
+	imc_pmon_sample(&imc, &batch);
+	imc_pmon_clear(&imc);
+	current = monitoring_set;
+	gap_log_arm(&gaps, (uint32_t)get_time());
+	for (int i = 0; i < REPETITIONS; i++) {
+		if (i % RX_SET_SIZE == 0) { // evict on every pass over the monitoring set
+			access_ev(ev);
+
+			// The eviction pass is far longer than gap_bound, which is
+			// calibrated on a loop without it: do not count it as a gap
+			gap_log_resume(&gaps, (uint32_t)get_time());
+		}
+
+		// Time accesses to the monitoring set
+		asm volatile(
+			".align 32\n\t"
+			"lfence\n\t"
+			"rdtsc\n\t" /* eax = TSC (timestamp counter)*/
+			"shl $32, %%rdx\n\t"
+			"or %%rdx, %%rax\n\t"
+
+			"movq %%rax, %%r8\n\t" /* r8 = rax; this is to back up rax into another register */
+
+			"movq (%2), %2\n\t" /* current = *current; LOAD */
+
+			"rdtscp\n\t" /* eax = TSC (timestamp counter) */
+			"shl $32, %%rdx\n\t"
+			"or %%rdx, %%rax\n\t"
+
+			"sub %%r8, %%rax\n\t" /* rax = rax - r8; get timing difference between the second timestamp and the first one */
+
+			"movq %%r8, %0\n\t"										   /* result_x[i] = r8 */
+			"movl %%eax, %1\n\t"									   /* result_y[i] = eax */
+			: "=rm"(samples_x[i]), "=rm"(samples_y[i]), "+rm"(current) /*output*/
+			:
+			: "rax", "rcx", "rdx", "r8", "memory");
+
+		gap_check(&gaps, i, (uint32_t)samples_x[i]);
+	}
+	imc_pmon_sample(&imc, &batch);
+	irqs_ok = irqs_ok && irq_snapshot_take(cpu, &irqs_after) == 0;
+
+	// Store the samples and the tagged ranges
+	char filename[512];
+	snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+	FILE *output_file = fopen(filename, "w");
+	if (output_file == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	for (int i = 0; i < REPETITIONS; i++) {
+		fprintf(output_file, "%" PRIu64 " %" PRIu32 "\n", samples_x[i], samples_y[i]);
+	}
+	fclose(output_file);
+
+	snprintf(filename, sizeof(filename), "%s/%s.gaps", dir, name);
+	gap_log_write(&gaps, filename, irqs_ok ? &irqs_before : NULL, irqs_ok ? &irqs_after : NULL);
+
+	if (imc.nr_channels > 0) {
+		// The counts are for the whole socket (the transmitter included).
+		// Each access_ev makes 6 loads per line but the last two, 4 times
+		uint64_t loads = REPETITIONS + (uint64_t)(REPETITIONS / RX_SET_SIZE) * 4 * 6 * (RX_SET_SIZE - 2);
+		snprintf(filename, sizeof(filename), "%s/%s.mem", dir, name);
+		output_file = fopen(filename, "w");
+		if (output_file == NULL) {
+			perror("fopen");
+			exit(1);
+		}
+		fprintf(output_file, "# DRAM traffic of the socket while the receiver made %" PRIu64 " loads\n", loads);
+		fprintf(output_file, "# box reads writes\n");
+		imc_pmon_write(&imc, output_file, "");
+		fclose(output_file);
+	}
+}
+
+static int valid_placement(const struct placement *p)
+{
+	int ids[6] = {p->tx_core, p->tx_slice_a, p->tx_slice_b, p->rx_core, p->rx_ms_slice, p->rx_ev_slice};
+	for (int i = 0; i < 6; i++) {
+		if (ids[i] < 0 || ids[i] >= NUM_CHA) {
+			return 0;
+		}
+	}
+	// The receiver's monitoring set and EV are searched for from the same set
+	return cha_to_cpu(p->tx_core) >= 0 && cha_to_cpu(p->rx_core) >= 0 && p->tx_core != p->rx_core &&
+		   p->rx_ms_slice != p->rx_ev_slice;
+}
+
+/*
+ * Parses a knob configuration: comma-separated pf=<bits> and uncore=<ratio>
+ * settings, e.g., pf=15,uncore=22 (the name of the configuration is the
+ * argument itself). Returns 0, or -1 if the configuration is wrong.
+ */
+static int parse_knob_config(const char *arg, struct knob_config *config)
+{
+	config->name = arg;
+	config->prefetch = -1;
+	config->uncore_ratio = -1;
+	char copy[128];
+	snprintf(copy, sizeof(copy), "%s", arg);
+	for (char *setting = strtok(copy, ","); setting != NULL; setting = strtok(NULL, ",")) {
+		if (sscanf(setting, "pf=%li", &config->prefetch) == 1) {
+			if (config->prefetch < 0 || (uint64_t)config->prefetch > PREFETCH_ALL_DISABLE) {
+				return -1;
+			}
+		} else if (sscanf(setting, "uncore=%d", &config->uncore_ratio) == 1) {
+			if (config->uncore_ratio <= 0) {
+				return -1;
+			}
+		} else {
+			return -1;
+		}
+	}
+	return strchr(arg, '/') == NULL ? 0 : -1;
+}
+
+static void apply_knob_config(const struct knob_config *config)
+{
+	if (config->prefetch >= 0) {
+		hw_knobs_set_prefetch_all(config->prefetch);
+	}
+	if (config->uncore_ratio > 0 && hw_knobs_set_uncore_ratio(0, config->uncore_ratio, config->uncore_ratio) != 0) {
+		exit(1);
+	}
+}
+
+/*
+ * Runs the contention experiment of run-single.sh for every placement of a
+ * list, in one process: the sets of every slice are built once, and a
+ * transmitter thread stays alive and switches between placements (and
+ * between loads and spinning) on command, while the main thread takes the
+ * receiver traces.
+ *
+ * If knob configurations are given, every placement is measured under each
+ * of them back to back, into <output_dir>/<config>/<placement>. The knobs are
+ * restored when the sweep ends (or is interrupted).
+ */
+int main(int argc, char **argv)
+{
+	// Check arguments
+	if (argc < 3 || argc > 3 + MAX_KNOB_CONFIGS) {
+		fprintf(stderr, "Wrong Input! Enter the placement list, the output directory and (optionally) knob configurations!\n");
+		fprintf(stderr, "Enter: %s <placements_file> <output_dir> [pf=<bits>,uncore=<ratio> ...]\n", argv[0]);
+		fprintf(stderr, "Each line of the placement list is: tx_core tx_slice_a tx_slice_b rx_core rx_ms_slice rx_ev_slice\n");
+		exit(1);
+	}
+
+	// Parse knob configurations
+	static struct knob_config configs[MAX_KNOB_CONFIGS];
+	int nr_configs = argc - 3;
+	for (int c = 0; c < nr_configs; c++) {
+		if (parse_knob_config(argv[3 + c], &configs[c]) != 0) {
+			fprintf(stderr, "Wrong knob configuration %s! Use pf=<0-15> and/or uncore=<ratio>, comma-separated\n",
+					argv[3 + c]);
+			exit(1);
+		}
+	}
+
+	// Read the placements
+	FILE *placements_file = fopen(argv[1], "r");
+	if (placements_file == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	static struct placement placements[MAX_PLACEMENTS];
+	int nr_placements = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), placements_file) != NULL) {
+		if (line[0] == '#') {
+			continue;
+		}
+		struct placement *p = &placements[nr_placements];
+		if (sscanf(line, "%d %d %d %d %d %d", &p->tx_core, &p->tx_slice_a, &p->tx_slice_b, &p->rx_core,
+				   &p->rx_ms_slice, &p->rx_ev_slice) != 6) {
+			continue;
+		}
+		if (!valid_placement(p)) {
+			fprintf(stderr, "Wrong placement! %s", line);
+			exit(1);
+		}
+		if (++nr_placements == MAX_PLACEMENTS) {
+			fprintf(stderr, "Too many placements! At most %d are supported\n", MAX_PLACEMENTS);
+			exit(1);
+		}
+	}
+	fclose(placements_file);
+
+	if (mkdir(argv[2], 0755) != 0 && errno != EEXIST) {
+		perror("mkdir");
+		exit(1);
+	}
+	for (int c = 0; c < nr_configs; c++) {
+		char dir[256];
+		snprintf(dir, sizeof(dir), "%s/%s", argv[2], configs[c].name);
+		if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+			perror("mkdir");
+			exit(1);
+		}
+	}
+
+	// Allocate large buffer (pool of addresses)
+	void *buffer = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+	if (buffer == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	// Write data to the buffer so that any copy-on-write
+	// mechanisms will give us our own copies of the pages.
+	memset(buffer, 0, BUF_SIZE);
+
+	// Set the scheduling priority to high to avoid interruptions
+	// (lower priorities cause more favorable scheduling, and -20 is the max)
+	setpriority(PRIO_PROCESS, 0, -20);
+
+	// Prepare the sets of every slice once
+	printf("Preparing the sets of %d slices\n", NUM_CHA);
+	for (int slice = 0; slice < NUM_CHA; slice++) {
+		tx_evs[slice] = build_tx_ev(slice, buffer);
+		rx_sets[slice] = build_rx_set(slice, buffer);
+	}
+
+	// Count the DRAM traffic of each trace
+	msr_transport_wrap_fd(&transport, 0, -1);
+	msr_batch_init(&batch, &transport);
+	if (imc_pmon_open(&imc, &transport) > 0) {
+		imc_pmon_start(&imc, &batch);
+	}
+
+	// Start the transmitter (spinning on the core of the first placement)
+	pthread_t transmitter;
+	command.mode = TX_SPIN;
+	command.core = placements[0].tx_core;
+	if (pthread_create(&transmitter, NULL, run_transmitter, NULL) != 0) {
+		perror("pthread_create");
+		exit(1);
+	}
+
+	for (int i = 0; i < nr_placements; i++) {
+		struct placement *p = &placements[i];
+		for (int c = 0; c < (nr_configs > 0 ? nr_configs : 1); c++) {
+			char dir[256];
+			if (nr_configs > 0) {
+				apply_knob_config(&configs[c]);
+				snprintf(dir, sizeof(dir), "%s/%s/%d-%d-%d-%d-%d-%d", argv[2], configs[c].name, p->tx_core,
+						 p->tx_slice_a, p->tx_slice_b, p->rx_core, p->rx_ms_slice, p->rx_ev_slice);
+			} else {
+				snprintf(dir, sizeof(dir), "%s/%d-%d-%d-%d-%d-%d", argv[2], p->tx_core, p->tx_slice_a,
+						 p->tx_slice_b, p->rx_core, p->rx_ms_slice, p->rx_ev_slice);
+			}
+			if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+				perror("mkdir");
+				exit(1);
+			}
+			printf("Placement %d/%d: %s\n", i + 1, nr_placements, dir);
+
+			// Pin the receiver, then take the transmitter on and off traces
+			// back to back
+			pin_cpu(cha_to_cpu(p->rx_core));
+			send_command(TX_LOADS, p->tx_core, p->tx_slice_a, p->tx_slice_b);
+			take_trace(p, dir, "tx_on.log");
+			send_command(TX_SPIN, p->tx_core, p->tx_slice_a, p->tx_slice_b);
+			take_trace(p, dir, "tx_off.log");
+		}
+	}
+	hw_knobs_restore();
+
+	// Stop the transmitter
+	command.mode = TX_QUIT;
+	__sync_synchronize();
+	command.seq++;
+	pthread_join(transmitter, NULL);
+
+	// Clean up
+	imc_pmon_close(&imc);
+	munmap(buffer, BUF_SIZE);
+	for (int slice = 0; slice < NUM_CHA; slice++) {
+		struct Node *curr_node, *tmp = NULL;
+		for (curr_node = tx_evs[slice]; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+		for (curr_node = rx_sets[slice]; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+	}
+
+	return 0;
+}
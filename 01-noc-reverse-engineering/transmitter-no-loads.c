@@ -1,5 +1,6 @@
 #include "../util/util.h"
 #include "../util/machine_const.h"
+#include "../util/topology.h"
 #include <semaphore.h>
 #include <sys/resource.h> 
 
@@ -27,7 +28,7 @@ int main(int argc, char **argv)
 	setpriority(PRIO_PROCESS, 0, -20);
 
 	// Pin the monitoring program to the desired core
-	int cpu = cha_id_to_cpu[core];
+	int cpu = cha_to_cpu(core);
 	// printf("Pinning to cpu %d\n", cpu);
 	pin_cpu(cpu);
 
@@ -1,5 +1,6 @@
 #include "../util/util.h"
 #include "../util/machine_const.h"
+#include "../util/topology.h"
 #include <semaphore.h>
 #include <sys/resource.h> 
 #include <sys/mman.h>
@@ -69,7 +70,7 @@ int main(int argc, char **argv)
 	setpriority(PRIO_PROCESS, 0, -20);
 
 	// Pin the monitoring program to the desired core
-	int cpu = cha_id_to_cpu[core];
+	int cpu = cha_to_cpu(core);
 	pin_cpu(cpu);
 
 	// Mutex to avoid colliding with tx when creating EVs
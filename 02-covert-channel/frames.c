@@ -0,0 +1,92 @@
+#include "../util/cc_frame.h"
+#include "pattern.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Framing layer of the covert channel on the receiver side (see cc_frame.h).
+ *
+ * "stream" prints the channel bits that transmitter-framed (none) or
+ * transmitter-framed-fec (conv) sends, for print-errors.py to align the
+ * received bits with. "decode" reads the soft bits print-errors.py writes
+ * (one value in [0, 1] per interval), finds the frames, decodes them and
+ * checks their CRCs. It prints the payload bits of the frames that passed
+ * (the goodput of the run), and the frame counts on stderr.
+ */
+
+static float *read_soft(const char *filename, size_t *n)
+{
+	FILE *f = fopen(filename, "r");
+	if (f == NULL) {
+		perror(filename);
+		exit(1);
+	}
+
+	size_t size = 1 << 16;
+	float *soft = malloc(size * sizeof(*soft));
+	*n = 0;
+	while (soft != NULL && fscanf(f, "%f", &soft[*n]) == 1) {
+		if (++*n == size) {
+			size *= 2;
+			soft = realloc(soft, size * sizeof(*soft));
+		}
+	}
+	if (soft == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	fclose(f);
+	return soft;
+}
+
+static void decode(const char *filename, enum cc_fec fec)
+{
+	size_t n;
+	float *soft = read_soft(filename, &n);
+	size_t frame_bits = cc_frame_bits(fec);
+
+	// Decode the frame after each preamble; after a frame that passed its
+	// CRC, look for the next one after it, and otherwise one bit further
+	uint64_t found = 0, good = 0, payload_bits = 0;
+	long pos = 0;
+	while ((pos = cc_frame_find(soft, n, pos)) >= 0 && pos + frame_bits <= n) {
+		struct cc_frame frame;
+		found++;
+		if (cc_frame_decode(soft + pos + FRAME_PREAMBLE_BITS, fec, &frame) == 0) {
+			good++;
+			payload_bits += 8 * frame.length;
+			pos += frame_bits;
+		} else {
+			pos++;
+		}
+	}
+
+	fprintf(stderr, "%zu channel bits, %" PRIu64 " preambles, %" PRIu64 " frames passed the CRC (%zu channel bits each)\n",
+			n, found, good, frame_bits);
+	printf("%" PRIu64 "\n", payload_bits);
+	free(soft);
+}
+
+int main(int argc, char **argv)
+{
+	// Check arguments
+	int fec = argc >= 3 ? cc_fec_parse(argv[2]) : -1;
+	if (fec < 0 || !((argc == 3 && strcmp(argv[1], "stream") == 0) || (argc == 4 && strcmp(argv[1], "decode") == 0))) {
+		fprintf(stderr, "Wrong Input! Enter the command, the FEC (none or conv), and the soft bits to decode!\n");
+		fprintf(stderr, "Enter: %s stream <fec>\n", argv[0]);
+		fprintf(stderr, "   or: %s decode <fec> <soft_filename>\n", argv[0]);
+		exit(1);
+	}
+
+	if (strcmp(argv[1], "stream") == 0) {
+		char *stream = cc_frame_stream(RANDOM_BITS, fec);
+		printf("%s\n", stream);
+		free(stream);
+	} else {
+		decode(argv[3], fec);
+	}
+
+	return 0;
+}
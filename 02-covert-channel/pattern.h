@@ -0,0 +1,11 @@
+/*
+ * The random bits of transmitter-rand-bits (print-errors.py reads them from
+ * here to compare the received bits to).
+ */
+
+#ifndef PATTERN_H_
+#define PATTERN_H_
+
+#define RANDOM_BITS "1110011001010000110111110101011110001001111001010001100011110011100100011101110010010100100100011001110101111010111110100010000100100111001111100111011010110110011011011000011010001010000101110010010110001010110000001001111111001111010111111001111111000100000000100011011101011000001100010000000110000011001101101111010100011000100110100011001000100011011000010100100011100101011010011000110011001100001101101001101111011110000100001010001100001100000010111111110111110100110011100000011101001100110011001010101011011101000101110111101000001000110101110000100100010110110100101101001100110101110011000010111011010111111100001101011000000000011101011101000111101111110110010100010000101001100110000010000011111100101101010110001111011111100000001110110100011000011010101100111010100100101100000011000100101011000101111001011011111101101011010100111000101000101111101000111101001111100101100010011111111000100011010101101010100001110000011101011000001101100010100100001110000000100100000000000010100000"
+
+#endif // PATTERN_H_
@@ -13,12 +13,16 @@ def binary_entropy(x):
 
 def read_from_file(filename):
     results = {}
-    # Results of all runs are all in the same file
+    goodbits = {}
+    # Results of all runs are all in the same file (framed runs add the payload
+    # bits that passed the CRC as a third column)
     with open(filename) as f:
         for line in f:
-            x, y = line.strip().split()
-            results.setdefault(float(x), []).append(int(y))
-    return results
+            fields = line.strip().split()
+            results.setdefault(float(fields[0]), []).append(int(fields[1]))
+            if len(fields) > 2:
+                goodbits.setdefault(float(fields[0]), []).append(int(fields[2]))
+    return results, goodbits
 
 
 def main():
@@ -29,12 +33,16 @@ def main():
     except:
         pass
 
-    results = read_from_file(sys.argv[1])
-    # Compute the probabilities of bit flip
+    results, goodbits = read_from_file(sys.argv[1])
+    bits_per_symbol = int(sys.argv[2]) if len(sys.argv) > 2 else 1
+    lanes = int(sys.argv[3]) if len(sys.argv) > 3 else 1
+    fec = sys.argv[4] if len(sys.argv) > 4 else None
+
+    # Compute the probabilities of bit flip (the test set has 100000 symbols per lane)
     error_probabilities = {}
     for bitrate in results.keys():
         for sample in results[bitrate]:
-            prob = sample / 100000
+            prob = sample / (100000 * bits_per_symbol * lanes)
             error_probabilities.setdefault(bitrate, []).append(prob)
 
     # Compute the channel capacities
@@ -52,6 +60,13 @@ def main():
     error_probability = [np.mean(error_probabilities[br]) for br in raw_bitrate]
     error_probability_std = [np.std(error_probabilities[br]) for br in raw_bitrate]
 
+    # The goodput is the share of the channel bits of the test set that
+    # arrived as payload of frames that passed their CRC
+    if goodbits:
+        goodputs = {br: [br * bits / (100000 * bits_per_symbol * lanes) for bits in goodbits[br]] for br in raw_bitrate}
+        goodput = [np.mean(goodputs[br]) for br in raw_bitrate]
+        goodput_std = [np.std(goodputs[br]) for br in raw_bitrate]
+
     # Plot the channel capacity / error probability plot
     plt.rcParams["figure.figsize"] = (6.4, 2.2)
     fig, ax1 = plt.subplots()
@@ -60,6 +75,10 @@ def main():
     ax1.set_xlabel('Raw bandwidth (Mbps)')
     ax1.set_ylabel('Capacity (Mbps)', color=color)
     line1 = ax1.errorbar(raw_bitrate, capacity, yerr=capacity_std, color=color, marker="s", label="Capacity", capsize=2, linestyle='--')
+    lines = [line1]
+    if goodbits:
+        line3 = ax1.errorbar(raw_bitrate, goodput, yerr=goodput_std, color='tab:green', marker="^", label="Goodput (%s)" % fec, capsize=2, linestyle='--')
+        lines.append(line3)
     ax1.tick_params(axis='y', labelcolor=color)
 
     ax2 = ax1.twinx()  # instantiate a second axes that shares the same x-axis
@@ -69,17 +88,26 @@ def main():
     line2 = ax2.errorbar(raw_bitrate, error_probability, yerr=error_probability_std, color=color, marker=".", label="Error probability", linestyle='--', capsize=2)
     ax2.tick_params(axis='y', labelcolor=color)
 
-    lines = [line2, line1]
+    lines = [line2] + lines
     labels = [l.get_label() for l in lines]
     ax1.legend(lines, labels, loc="upper left", frameon=True)
 
     plt.grid()
     plt.tight_layout()
-    plt.savefig("plot/capacity-plot.pdf")
+    name = "capacity-plot"
+    if bits_per_symbol > 1:
+        name += "-%dbit" % bits_per_symbol
+    if lanes > 1:
+        name += "-%dlanes" % lanes
+    if fec is not None:
+        name += "-%s" % fec
+    plt.savefig("plot/%s.pdf" % name)
     plt.clf()
 
     print(capacity)
     print(error_probability)
+    if goodbits:
+        print(goodput)
 
 
 if __name__ == "__main__":
@@ -1,16 +1,47 @@
 import argparse
+import math
 import multiprocessing as mp
+import os
+import re
+import sys
 from collections import namedtuple
 
 import numpy as np
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'util'))
+from freq_tag import load_freq, reference_mask, scale_factors
+from host_profile import LATENCY, load_host_profile
+from sample_guard import gap_mask
+
 ParseParams = namedtuple('ParseParams', 'interval offset contention_frac threshold score')
 interval = None
 result_x = None
 result_y = None
 SCORE_MAX = 9999999999999
-pattern = "1110011001010000110111110101011110001001111001010001100011110011100100011101110010010100100100011001110101111010111110100010000100100111001111100111011010110110011011011000011010001010000101110010010110001010110000001001111111001111010111111001111111000100000000100011011101011000001100010000000110000011001101101111010100011000100110100011001000100011011000010100100011100101011010011000110011001100001101101001101111011110000100001010001100001100000010111111110111110100110011100000011101001100110011001010101011011101000101110111101000001000110101110000100100010110110100101101001100110101110011000010111011010111111100001101011000000000011101011101000111101111110110010100010000101001100110000010000011111100101101010110001111011111100000001110110100011000011010101100111010100100101100000011000100101011000101111001011011111101101011010100111000101000101111101000111101001111100101100010011111111000100011010101101010100001110000011101011000001101100010100100001110000000100100000000000010100000"
+bits_per_symbol = 1
+soft_output = None
+PATTERN_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'pattern.h')
+
+
+def load_random_bits():
+    """Returns the random bits the transmitters send (RANDOM_BITS in pattern.h)."""
+    with open(PATTERN_HEADER) as f:
+        return re.search(r'#define RANDOM_BITS "([01]+)"', f.read()).group(1)
+
+
+pattern = load_random_bits()
 patternlen = len(pattern)
+# Lane of the trace being decoded, out of lanes, and its share of the pattern
+lane = 0
+lanes = 1
+lane_pattern = pattern
+
+# Latency thresholds of this host (see 00-host-profile); the defaults were
+# measured on our machine
+LATENCY_PROFILE = load_host_profile(LATENCY, {
+    'llc_local_median': 70,
+    'llc_remote_dram_thres': 120,
+})
 
 # The first 100 intervals are discarded
 # The following 1000 intervals are the training set
@@ -26,18 +57,59 @@ train_intv_end = train_intv_start + train_intervals
 test_intv_start = discard_intervals + train_intervals
 test_intv_end = test_intv_start + test_intervals
 
-def read_from_file(filename):
-    """Read a 2-column receiver trace file."""
+def read_from_file(filename, drop_gaps=True, vantages=None, freq_tolerance=None):
+    """Read a 2-column receiver trace file.
+
+    If drop_gaps is set, the samples tagged as hit by interrupts are dropped.
+    The remaining samples keep their timestamps, so they are still assigned
+    to the right intervals.
+
+    If the receiver tagged the trace with the frequencies it ran at (a .freq
+    file, see util/freq_tag.py), the latencies are rescaled to the frequencies
+    of the latency profile, so that its thresholds apply. With freq_tolerance
+    (a fraction), the samples of the blocks that ran further than that from
+    these frequencies are dropped rather than rescaled: the uncore frequency of the blocks
+    is only the average over the trace, so rescaling does not undo a change of
+    the uncore frequency during the trace.
+
+    3-column traces of receiver-multi-vantage ("tsc vantage latency") are read
+    as one trace with the samples of all the vantages, or of the given
+    vantages only.
+    """
     result_x = []
     result_y = []
+    lines = []
     with open(filename) as f:
-        for line in f:
-            x, y = line.strip().split()
-            result_x.append(int(x))
-            result_y.append(int(y))
+        for number, line in enumerate(f):
+            parts = line.strip().split()
+            if len(parts) == 3 and vantages is not None and int(parts[1]) not in vantages:
+                continue
+            result_x.append(int(parts[0]))
+            result_y.append(int(parts[-1]))
+            lines.append(number)
+    if drop_gaps:
+        mask = gap_mask(filename, len(result_x))
+        result_x = [x for x, keep in zip(result_x, mask) if keep]
+        result_y = [y for y, keep in zip(result_y, mask) if keep]
+        lines = [number for number, keep in zip(lines, mask) if keep]
+    if load_freq(filename):
+        # The blocks of the .freq file count the lines of the trace
+        num_lines = lines[-1] + 1 if lines else 0
+        factors = scale_factors(filename, num_lines)
+        result_y = [y / factors[number] for y, number in zip(result_y, lines)]
+        if freq_tolerance is not None:
+            mask = reference_mask(filename, num_lines, freq_tolerance)
+            result_x = [x for x, number in zip(result_x, lines) if mask[number]]
+            result_y = [y for y, number in zip(result_y, lines) if mask[number]]
     return result_x, result_y
 
 
+def share_of_pattern(lane, lanes):
+    """Returns one period of the bits the transmitter of a lane sends (every lanes-th bit from lane on)."""
+    period = patternlen // math.gcd(patternlen, lanes)
+    return ''.join(pattern[(time * lanes + lane) % patternlen] for time in range(period))
+
+
 def diff_letters(a, b):
     return sum(a[i] != b[i] for i in range(len(a)))
 
@@ -95,7 +167,7 @@ def per_offset_worker(parse_params):
     # lower threshold than with shorter intervals).
     # We try different fractions of contention samples observed (e.g. 10% of the
     # samples must show contention for the bit to be counted as a 1)
-    thresholds = range(70, 120, 2)	# FIXME: adjust these thresholds for your CPU
+    thresholds = range(LATENCY_PROFILE['llc_local_median'], LATENCY_PROFILE['llc_remote_dram_thres'], 2)
     contention_fracs = range(1, 70, 4) # test from 0.01 to 0.7 in intervals of 0.04
 
     best_contention_frac = None
@@ -111,16 +183,17 @@ def per_offset_worker(parse_params):
                 # Because we don't know at what point in the random sequence of
                 # bits we started sampling, we need to test against all possible
                 # shifts of the pattern. This is *much* faster in numpy, so we
-                # convert to np arrays for this step.
-                score = patternlen
+                # convert to np arrays for this step. A pattern that is longer
+                # than the training set (a frame stream) is cut to its length.
+                score = max(len(lane_pattern), len(result))
 
-                nppattern = np.array([int(i) for i in pattern])
+                nppattern = np.array([int(i) for i in lane_pattern])
                 result = np.array([int(i) for i in result])
-                for i in range(patternlen):
+                for i in range(len(lane_pattern)):
                     # This is what the numpy function below is effectively doing:
-                    # candidate = pattern[i:] + pattern[:i]
+                    # candidate = lane_pattern[i:] + lane_pattern[:i]
                     # newscore = diff_letters(result, candidate)
-                    newscore = np.count_nonzero(np.roll(nppattern, i) != result)
+                    newscore = np.count_nonzero(np.resize(np.roll(nppattern, i), len(result)) != result)
                     if (newscore < score):
                         score = newscore
             else:
@@ -142,29 +215,293 @@ def per_offset_worker(parse_params):
                 best_score = score
     return ParseParams(interval, offset, best_contention_frac, best_threshold, best_score)
 
-def main():
-    global interval, result_x, result_y, random_pattern
 
-    parser = argparse.ArgumentParser()
-    parser.add_argument('result_path', help='Path to the receiver trace')
-    parser.add_argument('interval', help='Interval used in the covert channel run', type=int)
-    parser.add_argument('--random_pattern',
-        help='Expect random bits rather than alternating bits',
-        action='store_true',
-        default=False
-    )
-    args = parser.parse_args()
+# Multi-level symbols (see MULTI_LEVEL in transmitter.c): each interval carries
+# bits_per_symbol bits as one of 2^bits_per_symbol levels, and the bits of a
+# symbol are the Gray code of its level. The receiver sees a higher fraction
+# of contended samples at higher levels, so an interval is decoded by comparing
+# that fraction to level boundaries, which are set from the training intervals
+# (the midpoints between the mean fractions of adjacent levels).
 
-    result_x, result_y = read_from_file(args.result_path)
-    interval = args.interval
-    random_pattern = args.random_pattern
+def level_to_gray(level):
+    return level ^ (level >> 1)
+
+
+def gray_to_level(g):
+    level = 0
+    while g:
+        level ^= g
+        g >>= 1
+    return level
+
+
+def symbol_sequence():
+    """Returns one period of the levels the transmitter sends."""
+    levels = 1 << bits_per_symbol
+    if not random_pattern:
+        return np.arange(levels)
+
+    # The transmitter takes the next bits_per_symbol bits of the pattern (of
+    # every lanes-th symbol from its lane on, see exp_sync.h)
+    period = patternlen // math.gcd(patternlen, bits_per_symbol * lanes)
+    sequence = []
+    for time in range(period):
+        symbol = time * lanes + lane
+        bits = 0
+        for b in range(bits_per_symbol):
+            bits = (bits << 1) | (pattern[(symbol * bits_per_symbol + b) % patternlen] == '1')
+        sequence.append(gray_to_level(bits))
+    return np.array(sequence)
 
+
+def contention_fractions(intervals, threshold):
+    """Returns the interval numbers and, for each, the fraction of samples at or above threshold."""
+    numbers = np.array(list(intervals.keys()))
+    fractions = np.array([np.count_nonzero(np.array(samples) >= threshold) / len(samples) for samples in intervals.values()])
+    return numbers, fractions
+
+
+def level_means(fractions, levels):
+    """Returns the mean fraction of the training intervals of each (known) level."""
+    return np.array([np.mean(fractions[levels == level]) if np.any(levels == level) else np.nan
+                     for level in range(1 << bits_per_symbol)])
+
+
+def level_boundaries(means):
+    """Sets the boundaries between the levels midway between their mean fractions."""
+    return np.sort([(a + b) / 2 for a, b in zip(means, means[1:])])
+
+
+def parse_intervals_into_levels(fractions, boundaries):
+    """Classify each interval as the level whose boundaries enclose its contention fraction."""
+    return np.searchsorted(boundaries, fractions)
+
+
+def bit_errors(decoded, expected):
+    """Returns the number of bits that differ between the Gray codes of two level arrays."""
+    flips = level_to_gray(decoded) ^ level_to_gray(expected)
+    return int(sum(np.count_nonzero((flips >> b) & 1) for b in range(bits_per_symbol)))
+
+
+def best_shift(numbers, decoded, sequence):
+    """Aligns the decoded levels with the sent sequence: returns the shift with the fewest bit errors and its errors."""
+    best = (0, SCORE_MAX)
+    for shift in range(len(sequence)):
+        score = bit_errors(decoded, sequence[(numbers + shift) % len(sequence)])
+        if score < best[1]:
+            best = (shift, score)
+    return best
+
+
+def per_offset_worker_multi_level(parse_params):
+    """Same as per_offset_worker for multi-level symbols.
+
+    For each threshold and alignment of the sent sequence, the training
+    intervals set the level boundaries, which are returned in the
+    contention_frac field (and the score is a tuple, see below).
+    """
+    offset = parse_params.offset
+    interval = parse_params.interval
+
+    cur_interval_no = 0
+    train_intervals = {}
+    for i in range(len(result_x)):
+        x = result_x[i]
+        y = result_y[i]
+        if ((x + offset) > interval * (cur_interval_no + 1)):
+            cur_interval_no += 1
+
+        if (discard_intv_start <= cur_interval_no < discard_intv_end):
+            continue
+        if (train_intv_start <= cur_interval_no < train_intv_end):
+            train_intervals.setdefault(cur_interval_no, []).append(y)
+        else:
+            break
+
+    sequence = symbol_sequence()
+    thresholds = range(LATENCY_PROFILE['llc_local_median'], LATENCY_PROFILE['llc_remote_dram_thres'], 2)
+
+    best_boundaries = None
+    best_threshold = None
+    best_score = (SCORE_MAX, 0)
+
+    # The score is the number of bit errors, and then the spread of the
+    # fractions around the means of their levels: offsets a little off the
+    # interval boundaries often decode the training intervals without errors
+    # too, but mix the levels of neighbouring intervals
+    for threshold in thresholds:
+        numbers, fractions = contention_fractions(train_intervals, threshold)
+        for shift in range(len(sequence)):
+            expected = sequence[(numbers + shift) % len(sequence)]
+            means = level_means(fractions, expected)
+            if np.any(np.isnan(means)):
+                continue
+            boundaries = level_boundaries(means)
+            errors = bit_errors(parse_intervals_into_levels(fractions, boundaries), expected)
+            score = (errors, float(np.sum((fractions - means[expected]) ** 2)))
+            if (score <= best_score):
+                best_threshold = threshold
+                best_boundaries = tuple(boundaries)
+                best_score = score
+    return ParseParams(interval, offset, best_boundaries, best_threshold, best_score)
+
+
+def write_soft_bits(filename, intervals, threshold, min_contention_frac):
+    """Write one soft bit per interval for the frame decoder (bin/frames).
+
+    The fraction of contended samples of an interval is mapped to [0, 1] so
+    that min_contention_frac, the boundary between the bits, maps to 0.5.
+    Intervals without samples (e.g., all dropped as gaps) are written as 0.5.
+    """
+    numbers, fractions = contention_fractions(intervals, threshold)
+    soft = dict(zip(numbers, fractions))
+    with open(filename, 'w') as f:
+        for number in range(min(numbers), max(numbers) + 1):
+            if number not in soft:
+                f.write('0.5\n')
+            elif soft[number] <= min_contention_frac:
+                f.write('%.4f\n' % (soft[number] / min_contention_frac / 2))
+            else:
+                f.write('%.4f\n' % (0.5 + (soft[number] - min_contention_frac) / (1 - min_contention_frac) / 2))
+
+
+# Clock recovery (--clock_recovery) finds the bit boundaries while decoding
+# the trace, instead of searching for the offset of the interval boundaries
+# offline, and follows them if the transmitter drifts. It needs a transmitter
+# that sends frames (see util/cc_frame.h), as it locks onto their preamble:
+# - Acquisition: the phase of the boundaries is estimated from where in the
+#   interval the fraction of contended samples changes the most, over the
+#   discarded intervals.
+# - Tracking: at each boundary between different bits, an early-late gate
+#   measures how far the actual boundary is from the expected one, from the
+#   fractions of the halves of the intervals on each side of it. A
+#   second-order loop then corrects the phase and the period, with wide gains
+#   until the preamble is seen and narrow ones after it.
+FRAME_PREAMBLE = format(0x1ACFFC1D, '032b')
+FRAME_SYNC_ERRORS = 3
+clock_recovery = False
+PHASE_BINS = 16
+ACQUISITION_GAINS = (0.1, 0.0025)  # (phase, period) per measured boundary
+TRACKING_GAINS = (0.02, 0.0001)
+
+
+def two_means(values):
+    """Splits values into two clusters (1-D k-means) and returns their means."""
+    low, high = np.percentile(values, 5), np.percentile(values, 95)
+    for _ in range(20):
+        middle = (low + high) / 2
+        if np.all(values < middle) or np.all(values >= middle):
+            break
+        low, high = values[values < middle].mean(), values[values >= middle].mean()
+    return low, high
+
+
+def coarse_phase(x, contended):
+    """Estimates the offset of the bit boundaries in [0, interval).
+
+    The samples are binned into PHASE_BINS bins per interval. At each bin
+    edge, the squared change between the fractions of contended samples of
+    the half intervals before and after it votes for the phase of that edge
+    (the angle of their weighted circular mean): it peaks at the boundaries
+    between different bits.
+    """
+    bins = (x // (interval / PHASE_BINS)).astype(np.int64)
+    hits = np.concatenate(([0], np.cumsum(np.bincount(bins, weights=contended))))
+    counts = np.concatenate(([0], np.cumsum(np.bincount(bins))))
+    half = PHASE_BINS // 2
+    edges = np.arange(half, len(hits) - half)
+    with np.errstate(invalid='ignore', divide='ignore'):
+        before = (hits[edges] - hits[edges - half]) / (counts[edges] - counts[edges - half])
+        after = (hits[edges + half] - hits[edges]) / (counts[edges + half] - counts[edges])
+    change = np.nan_to_num((after - before) ** 2)
+    angles = 2 * np.pi * (edges % PHASE_BINS) / PHASE_BINS
+    angle = np.angle(np.sum(change * np.exp(1j * angles)))
+    return (angle / (2 * np.pi) % 1) * interval
+
+
+def recover_clock():
+    """Finds the bit boundaries of the trace in result_x and result_y.
+
+    Returns the sample threshold, the contention fraction that separates the
+    bits, and the test intervals, or None if the preamble was not seen before
+    the end of the training intervals.
+    """
+    x = np.array(result_x, dtype=np.float64)
+    y = np.array(result_y)
+    acquisition = x < interval * discard_intv_end
+    threshold = sum(two_means(y[acquisition])) / 2
+    contended = y >= threshold
+    hits = np.concatenate(([0], np.cumsum(contended)))
+
+    # The fractions of the bits are the clusters of the fractions of the
+    # acquisition intervals
+    boundary = coarse_phase(x[acquisition], contended[acquisition])
+    edges = np.searchsorted(x, boundary + interval * np.arange(discard_intervals + 1))
+    fractions = np.array([(hits[b] - hits[a]) / (b - a) for a, b in zip(edges, edges[1:]) if b > a])
+    levels = two_means(fractions)
+    min_contention_frac = sum(levels) / 2
+
+    period = float(interval)
+    gains = ACQUISITION_GAINS
+    bits = []
+    locked = None
+    previous = None  # Bit and fraction of the second half of the last interval
+    test_intervals = {}
+    for number in range(test_intv_end):
+        middle, end = boundary + period / 2, boundary + period
+        first, half, last = np.searchsorted(x, [boundary, middle, end])
+        if first == len(x):
+            break
+        bit = bool(last > first and (hits[last] - hits[first]) / (last - first) > min_contention_frac)
+        if locked is None:
+            bits.append('1' if bit else '0')
+            if len(bits) >= len(FRAME_PREAMBLE) and diff_letters(bits[-len(FRAME_PREAMBLE):], FRAME_PREAMBLE) <= FRAME_SYNC_ERRORS:
+                locked = number - len(FRAME_PREAMBLE) + 1
+                gains = TRACKING_GAINS
+            elif number >= train_intv_end:
+                return None
+
+        # Early-late gate: error is how far the actual boundary is after the
+        # expected one. If it is after it (error > 0, our boundary is early),
+        # the first half of this interval has error / (period / 2) of the last
+        # bit; if it is before it (error < 0, our boundary is late), the second
+        # half of the last interval has -error / (period / 2) of this bit. A
+        # positive error moves the next boundary later
+        error = 0
+        if previous is not None and previous[1] is not None and previous[0] != bit and half > first:
+            late = (hits[half] - hits[first]) / (half - first)
+            error = period / 2 * ((previous[1] - levels[previous[0]]) + (late - levels[bit])) / (levels[previous[0]] - levels[bit])
+            error = max(-period / 2, min(period / 2, error))
+        previous = (bit, (hits[last] - hits[half]) / (last - half) if last > half else None) if last > first else None
+
+        if test_intv_start <= number:
+            test_intervals[number] = list(y[first:last])
+        boundary = end + gains[0] * error
+        period += gains[1] * error
+
+    if locked is None:
+        return None
+    print('Clock recovery: locked at interval %d, period %.2f cycles' % (locked, period), file=sys.stderr)
+    test_intervals = {number: samples for number, samples in test_intervals.items() if samples}
+    return threshold, min_contention_frac, test_intervals
+
+
+def search_offsets():
+    """Finds the bit boundaries by trying offsets on the training intervals.
+
+    Returns the best threshold and contention fraction (or level boundaries),
+    and the test intervals.
+    """
     # Parse trace into intervals
     pool = mp.Pool(processes=40)
-    offsets = range(0, interval // 2, interval // 80)
+    # Multi-level symbols only spam for part of the interval, so they need the
+    # interval boundaries to be found across the whole interval
+    offsets = range(0, interval // 2 if bits_per_symbol == 1 else interval, interval // 80)
     params = [ParseParams(interval, o, None, None, None) for o in offsets]
 
-    best_params_per_offset = pool.map(per_offset_worker, params)
+    worker = per_offset_worker if bits_per_symbol == 1 else per_offset_worker_multi_level
+    best_params_per_offset = pool.map(worker, params)
+    pool.close()
 
     # Select the best parameter
     best_params = min(best_params_per_offset, key=lambda x: x.score)
@@ -190,6 +527,30 @@ def main():
         else:
             continue
 
+    return best_threshold, best_contention_frac, test_intervals
+
+
+def count_errors():
+    """Decodes the trace in result_x and result_y and returns its bit errors."""
+    recovered = recover_clock() if clock_recovery else None
+    if clock_recovery and recovered is None:
+        print('Clock recovery: no preamble in the training intervals, searching the offsets instead', file=sys.stderr)
+    if recovered is not None:
+        best_threshold, best_contention_frac, test_intervals = recovered
+    else:
+        best_threshold, best_contention_frac, test_intervals = search_offsets()
+
+    if bits_per_symbol > 1:
+        # Decode the levels and count the bit errors at the best alignment
+        # (the test set holds bits_per_symbol bits per interval)
+        numbers, fractions = contention_fractions(test_intervals, best_threshold)
+        decoded = parse_intervals_into_levels(fractions, np.array(best_contention_frac))
+        _, score = best_shift(numbers, decoded, symbol_sequence())
+        return score
+
+    if soft_output is not None:
+        write_soft_bits(soft_output, test_intervals, best_threshold, best_contention_frac)
+
     # Parse the intervals into bits
     result = parse_intervals_into_bits(test_intervals, best_threshold, best_contention_frac)
 
@@ -197,31 +558,109 @@ def main():
         score = SCORE_MAX
         best_offset = 0
 
-        # Find the best offset using the first patternlen intervals
-        nppattern = np.array([int(i) for i in pattern])
+        # Find the best offset using the first period of the pattern of this lane
+        nppattern = np.array([int(i) for i in lane_pattern])
         npresult = np.array([int(i) for i in result])
-        for i in range(patternlen):
-            newscore = np.count_nonzero(np.roll(nppattern, i) != npresult[:patternlen])
+        for i in range(len(lane_pattern)):
+            newscore = np.count_nonzero(np.roll(nppattern, i) != npresult[:len(lane_pattern)])
             if (newscore < score):
                 best_offset = i
                 score = newscore
         
         # Evaluate on the entire collected result
-        extended_pattern = np.tile(nppattern, len(result) // patternlen + 1)[:len(result)]
-        score = np.count_nonzero(np.roll(extended_pattern, best_offset) != npresult)
+        extended_pattern = np.tile(np.roll(nppattern, best_offset), len(result) // len(lane_pattern) + 1)[:len(result)]
+        score = np.count_nonzero(extended_pattern != npresult)
     else:
         # Compare these bits with the ground truth
         # The ground truth is either 0101... or 1010...
         candidate_1 = "01" * ((len(result) // 2) + 1)
         candidate_2 = "10" * ((len(result) // 2) + 1)
 
-        # Print the number of bit flips between the
+        # Count the number of bit flips between the
         # decoded stream and the (correct) ground truth
         score_1 = diff_letters(result, candidate_1[:len(result)])
         score_2 = diff_letters(result, candidate_2[:len(result)])
         score = min(score_1, score_2)
+    return score
+
+
+def main():
+    global interval, result_x, result_y, random_pattern, bits_per_symbol, lane, lanes, lane_pattern
+    global pattern, patternlen, soft_output, clock_recovery
+
+    parser = argparse.ArgumentParser()
+    parser.add_argument('result_path', help='Path to the receiver trace')
+    parser.add_argument('interval', help='Interval used in the covert channel run', type=int)
+    parser.add_argument('--random_pattern',
+        help='Expect random bits rather than alternating bits',
+        action='store_true',
+        default=False
+    )
+    parser.add_argument('--keep_gaps',
+        help='Keep the samples tagged as hit by interrupts',
+        action='store_true',
+        default=False
+    )
+    parser.add_argument('--freq_tolerance',
+        help='Drop the samples of the blocks whose tagged frequencies are more than this many percent off the latency profile (the others are still rescaled)',
+        type=float,
+        default=None
+    )
+    parser.add_argument('--vantage',
+        help='Only use the samples of this vantage of a multi-vantage trace (can be repeated)',
+        action='append',
+        type=int,
+        default=None
+    )
+    parser.add_argument('--bits_per_symbol',
+        help='Decode multi-level symbols of this many bits (transmitter-multi-level)',
+        type=int,
+        default=1
+    )
+    parser.add_argument('--lanes',
+        help='Reassemble the payload of a lane-parallel run from the traces <result_path>.lane<i> (runner -l)',
+        type=int,
+        default=1
+    )
+    parser.add_argument('--pattern_file',
+        help='Expect the random bits in this file instead of the built-in pattern (e.g., the output of bin/frames stream)',
+        default=None
+    )
+    parser.add_argument('--soft_output',
+        help='Write one soft bit per test interval to this file, for bin/frames decode',
+        default=None
+    )
+    parser.add_argument('--clock_recovery',
+        help='Find the bit boundaries by locking onto the frame preamble and tracking them (needs a framed transmitter)',
+        action='store_true'
+    )
+    args = parser.parse_args()
+    if args.clock_recovery and (args.bits_per_symbol != 1 or args.lanes != 1):
+        parser.error('--clock_recovery needs one bit per symbol and one lane')
+    if args.soft_output is not None and (args.bits_per_symbol != 1 or args.lanes != 1):
+        parser.error('--soft_output needs one bit per symbol and one lane')
+
+    if args.pattern_file is not None:
+        with open(args.pattern_file) as f:
+            pattern = f.read().strip()
+        patternlen = len(pattern)
+    soft_output = args.soft_output
+    clock_recovery = args.clock_recovery
+    interval = args.interval
+    random_pattern = args.random_pattern
+    bits_per_symbol = args.bits_per_symbol
+    lanes = args.lanes
+
+    # With several lanes, the payload is reassembled from the share of the
+    # pattern each lane carries, so its errors are the sum of their errors
+    score = 0
+    for lane in range(lanes):
+        path = args.result_path if lanes == 1 else '%s.lane%d' % (args.result_path, lane)
+        result_x, result_y = read_from_file(path, drop_gaps=not args.keep_gaps, vantages=args.vantage,
+                                            freq_tolerance=args.freq_tolerance / 100 if args.freq_tolerance is not None else None)
+        lane_pattern = share_of_pattern(lane, lanes)
+        score += count_errors()
 
-    # print('Errors: {}/{} ({}%)'.format(score, len(result), score * 100 / len(result)))
     print(score)
 
 
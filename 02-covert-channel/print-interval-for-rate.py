@@ -3,12 +3,13 @@ import sys
 
 def main():
     # Parse args
-    assert len(sys.argv) == 3, "Specify the CPU frequency in GHz and the desired bitrate in Mbps"
+    assert len(sys.argv) in (3, 4), "Specify the CPU frequency in GHz, the desired bitrate in Mbps and optionally the bits per symbol"
     proc_frequency = float(sys.argv[1]) * 10**9   # e.g., 3*10^9
     goal_Mbps = float(sys.argv[2])                # e.g., 1
+    bits_per_symbol = int(sys.argv[3]) if len(sys.argv) == 4 else 1
 
     # Compute the interval that the channel needs to use to achieve the desired bitrate
-    need_interval = int(proc_frequency / (goal_Mbps * 10**6))
+    need_interval = int(proc_frequency * bits_per_symbol / (goal_Mbps * 10**6))
     print(need_interval, end="")
 
 
@@ -0,0 +1,100 @@
+#include "../util/util.h"
+#include "../util/machine_const.h"
+#include "../util/multi_vantage.h"
+#include "../util/exp_sync.h"
+#include <string.h>
+
+/*
+ * Same as receiver-no-ev, but samples several (core, slice) paths at once
+ * with one thread per path. The output trace has one "<tsc> <vantage> <latency>"
+ * line per sample, ordered by TSC, where vantage is the index of the path in
+ * the command line.
+ */
+int main(int argc, char **argv)
+{
+	// Check arguments
+	if (argc < 4 || argc - 3 > MAX_VANTAGES) {
+		fprintf(stderr, "Wrong Input! Enter output filename, channel interval and up to %d vantages (core ID:slice ID)!\n", MAX_VANTAGES);
+		fprintf(stderr, "Enter: %s <output_filename> <interval> <core_ID>:<slice_ID> [<core_ID>:<slice_ID> ...]\n", argv[0]);
+		exit(1);
+	}
+
+	// Parse channel interval
+	uint32_t interval = 1; // C does not like this if not initialized
+	sscanf(argv[2], "%" PRIu32, &interval);
+	if (interval <= 0) {
+		printf("Wrong interval! interval should be greater than 0!\n");
+		exit(1);
+	}
+
+	// Parse vantages
+	int nr_vantages = argc - 3;
+	int cores[MAX_VANTAGES], slices[MAX_VANTAGES];
+	for (int i = 0; i < nr_vantages; i++) {
+		if (multi_vantage_parse(argv[3 + i], &cores[i], &slices[i]) != 0) {
+			fprintf(stderr, "Wrong vantage %s! core_ID and slice_ID should be in the range [0, %d]!\n", argv[3 + i], NUM_CHA - 1);
+			exit(1);
+		}
+		for (int j = 0; j < i; j++) {
+			if (cores[j] == cores[i]) {
+				fprintf(stderr, "Wrong vantage %s! Each vantage needs its own core!\n", argv[3 + i]);
+				exit(1);
+			}
+		}
+	}
+
+	// Prepare output filename
+	FILE *output_file = fopen(argv[1], "w");
+	if (output_file == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+
+	// For this experiment we can use a fixed cache set
+	int set_ID = 33;
+
+	//////////////////////////////////////////////////////////////////////
+	// Set up memory
+	//////////////////////////////////////////////////////////////////////
+
+	// Mutex to avoid colliding with tx when creating EVs
+	// This is unnecessary when using the hash function
+	struct exp_sync sync;
+	exp_sync_open(&sync, EXP_RX);
+	exp_sync_setup_begin(&sync);
+
+	// Prepare the monitoring sets (same as receiver-no-ev: 24 addresses
+	// distributed across 2 LLC sets, 4 loads timed per sample, no EV)
+	printf("Rx: starting setup\n");
+	const int repetitions = 4000000;
+	static struct multi_vantage mv;
+	multi_vantage_init(&mv, nr_vantages, cores, slices, set_ID, 1, 24, 0, 4, repetitions);
+	printf("Rx: Done with setup\n");
+
+	// Release setup mutex
+	exp_sync_setup_end(&sync);
+	// Barrier for experiment start
+	exp_sync_barrier(&sync);
+
+	// Bring the monitoring sets into the LLC
+	multi_vantage_arm(&mv);
+
+	// Start all the vantages on the same interval boundary, after giving
+	// time to the transmitter to warm up
+	uint64_t start = get_time() + 500000;
+	start += interval - (start % interval);
+	multi_vantage_go(&mv, start, UINT64_MAX);
+	multi_vantage_wait(&mv);
+
+	// Store the samples to disk
+	int samples = multi_vantage_write_merged(&mv, output_file, start);
+	printf("Rx: %d samples from %d vantages (%d gaps)\n", samples, nr_vantages, multi_vantage_gaps(&mv));
+	exp_sync_report(&sync, samples, multi_vantage_gaps(&mv));
+
+	// Free the buffers and file
+	multi_vantage_destroy(&mv);
+	fclose(output_file);
+	exp_sync_close(&sync);
+
+	return 0;
+}
@@ -1,6 +1,9 @@
 #include "../util/util.h"
 #include "../util/machine_const.h"
-#include <semaphore.h>
+#include "../util/topology.h"
+#include "../util/sample_guard.h"
+#include "../util/freq_tag.h"
+#include "../util/exp_sync.h"
 #include <sys/mman.h>
 #include <string.h>
 #include <x86intrin.h>
@@ -53,21 +56,24 @@ int main(int argc, char **argv)
 	// This time we do not set the priority like in the RE because
 	// doing so would use root and we want our actual attack
 	// to be realistic for a user space process
-	int cpu = cha_id_to_cpu[core_ID];
+	int cpu = cha_to_cpu(core_ID);
 	pin_cpu(cpu);
 
+	// Tag the samples with the core and uncore frequencies, so that
+	// print-errors.py can rescale them when the frequencies are not pinned
+	struct freq_tag freq;
+	freq_tag_init(&freq, cpu);
+	printf("Rx: frequency tagging: %s\n", freq_tag_name(&freq));
+
 	//////////////////////////////////////////////////////////////////////
 	// Set up memory
 	//////////////////////////////////////////////////////////////////////
 
 	// Mutex to avoid colliding with tx when creating EVs
 	// This is unnecessary when using the hash function
-	sem_t *setup_sem = sem_open("setup_sem", 0);
-	if (setup_sem == SEM_FAILED) {
-		perror("rx sem_open cha_pmon_sem");
-		return -1;
-	}
-	sem_wait(setup_sem);
+	struct exp_sync sync;
+	exp_sync_open(&sync, EXP_RX);
+	exp_sync_setup_begin(&sync);
 
 	// Allocate large buffer (pool of addresses)
 	void *buffer = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
@@ -126,21 +132,22 @@ int main(int argc, char **argv)
 	uint32_t *result_x = (uint32_t *)malloc(sizeof(*result_x) * repetitions);
 	uint32_t *result_y = (uint32_t *)malloc(sizeof(*result_y) * repetitions);
 
+	// Prepare the gap detection (samples hit by interrupts are tagged in <output_filename>.gaps)
+	static struct gap_log gaps;
+	static struct irq_snapshot irqs_before, irqs_after;
+	gap_log_init(&gaps, gap_bound_from_profile(), GAP_SETTLE_SAMPLES);
+	char gaps_filename[256];
+	snprintf(gaps_filename, sizeof(gaps_filename), "%s.gaps", argv[3]);
+	static struct freq_log freqs;
+	char freq_filename[256];
+	snprintf(freq_filename, sizeof(freq_filename), "%s" FREQ_SUFFIX, argv[3]);
+
 	printf("Rx: Done with setup\n");
 
 	// Release setup mutex
-	sem_post(setup_sem);
-	sem_close(setup_sem);
+	exp_sync_setup_end(&sync);
 	// Barrier for experiment start
-	sem_t *tx_ready = sem_open("tx_ready", 0);
-	sem_t *rx_ready = sem_open("rx_ready", 0);
-	if (tx_ready == SEM_FAILED || rx_ready == SEM_FAILED) {
-		perror("Rx failed to open barrier");
-		exit(-1);
-	}
-	// Signal to tx that rx is ready
-	sem_post(rx_ready);
-	sem_wait(tx_ready);
+	exp_sync_barrier(&sync);
 
 	// Wait a bit (give time to the transmitter to warm up)
 	wait_cycles(500000);
@@ -161,8 +168,17 @@ int main(int argc, char **argv)
 	} while ((cycles % interval) > 10);
 
 	// Time LLC loads
+	int irqs_ok = irq_snapshot_take(cpu, &irqs_before) == 0;
+	freq_log_start(&freqs, &freq);
+	gap_log_arm(&gaps, (uint32_t)get_time());
 	for (i = 0; i < repetitions; i++) {
 
+		// Tag the previous block with the core frequency (rdpmc only,
+		// so no syscall is hidden from the gap detection)
+		if (i > 0 && i % FREQ_BLOCK_SAMPLES == 0) {
+			freq_log_mark(&freqs, i);
+		}
+
 		// Access the addresses sequentially.
 		asm volatile(
 			".align 16\n\t"
@@ -185,19 +201,32 @@ int main(int argc, char **argv)
 			: "r"(curr_node->address), "r"(curr_node->next->address) , "r"(curr_node->next->next->address), "r"(curr_node->next->next->next->address)
 			: "rax", "rcx", "rdx", "r8", "r9", "memory");
 
+		gap_check(&gaps, i, result_x[i]);
+
 		curr_node = curr_node->next->next->next->next;
 	}
+	irqs_ok = irqs_ok && irq_snapshot_take(cpu, &irqs_after) == 0;
+	freq_log_finish(&freqs, repetitions);
 
 	// Store the samples to disk
 	for (i = 0; i < repetitions; i++) {
 		fprintf(output_file, "%" PRIu32 " %" PRIu32 "\n", result_x[i] - result_x[0], result_y[i]);
 	}
 
+	// Store the tagged ranges
+	gap_log_write(&gaps, gaps_filename, irqs_ok ? &irqs_before : NULL, irqs_ok ? &irqs_after : NULL);
+	freq_log_write(&freqs, freq_filename);
+	printf("Rx: gaps detected: %d\n", gaps.count);
+	exp_sync_report(&sync, repetitions, gaps.count);
+	if (irqs_ok) {
+		irq_snapshot_report(stdout, "Rx: ", &irqs_before, &irqs_after);
+	}
+
 	// Free the buffers and file
+	freq_tag_close(&freq);
 	munmap(buffer, BUF_SIZE);
 	fclose(output_file);
-	sem_close(tx_ready);
-	sem_close(rx_ready);
+	exp_sync_close(&sync);
 	free(result_x);
 	free(result_y);
 
@@ -2,8 +2,72 @@
 cd "${BASH_SOURCE%/*}/" || exit # cd into correct directory
 
 CPU_GHZ=2.2
+RUN_RETRIES=3 # Runs of the runner at each bitrate before skipping it
 
-rm -rf out/capacity-data.out
+# Parse args
+BITS_PER_SYMBOL=1
+LANES=1
+FEC=
+if [ $# -ge 1 ]; then
+	BITS_PER_SYMBOL=$1
+fi
+if [ $# -ge 2 ]; then
+	LANES=$2
+fi
+if [ $# -ge 3 ]; then
+	FEC=$3
+fi
+if [ $# -gt 3 ]; then
+	echo "ERROR: Incorrect number of arguments"
+	echo "./run-all-capacity.sh [bits_per_symbol] [lanes] [none|conv]"
+	exit
+fi
+if [ -n "$FEC" ] && { [ $BITS_PER_SYMBOL -ne 1 ] || [ $LANES -ne 1 ]; }; then
+	echo "ERROR: Framing needs one bit per symbol and one lane"
+	exit
+fi
+
+# Multi-level symbols need the transmitter built with the same number of bits
+# per symbol (make BITS_PER_SYMBOL=...)
+if [ $BITS_PER_SYMBOL -eq 1 ]; then
+	TRANSMITTER=./bin/transmitter-rand-bits
+	CAPACITY_DATA=out/capacity-data.out
+else
+	TRANSMITTER=./bin/transmitter-multi-level-rand-bits
+	CAPACITY_DATA=out/capacity-data-${BITS_PER_SYMBOL}bit.out
+fi
+
+# Framing sends the random bits in frames (with FEC if conv), which the
+# receiver trace is decoded from with clock recovery (locking onto their
+# preamble), and the goodput is the payload of the frames that pass their CRC
+if [ "$FEC" = "none" ]; then
+	TRANSMITTER=./bin/transmitter-framed
+elif [ "$FEC" = "conv" ]; then
+	TRANSMITTER=./bin/transmitter-framed-fec
+elif [ -n "$FEC" ]; then
+	echo "ERROR: Unknown FEC $FEC"
+	exit
+fi
+if [ -n "$FEC" ]; then
+	CAPACITY_DATA=out/capacity-data-$FEC.out
+	./bin/frames stream $FEC > out/frame-stream.txt
+	PATTERN_ARGS="--pattern_file out/frame-stream.txt --soft_output out/frame-soft.txt --clock_recovery"
+fi
+
+# Several lanes run the transmitter/receiver pairs the analytical model picks
+# (the raw bandwidth is that of all the lanes together)
+if [ $LANES -eq 1 ]; then
+	RUN_ARGS="$TRANSMITTER 8 5 ./bin/receiver-no-ev 7 6 ./out/receiver-contention.out"
+else
+	source ../venv/bin/activate
+	PAIRS=$(cd ../04-analytical-model && python covert_lanes.py $LANES | awk '{printf "%s:%s:%s:%s ", $1, $2, $3, $4}')
+	deactivate
+	echo "Lanes: $PAIRS"
+	LANES=$(echo $PAIRS | wc -w)
+	CAPACITY_DATA=${CAPACITY_DATA%.out}-${LANES}lanes.out
+fi
+
+rm -rf $CAPACITY_DATA
 ./setup.sh
 
 for ITERATION in {1..5}; do
@@ -12,38 +76,46 @@ for ITERATION in {1..5}; do
 		
 		# Compute interval for the desired bitrate
 		source ../venv/bin/activate
-		INTERVAL=$(python print-interval-for-rate.py $CPU_GHZ $BITRATE)
+		INTERVAL=$(python print-interval-for-rate.py $CPU_GHZ $BITRATE $BITS_PER_SYMBOL)
 		deactivate
 
-		# Kill previous processes
-		sudo killall -9 transmitter-rand-bits &> /dev/null
-		sudo killall -9 receiver-no-ev &> /dev/null
-
-		# Run
-		until
-			sudo ./bin/transmitter-rand-bits 8 5 $INTERVAL > /dev/null &
-			sleep 1
-			sudo ./bin/receiver-no-ev 7 6 ./out/receiver-contention.out $INTERVAL > /dev/null
-		do
-			echo "Repeating iteration because it failed"
-			sudo killall transmitter-rand-bits &> /dev/null
+		# Run (the runner repeats failed attempts and stops the transmitter);
+		# the traces of the previous run are deleted so that a failed run
+		# cannot be scored with them, and a run that still fails is skipped
+		STATUS=1
+		for RUN in $(seq 1 $RUN_RETRIES); do
+			rm -f ./out/receiver-contention.out*
+			if [ $LANES -eq 1 ]; then
+				sudo ./bin/runner $RUN_ARGS $INTERVAL > /dev/null
+			else
+				sudo ./bin/runner -l $TRANSMITTER ./bin/receiver-no-ev ./out/receiver-contention.out $INTERVAL 5 $PAIRS > /dev/null
+			fi
+			STATUS=$?
+			if [ $STATUS -eq 0 ]; then
+				break
+			fi
+			echo "Run at $BITRATE Mbps failed (status $STATUS)"
 		done
-
-		sleep 0.05
-		sudo killall -9 transmitter-rand-bits &> /dev/null
-		sudo killall -9 receiver-no-ev &> /dev/null
+		if [ $STATUS -ne 0 ]; then
+			echo "Skipping $BITRATE Mbps"
+			continue
+		fi
 
 		source ../venv/bin/activate
-		ERRORS=$(python print-errors.py out/receiver-contention.out $INTERVAL --random_pattern)
+		ERRORS=$(python print-errors.py out/receiver-contention.out $INTERVAL --random_pattern --bits_per_symbol $BITS_PER_SYMBOL --lanes $LANES $PATTERN_ARGS)
 		deactivate
 
-		echo "$BITRATE $ERRORS" >> out/capacity-data.out
-		sleep 1
+		if [ -n "$FEC" ]; then
+			GOODBITS=$(./bin/frames decode $FEC out/frame-soft.txt)
+			echo "$BITRATE $ERRORS $GOODBITS" >> $CAPACITY_DATA
+		else
+			echo "$(echo "$BITRATE * $LANES" | bc) $ERRORS" >> $CAPACITY_DATA
+		fi
 	done
 done
 
 echo "Generating plot"
 source ../venv/bin/activate
-python plot-capacity-figure.py out/capacity-data.out
+python plot-capacity-figure.py $CAPACITY_DATA $BITS_PER_SYMBOL $LANES $FEC
 deactivate
 ./cleanup.sh
\ No newline at end of file
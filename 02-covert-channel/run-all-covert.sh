@@ -14,23 +14,10 @@ fi
 
 echo "Running covert channel test with an interval of $INTERVAL cycles"
 
-# Kill previous processes
-sudo killall transmitter &> /dev/null
-
 ./setup.sh
 
-# Run
-until
-	sudo ./bin/transmitter 8 5 $INTERVAL & # > /dev/null &
-	sleep 1
-	sudo ./bin/receiver-no-ev 7 6 ./out/receiver-contention.out $INTERVAL #> /dev/null
-do
-	echo "Repeating iteration $i because it failed"
-	sudo killall transmitter &> /dev/null
-done
-
-sleep 0.05
-sudo killall transmitter &> /dev/null
+# Run (the runner repeats failed attempts and stops the transmitter)
+sudo ./bin/runner ./bin/transmitter 8 5 ./bin/receiver-no-ev 7 6 ./out/receiver-contention.out $INTERVAL
 
 ./cleanup.sh
 
@@ -0,0 +1,325 @@
+#include "../util/util.h"
+#include "../util/machine_const.h"
+#include "../util/topology.h"
+#include "../util/exp_sync.h"
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_ATTEMPTS 5
+#define TX_STOP_TIMEOUT_MS 1000 /* Time given to the transmitter to stop before it is killed */
+
+/*
+ * Runs a transmitter and a receiver-no-ev style receiver against each other:
+ * forks them pinned to their cores, synchronizes them through a shared futex
+ * barrier (see exp_sync.h), waits for the receiver, and then stops the
+ * transmitter through the shared stop flag. A failed attempt (a child that
+ * exits with an error or dies) is repeated up to the given number of times.
+ *
+ * With -l, it runs several transmitter/receiver pairs (lanes) at once, e.g.
+ * those picked by 04-analytical-model/covert_lanes.py: the transmitters split
+ * the pattern between them, and the receiver of lane i writes its trace to
+ * <output_filename>.lane<i>.
+ *
+ * This replaces the named semaphores, the background launch, the sleep and
+ * the killall of the shell scripts.
+ */
+
+struct lane {
+	int tx_core, tx_slice, rx_core, rx_slice;
+	char tx_core_str[16], tx_slice_str[16], rx_core_str[16], rx_slice_str[16];
+	char output[PATH_MAX];
+	char *tx_argv[5];
+	char *rx_argv[6];
+	pid_t tx, rx;
+	int tx_status, rx_status, tx_done, rx_done;
+};
+
+static double elapsed_ms(const struct timespec *from)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - from->tv_sec) * 1e3 + (now.tv_nsec - from->tv_nsec) / 1e6;
+}
+
+/*
+ * Forks a child pinned to the cpu of core_ID that runs argv with the shared
+ * mapping and its lane in its environment.
+ */
+static pid_t spawn(int core_ID, int fd, int lane, char **argv)
+{
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid > 0) {
+		return pid;
+	}
+
+	// Do not outlive the runner (a transmitter would spin forever)
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+	if (getppid() == 1) {
+		exit(1);
+	}
+
+	// The affinity is kept through exec
+	pin_cpu(cha_to_cpu(core_ID));
+
+	char fd_str[16];
+	snprintf(fd_str, sizeof(fd_str), "%d", fd);
+	setenv(EXP_SYNC_FD_ENV, fd_str, 1);
+	snprintf(fd_str, sizeof(fd_str), "%d", lane);
+	setenv(EXP_SYNC_LANE_ENV, fd_str, 1);
+	execv(argv[0], argv);
+	perror(argv[0]);
+	exit(1);
+}
+
+static int exited_ok(int status)
+{
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void print_status(const char *name, int status)
+{
+	if (WIFEXITED(status)) {
+		printf("Runner: %s exited with status %d\n", name, WEXITSTATUS(status));
+	} else if (WIFSIGNALED(status)) {
+		printf("Runner: %s killed by signal %d\n", name, WTERMSIG(status));
+	}
+}
+
+/*
+ * Stops the transmitters that are still running through the shared flag (or,
+ * if a receiver failed, by aborting, in case they still wait at the barrier),
+ * and kills those that do not exit within TX_STOP_TIMEOUT_MS.
+ */
+static void stop_tx(struct exp_shared *sh, struct lane *lanes, int n, int abort)
+{
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (abort) {
+		exp_shared_abort(sh);
+	} else {
+		exp_shared_stop(sh);
+	}
+	for (int i = 0; i < n; i++) {
+		struct lane *l = &lanes[i];
+		while (!l->tx_done && waitpid(l->tx, &l->tx_status, WNOHANG) == 0) {
+			if (elapsed_ms(&start) > TX_STOP_TIMEOUT_MS) {
+				fprintf(stderr, "Runner: the transmitter of lane %d did not stop, killing it\n", i);
+				kill(l->tx, SIGKILL);
+				waitpid(l->tx, &l->tx_status, 0);
+				break;
+			}
+			usleep(100);
+		}
+	}
+}
+
+static struct lane *find_child(struct lane *lanes, int n, pid_t pid, int *is_tx)
+{
+	for (int i = 0; i < n; i++) {
+		if (lanes[i].tx == pid || lanes[i].rx == pid) {
+			*is_tx = lanes[i].tx == pid;
+			return &lanes[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Runs one attempt of all the lanes. Returns 0 if all the children succeeded.
+ */
+static int run_attempt(struct exp_shared *sh, int fd, struct lane *lanes, int n)
+{
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	exp_shared_reset(sh, n);
+
+	for (int i = 0; i < n; i++) {
+		lanes[i].tx_status = lanes[i].rx_status = 0;
+		lanes[i].tx_done = lanes[i].rx_done = 0;
+		lanes[i].tx = spawn(lanes[i].tx_core, fd, i, lanes[i].tx_argv);
+	}
+	for (int i = 0; i < n; i++) {
+		lanes[i].rx = spawn(lanes[i].rx_core, fd, i, lanes[i].rx_argv);
+	}
+
+	// Wait for the receivers; if a transmitter exits first, it failed
+	int receivers = n, failed = 0;
+	while (receivers > 0) {
+		int status, is_tx;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("waitpid");
+			exit(1);
+		}
+		struct lane *l = find_child(lanes, n, pid, &is_tx);
+		if (l == NULL) {
+			continue;
+		}
+		if (is_tx) {
+			l->tx_status = status;
+			l->tx_done = 1;
+			print_status("transmitter", status);
+			failed = 1;
+			exp_shared_abort(sh);
+		} else {
+			l->rx_status = status;
+			l->rx_done = 1;
+			receivers--;
+			if (!exited_ok(status)) {
+				print_status("receiver", status);
+				failed = 1;
+				exp_shared_abort(sh);
+			}
+		}
+	}
+	stop_tx(sh, lanes, n, failed);
+
+	// The transmitters stopped by the flag return 0; before that, they failed
+	int ok = !failed;
+	for (int i = 0; i < n; i++) {
+		ok = ok && exited_ok(lanes[i].tx_status) && sh->results[i][EXP_RX].done;
+	}
+	if (ok) {
+		uint64_t bits = 0;
+		for (int i = 0; i < n; i++) {
+			struct exp_result *t = &sh->results[i][EXP_TX], *r = &sh->results[i][EXP_RX];
+			if (n > 1) {
+				printf("Runner: lane %d: ", i);
+			} else {
+				printf("Runner: ");
+			}
+			printf("%" PRIu64 " samples (%" PRIu32 " gaps), %" PRIu64 " bits sent, start skew %" PRId64 " cycles",
+				   r->count, r->gaps, t->count, (int64_t)(r->start - t->start));
+			if (n > 1) {
+				printf("\n");
+			} else {
+				printf(", %.1f ms\n", elapsed_ms(&start));
+			}
+			bits += t->count;
+		}
+		if (n > 1) {
+			printf("Runner: %d lanes, %" PRIu64 " bits sent, %.1f ms\n", n, bits, elapsed_ms(&start));
+		}
+	}
+	return ok ? 0 : -1;
+}
+
+static int parse_core(const char *str, int *core)
+{
+	return sscanf(str, "%d", core) == 1 && *core >= 0 && *core < NUM_CHA;
+}
+
+/*
+ * Fills in a lane from its core and slice IDs, given as strings.
+ */
+static void parse_lane(struct lane *l, int index, int n, char *transmitter, char *receiver, const char *output,
+					   char *interval, const char *tx_core, const char *tx_slice, const char *rx_core, const char *rx_slice)
+{
+	if (!parse_core(tx_core, &l->tx_core) || !parse_core(rx_core, &l->rx_core)) {
+		fprintf(stderr, "Wrong core! core IDs should be in the range [0, %d]!\n", NUM_CHA - 1);
+		exit(1);
+	}
+	if (cha_to_cpu(l->tx_core) < 0 || cha_to_cpu(l->rx_core) < 0) {
+		fprintf(stderr, "Wrong core! The tiles of the transmitters and the receivers need an active core!\n");
+		exit(1);
+	}
+
+	// The children check the slice IDs
+	snprintf(l->tx_core_str, sizeof(l->tx_core_str), "%s", tx_core);
+	snprintf(l->tx_slice_str, sizeof(l->tx_slice_str), "%s", tx_slice);
+	snprintf(l->rx_core_str, sizeof(l->rx_core_str), "%s", rx_core);
+	snprintf(l->rx_slice_str, sizeof(l->rx_slice_str), "%s", rx_slice);
+	if (n > 1) {
+		snprintf(l->output, sizeof(l->output), "%s.lane%d", output, index);
+	} else {
+		snprintf(l->output, sizeof(l->output), "%s", output);
+	}
+
+	char *tx_argv[] = {transmitter, l->tx_core_str, l->tx_slice_str, interval, NULL};
+	char *rx_argv[] = {receiver, l->rx_core_str, l->rx_slice_str, l->output, interval, NULL};
+	memcpy(l->tx_argv, tx_argv, sizeof(tx_argv));
+	memcpy(l->rx_argv, rx_argv, sizeof(rx_argv));
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Wrong Input! Enter the transmitter and receiver binaries with their core and slice IDs, the output filename, the channel interval and optionally the number of attempts!\n");
+	fprintf(stderr, "Enter: %s <transmitter> <tx_core_ID> <tx_slice_ID> <receiver> <rx_core_ID> <rx_slice_ID> <output_filename> <interval> [attempts]\n", name);
+	fprintf(stderr, "   or: %s -l <transmitter> <receiver> <output_filename> <interval> <attempts> <tx_core_ID>:<tx_slice_ID>:<rx_core_ID>:<rx_slice_ID> [...]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct lane lanes[EXP_MAX_LANES];
+	int n, attempts = DEFAULT_ATTEMPTS;
+	char *attempts_str = NULL;
+
+	// Check arguments
+	if (argc >= 8 && strcmp(argv[1], "-l") == 0) {
+		n = argc - 7;
+		if (n > EXP_MAX_LANES) {
+			fprintf(stderr, "Too many lanes! At most %d lanes are supported!\n", EXP_MAX_LANES);
+			exit(1);
+		}
+		for (int i = 0; i < n; i++) {
+			char tx_core[16], tx_slice[16], rx_core[16], rx_slice[16];
+			if (sscanf(argv[7 + i], "%15[^:]:%15[^:]:%15[^:]:%15s", tx_core, tx_slice, rx_core, rx_slice) != 4) {
+				usage(argv[0]);
+			}
+			parse_lane(&lanes[i], i, n, argv[2], argv[3], argv[4], argv[5], tx_core, tx_slice, rx_core, rx_slice);
+		}
+		attempts_str = argv[6];
+	} else if (argc == 9 || argc == 10) {
+		n = 1;
+		parse_lane(&lanes[0], 0, 1, argv[1], argv[4], argv[7], argv[8], argv[2], argv[3], argv[5], argv[6]);
+		if (argc == 10) {
+			attempts_str = argv[9];
+		}
+	} else {
+		usage(argv[0]);
+	}
+
+	// All the children need their own cores
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			if (lanes[i].tx_core == lanes[j].rx_core || (i != j && (lanes[i].tx_core == lanes[j].tx_core ||
+																	lanes[i].rx_core == lanes[j].rx_core))) {
+				fprintf(stderr, "Wrong core! The transmitters and the receivers need their own cores!\n");
+				exit(1);
+			}
+		}
+	}
+
+	// Parse the number of attempts
+	if (attempts_str != NULL && (sscanf(attempts_str, "%d", &attempts) != 1 || attempts <= 0)) {
+		fprintf(stderr, "Wrong number of attempts! It should be greater than 0!\n");
+		exit(1);
+	}
+
+	int fd;
+	struct exp_shared *sh = exp_shared_create(&fd);
+
+	for (int attempt = 1; attempt <= attempts; attempt++) {
+		if (run_attempt(sh, fd, lanes, n) == 0) {
+			return 0;
+		}
+		printf("Runner: attempt %d of %d failed\n", attempt, attempts);
+	}
+
+	return 1;
+}
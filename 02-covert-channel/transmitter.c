@@ -1,12 +1,41 @@
 #include "../util/util.h"
 #include "../util/machine_const.h"
-#include <semaphore.h>
+#include "../util/topology.h"
+#include "../util/exp_sync.h"
+#include "../util/cc_frame.h"
+#include "pattern.h"
 #include <sys/mman.h>
 #include <string.h>
 #include <x86intrin.h>
 
 #define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
 
+#ifdef MULTI_LEVEL
+/*
+ * Multi-level symbols: each interval carries BITS_PER_SYMBOL bits as one of
+ * LEVELS traffic intensities. Level k spams for k / (LEVELS - 1) of the
+ * interval and idles for the rest, so the fraction of receiver samples that
+ * see contention grows with the level (level 0 is a 0 bit and the top level a
+ * 1 bit of the binary channel). The bits of a symbol are the Gray code of its
+ * level, so that mistaking a level for a neighbouring one flips a single bit.
+ */
+#ifndef BITS_PER_SYMBOL
+#define BITS_PER_SYMBOL 2
+#endif
+#define LEVELS (1 << BITS_PER_SYMBOL)
+
+#ifdef RANDOM_PATTERN
+// Returns the level whose Gray code is g
+static uint32_t gray_to_level(uint32_t g)
+{
+	for (uint32_t mask = g >> 1; mask != 0; mask >>= 1) {
+		g ^= mask;
+	}
+	return g;
+}
+#endif
+#endif
+
 int main(int argc, char **argv)
 {
 	int i;
@@ -47,21 +76,18 @@ int main(int argc, char **argv)
 	// This time we do not set the priority like in the RE because
 	// doing so would use root and we want our actual attack
 	// to be realistic for a user space process
-	int cpu = cha_id_to_cpu[core_ID];
+	int cpu = cha_to_cpu(core_ID);
 	pin_cpu(cpu);
 
 	//////////////////////////////////////////////////////////////////////
 	// Set up memory
 	//////////////////////////////////////////////////////////////////////
 
-	// Mutex to avoid colliding with tx when creating EVs
+	// Mutex to avoid colliding with rx when creating EVs
 	// This is unnecessary when using the hash function
-	sem_t *setup_sem = sem_open("setup_sem", 0);
-	if (setup_sem == SEM_FAILED) {
-		perror("rx sem_open cha_pmon_sem");
-		return -1;
-	}
-	sem_wait(setup_sem);
+	struct exp_sync sync;
+	exp_sync_open(&sync, EXP_TX);
+	exp_sync_setup_begin(&sync);
 
 	// Allocate large buffer (pool of addresses)
 	void *buffer = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
@@ -223,7 +249,11 @@ int main(int argc, char **argv)
 	//////////////////////////////////////////////////////////////////////
 
 #ifdef RANDOM_PATTERN
-	char *pattern = "1110011001010000110111110101011110001001111001010001100011110011100100011101110010010100100100011001110101111010111110100010000100100111001111100111011010110110011011011000011010001010000101110010010110001010110000001001111111001111010111111001111111000100000000100011011101011000001100010000000110000011001101101111010100011000100110100011001000100011011000010100100011100101011010011000110011001100001101101001101111011110000100001010001100001100000010111111110111110100110011100000011101001100110011001010101011011101000101110111101000001000110101110000100100010110110100101101001100110101110011000010111011010111111100001101011000000000011101011101000111101111110110010100010000101001100110000010000011111100101101010110001111011111100000001110110100011000011010101100111010100100101100000011000100101011000101111001011011111101101011010100111000101000101111101000111101001111100101100010011111111000100011010101101010100001110000011101011000001101100010100100001110000000100100000000000010100000";
+	char *pattern = RANDOM_BITS;
+	#ifdef FRAMED
+	// Send the pattern in frames (see cc_frame.h)
+	pattern = cc_frame_stream(pattern, FRAME_FEC);
+	#endif
 	int patternlen = strlen(pattern);
 #endif
 
@@ -267,18 +297,9 @@ int main(int argc, char **argv)
 	//////////////////////////////////////////////////////////////////////
 
 	// Release setup mutex
-	sem_post(setup_sem);
-	sem_close(setup_sem);
+	exp_sync_setup_end(&sync);
 	// Barrier for experiment start
-	sem_t *tx_ready = sem_open("tx_ready", 0);
-	sem_t *rx_ready = sem_open("rx_ready", 0);
-	if (tx_ready == SEM_FAILED || rx_ready == SEM_FAILED) {
-		perror("Rx failed to open barrier");
-		exit(-1);
-	}
-	// Signal to tx that rx is ready
-	sem_post(tx_ready);
-	sem_wait(rx_ready);
+	exp_sync_barrier(&sync);
 
 	uint64_t start_t;
 	uint32_t time;
@@ -288,11 +309,47 @@ int main(int argc, char **argv)
 		start_t = get_time();
 	} while ((start_t % interval) > 10);
 
-	// Send
-	for (time = 0; time < UINT32_MAX; time++) {
+	// Send (until killed, or until the runner stops us)
+	for (time = 0; time < UINT32_MAX && !exp_sync_stopped(&sync); time++) {
+
+		#ifdef RANDOM_PATTERN
+		// Our share of the pattern when several lanes split it (see exp_sync.h)
+		uint64_t symbol = (uint64_t)time * sync.lanes + sync.lane;
+		#endif
+
+		#ifdef MULTI_LEVEL
+		#ifdef RANDOM_PATTERN
+		// Take the next BITS_PER_SYMBOL bits of the pattern
+		uint32_t bits = 0;
+		for (int b = 0; b < BITS_PER_SYMBOL; b++) {
+			bits = (bits << 1) | (pattern[(symbol * BITS_PER_SYMBOL + b) % patternlen] == '1');
+		}
+		uint32_t level = gray_to_level(bits);
+		#else
+		// Step through all the levels in turn
+		uint32_t level = time % LEVELS;
+		#endif
 
+		// Spam for the first level / (LEVELS - 1) of the interval, and idle for the rest
+		uint64_t symbol_end = (uint64_t)interval * time;
+		uint64_t idle = (uint64_t)interval * (LEVELS - 1 - level) / (LEVELS - 1);
+		uint64_t busy_end = symbol_end > idle ? symbol_end - idle : 0;
+		while ((get_time() - start_t) < busy_end) {
+			current = ev;
+			while (current != NULL) {
+				maccess(current->address);
+				current = current->next;
+			}
+			current = ev_local;
+			while (current != NULL) {
+				maccess(current->address);
+				current = current->next;
+			}
+		}
+		while ((get_time() - start_t) < symbol_end) {}
+		#else
 		#ifdef RANDOM_PATTERN
-		if (pattern[time % patternlen] == '1') {
+		if (pattern[symbol % patternlen] == '1') {
 		#else
 		if (time % 2 == 0) {
 		#endif
@@ -313,13 +370,18 @@ int main(int argc, char **argv)
 			// Send 0 by doing nothing
 			while ((get_time() - start_t) < (interval * time)) {}
 		}
+		#endif
 	}
 
+	exp_sync_report(&sync, time, 0);
+
 	// Free the buffer
 	munmap(buffer, BUF_SIZE);
+#ifdef FRAMED
+	free(pattern);
+#endif
 
-	sem_close(tx_ready);
-	sem_close(rx_ready);
+	exp_sync_close(&sync);
 
 	// Clean up lists
 	struct Node *tmp = NULL;
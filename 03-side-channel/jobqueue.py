@@ -0,0 +1,120 @@
+"""
+Durable job queue for long collection campaigns.
+
+A campaign (e.g. the single-bit traces of one placement) is split into jobs
+that each collect a block of repetitions with one monitor run. The queue of a
+campaign is stored in <store>/<campaign>/queue.json, and the traces of each
+completed job in <store>/<campaign>/<job id>/. A job is committed by moving its
+traces into a staging directory and renaming that directory into place, so
+the traces of a job are either all in the store or not at all, and a job is
+done exactly when its directory exists.
+
+Restarting a campaign re-adds its jobs (which keeps the existing ones), drops
+the staging directories of interrupted commits, and runs the jobs that are not
+done, in order. Completed jobs are never collected again.
+"""
+import json
+import os
+import shutil
+
+STORE = 'jobs'
+STAGING_PREFIX = '.staging-'
+
+
+def fsync_directory(path):
+    fd = os.open(path, os.O_RDONLY)
+    try:
+        os.fsync(fd)
+    finally:
+        os.close(fd)
+
+
+def fsync_file(path):
+    with open(path, 'rb') as f:
+        os.fsync(f.fileno())
+
+
+def write_atomic(path, data):
+    """Replaces the file at path with data, so that it is either the old or the new file after a crash."""
+    tmp = path + '.tmp'
+    with open(tmp, 'w') as f:
+        f.write(data)
+        f.flush()
+        os.fsync(f.fileno())
+    os.replace(tmp, path)
+    fsync_directory(os.path.dirname(path))
+
+
+class JobQueue:
+    def __init__(self, campaign, store=STORE):
+        self.directory = os.path.join(store, campaign)
+        os.makedirs(self.directory, exist_ok=True)
+        self.path = os.path.join(self.directory, 'queue.json')
+        self.jobs = []
+        if os.path.exists(self.path):
+            with open(self.path) as f:
+                self.jobs = json.load(f)
+
+        # Leftovers of a commit interrupted before its rename
+        for name in os.listdir(self.directory):
+            if name.startswith(STAGING_PREFIX):
+                shutil.rmtree(os.path.join(self.directory, name))
+
+    def save(self):
+        write_atomic(self.path, json.dumps(self.jobs, indent=1))
+
+    def add(self, job_id, **params):
+        """Appends a job with the given parameters, unless the queue already has it."""
+        if any(job['id'] == job_id for job in self.jobs):
+            return
+        self.jobs.append(dict(params, id=job_id, attempts=0))
+        self.save()
+
+    def job_directory(self, job):
+        return os.path.join(self.directory, job['id'])
+
+    def is_done(self, job):
+        return os.path.isdir(self.job_directory(job))
+
+    def pending(self):
+        return [job for job in self.jobs if not self.is_done(job)]
+
+    def commit(self, job, files):
+        """Moves files, a list of (path, name in the job directory) pairs, into the store as the results of job."""
+        staging = os.path.join(self.directory, STAGING_PREFIX + job['id'])
+        os.makedirs(staging)
+        for path, name in files:
+            dst = os.path.join(staging, name)
+            os.makedirs(os.path.dirname(dst), exist_ok=True)
+            shutil.move(path, dst)
+            fsync_file(dst)
+        for root, _, _ in os.walk(staging):
+            fsync_directory(root)
+        os.rename(staging, self.job_directory(job))
+        fsync_directory(self.directory)
+
+    def run(self, collect, max_attempts=3):
+        """Runs the pending jobs in order with collect(job), which returns the
+        files to commit (see commit) or None if the collection failed.
+
+        Returns False, leaving the remaining jobs for the next run, if a job
+        failed max_attempts times in a row.
+        """
+        for job in self.pending():
+            for attempt in range(max_attempts):
+                job['attempts'] += 1
+                self.save()
+                print('Job %s (attempt %d of %d)' % (job['id'], attempt + 1, max_attempts))
+                files = collect(job)
+                if files is not None:
+                    self.commit(job, files)
+                    break
+            else:
+                print('Job %s failed %d times, stopping; run again to resume' % (job['id'], max_attempts))
+                return False
+        return True
+
+    def results(self, name=''):
+        """Returns the paths of the files (or subdirectory) name in the
+        directories of the completed jobs, in queue order."""
+        return [os.path.join(self.job_directory(job), name) for job in self.jobs if self.is_done(job)]
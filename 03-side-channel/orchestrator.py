@@ -1,10 +1,13 @@
 import argparse
+import bisect
 import glob
 import multiprocessing
 import os
 import pickle
+import random
 import statistics
 import subprocess
+import sys
 from distutils.dir_util import copy_tree, remove_tree
 from distutils.file_util import copy_file
 from multiprocessing import Process
@@ -18,6 +21,24 @@ from sklearn.metrics import (accuracy_score, f1_score, precision_score,
 from sklearn.model_selection import train_test_split
 from sklearn.multiclass import OneVsRestClassifier
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'util'))
+from freq_tag import FREQ_SUFFIX, load_core_share, load_freq, normalize, reference_mhz
+from host_profile import LATENCY, load_host_profile
+from jobqueue import STORE, JobQueue
+from sample_guard import GAPS_SUFFIX, has_gaps
+
+# Latency thresholds of this host (see 00-host-profile); the defaults were
+# measured on our machine with the frequencies pinned
+LATENCY_PROFILE = load_host_profile(LATENCY, {
+    'l2_llc_local_thres': 38,
+    'llc_remote_dram_thres': 120,
+})
+
+# Frequencies the thresholds are valid at: the traces tagged with the
+# frequencies they were taken at are rescaled to them (see util/freq_tag.py)
+REFERENCE_MHZ = reference_mhz()
+CORE_SHARE = load_core_share()
+
 
 # -------------------------------------------------------------------------------------------------------------------
 # Utility Functions
@@ -34,14 +55,19 @@ def parse_file_1c(fn):
     return np.array(lines)
 
 
+# Trace file -> array of latencies at the reference frequencies
+def parse_trace(fn):
+    return np.array(normalize(parse_file_1c(fn), fn, REFERENCE_MHZ, CORE_SHARE))
+
+
 # -------------------------------------------------------------------------------------------------------------------
 # Plotting Functions
 # -------------------------------------------------------------------------------------------------------------------
 
 # Plots two traces to visualize the diff: zero on the left and one on the right
 def plot_one_vs_zero(traces_bit_tuples, plot_id="0"):
-    low_thres = 38		# FIXME: change to other ranges if needed
-    high_thres = 120  # FIXME: change to other ranges if needed
+    low_thres = LATENCY_PROFILE['l2_llc_local_thres']
+    high_thres = LATENCY_PROFILE['llc_remote_dram_thres']
 
     # Parse traces and filter out outliers
     trace_0_dict = {}
@@ -133,109 +159,267 @@ def plot_one_vs_zero(traces_bit_tuples, plot_id="0"):
 # Data Collection Functions
 # -------------------------------------------------------------------------------------------------------------------
 
-# Collects $(runs_per_iteration) samples for the given $(target_iteration) of the victim
-def collect(target_iteration, runs_per_iteration):
-    if target_iteration <= 0:
-        print("Iteration number should be greater than 0")
-        exit(0)
+# Collections are split into jobs of at most JOB_BLOCK repetitions (one monitor
+# run each), which are committed to the job store as they complete, so that an
+# interrupted campaign resumes where it stopped (see jobqueue.py)
+JOB_BLOCK = 500
 
-    # Delete previous output files
-    prev_files = glob.glob("out/*.out")
-    for x in prev_files:
-        os.remove(x)
 
-    # Run monitor (attacker) until it succeeds:
-    monitor_err = 1
-    trials = 0
-    while (monitor_err != 0 and trials < 3):
-        cl = ['./bin/mesh-monitor', str(monitor_coreno), str(monitor_sliceno), str(runs_per_iteration), str(target_iteration)]
-        print(cl)
-        monitor_popen = subprocess.Popen(cl)
+# Returns the job queue of a campaign, named after the victim and the given parameters
+def campaign_queue(kind, *params):
+    return JobQueue('-'.join([victim_name, kind] + [str(p) for p in params]))
 
-        # Wait for monitor to complete (FIXME: tune timeout if necessary)
-        try:
-            monitor_err = monitor_popen.wait(timeout=600)
-        except:
-            print('monitor out of time')
-            monitor_err = -1
-        print('monitor returned %d.' % (monitor_err))
-
-        trials += 1
-
-    if (trials == 3):
-        exit(0)
 
-    # Save output into the desired directory
-    try:
-        remove_tree("data-single-bit")
-    except:
-        pass
-    os.makedirs("data-single-bit")
+# Adds the jobs collecting $(runs) repetitions in blocks; make_cl(first, n)
+# returns the monitor command line of the block of n repetitions from $(first)
+def add_block_jobs(queue, runs, make_cl, outputs, timeout):
+    for first in range(0, runs, JOB_BLOCK):
+        queue.add('block-%06d' % first, cl=make_cl(first, min(JOB_BLOCK, runs - first)), first=first,
+                  outputs=outputs, timeout=timeout)
 
-    files = glob.glob("out/*.out")
-    for x in files:
-        copy_file(x, "data-single-bit")
 
+# Runs the monitor of a job with its output directories emptied, and returns
+# the traces to commit, renumbered from the first repetition of the job (None
+# if the monitor failed)
+def run_monitor_job(job):
+    for directory in job['outputs']:
+        os.makedirs(directory, exist_ok=True)
+        for x in glob.glob(directory + "/*.out*"):
+            os.remove(x)
 
-# Collects $(runs_per_iteration_train) training samples for all iterations of the victim
-# Also collects $(runs_per_iteration_test) testing samples for all iterations of the victim
-def full_key_recovery_collect(runs_per_iteration_train, runs_per_iteration_test, bit_length):
+    print(job['cl'])
+    monitor_popen = subprocess.Popen(job['cl'])
 
-    # Create output folders
+    # Wait for monitor to complete (FIXME: tune timeout if necessary)
     try:
-        os.makedirs('out-train')
+        monitor_err = monitor_popen.wait(timeout=job['timeout'])
     except:
-        pass
+        print('monitor out of time')
+        monitor_popen.kill()
+        monitor_popen.wait()
+        monitor_err = -1
+    print('monitor returned %d.' % (monitor_err))
+    if monitor_err != 0:
+        return None
+
+    files = []
+    for directory in job['outputs']:
+        for f in glob.glob(directory + "/*.out*"):
+            run, rest = os.path.basename(f).split('_', 1)
+            files.append((f, os.path.join(directory, '%04d_%s' % (int(run) + job['first'], rest))))
+    return files
+
+
+# Runs the pending jobs of a campaign, and stops the orchestrator if one keeps
+# failing (the completed jobs are kept for the next run)
+def run_jobs(queue):
+    if not queue.run(run_monitor_job):
+        exit(1)
+
+
+# Copies the traces the completed jobs of a campaign collected in $(output)
+# into $(dst_directory)
+def assemble(queue, output, dst_directory):
     try:
-        os.makedirs('out-test')
+        remove_tree(dst_directory)
     except:
         pass
+    os.makedirs(dst_directory)
+    for directory in queue.results(output):
+        for x in glob.glob(directory + "/*"):
+            copy_file(x, dst_directory)
 
-    # Delete previous output files
-    prev_files = glob.glob("out-train/*.out")
-    for x in prev_files:
-        os.remove(x)
-
-    # Delete previous output files
-    prev_files = glob.glob("out-test/*.out")
-    for x in prev_files:
-        os.remove(x)
-
-    # Run monitor (attacker) until it succeeds:
-    monitor_err = 1
-    trials = 0
-    while (monitor_err != 0 and trials < 3):
-        cl = ['./bin/mesh-monitor-full-key-per-iteration', str(monitor_coreno), str(monitor_sliceno), str(runs_per_iteration_train), str(runs_per_iteration_test), str(bit_length)]
-        print(cl)
-        monitor_popen = subprocess.Popen(cl)
-
-        # Wait for monitor to complete (FIXME: tune timeout if necessary)
-        try:
-            monitor_err = monitor_popen.wait(timeout=200000)
-        except:
-            print('monitor out of time')
-            monitor_err = -1
-        print('monitor returned %d.' % (monitor_err))
 
-        trials += 1
+# Collects $(runs_per_iteration) samples for the given $(target_iteration) of the victim
+def collect(target_iteration, runs_per_iteration):
+    if target_iteration <= 0:
+        print("Iteration number should be greater than 0")
+        exit(0)
 
-    if (trials == 2):
-        print("Monitor failed after %d trials. Giving up" % trials)
-        exit(1)
+    # Run monitor (attacker) in blocks until all of them succeed
+    queue = campaign_queue('single-bit', monitor_coreno, monitor_sliceno, target_iteration, runs_per_iteration)
+    add_block_jobs(queue, runs_per_iteration,
+                   lambda first, n: ['./bin/mesh-monitor', str(monitor_coreno), str(monitor_sliceno), str(n), str(target_iteration)],
+                   ['out'], 600)
+    run_jobs(queue)
 
     # Save output into the desired directory
+    assemble(queue, 'out', "data-single-bit")
+
+
+# Collects $(runs_per_iteration) samples for the given $(target_iteration) of the victim
+# from several (core, slice) vantages at once, given as "core:slice" strings
+def multi_vantage_collect(target_iteration, runs_per_iteration, vantages):
+    if target_iteration <= 0:
+        print("Iteration number should be greater than 0")
+        exit(0)
+
+    # Run monitor (attacker) in blocks until all of them succeed
+    queue = campaign_queue('multi-vantage', '-'.join(v.replace(':', '.') for v in vantages), target_iteration, runs_per_iteration)
+    add_block_jobs(queue, runs_per_iteration,
+                   lambda first, n: ['./bin/mesh-monitor-multi-vantage', str(n), str(target_iteration)] + vantages,
+                   ['out-multi-vantage'], 600)
+    run_jobs(queue)
+
+    # Save output into the desired directory, one subdirectory per vantage
     try:
-        remove_tree("data-fkr-train")
+        remove_tree("data-multi-vantage")
     except:
         pass
+    for directory in queue.results('out-multi-vantage'):
+        split_multi_vantage(directory, "data-multi-vantage", vantages)
+
+
+# Splits the merged traces of the multi-vantage monitor ("tsc vantage latency"
+# lines) into one directory of single-path traces per vantage
+def split_multi_vantage(src_directory, dst_directory, vantages):
+    vantage_dirs = []
+    for vantage in vantages:
+        vantage_dir = os.path.join(dst_directory, vantage.replace(':', '-'))
+        os.makedirs(vantage_dir, exist_ok=True)
+        vantage_dirs.append(vantage_dir)
+
+    for f in glob.glob(src_directory + "/*.out"):
+        latencies = [[] for _ in vantages]
+        with open(f) as fp:
+            for line in fp:
+                _, vantage, latency = line.split()
+                latencies[int(vantage)].append(latency)
+        for vantage_dir, trace in zip(vantage_dirs, latencies):
+            with open(os.path.join(vantage_dir, os.path.basename(f)), 'w') as fp:
+                fp.write(''.join(latency + '\n' for latency in trace))
+
+
+# Collects $(runs) traces of all the victim iterations from $(first_iteration) on,
+# one victim run each (see capture_iterations in scutil/dont-mesh-around.h),
+# and segments them into per-iteration traces in dst_directory
+def multi_iteration_collect(first_iteration, runs, dst_directory, mode):
+
+    # Run monitor (attacker) in blocks until all of them succeed: the training
+    # runs (a new key each) in blocks, and the test runs (all with the same
+    # key) in a single job
+    cl = ['./bin/mesh-monitor-multi-iteration', str(monitor_coreno), str(monitor_sliceno)]
+    queue = campaign_queue('multi-iteration', dst_directory, monitor_coreno, monitor_sliceno, first_iteration, runs)
+    if mode == 'train':
+        add_block_jobs(queue, runs, lambda first, n: cl + [str(n), str(first_iteration), mode],
+                       ['out-multi-iteration'], 6000)
+    else:
+        queue.add('test', cl=cl + [str(runs), str(first_iteration), mode], first=0,
+                  outputs=['out-multi-iteration'], timeout=6000 * (runs // JOB_BLOCK + 1))
+    run_jobs(queue)
+
     # Save output into the desired directory
     try:
-        remove_tree("data-fkr-test")
+        remove_tree(dst_directory)
     except:
         pass
+    for directory in queue.results('out-multi-iteration'):
+        split_multi_iteration(directory, dst_directory)
+
+
+# Returns the (iteration, bit, start, end) TSC windows of the iterations in the
+# markers of a trace, given as (tsc, iteration, op) tuples. An iteration starts
+# at its A operation and ends where the victim ends the iteration of interest
+# when capturing a single iteration (see the cryptoloop_check_* functions in
+# scutil/dont-mesh-around.c), so the segments match the traces of the full-key
+# monitor; its bit is 1 if it has a B operation.
+def iteration_windows(markers):
+    windows = []
+    for k, (start, iteration, op) in enumerate(markers):
+        if op != 'A':
+            continue
+        attacking = 2
+        for end, _, next_op in markers[k + 1:]:
+            if next_op == 'E' or (next_op == 'A' and attacking >= 3) or (next_op == 'B' and attacking == 3):
+                windows.append((iteration, int(attacking == 4), start, end))
+                break
+            attacking += 1 if next_op == 'A' else 2
+    return windows
+
+
+# Segments the traces of the multi-iteration monitor ("tsc latency" lines)
+# into one trace per iteration with their iteration markers, named like those
+# of the full-key monitor ("<run>_data_<iteration>_<bit>.out"). The .gaps and
+# .freq files are split along.
+def split_multi_iteration(src_directory, dst_directory):
+    os.makedirs(dst_directory, exist_ok=True)
+    for f in glob.glob(src_directory + "/*.out"):
+        if not os.path.exists(f + ".markers"):
+            continue
+        run = os.path.basename(f).split('_')[0]
 
-    copy_tree("out-train", "data-fkr-train")
-    copy_tree("out-test", "data-fkr-test")
+        # Times relative to the first sample (the TSCs are 32 bits)
+        with open(f) as fp:
+            samples = [line.split() for line in fp]
+        if not samples:
+            continue
+        base = int(samples[0][0])
+        starts = [(int(tsc) - base) & 0xffffffff for tsc, _ in samples]
+        with open(f + ".markers") as fp:
+            markers = [(int(tsc), int(iteration), op) for tsc, iteration, op in (line.split() for line in fp)]
+        gaps = []
+        if has_gaps(f):
+            with open(f + GAPS_SUFFIX) as fp:
+                gaps = [tuple(int(x) for x in line.split()) for line in fp if not line.startswith('#')]
+        freqs = load_freq(f)
+
+        for iteration, bit, start, end in iteration_windows(markers):
+            first = bisect.bisect_left(starts, (start - base) & 0xffffffff)
+            last = bisect.bisect_left(starts, (end - base) & 0xffffffff)
+            if first >= last:
+                continue
+            out = os.path.join(dst_directory, "%s_data_%04d_%d.out" % (run, iteration, bit))
+            with open(out, 'w') as fp:
+                fp.write(''.join(samples[i][1] + '\n' for i in range(first, last)))
+
+            # Rebase the tagged samples of this segment
+            segment_gaps = [(max(a, first) - first, min(b, last - 1) - first, cycles)
+                            for a, b, cycles in gaps if a < last and b >= first]
+            if segment_gaps:
+                with open(out + GAPS_SUFFIX, 'w') as fp:
+                    fp.write(''.join("%d %d %d\n" % r for r in segment_gaps))
+            segment_freqs = [(max(a, first) - first, min(b, last - 1) - first, core, uncore)
+                             for a, b, core, uncore in freqs if a < last and b >= first]
+            if segment_freqs:
+                with open(out + FREQ_SUFFIX, 'w') as fp:
+                    fp.write(''.join("%d %d %d %d\n" % r for r in segment_freqs))
+
+
+# Trains a classifier for each vantage of a multi-vantage collection
+# and reports the best vantage
+def multi_vantage_train(directory):
+    accuracies = {}
+    for vantage_dir in sorted(glob.glob(directory + "/*")):
+        vantage = os.path.basename(vantage_dir).replace('-', ':')
+        print("Vantage", vantage)
+        accuracies[vantage] = train(vantage_dir)
+
+    for vantage, accuracy in accuracies.items():
+        print("Vantage %s: accuracy = %f" % (vantage, accuracy))
+    if accuracies:
+        best_vantage = max(accuracies, key=accuracies.get)
+        print("Best vantage (core:slice) =", best_vantage, "with accuracy =", accuracies[best_vantage])
+
+
+# Collects $(runs_per_iteration_train) training samples for all iterations of the victim
+# Also collects $(runs_per_iteration_test) testing samples for all iterations of the victim
+def full_key_recovery_collect(runs_per_iteration_train, runs_per_iteration_test, bit_length):
+
+    # Run monitor (attacker) in blocks until all of them succeed: the training
+    # keys in blocks, and the test key in a single job (the monitor only
+    # switches to it once)
+    cl = ['./bin/mesh-monitor-full-key-per-iteration', str(monitor_coreno), str(monitor_sliceno)]
+    queue = campaign_queue('full-key', monitor_coreno, monitor_sliceno, runs_per_iteration_train, runs_per_iteration_test, bit_length)
+    add_block_jobs(queue, runs_per_iteration_train,
+                   lambda first, n: cl + [str(n), '0', str(bit_length)],
+                   ['out-train', 'out-test'], 200000)
+    queue.add('test', cl=cl + ['0', str(runs_per_iteration_test), str(bit_length)], first=0,
+              outputs=['out-train', 'out-test'], timeout=200000)
+    run_jobs(queue)
+
+    # Save output into the desired directory
+    assemble(queue, 'out-train', "data-fkr-train")
+    assemble(queue, 'out-test', "data-fkr-test")
 
 
 # -------------------------------------------------------------------------------------------------------------------
@@ -254,6 +438,13 @@ def parse(directory, iteration_index=""):
     out_files = sorted(glob.glob(directory + ("/*_data_%s*.out" % iteration_index)))
     traces_bit_tuples = []
 
+    # Skip the traces hit by interrupts (the monitor only keeps them after
+    # failing to re-take them several times)
+    interrupted = set(f for f in out_files if has_gaps(f))
+    if interrupted:
+        print("Skipping", len(interrupted), "traces hit by interrupts")
+        out_files = [f for f in out_files if f not in interrupted]
+
     # Read the traces
     for f in out_files:
 
@@ -262,7 +453,7 @@ def parse(directory, iteration_index=""):
         actual_bit = parts[3]
 
         # Parse file
-        trace = parse_file_1c(f)  # this array contains all the samples
+        trace = parse_trace(f)  # this array contains all the samples
         traces_bit_tuples.append((trace, actual_bit))
 
     # First, count how many zeros and ones there are in the data parsed
@@ -390,6 +581,8 @@ def train(directory, savemodel=0):
         with open(("models/input_len.pickle"), "wb") as fp:  # Pickling
             pickle.dump(lowerbound, fp)
 
+    return best_score
+
 
 # -------------------------------------------------------------------------------------------------------------------
 # ML Test Functions (used for full key recovery)
@@ -430,7 +623,7 @@ def full_key_recovery_test(exclude_first_bit=0):
         all_traces = []
         actual_bit = files[0].split('/')[-1].split('.')[0].split('_')[3]
         for f in files:
-            trace = parse_file_1c(f)  # this array contains all the samples
+            trace = parse_trace(f)  # this array contains all the samples
             bit = f.split('/')[-1].split('.')[0].split('_')[3]
             if actual_bit != bit:
                 print("ERROR! Testing with different keys")
@@ -637,7 +830,7 @@ def train_per_single_iteration():
         actual_bit = parts[3]
 
         # Parse file
-        trace = parse_file_1c(f)  # this array contains all the samples
+        trace = parse_trace(f)  # this array contains all the samples
         all_traces_dict.setdefault(iteration_index, []).append((trace, actual_bit))
 
     # Now process the results of the experiments
@@ -655,37 +848,44 @@ def train_per_single_iteration():
 # Miscellaneous
 # -------------------------------------------------------------------------------------------------------------------
 
+# Best receiver slice for each receiver core, with the sender on CHA 0
+BEST_RECEIVER_SLICE = {
+    1: 25,
+    2: 1,
+    4: 23,
+    5: 23,
+    6: 25,
+    7: 1,
+    8: 2,
+    9: 15,
+    10: 23,
+    11: 8,
+    12: 1,
+    13: 6,
+    14: 6,
+    15: 8,
+    16: 2,
+    17: 10,
+    18: 11,
+    19: 12,
+    20: 1,
+    21: 2,
+    22: 6,
+    23: 8,
+    24: 1
+}
+
+# Largest accuracy difference between a placement measured concurrently and
+# alone that is not considered interference
+INTERFERENCE_TOLERANCE = 0.05
+
+
 def analytical_model_verification():
     """
     Pin the receiver on each core and use the best receiver slice.
 
     Sender is on CHA 0.
     """
-    best_slice = {
-        1: 25,
-        2: 1,
-        4: 23,
-        5: 23,
-        6: 25,
-        7: 1,
-        8: 2,
-        9: 15,
-        10: 23,
-        11: 8,
-        12: 1,
-        13: 6,
-        14: 6,
-        15: 8,
-        16: 2,
-        17: 10,
-        18: 11,
-        19: 12,
-        20: 1,
-        21: 2,
-        22: 6,
-        23: 8,
-        24: 1
-    }
     global monitor_coreno
     global monitor_sliceno
     for core in range(26):
@@ -694,11 +894,58 @@ def analytical_model_verification():
         if core in (0, 3, 25):
             continue
         monitor_coreno = core
-        monitor_sliceno = best_slice[monitor_coreno]
+        monitor_sliceno = BEST_RECEIVER_SLICE[monitor_coreno]
+        print("Placement %d:%d" % (monitor_coreno, monitor_sliceno))
         collect(target_iteration, 5000)
         train("data-single-bit")
 
 
+def concurrent_model_verification(baseline_samples=3):
+    """
+    Same placements as analytical_model_verification, but measured
+    concurrently: the analytical model groups them into sets whose mesh paths
+    and CHAs do not interact (see 04-analytical-model/schedule_placements.py),
+    and the multi-vantage monitor collects each group at once.
+
+    To verify that the placements of a group did not interfere, a sample of
+    them is also collected alone (the serial baseline), and their accuracies
+    are compared.
+    """
+    sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '04-analytical-model'))
+    from schedule_placements import concurrent_groups
+
+    groups = concurrent_groups(sorted(BEST_RECEIVER_SLICE.items()), reserved=(0,))
+    print("%d placements in %d concurrent groups" % (len(BEST_RECEIVER_SLICE), len(groups)))
+
+    accuracies = {}
+    for group in groups:
+        vantages = ['%d:%d' % placement for placement in group]
+        print("Concurrent group:", ' '.join(vantages))
+        multi_vantage_collect(target_iteration, 5000, vantages)
+        for core, slice_ in group:
+            print("Placement %d:%d" % (core, slice_))
+            accuracies[(core, slice_)] = train(os.path.join("data-multi-vantage", "%d-%d" % (core, slice_)))
+
+    # Serial baseline on a sample of the placements that shared a group
+    shared = [placement for group in groups if len(group) > 1 for placement in group]
+    sample = random.Random(0).sample(shared, min(baseline_samples, len(shared)))
+    interfered = []
+    for core, slice_ in sample:
+        vantage = '%d:%d' % (core, slice_)
+        print("Baseline", vantage)
+        multi_vantage_collect(target_iteration, 5000, [vantage])
+        serial = train(os.path.join("data-multi-vantage", "%d-%d" % (core, slice_)))
+        concurrent = accuracies[(core, slice_)]
+        print("Baseline %s: serial accuracy = %f, concurrent accuracy = %f" % (vantage, serial, concurrent))
+        if abs(serial - concurrent) > INTERFERENCE_TOLERANCE:
+            interfered.append(vantage)
+
+    if interfered:
+        print("Interference detected on", ' '.join(interfered), "- run the verification serially (--analyticalmodelverify)")
+    else:
+        print("No interference on the %d baseline placements" % len(sample))
+
+
 def is_process_running(processName):
     # Iterate over the all the running process
     for proc in psutil.process_iter():
@@ -742,15 +989,30 @@ if __name__ == '__main__':
     parser.add_argument('--train', action='store_true')
     parser.add_argument('--plot', action='store_true')
 
+    # Single bit, several vantages at once (e.g., --multivantagecollect 5000 9:13 7:6)
+    parser.add_argument('--multivantagecollect', nargs='+')
+    parser.add_argument('--multivantagetrain', action='store_true')
+
     # Full key
     parser.add_argument('--fullkeyrecoverycollect', nargs=2)
+    parser.add_argument('--fullkeyrecoverycollectmultiiteration', nargs=2)
     parser.add_argument('--fullkeyrecoverytrain', action='store_true')
     parser.add_argument('--fullkeyrecoverytest', action='store_true')
 
     # Analytical Model Verification
     parser.add_argument('--analyticalmodelverify', action='store_true')
+    parser.add_argument('--analyticalmodelverifyconcurrent', action='store_true')
+
+    # Drop the completed jobs of previous campaigns instead of resuming them
+    parser.add_argument('--newcampaign', action='store_true')
     args = parser.parse_args()
 
+    if args.newcampaign:
+        try:
+            remove_tree(STORE)
+        except:
+            pass
+
     # Prepare output directories
     try:
         os.makedirs('data')
@@ -785,10 +1047,12 @@ if __name__ == '__main__':
         target_iteration = 4    # iteration 1 is always 1 in ECDSA
         bit_length = 256
         exclude_first_bit = 1   # first bit in ECDSA is always 1
+        victim_name = 'ecdsa'
     elif victim_path == rsa_path:
         target_iteration = 1
         bit_length = 1024
         exclude_first_bit = 0
+        victim_name = 'rsa'
 
     # Run the orchestrator
     if args.collect:
@@ -809,6 +1073,14 @@ if __name__ == '__main__':
     if args.train:
         train("data-single-bit")
 
+    # Collect and train from several vantages at once
+    if args.multivantagecollect:
+        no_victim_runs = int(args.multivantagecollect[0])
+        multi_vantage_collect(target_iteration, no_victim_runs, args.multivantagecollect[1:])
+
+    if args.multivantagetrain:
+        multi_vantage_train("data-multi-vantage")
+
     # Collect data for full key recovery
     if args.fullkeyrecoverycollect:
 
@@ -819,6 +1091,12 @@ if __name__ == '__main__':
 
         full_key_recovery_collect(runs_per_iteration_train, runs_per_iteration_test, bit_length)
 
+    # Collect data for full key recovery with one victim run per key instead
+    # of one per iteration
+    if args.fullkeyrecoverycollectmultiiteration:
+        multi_iteration_collect(1, int(args.fullkeyrecoverycollectmultiiteration[0]), "data-fkr-train", 'train')
+        multi_iteration_collect(1, int(args.fullkeyrecoverycollectmultiiteration[1]), "data-fkr-test", 'test')
+
     # Test data for full key recovery
     if args.fullkeyrecoverytrain:
         train("data-fkr-train", savemodel=1)
@@ -830,3 +1108,7 @@ if __name__ == '__main__':
     # Get accuracy for receiver on each core
     if args.analyticalmodelverify:
         analytical_model_verification()
+
+    # Same, measuring the placements that do not interact at the same time
+    if args.analyticalmodelverifyconcurrent:
+        concurrent_model_verification()
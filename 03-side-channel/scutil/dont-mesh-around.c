@@ -1,14 +1,37 @@
 #include "dont-mesh-around.h"
 
+#include <cpuid.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <x86intrin.h>
 
 #define BUF_SIZE 400 * 1024UL * 1024 /* Buffer Size -> 400*1MB */
+#define CPUID_7_ECX_WAITPKG (1 << 5)
+#define UMWAIT_C01 1 /* Lighter sleep state than C0.2, with a faster wake-up */
+#define FUTEX_SLICE_NS 1000000L /* Futex waits are cut in slices to check the timeout */
+#define WAKE_DELAY_CYCLES 100000 /* Time the helper waits before each signal */
 
 static volatile struct sharestruct *mysharestruct = NULL;
 static struct Node *eviction_sets[L2_CACHE_SETS];
 static void *buffer;
 static int iteration_counter;
+static int capturing;	/* Recording markers until the end of the loop (capture_iterations) */
+
+static void record_marker(enum marker_op op)
+{
+	volatile struct marker_ring *ring = get_marker_ring(mysharestruct);
+	uint32_t head = ring->head;
+	volatile struct marker *m = &ring->events[head % MARKER_RING_EVENTS];
+	m->tsc = (uint32_t)__rdtsc();
+	m->iteration = iteration_counter;
+	m->op = op;
+	ring->head = head + 1;
+}
 
 
 void prepare_for_attack(uint8_t *attacking) {
@@ -18,6 +41,7 @@ void prepare_for_attack(uint8_t *attacking) {
 	mysharestruct->iteration_of_interest_running = 0;
 	iteration_counter = 0;
 	*attacking = 0;
+	handshake_signal_state(mysharestruct, VICTIM_SIGNING);
 
 	static uint8_t first_time = 1;
 	if (first_time == 1) {
@@ -103,19 +127,28 @@ void check_attack_iteration(uint8_t *attacking) {
 		cryptoloop_check_a(attacking);
 		cryptoloop_check_b(attacking);
 
-		// Mark the attack as started
-		*attacking = 1;
-		mysharestruct->iteration_of_interest_running = 1;
+		// Mark the attack as started (with capture_iterations, it only ends
+		// at the end of the loop)
+		if (mysharestruct->capture_iterations) {
+			get_marker_ring(mysharestruct)->head = 0;
+			capturing = 1;
+		} else {
+			*attacking = 1;
+		}
+		handshake_signal_start(mysharestruct);
 		_mm_lfence();
 	}
 }
 
 void cryptoloop_check_a(uint8_t *attacking) {
+	if (capturing) {
+		record_marker(MARKER_A);
+	}
+
 	if (*attacking == 0) {
 		return;
 	} else if (*attacking == 3) {
-		mysharestruct->bit_of_the_iteration_of_interest = 0;
-		mysharestruct->iteration_of_interest_running = 0;
+		handshake_signal_end(mysharestruct, 0);
 		*attacking = 0;
 
 		// What bit was actually being processed in this iteration?
@@ -124,8 +157,7 @@ void cryptoloop_check_a(uint8_t *attacking) {
 		// fprintf(stderr, "0\n");	// FIXME: uncomment if needed
 
 	} else if (*attacking == 4) {
-		mysharestruct->bit_of_the_iteration_of_interest = 1;
-		mysharestruct->iteration_of_interest_running = 0;
+		handshake_signal_end(mysharestruct, 1);
 		*attacking = 0;
 
 		// What bit was actually being processed in this iteration?
@@ -139,11 +171,14 @@ void cryptoloop_check_a(uint8_t *attacking) {
 }
 
 void cryptoloop_check_b(uint8_t *attacking) {
+	if (capturing) {
+		record_marker(MARKER_B);
+	}
+
 	if (*attacking == 0) {
 		return;
 	} else if (*attacking == 3) {
-		mysharestruct->bit_of_the_iteration_of_interest = 0;
-		mysharestruct->iteration_of_interest_running = 0;
+		handshake_signal_end(mysharestruct, 0);
 		*attacking = 0;
 
 		// What bit was actually being processed in this iteration?
@@ -161,11 +196,18 @@ void end_attack(uint8_t *attacking) {
 	// Reset the request variable (in case the iteration requested never happened)
 	mysharestruct->sign_requested = 0;
 
+	// End the capture of all the iterations
+	if (capturing) {
+		record_marker(MARKER_END);
+		capturing = 0;
+		handshake_signal_end(mysharestruct, 0);
+	}
+	handshake_signal_state(mysharestruct, VICTIM_DONE);
+
 	if (*attacking == 0) {
 		return;
 	} else if (*attacking == 3) {
-		mysharestruct->bit_of_the_iteration_of_interest = 0;
-		mysharestruct->iteration_of_interest_running = 0;
+		handshake_signal_end(mysharestruct, 0);
 		*attacking = 0;
 
 		// What bit was actually being processed in this iteration?
@@ -174,8 +216,7 @@ void end_attack(uint8_t *attacking) {
 		// fprintf(stderr, "0\n");	// FIXME: uncomment if needed
 
 	} else if (*attacking == 4) {
-		mysharestruct->bit_of_the_iteration_of_interest = 1;
-		mysharestruct->iteration_of_interest_running = 0;
+		handshake_signal_end(mysharestruct, 1);
 		*attacking = 0;
 
 		// What bit was actually being processed in this iteration?
@@ -184,8 +225,7 @@ void end_attack(uint8_t *attacking) {
 		// fprintf(stderr, "1\n");	// FIXME: uncomment if needed
 
 	} else {
-		mysharestruct->bit_of_the_iteration_of_interest = 0;
-		mysharestruct->iteration_of_interest_running = 0;
+		handshake_signal_end(mysharestruct, 0);
 		*attacking = 0;
 
 		// If attacking = 2 (only other option), then it means
@@ -200,3 +240,412 @@ void cryptoloop_print_ground_truth_bit(uint8_t secret_bit) {
 	fprintf(stderr, "%d", secret_bit);
 	fflush(stderr);
 }
+
+//////////////////////////////////////////////////////////////////////
+// Handshake
+//////////////////////////////////////////////////////////////////////
+
+static const char *handshake_names[] = {"auto", "umwait", "futex", "pause"};
+
+// The struct is in a shared file mapping: no FUTEX_PRIVATE_FLAG
+static void futex_wait(volatile int *addr, int value, long timeout_ns)
+{
+	struct timespec timeout = {0, timeout_ns};
+	syscall(SYS_futex, (int *)addr, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+static void futex_wake(volatile int *addr)
+{
+	syscall(SYS_futex, (int *)addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static int has_waitpkg(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		return 0;
+	}
+	return (ecx & CPUID_7_ECX_WAITPKG) != 0;
+}
+
+static inline void umonitor(volatile void *addr)
+{
+	asm volatile("umonitor %0" ::"r"(addr) : "memory");
+}
+
+static inline void umwait(uint64_t deadline)
+{
+	asm volatile("umwait %0" ::"r"(UMWAIT_C01), "a"((uint32_t)deadline), "d"((uint32_t)(deadline >> 32)) : "cc", "memory");
+}
+
+/*
+ * Returns the number of pause instructions that take about
+ * HANDSHAKE_POLL_CYCLES.
+ */
+static uint32_t calibrate_pauses(void)
+{
+	const int n = 10000;
+	uint64_t start = __rdtsc();
+	for (int i = 0; i < n; i++) {
+		_mm_pause();
+	}
+	uint64_t cycles_per_pause = (__rdtsc() - start) / n;
+	uint64_t pauses = cycles_per_pause > 0 ? HANDSHAKE_POLL_CYCLES / cycles_per_pause : HANDSHAKE_POLL_CYCLES;
+	return pauses > 0 ? pauses : 1;
+}
+
+void handshake_init(struct handshake *h, volatile struct sharestruct *share)
+{
+	memset(h, 0, sizeof(*h));
+	h->share = share;
+	h->check_samples = HANDSHAKE_CHECK_SAMPLES;
+	h->check_cycles = HANDSHAKE_CHECK_CYCLES;
+	h->pauses_per_poll = calibrate_pauses();
+	share->waiters = 0;
+
+	const char *env = getenv(HANDSHAKE_ENV);
+	h->strategy = HANDSHAKE_AUTO;
+	if (env != NULL) {
+		for (int i = 0; i < (int)(sizeof(handshake_names) / sizeof(handshake_names[0])); i++) {
+			if (strcmp(env, handshake_names[i]) == 0) {
+				h->strategy = i;
+			}
+		}
+	}
+
+	if (h->strategy == HANDSHAKE_UMWAIT && !has_waitpkg()) {
+		fprintf(stderr, "[handshake] UMWAIT is not supported, using the futex\n");
+		h->strategy = HANDSHAKE_FUTEX;
+	}
+	if (h->strategy == HANDSHAKE_AUTO) {
+		h->strategy = has_waitpkg() ? HANDSHAKE_UMWAIT : HANDSHAKE_FUTEX;
+	}
+}
+
+const char *handshake_name(const struct handshake *h)
+{
+	return handshake_names[h->strategy];
+}
+
+/*
+ * Waits until the flag (a field of the shared struct) differs from value, or
+ * until the TSC deadline. Returns 1 if it changed.
+ */
+static int wait_change(struct handshake *h, volatile int *flag, int value, uint64_t deadline)
+{
+
+	switch (h->strategy) {
+	case HANDSHAKE_UMWAIT:
+		while (*flag == value && __rdtsc() < deadline) {
+			umonitor(flag);
+			if (*flag != value) {
+				break;
+			}
+			umwait(deadline);
+		}
+		break;
+	case HANDSHAKE_FUTEX:
+		// The locked add orders our registration before the check of the flag
+		// (the victim checks waiters after writing the flag)
+		__atomic_add_fetch(&h->share->waiters, 1, __ATOMIC_SEQ_CST);
+		while (*flag == value && __rdtsc() < deadline) {
+			futex_wait(flag, value, FUTEX_SLICE_NS);
+		}
+		__atomic_sub_fetch(&h->share->waiters, 1, __ATOMIC_SEQ_CST);
+		break;
+	default:
+		while (*flag == value && __rdtsc() < deadline) {
+			for (uint32_t i = 0; i < h->pauses_per_poll; i++) {
+				_mm_pause();
+			}
+		}
+		break;
+	}
+	return *flag != value;
+}
+
+/**
+ * Waits for the victim to start the iteration of interest, for at most
+ * timeout_cycles. Returns 1 if it started.
+ */
+int handshake_wait_start(struct handshake *h, uint64_t timeout_cycles)
+{
+	int started = wait_change(h, &h->share->iteration_of_interest_running, 0, __rdtsc() + timeout_cycles);
+	h->next_check = (uint32_t)__rdtsc();
+	return started;
+}
+
+/**
+ * Waits for the victim to end the iteration of interest, for at most
+ * timeout_cycles. Returns 1 if it ended.
+ */
+int handshake_wait_end(struct handshake *h, uint64_t timeout_cycles)
+{
+	return wait_change(h, &h->share->iteration_of_interest_running, 1, __rdtsc() + timeout_cycles);
+}
+
+/**
+ * Returns the number of samples taken before the victim ended the iteration
+ * of interest, given the start TSC (low 32 bits) of each sample.
+ */
+uint32_t handshake_trim(const struct handshake *h, const uint32_t *starts, uint32_t nr_samples)
+{
+	uint32_t end = h->share->iteration_end_tsc;
+	while (nr_samples > 0 && (int32_t)(starts[nr_samples - 1] - end) > 0) {
+		nr_samples--;
+	}
+	return nr_samples;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Pins the calling process to a cpu other than cpu. Returns -1 if there is
+ * none.
+ */
+static int pin_to_other_cpu(int cpu)
+{
+	long nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	for (int other = 0; other < CPU_SETSIZE && other < nr_cpus; other++) {
+		cpu_set_t set;
+		if (other == cpu) {
+			continue;
+		}
+		// Offline cpus are rejected by sched_setaffinity
+		CPU_ZERO(&set);
+		CPU_SET(other, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == 0) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Measures the median time from handshake_signal_start in a helper process
+ * on another cpu to the return of handshake_wait_start with our strategy,
+ * over the given number of rounds. The victim is not involved: the helper
+ * signals on a private copy of the shared struct. Stores the result in
+ * h->wake_latency and returns it (0 if there is no other cpu to run the helper
+ * on).
+ */
+uint64_t handshake_measure_wake_latency(struct handshake *h, int rounds)
+{
+	struct wake_probe {
+		struct sharestruct share;
+		volatile uint64_t signal_tsc;
+		volatile int round;
+		volatile int helper_ready;
+	};
+
+	struct wake_probe *probe = mmap(NULL, PAGE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	uint64_t *latencies = malloc(sizeof(*latencies) * rounds);
+	if (probe == MAP_FAILED || latencies == NULL) {
+		perror("handshake_measure_wake_latency");
+		exit(1);
+	}
+	memset((void *)probe, 0, sizeof(*probe));
+
+	int cpu = sched_getcpu();
+	pid_t helper = fork();
+	if (helper < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (helper == 0) {
+		// Signal each round after a delay, so that the attacker is waiting
+		if (pin_to_other_cpu(cpu) != 0) {
+			probe->helper_ready = -1;
+			_exit(0);
+		}
+		probe->helper_ready = 1;
+		for (int round = 1; round <= rounds; round++) {
+			while (probe->round != round);
+			wait_cycles(WAKE_DELAY_CYCLES);
+			probe->signal_tsc = __rdtsc();
+			handshake_signal_start(&probe->share);
+		}
+		_exit(0);
+	}
+
+	while (probe->helper_ready == 0);
+	h->wake_latency = 0;
+	if (probe->helper_ready > 0) {
+		struct handshake local = *h;
+		local.share = &probe->share;
+		for (int round = 1; round <= rounds; round++) {
+			probe->share.iteration_of_interest_running = 0;
+			probe->round = round;
+			handshake_wait_start(&local, UINT64_MAX / 2);
+			latencies[round - 1] = __rdtsc() - probe->signal_tsc;
+		}
+		qsort(latencies, rounds, sizeof(*latencies), compare_u64);
+		h->wake_latency = latencies[rounds / 2];
+	}
+
+	waitpid(helper, NULL, 0);
+	munmap((void *)probe, PAGE);
+	free(latencies);
+	return h->wake_latency;
+}
+
+/**
+ * Marks the iteration of interest as started, and wakes up the attackers
+ * waiting on the futex.
+ */
+void handshake_signal_start(volatile struct sharestruct *share)
+{
+	share->iteration_of_interest_running = 1;
+	_mm_mfence(); /* The flag has to be visible before we look for waiters */
+	if (share->waiters) {
+		futex_wake(&share->iteration_of_interest_running);
+	}
+}
+
+/**
+ * Publishes the bit of the iteration of interest and its end time, and marks
+ * it as ended.
+ */
+void handshake_signal_end(volatile struct sharestruct *share, uint8_t bit)
+{
+	share->bit_of_the_iteration_of_interest = bit;
+	share->iteration_end_tsc = (uint32_t)__rdtsc();
+	share->iteration_of_interest_running = 0;
+	_mm_mfence();
+	if (share->waiters) {
+		futex_wake(&share->iteration_of_interest_running);
+	}
+}
+
+/**
+ * Publishes the state of the victim, and wakes up the attackers waiting for
+ * it on the futex.
+ */
+void handshake_signal_state(volatile struct sharestruct *share, enum victim_state state)
+{
+	share->victim_state = state;
+	_mm_mfence();
+	if (share->waiters) {
+		futex_wake(&share->victim_state);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Iteration markers
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * Writes the markers of the last capture to filename, one "tsc iteration op"
+ * line per event. Returns the number of events, or -1 if the ring
+ * overflowed (the first events are lost).
+ */
+int marker_ring_write(volatile struct sharestruct *share, const char *filename)
+{
+	volatile struct marker_ring *ring = get_marker_ring(share);
+	uint32_t nr_events = ring->head;
+	if (nr_events > MARKER_RING_EVENTS) {
+		return -1;
+	}
+
+	FILE *f = fopen(filename, "w");
+	if (f == NULL) {
+		perror("fopen markers");
+		exit(1);
+	}
+	for (uint32_t i = 0; i < nr_events; i++) {
+		volatile struct marker *m = &ring->events[i];
+		fprintf(f, "%" PRIu32 " %" PRIu16 " %c\n", m->tsc, m->iteration, m->op);
+	}
+	fclose(f);
+	return nr_events;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Cooldown
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * Starts with the given cooldown (at most COOLDOWN_MAX_CYCLES).
+ */
+void cooldown_init(struct cooldown *c, uint64_t cycles)
+{
+	memset(c, 0, sizeof(*c));
+	c->cycles = cycles < COOLDOWN_MAX_CYCLES ? cycles : COOLDOWN_MAX_CYCLES;
+}
+
+/**
+ * Waits for the victim to be back at its wait loop, for at most
+ * timeout_cycles. Returns 1 if it is.
+ */
+int handshake_wait_idle(struct handshake *h, uint64_t timeout_cycles)
+{
+	uint64_t deadline = __rdtsc() + timeout_cycles;
+	int state;
+	while ((state = h->share->victim_state) != VICTIM_IDLE) {
+		if (!wait_change(h, &h->share->victim_state, state, deadline)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Called at the end of a trace: waits for the victim to be back at its wait
+ * loop and starts the cooldown.
+ */
+void cooldown_start(struct cooldown *c, struct handshake *h)
+{
+	int state = h->share->victim_state;
+	c->tracked = state == VICTIM_IDLE || state == VICTIM_SIGNING || state == VICTIM_DONE;
+	if (c->tracked && !handshake_wait_idle(h, COOLDOWN_IDLE_TIMEOUT_CYCLES)) {
+		fprintf(stderr, "[cooldown] the victim did not return to its wait loop\n");
+		c->tracked = 0;
+	}
+	c->idle_at = __rdtsc();
+}
+
+/**
+ * Called before the next request, once the monitoring sets are re-primed:
+ * waits for the rest of the cooldown.
+ */
+void cooldown_wait(const struct cooldown *c)
+{
+	uint64_t cycles = c->tracked ? c->cycles : COOLDOWN_MAX_CYCLES;
+	while (__rdtsc() - c->idle_at < cycles) {
+		_mm_pause();
+	}
+}
+
+/**
+ * Sets the cooldown to the time the recorded latencies took to settle, and
+ * clears them. Returns the new cooldown.
+ */
+uint64_t cooldown_from_decay(struct cooldown *c)
+{
+	// Baseline: the last quarter of the window
+	const int settled = COOLDOWN_BUCKETS * 3 / 4;
+	uint64_t sum = 0, count = 0;
+	for (int b = settled; b < COOLDOWN_BUCKETS; b++) {
+		sum += c->sums[b];
+		count += c->counts[b];
+	}
+
+	if (count > 0) {
+		double baseline = (double)sum / count;
+		int last_noisy = -1;
+		for (int b = 0; b < settled; b++) {
+			if (c->counts[b] > 0 && (double)c->sums[b] / c->counts[b] > baseline + COOLDOWN_TOLERANCE) {
+				last_noisy = b;
+			}
+		}
+		c->cycles = (uint64_t)(last_noisy + 1) * COOLDOWN_BUCKET_CYCLES;
+	}
+
+	memset(c->sums, 0, sizeof(c->sums));
+	memset(c->counts, 0, sizeof(c->counts));
+	return c->cycles;
+}
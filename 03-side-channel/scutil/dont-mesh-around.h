@@ -36,24 +36,114 @@
 // Should fit in one cache line
 struct sharestruct {
 	volatile int sign_requested; // 4B
-	volatile int iteration_of_interest_running;	 // 4B
+	volatile int iteration_of_interest_running;	 // 4B (also the futex of the handshake)
 	volatile uint8_t bit_of_the_iteration_of_interest;
 	volatile uint8_t use_randomized_key;
+	volatile uint8_t capture_iterations;	// 1B; capture all the iterations from sign_requested on (see marker_ring)
+	volatile int waiters;	// 4B; attackers sleeping on iteration_of_interest_running
+	volatile uint32_t iteration_end_tsc; // 4B; low 32 bits of the TSC when the iteration of interest ended
+	volatile int victim_state; // 4B; enum victim_state (also a futex, see cooldown_start)
+};
+
+/*
+ * Iteration markers.
+ *
+ * With capture_iterations set, the iteration of interest does not end after
+ * one iteration: the victim keeps iteration_of_interest_running set until the
+ * end of the loop, and appends an event to the marker ring for each operation
+ * of each iteration (A: the squaring/doubling each iteration starts with, B:
+ * the multiplication/addition of a 1 bit) and one at the end of the loop. The
+ * attacker records a single trace over all of them and reads the ring after
+ * the trace, so that the trace can be segmented offline (see
+ * split_multi_iteration in orchestrator.py). The ring is on the page after the
+ * shared struct.
+ */
+
+#define MARKER_RING_EVENTS 4096
+
+enum marker_op { MARKER_A = 'A', MARKER_B = 'B', MARKER_END = 'E' };
+
+struct marker {
+	uint32_t tsc;		/* Low 32 bits of the TSC */
+	uint16_t iteration;	/* Iteration of the victim loop (from 1) */
+	uint8_t op;			/* enum marker_op */
+	uint8_t unused;
+};
+
+struct marker_ring {
+	volatile uint32_t head;	/* Events appended since the start of the capture */
+	struct marker events[MARKER_RING_EVENTS];
+};
+
+// Size of the shared file: the struct, and the ring on the next pages
+#define SHARE_SIZE (PAGE + (sizeof(struct marker_ring) + PAGE - 1) / PAGE * PAGE)
+
+// What the victim is doing, published in victim_state
+enum victim_state {
+	VICTIM_UNKNOWN,		// Victims that do not publish their state
+	VICTIM_IDLE,		// Back at its wait loop
+	VICTIM_SIGNING,		// In the decryption/signature (set by prepare_for_attack)
+	VICTIM_DONE,		// Out of the attacked loop (set by end_attack), returning to its wait loop
+};
+
+/*
+ * Handshake between the attacker and the victim.
+ *
+ * The victim signals the start and the end of the iteration of interest with
+ * handshake_signal_start/handshake_signal_end. The attacker waits for them
+ * with one of the strategies below, picked by the environment variable
+ * HANDSHAKE_ENV (auto, umwait, futex or pause):
+ *
+ *  - HANDSHAKE_UMWAIT: UMONITOR/UMWAIT on the line of the shared struct, when
+ *    CPUID reports WAITPKG. The core sleeps in C0.1 and wakes up when the
+ *    victim writes the line.
+ *  - HANDSHAKE_FUTEX: a futex wait on iteration_of_interest_running. The victim
+ *    only makes the wake-up syscall when an attacker is registered in waiters.
+ *  - HANDSHAKE_PAUSE: polls the shared struct every HANDSHAKE_POLL_CYCLES, with
+ *    the number of pause instructions in between calibrated at init.
+ *
+ * Auto uses UMWAIT when available and the futex otherwise.
+ * handshake_measure_wake_latency measures the time from the signal to the
+ * wake-up of the attacker with a helper process on another cpu.
+ *
+ * Reading the shared struct is a coherence transaction on the mesh we are
+ * measuring (our eviction sets keep evicting it from the private caches), so
+ * during a trace the attacker only reads it when handshake_end_due says so:
+ * every check_samples samples or when check_cycles have passed since the last
+ * read. The samples taken after the end of the iteration (iteration_end_tsc)
+ * are then dropped with handshake_trim.
+ */
+
+#define HANDSHAKE_ENV "DMA_HANDSHAKE"
+#define HANDSHAKE_POLL_CYCLES 200		/* Time between two reads of the shared struct with HANDSHAKE_PAUSE */
+#define HANDSHAKE_CHECK_SAMPLES 32		/* Samples between two checks of the end of the iteration */
+#define HANDSHAKE_CHECK_CYCLES 5000		/* Or cycles since the last check, whichever comes first */
+#define HANDSHAKE_WAKE_ROUNDS 64		/* Rounds of handshake_measure_wake_latency */
+
+enum handshake_strategy { HANDSHAKE_AUTO, HANDSHAKE_UMWAIT, HANDSHAKE_FUTEX, HANDSHAKE_PAUSE };
+
+struct handshake {
+	enum handshake_strategy strategy;
+	volatile struct sharestruct *share;
+	uint32_t pauses_per_poll;	/* HANDSHAKE_PAUSE: pause instructions between two polls */
+	uint32_t check_samples;
+	uint32_t check_cycles;
+	uint32_t next_check;		/* TSC (low 32 bits) of the next check of the end */
+	uint64_t wake_latency;		/* Median wake-up latency in cycles (0 if not measured) */
 };
 
 static int createfile(const char *fn)
 {
 	int fd;
 	struct stat sb;
-	char sharebuf[PAGE];
-	if (stat(fn, &sb) != 0 || sb.st_size != PAGE) {
+	if (stat(fn, &sb) != 0 || sb.st_size != SHARE_SIZE) {
 		fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0644);
 		if (fd < 0) {
 			perror("open");
 			fprintf(stderr, "createfile: couldn't create shared file %s\n", fn);
 			exit(1);
 		}
-		if (write(fd, sharebuf, PAGE) != PAGE) {
+		if (ftruncate(fd, SHARE_SIZE) != 0) {
 			fprintf(stderr, "createfile: couldn't write shared file\n");
 			exit(1);
 		}
@@ -72,7 +162,7 @@ static volatile struct sharestruct *get_sharestruct(void)
 {
 	int fd = createfile(SYNCFILE);
 	volatile struct sharestruct *ret;
-	ret = (volatile struct sharestruct *)mmap(NULL, PAGE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FILE, fd, 0);
+	ret = (volatile struct sharestruct *)mmap(NULL, SHARE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FILE, fd, 0);
 	if (ret == MAP_FAILED) {
 		perror("mmap");
 		exit(1);
@@ -80,6 +170,95 @@ static volatile struct sharestruct *get_sharestruct(void)
 	return ret;
 }
 
+static inline volatile struct marker_ring *get_marker_ring(volatile struct sharestruct *share)
+{
+	return (volatile struct marker_ring *)((volatile char *)share + PAGE);
+}
+
+int marker_ring_write(volatile struct sharestruct *share, const char *filename);
+
+// Attacker side of the handshake
+void handshake_init(struct handshake *h, volatile struct sharestruct *share);
+const char *handshake_name(const struct handshake *h);
+int handshake_wait_start(struct handshake *h, uint64_t timeout_cycles);
+int handshake_wait_end(struct handshake *h, uint64_t timeout_cycles);
+uint64_t handshake_measure_wake_latency(struct handshake *h, int rounds);
+uint32_t handshake_trim(const struct handshake *h, const uint32_t *starts, uint32_t nr_samples);
+
+static inline int handshake_running(const struct handshake *h)
+{
+	return h->share->iteration_of_interest_running;
+}
+
+/*
+ * Returns whether the monitoring loop should check the end of the iteration
+ * before the given sample; now is the TSC (low 32 bits) of the last sample.
+ */
+static inline int handshake_end_due(struct handshake *h, uint32_t sample, uint32_t now)
+{
+	if (sample % h->check_samples != 0 && (int32_t)(now - h->next_check) < 0) {
+		return 0;
+	}
+	h->next_check = now + h->check_cycles;
+	return 1;
+}
+
+// Victim side of the handshake
+void handshake_signal_start(volatile struct sharestruct *share);
+void handshake_signal_end(volatile struct sharestruct *share, uint8_t bit);
+void handshake_signal_state(volatile struct sharestruct *share, enum victim_state state);
+
+/*
+ * Cooldown between two traces.
+ *
+ * After a trace, the attacker waits for the victim to be back at its wait
+ * loop (cooldown_start), re-primes its monitoring sets, and then waits until
+ * the noise of the previous run has decayed (cooldown_wait) before it requests
+ * the next one. The time the re-priming takes counts towards the cooldown.
+ *
+ * The cooldown is measured: cooldown_record collects the latencies of the
+ * probes taken after the victim went idle in buckets of
+ * COOLDOWN_BUCKET_CYCLES, and cooldown_from_decay sets the cooldown to the end
+ * of the last bucket whose mean is more than COOLDOWN_TOLERANCE cycles above
+ * the settled baseline (the mean of the last quarter of the window). With a
+ * victim that does not publish its state, the attacker cannot tell when it is
+ * idle and waits COOLDOWN_MAX_CYCLES after each trace, as it used to.
+ */
+
+#define COOLDOWN_MAX_CYCLES 150000000		/* Longest cooldown, and the window of the measurement */
+#define COOLDOWN_BUCKET_CYCLES 1000000		/* Resolution of the measurement */
+#define COOLDOWN_BUCKETS (COOLDOWN_MAX_CYCLES / COOLDOWN_BUCKET_CYCLES)
+#define COOLDOWN_TOLERANCE 2				/* Cycles above the baseline that still count as settled */
+#define COOLDOWN_OUTLIER 1000				/* Latencies above this (interrupts) are not recorded */
+#define COOLDOWN_ROUNDS 8					/* Victim runs the measurement is averaged over */
+#define COOLDOWN_IDLE_TIMEOUT_CYCLES 10000000000UL /* Time given to the victim to return to its wait loop */
+
+struct cooldown {
+	uint64_t cycles;	/* Time from the victim going idle to the next request */
+	uint64_t idle_at;	/* TSC when the victim was last seen idle */
+	int tracked;		/* Whether the victim publishes its state */
+	uint64_t sums[COOLDOWN_BUCKETS];
+	uint32_t counts[COOLDOWN_BUCKETS];
+};
+
+void cooldown_init(struct cooldown *c, uint64_t cycles);
+int handshake_wait_idle(struct handshake *h, uint64_t timeout_cycles);
+void cooldown_start(struct cooldown *c, struct handshake *h);
+void cooldown_wait(const struct cooldown *c);
+uint64_t cooldown_from_decay(struct cooldown *c);
+
+/*
+ * Records the latency of a probe taken at TSC now, after cooldown_start.
+ */
+static inline void cooldown_record(struct cooldown *c, uint64_t now, uint32_t latency)
+{
+	uint64_t bucket = (now - c->idle_at) / COOLDOWN_BUCKET_CYCLES;
+	if (latency <= COOLDOWN_OUTLIER && bucket < COOLDOWN_BUCKETS) {
+		c->sums[bucket] += latency;
+		c->counts[bucket]++;
+	}
+}
+
 // Functions added to sync with the victim
 void prepare_for_attack(uint8_t *attacking);
 void check_attack_iteration(uint8_t *attacking);
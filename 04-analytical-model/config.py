@@ -4,7 +4,17 @@ Analytical model processor configuration
 This file describes the setup of the victim machine. All numbers use slice IDs
 which are converted into the 2D coordinates used in the paper.
 Throughout the code, CHA and slice ID are used synonymously.
+
+The active cores and the die layout are read from the topology and layout
+profiles of this host (see 00-host-profile) when they exist; the defaults
+below are our machine.
 """
+import os
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'util'))
+from host_profile import load_active_cores, load_die_layout
+
 #####################################
 # Contention weights
 #####################################
@@ -22,19 +32,25 @@ ROUNDROBIN_SCORE = 0
 #####################################
 
 # Slice IDs of the fully active cores
-CORES = [0,1,2,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24]
+CORES = load_active_cores([0,1,2,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24])
 # Slice IDs of the LLC slices (all 26 slices are active on our machine)
 SLICES = range(26)
 
 # The physical layout of the slice IDs on the die
 # -1 denotes a tile with no slice ID (IMC or fully-disabled core)
-DIE_LAYOUT = [
+DEFAULT_DIE_LAYOUT = [
     [0, 4, 9, 13, 17, 22],
     [-1, 5, 10, 14, 18, -1],
     [1, 6, 11, 15, 19, 23],
     [2, 7, 12, -1, 20, 24],
     [3, 8, -1, 16, 21, 25]
 ]
+DIE_LAYOUT = load_die_layout(DEFAULT_DIE_LAYOUT)
+
+# The lane scheduling policy below was reverse-engineered on a 5x6 mesh
+if len(DIE_LAYOUT) != len(DEFAULT_DIE_LAYOUT) or len(DIE_LAYOUT[0]) != len(DEFAULT_DIE_LAYOUT[0]):
+    print('Warning: the layout profile of this host is not a 5x6 mesh, using the default die layout')
+    DIE_LAYOUT = DEFAULT_DIE_LAYOUT
 
 #####################################
 # Lane scheduling policy
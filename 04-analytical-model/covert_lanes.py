@@ -0,0 +1,77 @@
+"""
+Selection of transmitter/receiver pairs for a lane-parallel covert channel
+
+The covert channel of covert-channel uses one transmitter (core, slice) and one
+receiver (core, slice). Several channels can run at once if each receiver only
+sees the contention of its own transmitter: a pair is usable if the model
+predicts priority contention from its transmitter on its receiver
+(get_config_contention), and two pairs are independent if neither
+transmitter contends with the receiver of the other pair. The pairs also use
+distinct CHAs (as cores or slices), since the model does not score slice port
+contention.
+
+Running this file prints the pairs as "tx_core tx_slice rx_core rx_slice"
+lines, which is what the lane mode of covert-channel/runner.c takes.
+"""
+import sys
+
+from predict_contention import get_config_contention
+from config import CORES, SLICES
+
+# Most pairs the covert-channel runner runs at once (EXP_MAX_LANES)
+MAX_LANES = 8
+
+
+def pair_score(tx, rx):
+    """Returns the contention the transmitter tx causes on the receiver rx, given as (core, slice)."""
+    return get_config_contention(tx[0], tx[1], rx[0], rx[1])
+
+
+def pairs_independent(a, b):
+    """Returns True if pairs a and b, given as (tx, rx), can run at the same time."""
+    if set(a[0] + a[1]) & set(b[0] + b[1]):
+        return False
+    return pair_score(a[0], b[1]) == 0 and pair_score(b[0], a[1]) == 0
+
+
+def independent_pairs(k, reserved=()):
+    """Picks up to k independent transmitter/receiver pairs.
+
+    reserved is a list of CHAs no pair may use. The pairs with the highest
+    contention scores are taken first, each one if it is independent of the
+    pairs already taken.
+    """
+    placements = [(core, slice_) for core in CORES for slice_ in SLICES
+                  if slice_ != core and core not in reserved and slice_ not in reserved]
+    candidates = []
+    for tx in placements:
+        for rx in placements:
+            if set(tx) & set(rx):
+                continue
+            score = pair_score(tx, rx)
+            if score > 0:
+                candidates.append((score, tx, rx))
+
+    pairs = []
+    for _, tx, rx in sorted(candidates, key=lambda c: (-c[0], c[1], c[2])):
+        if len(pairs) == k:
+            break
+        if all(pairs_independent((tx, rx), p) for p in pairs):
+            pairs.append((tx, rx))
+    return pairs
+
+
+def main():
+    assert len(sys.argv) == 2, "Specify the number of lanes"
+    k = int(sys.argv[1])
+    assert 0 < k <= MAX_LANES, "The number of lanes should be in the range [1, %d]" % MAX_LANES
+
+    pairs = independent_pairs(k)
+    if len(pairs) < k:
+        print('Warning: only found %d independent pairs' % len(pairs), file=sys.stderr)
+    for tx, rx in pairs:
+        print('%d %d %d %d' % (tx + rx))
+
+
+if __name__ == "__main__":
+    main()
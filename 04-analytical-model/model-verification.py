@@ -42,6 +42,7 @@ def analytical_model_verification():
 
 def parse_output(filepath):
     """Parses the output from side-channel/orchestrator.py --analyticalmodelverify
+    (or --analyticalmodelverifyconcurrent)
 
     Returns 4 arrays with the attacker placements tested, the accuracy,
     precision, and recall achieved in each case.
@@ -51,22 +52,31 @@ def parse_output(filepath):
         exit()
     with open(filepath, 'r') as f:
         raw = f.read()
-    
-    # Extract accuracy, precision, and recall values
-    data_pattern = re.compile('accuracy = ([0-9\.]+) precision = ([0-9\.]+) recall = ([0-9\.]+)')
-    matches = data_pattern.findall(raw)
-    accuracy = np.array([float(i[0]) for i in matches])
-    precision = np.array([float(i[1]) for i in matches])
-    recall = np.array([float(i[2]) for i in matches])
-    logging.debug(f'Found {len(matches)} data points in the output.')
-
-    # Extract the core values
-    core_pattern = re.compile('\[.*, \'(.*)\', .*, .*, .*\]')
-    matches = core_pattern.findall(raw)
-    attacker_cores = np.array([int(i) for i in matches])
-    logging.debug(f'Found {len(attacker_cores)} cores in the output.')
-
-    return (attacker_cores, accuracy, precision, recall)
+
+    # Each result follows the placement it was trained on: the monitor command
+    # line (whose first argument is the core) or, for concurrent runs, a
+    # "Placement core:slice" line. The serial baselines of the concurrent runs
+    # are skipped.
+    core_pattern = re.compile(r"\['\./bin/mesh-monitor', '([0-9]+)'|^Placement ([0-9]+):")
+    data_pattern = re.compile(r'accuracy = ([0-9\.]+) precision = ([0-9\.]+) recall = ([0-9\.]+)')
+    cores, accuracy, precision, recall = [], [], [], []
+    core = None
+    for line in raw.splitlines():
+        core_match = core_pattern.search(line)
+        data_match = data_pattern.search(line)
+        if core_match:
+            core = int(core_match.group(1) or core_match.group(2))
+        elif line.startswith('Baseline'):
+            core = None
+        elif data_match and core is not None:
+            cores.append(core)
+            accuracy.append(float(data_match.group(1)))
+            precision.append(float(data_match.group(2)))
+            recall.append(float(data_match.group(3)))
+            core = None
+    logging.debug(f'Found {len(cores)} data points in the output.')
+
+    return (np.array(cores), np.array(accuracy), np.array(precision), np.array(recall))
 
 def make_plot(attacker_cores, rsa_ml_acc, ecdsa_ml_acc, vuln_score_dict):
     """Makes a plot that validates the analytical model.
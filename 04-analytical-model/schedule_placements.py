@@ -0,0 +1,47 @@
+"""
+Scheduling of attacker placements into concurrent experiments
+
+The model verification measures one attacker placement (core, slice) at a
+time. Placements whose mesh paths do not interact can instead be measured at
+the same time on the same socket (e.g. by the multi-vantage monitor of
+side-channel). Two placements interact if one of them would observe contention
+from the traffic of the other according to get_config_contention, or if they
+share a CHA (a core or a slice of one is the core or the slice of the other).
+
+Note that the model does not score round-robin contention: the groups are only
+free of the contention the model predicts, which is why side-channel checks
+them against a serial baseline.
+"""
+from predict_contention import get_config_contention
+
+# Most placements the multi-vantage monitor measures at once (MAX_VANTAGES)
+MAX_CONCURRENT = 8
+
+
+def placements_interact(a, b):
+    """Returns True if placements a and b, given as (core, slice), interact."""
+    if set(a) & set(b):
+        return True
+    return get_config_contention(a[0], a[1], b[0], b[1]) > 0 or get_config_contention(b[0], b[1], a[0], a[1]) > 0
+
+
+def concurrent_groups(placements, max_group=MAX_CONCURRENT, reserved=()):
+    """Splits placements into groups of at most max_group placements that
+    do not interact with each other.
+
+    reserved is a list of CHAs no placement may use (e.g. the victim's core).
+    The placements that interact with the most others are placed first, each
+    one in the first group it fits in.
+    """
+    placements = [p for p in placements if not set(p) & set(reserved)]
+    conflicts = {p: sum(placements_interact(p, q) for q in placements if q != p) for p in placements}
+
+    groups = []
+    for p in sorted(placements, key=lambda p: (-conflicts[p], p)):
+        for group in groups:
+            if len(group) < max_group and not any(placements_interact(p, q) for q in group):
+                group.append(p)
+                break
+        else:
+            groups.append([p])
+    return groups
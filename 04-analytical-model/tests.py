@@ -1,4 +1,12 @@
+import os
+
+# The expected results are those of our machine: point the profile directory
+# somewhere empty so that config.py does not load the profiles of this host
+os.environ['DMA_PROFILE_DIR'] = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'no-profiles')
+
+from covert_lanes import *
 from predict_contention import *
+from schedule_placements import *
 from utils import *
 
 
@@ -30,6 +38,24 @@ if __name__ == '__main__':
     test_function('row-contention-4', is_row_contention, ContentionResult(False, False), f0, f4) # length-zero
     test_function('row-contention-5', is_row_contention, ContentionResult(True, False), f6, f5) # mix core and slice
 
+    ########################################
+    # Scheduling
+    placements = [(1, 25), (2, 1), (7, 1), (9, 15), (13, 6), (17, 10), (18, 11)]
+    groups = concurrent_groups(placements, max_group=3)
+    test_function('schedule-0', placements_interact, True, (2, 1), (7, 1)) # shared slice
+    test_function('schedule-1', lambda: sorted(p for g in groups for p in g), sorted(placements)) # all scheduled once
+    test_function('schedule-2', lambda: any(placements_interact(p, q) for g in groups for p in g for q in g if p != q), False)
+    test_function('schedule-3', lambda: max(len(g) for g in groups) <= 3, True)
+    test_function('schedule-4', concurrent_groups, [], [(1, 0), (0, 5)], 8, (0,)) # reserved CHA
+
+    ########################################
+    # Covert channel lanes
+    lanes = independent_pairs(3)
+    test_function('lanes-0', pairs_independent, False, ((8, 5), (7, 6)), ((9, 5), (10, 11))) # shared slice
+    test_function('lanes-1', len, 3, lanes)
+    test_function('lanes-2', lambda: all(pair_score(tx, rx) > 0 for tx, rx in lanes), True) # each rx sees its tx
+    test_function('lanes-3', lambda: all(pairs_independent(a, b) for a in lanes for b in lanes if a != b), True)
+
 
     ######################################## 
     # Configs
@@ -0,0 +1,207 @@
+/**
+ * cc_frame.c
+ *
+ * Framing and convolutional coding of the covert channel (see cc_frame.h).
+ */
+
+#include "cc_frame.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *fec_names[CC_FECS] = {"none", "conv"};
+
+int cc_fec_parse(const char *name)
+{
+	for (int fec = 0; fec < CC_FECS; fec++) {
+		if (strcmp(name, fec_names[fec]) == 0) {
+			return fec;
+		}
+	}
+	return -1;
+}
+
+uint16_t cc_crc16(const uint8_t *data, size_t len)
+{
+	uint16_t crc = 0xFFFF;
+	for (size_t i = 0; i < len; i++) {
+		crc ^= (uint16_t)data[i] << 8;
+		for (int b = 0; b < 8; b++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+size_t cc_frame_bits(enum cc_fec fec)
+{
+	if (fec == CC_FEC_CONV) {
+		return FRAME_PREAMBLE_BITS + 2 * (FRAME_INFO_BITS + CONV_K - 1);
+	}
+	return FRAME_PREAMBLE_BITS + FRAME_INFO_BITS;
+}
+
+static int parity(unsigned x)
+{
+	return __builtin_parity(x);
+}
+
+/*
+ * Serializes the length, the payload and the CRC of a frame into bytes.
+ */
+static void frame_to_bytes(const struct cc_frame *frame, uint8_t *bytes)
+{
+	bytes[0] = frame->length;
+	memcpy(bytes + 1, frame->payload, FRAME_PAYLOAD);
+	uint16_t crc = cc_crc16(bytes, 1 + FRAME_PAYLOAD);
+	bytes[1 + FRAME_PAYLOAD] = crc >> 8;
+	bytes[2 + FRAME_PAYLOAD] = crc & 0xFF;
+}
+
+static int get_bit(const uint8_t *bytes, size_t i)
+{
+	return (bytes[i / 8] >> (7 - i % 8)) & 1;
+}
+
+void cc_frame_encode(const struct cc_frame *frame, enum cc_fec fec, char *bits)
+{
+	uint8_t bytes[FRAME_INFO_BITS / 8];
+	frame_to_bytes(frame, bytes);
+
+	size_t n = 0;
+	for (int i = FRAME_PREAMBLE_BITS - 1; i >= 0; i--) {
+		bits[n++] = '0' + ((FRAME_PREAMBLE >> i) & 1);
+	}
+
+	if (fec == CC_FEC_NONE) {
+		for (size_t i = 0; i < FRAME_INFO_BITS; i++) {
+			bits[n++] = '0' + get_bit(bytes, i);
+		}
+		return;
+	}
+
+	// Shift the info bits and then the tail through the encoder
+	unsigned reg = 0;
+	for (size_t i = 0; i < FRAME_INFO_BITS + CONV_K - 1; i++) {
+		int bit = i < FRAME_INFO_BITS ? get_bit(bytes, i) : 0;
+		reg = ((reg << 1) | bit) & ((1 << CONV_K) - 1);
+		bits[n++] = '0' + parity(reg & CONV_G1);
+		bits[n++] = '0' + parity(reg & CONV_G2);
+	}
+}
+
+/*
+ * Soft-decision Viterbi decoding of the info bits of a frame. The branch
+ * metric is the distance between the soft values and the encoder outputs,
+ * and the path is traced back from state 0, where the tail leaves the encoder.
+ */
+static void viterbi_decode(const float *soft, uint8_t *bytes)
+{
+	enum { STEPS = FRAME_INFO_BITS + CONV_K - 1 };
+	static uint8_t decisions[STEPS][CONV_STATES];
+	float metrics[CONV_STATES], next[CONV_STATES];
+
+	for (int s = 0; s < CONV_STATES; s++) {
+		metrics[s] = s == 0 ? 0 : INFINITY;
+	}
+
+	for (int t = 0; t < STEPS; t++) {
+		for (int s = 0; s < CONV_STATES; s++) {
+			next[s] = INFINITY;
+		}
+		for (int s = 0; s < CONV_STATES; s++) {
+			if (isinf(metrics[s])) {
+				continue;
+			}
+			for (int bit = 0; bit < 2; bit++) {
+				unsigned reg = (s << 1) | bit;
+				int ns = reg & (CONV_STATES - 1);
+				float metric = metrics[s] + fabsf(parity(reg & CONV_G1) - soft[2 * t]) +
+							   fabsf(parity(reg & CONV_G2) - soft[2 * t + 1]);
+				if (metric < next[ns]) {
+					next[ns] = metric;
+					decisions[t][ns] = s >> (CONV_K - 2);	// The bit that leaves the register
+				}
+			}
+		}
+		memcpy(metrics, next, sizeof(metrics));
+	}
+
+	memset(bytes, 0, FRAME_INFO_BITS / 8);
+	int s = 0;
+	for (int t = STEPS - 1; t >= 0; t--) {
+		if (t < FRAME_INFO_BITS && (s & 1)) {
+			bytes[t / 8] |= 1 << (7 - t % 8);
+		}
+		s = (s >> 1) | (decisions[t][s] << (CONV_K - 2));
+	}
+}
+
+int cc_frame_decode(const float *soft, enum cc_fec fec, struct cc_frame *frame)
+{
+	uint8_t bytes[FRAME_INFO_BITS / 8];
+	if (fec == CC_FEC_CONV) {
+		viterbi_decode(soft, bytes);
+	} else {
+		memset(bytes, 0, sizeof(bytes));
+		for (size_t i = 0; i < FRAME_INFO_BITS; i++) {
+			if (soft[i] >= 0.5f) {
+				bytes[i / 8] |= 1 << (7 - i % 8);
+			}
+		}
+	}
+
+	uint16_t crc = cc_crc16(bytes, 1 + FRAME_PAYLOAD);
+	if ((bytes[1 + FRAME_PAYLOAD] << 8 | bytes[2 + FRAME_PAYLOAD]) != crc || bytes[0] > FRAME_PAYLOAD) {
+		return -1;
+	}
+	frame->length = bytes[0];
+	memcpy(frame->payload, bytes + 1, FRAME_PAYLOAD);
+	return 0;
+}
+
+long cc_frame_find(const float *soft, size_t n, size_t from)
+{
+	for (size_t i = from; i + FRAME_PREAMBLE_BITS <= n; i++) {
+		int errors = 0;
+		for (int b = 0; b < FRAME_PREAMBLE_BITS && errors <= FRAME_SYNC_ERRORS; b++) {
+			int expected = (FRAME_PREAMBLE >> (FRAME_PREAMBLE_BITS - 1 - b)) & 1;
+			errors += (soft[i + b] >= 0.5f) != expected;
+		}
+		if (errors <= FRAME_SYNC_ERRORS) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+char *cc_frame_stream(const char *pattern, enum cc_fec fec)
+{
+	size_t len = strlen(pattern);
+	size_t frame_bits = 8 * FRAME_PAYLOAD;
+	size_t frames = (len + frame_bits - 1) / frame_bits;
+	char *stream = malloc(frames * cc_frame_bits(fec) + 1);
+	if (stream == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	// Pack the pattern into the payloads, the last frame partly filled
+	for (size_t f = 0; f < frames; f++) {
+		struct cc_frame frame;
+		memset(&frame, 0, sizeof(frame));
+		size_t first = f * frame_bits;
+		size_t bits = len - first < frame_bits ? len - first : frame_bits;
+		frame.length = (bits + 7) / 8;
+		for (size_t i = 0; i < bits; i++) {
+			if (pattern[first + i] == '1') {
+				frame.payload[i / 8] |= 1 << (7 - i % 8);
+			}
+		}
+		cc_frame_encode(&frame, fec, stream + f * cc_frame_bits(fec));
+	}
+	stream[frames * cc_frame_bits(fec)] = '\0';
+	return stream;
+}
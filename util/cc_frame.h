@@ -0,0 +1,76 @@
+/**
+ * cc_frame.h
+ *
+ * Framing and forward error correction for the covert channel.
+ *
+ * The transmitter sends its payload in frames of a fixed size on the wire:
+ *
+ *   preamble (32 bits) | length (8 bits) | payload (FRAME_PAYLOAD bytes) | CRC-16 (16 bits)
+ *
+ * The length is the number of payload bytes in use (the rest is padding), and
+ * the CRC (CRC-16/CCITT-FALSE) covers the length and the whole payload field.
+ * Everything after the preamble is protected by the selected FEC:
+ *
+ * - CC_FEC_NONE sends it as is.
+ * - CC_FEC_CONV encodes it with the rate 1/2, constraint length 7
+ *   convolutional code (generators 171 and 133 in octal) followed by the 6
+ *   zero bits that bring the encoder back to state 0, and the receiver decodes
+ *   it with a soft-decision Viterbi decoder.
+ *
+ * The preamble is never encoded, so that the receiver can find the frames in
+ * the stream before decoding them. Bits are sent MSB first, and channel bits
+ * are passed around as '0'/'1' characters (as the pattern of the transmitter)
+ * or as soft values in [0, 1], where 0.5 means that nothing is known.
+ */
+
+#ifndef CC_FRAME_H_
+#define CC_FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FRAME_PREAMBLE 0x1ACFFC1DU	/* CCSDS attached sync marker */
+#define FRAME_PREAMBLE_BITS 32
+#define FRAME_SYNC_ERRORS 3			/* Preamble bits that may be flipped in a match */
+#define FRAME_PAYLOAD 16			/* Payload field size in bytes */
+#define FRAME_INFO_BITS (8 * (1 + FRAME_PAYLOAD + 2))
+
+#define CONV_K 7
+#define CONV_STATES (1 << (CONV_K - 1))
+#define CONV_G1 0171
+#define CONV_G2 0133
+
+enum cc_fec { CC_FEC_NONE, CC_FEC_CONV, CC_FECS };
+
+struct cc_frame {
+	uint8_t length;
+	uint8_t payload[FRAME_PAYLOAD];
+};
+
+// Parses "none" or "conv"; returns -1 otherwise
+int cc_fec_parse(const char *name);
+
+uint16_t cc_crc16(const uint8_t *data, size_t len);
+
+// Channel bits of a frame, preamble included
+size_t cc_frame_bits(enum cc_fec fec);
+
+// Writes the channel bits of a frame to bits ('0'/'1', not terminated)
+void cc_frame_encode(const struct cc_frame *frame, enum cc_fec fec, char *bits);
+
+/*
+ * Decodes the channel bits of a frame that follow its preamble. Returns 0 and
+ * fills in frame if its CRC matches, -1 otherwise.
+ */
+int cc_frame_decode(const float *soft, enum cc_fec fec, struct cc_frame *frame);
+
+// Returns the position of the first preamble at or after from in soft, or -1
+long cc_frame_find(const float *soft, size_t n, size_t from);
+
+/*
+ * Returns the channel bits of the frames that carry the bits of pattern (a
+ * '0'/'1' string), as a string to free.
+ */
+char *cc_frame_stream(const char *pattern, enum cc_fec fec);
+
+#endif // CC_FRAME_H_
@@ -0,0 +1,225 @@
+/**
+ * exp_sync.c
+ *
+ * Setup lock, start barrier and stop flag of an experiment (see exp_sync.h).
+ */
+
+#include "exp_sync.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+static const char *role_names[EXP_ROLES] = {"Tx", "Rx"};
+
+// The mapping is shared between processes: no FUTEX_PRIVATE_FLAG
+static void futex_wait(uint32_t *addr, uint32_t val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr, int nr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, nr, NULL, NULL, 0);
+}
+
+static void check_abort(struct exp_sync *s)
+{
+	if (s->shared->abort) {
+		fprintf(stderr, "%s: the runner aborted the experiment\n", role_names[s->role]);
+		exit(1);
+	}
+}
+
+static sem_t *open_sem(const char *name)
+{
+	sem_t *sem = sem_open(name, 0);
+	if (sem == SEM_FAILED) {
+		perror(name);
+		exit(1);
+	}
+	return sem;
+}
+
+/**
+ * Attaches to the runner's shared mapping if there is one, and opens the
+ * named semaphores otherwise.
+ */
+void exp_sync_open(struct exp_sync *s, enum exp_role role)
+{
+	memset(s, 0, sizeof(*s));
+	s->role = role;
+	s->lanes = 1;
+
+	const char *fd_str = getenv(EXP_SYNC_FD_ENV);
+	if (fd_str == NULL) {
+		s->setup_sem = open_sem("setup_sem");
+		s->tx_ready = open_sem("tx_ready");
+		s->rx_ready = open_sem("rx_ready");
+		return;
+	}
+
+	int fd = atoi(fd_str);
+	s->shared = mmap(NULL, sizeof(*s->shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (s->shared == MAP_FAILED) {
+		perror("mmap " EXP_SYNC_FD_ENV);
+		exit(1);
+	}
+	close(fd);
+
+	s->lanes = s->shared->lanes;
+	const char *lane_str = getenv(EXP_SYNC_LANE_ENV);
+	if (lane_str != NULL) {
+		s->lane = atoi(lane_str);
+	}
+	if (s->lane >= s->lanes) {
+		fprintf(stderr, "%s: wrong lane %" PRIu32 " of %" PRIu32 "\n", role_names[role], s->lane, s->lanes);
+		exit(1);
+	}
+}
+
+/**
+ * Takes the setup lock (the transmitter and the receiver do not build their
+ * sets at the same time).
+ */
+void exp_sync_setup_begin(struct exp_sync *s)
+{
+	if (s->shared == NULL) {
+		sem_wait(s->setup_sem);
+		return;
+	}
+	while (__atomic_exchange_n(&s->shared->setup_lock, 1, __ATOMIC_ACQUIRE) != 0) {
+		check_abort(s);
+		futex_wait(&s->shared->setup_lock, 1);
+	}
+	check_abort(s);
+}
+
+void exp_sync_setup_end(struct exp_sync *s)
+{
+	if (s->shared == NULL) {
+		sem_post(s->setup_sem);
+		return;
+	}
+	__atomic_store_n(&s->shared->setup_lock, 0, __ATOMIC_RELEASE);
+	futex_wake(&s->shared->setup_lock, 1);
+}
+
+/**
+ * Waits until both sides are ready to start.
+ */
+void exp_sync_barrier(struct exp_sync *s)
+{
+	if (s->shared == NULL) {
+		// Signal to the other side that we are ready
+		sem_post(s->role == EXP_TX ? s->tx_ready : s->rx_ready);
+		sem_wait(s->role == EXP_TX ? s->rx_ready : s->tx_ready);
+		return;
+	}
+
+	// The runner sets the abort flag before it opens the barrier, so a
+	// generation loaded after the abort comes with the flag set
+	struct exp_shared *sh = s->shared;
+	uint32_t generation = __atomic_load_n(&sh->generation, __ATOMIC_ACQUIRE);
+	check_abort(s);
+	if (__atomic_add_fetch(&sh->arrived, 1, __ATOMIC_ACQ_REL) == sh->parties) {
+		__atomic_store_n(&sh->arrived, 0, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&sh->generation, 1, __ATOMIC_RELEASE);
+		futex_wake(&sh->generation, INT_MAX);
+	} else {
+		while (__atomic_load_n(&sh->generation, __ATOMIC_ACQUIRE) == generation) {
+			futex_wait(&sh->generation, generation);
+		}
+	}
+	check_abort(s);
+	sh->results[s->lane][s->role].start = __rdtsc();
+}
+
+/**
+ * Reports the result of this side to the runner (nothing without a runner).
+ */
+void exp_sync_report(struct exp_sync *s, uint64_t count, uint32_t gaps)
+{
+	if (s->shared == NULL) {
+		return;
+	}
+	struct exp_result *r = &s->shared->results[s->lane][s->role];
+	r->count = count;
+	r->gaps = gaps;
+	__atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+}
+
+void exp_sync_close(struct exp_sync *s)
+{
+	if (s->shared != NULL) {
+		munmap(s->shared, sizeof(*s->shared));
+		s->shared = NULL;
+		return;
+	}
+	sem_close(s->setup_sem);
+	sem_close(s->tx_ready);
+	sem_close(s->rx_ready);
+}
+
+/**
+ * Creates the shared mapping in a memfd, which the children inherit through
+ * exec (fd is the descriptor to pass them in EXP_SYNC_FD_ENV).
+ */
+struct exp_shared *exp_shared_create(int *fd)
+{
+	*fd = memfd_create("exp_sync", 0);
+	if (*fd < 0) {
+		perror("memfd_create");
+		exit(1);
+	}
+	if (ftruncate(*fd, sizeof(struct exp_shared)) != 0) {
+		perror("ftruncate");
+		exit(1);
+	}
+	struct exp_shared *sh = mmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+	if (sh == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	return sh;
+}
+
+/**
+ * Prepares the mapping for a new experiment with the given number of lanes
+ * (a transmitter and a receiver each at the barrier).
+ */
+void exp_shared_reset(struct exp_shared *sh, uint32_t lanes)
+{
+	uint32_t generation = sh->generation;
+	memset(sh, 0, sizeof(*sh));
+	sh->generation = generation;
+	sh->parties = lanes * EXP_ROLES;
+	sh->lanes = lanes;
+}
+
+void exp_shared_stop(struct exp_shared *sh)
+{
+	sh->stop = 1;
+}
+
+/**
+ * Makes the children give up at their next wait, including those already
+ * waiting for the setup lock or at the barrier.
+ */
+void exp_shared_abort(struct exp_shared *sh)
+{
+	sh->abort = 1;
+	sh->stop = 1;
+	__atomic_store_n(&sh->setup_lock, 0, __ATOMIC_RELEASE);
+	futex_wake(&sh->setup_lock, INT_MAX);
+	__atomic_add_fetch(&sh->generation, 1, __ATOMIC_RELEASE);
+	futex_wake(&sh->generation, INT_MAX);
+}
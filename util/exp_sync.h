@@ -0,0 +1,90 @@
+/**
+ * exp_sync.h
+ *
+ * Synchronization of the transmitter and the receiver of an experiment.
+ *
+ * Standalone, the two programs use the named POSIX semaphores created by
+ * setup-sem (setup_sem serializes their setup, tx_ready and rx_ready form the
+ * start barrier), and the transmitter runs until it is killed.
+ *
+ * When they are started by a runner (02-covert-channel/runner.c), they instead
+ * share a struct exp_shared with it: the runner creates it in a memfd, and the
+ * children find the descriptor in the environment variable EXP_SYNC_FD_ENV.
+ * The setup lock and the start barrier are futexes in that mapping, the
+ * children report their results there, and the runner stops the transmitter
+ * by setting the stop flag, which the transmitter checks once per bit
+ * (exp_sync_stopped). Nothing is left behind when the processes exit, so there
+ * are no stale semaphores. If a child dies, the runner sets the abort flag and
+ * the other one gives up at its next wait instead of blocking forever.
+ *
+ * A runner can also run several transmitter/receiver pairs (lanes) at once:
+ * each child finds its lane in EXP_SYNC_LANE_ENV, all of them meet at the same
+ * barrier, and each lane reports in its own results. A transmitter sends its
+ * share of the payload (every lanes-th symbol from its lane on).
+ */
+
+#ifndef EXP_SYNC_H_
+#define EXP_SYNC_H_
+
+#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define EXP_SYNC_FD_ENV "DMA_EXP_FD"
+#define EXP_SYNC_LANE_ENV "DMA_EXP_LANE"
+#define EXP_MAX_LANES 8
+
+enum exp_role { EXP_TX, EXP_RX, EXP_ROLES };
+
+struct exp_result {
+	uint64_t count;		/* Bits sent (tx) or samples taken (rx) */
+	uint32_t gaps;		/* Gaps detected (rx) */
+	uint32_t done;		/* Set when the result is reported */
+	uint64_t start;		/* TSC when the child left the start barrier */
+};
+
+struct exp_shared {
+	uint32_t setup_lock;	/* Futex: 0 when free */
+	uint32_t arrived;		/* Children waiting at the start barrier */
+	uint32_t generation;	/* Futex: bumped when the barrier opens */
+	uint32_t parties;		/* Children that have to reach the barrier */
+	uint32_t lanes;			/* Transmitter/receiver pairs */
+	volatile uint32_t stop;	/* Set by the runner to stop the transmitter */
+	volatile uint32_t abort; /* Set by the runner when a child died */
+	struct exp_result results[EXP_MAX_LANES][EXP_ROLES];
+};
+
+struct exp_sync {
+	enum exp_role role;
+	uint32_t lane;				/* Lane of this child, out of lanes (0 of 1 without a runner) */
+	uint32_t lanes;
+	struct exp_shared *shared;	/* NULL when using the named semaphores */
+	sem_t *setup_sem;
+	sem_t *tx_ready;
+	sem_t *rx_ready;
+};
+
+// Children (transmitters and receivers)
+void exp_sync_open(struct exp_sync *s, enum exp_role role);
+void exp_sync_setup_begin(struct exp_sync *s);
+void exp_sync_setup_end(struct exp_sync *s);
+void exp_sync_barrier(struct exp_sync *s);
+void exp_sync_report(struct exp_sync *s, uint64_t count, uint32_t gaps);
+void exp_sync_close(struct exp_sync *s);
+
+/*
+ * Returns whether the runner asked the transmitter to stop (never without a
+ * runner).
+ */
+static inline int exp_sync_stopped(const struct exp_sync *s)
+{
+	return s->shared != NULL && s->shared->stop;
+}
+
+// Runner
+struct exp_shared *exp_shared_create(int *fd);
+void exp_shared_reset(struct exp_shared *sh, uint32_t lanes);
+void exp_shared_stop(struct exp_shared *sh);
+void exp_shared_abort(struct exp_shared *sh);
+
+#endif // EXP_SYNC_H_
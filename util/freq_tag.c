@@ -0,0 +1,343 @@
+/**
+ * freq_tag.c
+ *
+ * Core and uncore frequency tagging of sample blocks (see freq_tag.h).
+ */
+
+#include "freq_tag.h"
+#include "pmon_reg_defs.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#define UCLK_MASK 0xFFFFFFFFFFFFUL /* The U-box fixed counter is 48 bits wide */
+#define TSC_CALIBRATION_NS 20000000L
+
+/*
+ * Returns the TSC rate, measured against CLOCK_MONOTONIC_RAW.
+ */
+static uint64_t measure_tsc_khz(void)
+{
+	struct timespec start, end, wait = {0, TSC_CALIBRATION_NS};
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+	uint64_t tsc_start = __rdtsc();
+	nanosleep(&wait, NULL);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+	uint64_t tsc_end = __rdtsc();
+	uint64_t ns = (end.tv_sec - start.tv_sec) * 1000000000UL + end.tv_nsec - start.tv_nsec;
+	return (tsc_end - tsc_start) * 1000000UL / ns;
+}
+
+static int perf_open(uint64_t config, int group_fd)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+
+	// Count for this thread on whatever CPU it runs on
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/*
+ * Maps the perf page of an event for rdpmc. Returns NULL if rdpmc is not
+ * allowed.
+ */
+static struct perf_event_mmap_page *perf_map(int fd)
+{
+	struct perf_event_mmap_page *page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+	if (page == MAP_FAILED) {
+		return NULL;
+	}
+	if (!page->cap_user_rdpmc) {
+		munmap(page, sysconf(_SC_PAGESIZE));
+		return NULL;
+	}
+	return page;
+}
+
+/*
+ * Reads the count of a perf event with rdpmc (see perf_event_open(2)).
+ * Returns 0 if the event is not scheduled.
+ */
+static uint64_t perf_rdpmc(struct perf_event_mmap_page *page)
+{
+	uint32_t seq, index;
+	uint64_t count;
+	do {
+		seq = page->lock;
+		asm volatile("" ::: "memory");
+		index = page->index;
+		count = page->offset;
+		if (index != 0) {
+			uint16_t width = page->pmc_width;
+			int64_t pmc = __rdpmc(index - 1);
+			pmc <<= 64 - width;
+			pmc >>= 64 - width;
+			count += pmc;
+		} else {
+			count = 0;
+		}
+		asm volatile("" ::: "memory");
+	} while (page->lock != seq);
+	return count;
+}
+
+/**
+ * Sets up the frequency counters of the calling thread, which runs on cpu:
+ * APERF, MPERF and the uncore clock through the MSR transport if it is
+ * available, the perf core and reference cycles otherwise.
+ * Returns the backend selected (FREQ_NONE if neither works).
+ */
+int freq_tag_init(struct freq_tag *f, int cpu)
+{
+	memset(f, 0, sizeof(*f));
+	f->perf_fd = -1;
+	f->perf_ref_fd = -1;
+	f->tsc_khz = measure_tsc_khz();
+
+	// The perf cycle counters are used for the blocks inside a trace
+	// (read with rdpmc) with either backend
+	f->perf_fd = perf_open(PERF_COUNT_HW_CPU_CYCLES, -1);
+	if (f->perf_fd >= 0) {
+		f->perf_ref_fd = perf_open(PERF_COUNT_HW_REF_CPU_CYCLES, f->perf_fd);
+	}
+	if (f->perf_ref_fd >= 0) {
+		f->perf_page = perf_map(f->perf_fd);
+		f->perf_ref_page = perf_map(f->perf_ref_fd);
+		if (f->perf_page == NULL || f->perf_ref_page == NULL) {
+			fprintf(stderr, "[freq_tag] rdpmc not available, the traces are tagged as a whole\n");
+		}
+	}
+
+	if (msr_transport_available(cpu)) {
+		f->backend = FREQ_MSR;
+		f->transport = malloc(sizeof(*f->transport));
+		f->batch = malloc(sizeof(*f->batch));
+		if (f->transport == NULL || f->batch == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		msr_transport_open(f->transport, cpu, MSR_BACKEND_AUTO);
+		msr_batch_init(f->batch, f->transport);
+
+		// Enable the uncore clock counter (pmon_mux_start does the same)
+		msr_batch_write(f->batch, U_MSR_PMON_UCLK_FIXED_CTL, 1UL << PMON_CTL_en);
+		msr_batch_submit(f->batch);
+		return f->backend;
+	}
+
+	if (f->perf_fd < 0 || f->perf_ref_fd < 0) {
+		fprintf(stderr, "[freq_tag] no MSR access and no perf cycle counters (%s), frequencies are not tagged\n",
+				strerror(errno));
+		freq_tag_close(f);
+		return f->backend;
+	}
+	f->backend = FREQ_PERF;
+	return f->backend;
+}
+
+void freq_tag_close(struct freq_tag *f)
+{
+	if (f->transport != NULL) {
+		msr_transport_close(f->transport);
+		free(f->transport);
+		free(f->batch);
+	}
+	if (f->perf_page != NULL) {
+		munmap(f->perf_page, sysconf(_SC_PAGESIZE));
+	}
+	if (f->perf_ref_page != NULL) {
+		munmap(f->perf_ref_page, sysconf(_SC_PAGESIZE));
+	}
+	if (f->perf_ref_fd >= 0) {
+		close(f->perf_ref_fd);
+	}
+	if (f->perf_fd >= 0) {
+		close(f->perf_fd);
+	}
+	f->transport = NULL;
+	f->batch = NULL;
+	f->perf_page = NULL;
+	f->perf_ref_page = NULL;
+	f->perf_fd = -1;
+	f->perf_ref_fd = -1;
+	f->backend = FREQ_NONE;
+}
+
+const char *freq_tag_name(const struct freq_tag *f)
+{
+	switch (f->backend) {
+	case FREQ_MSR:
+		return "aperf-mperf-uclk";
+	case FREQ_PERF:
+		return "perf-cycles";
+	default:
+		return "none";
+	}
+}
+
+/**
+ * Reads the counters.
+ */
+void freq_tag_read(struct freq_tag *f, struct freq_counters *c)
+{
+	memset(c, 0, sizeof(*c));
+	if (f->backend == FREQ_MSR) {
+		msr_batch_read(f->batch, MSR_IA32_APERF, ~0UL, &c->aperf);
+		msr_batch_read(f->batch, MSR_IA32_MPERF, ~0UL, &c->mperf);
+		msr_batch_read(f->batch, U_MSR_PMON_UCLK_FIXED_CTR, UCLK_MASK, &c->uclk);
+		c->tsc = __rdtsc();
+		msr_batch_submit(f->batch);
+	} else if (f->backend == FREQ_PERF) {
+		uint64_t values[3]; /* Number of events, then their counts */
+		c->tsc = __rdtsc();
+		if (read(f->perf_fd, values, sizeof(values)) == sizeof(values)) {
+			c->aperf = values[1];
+			c->mperf = values[2];
+		}
+	} else {
+		c->tsc = __rdtsc();
+	}
+	if (f->perf_page != NULL && f->perf_ref_page != NULL) {
+		c->cycles = perf_rdpmc(f->perf_page);
+		c->ref_cycles = perf_rdpmc(f->perf_ref_page);
+	}
+}
+
+/**
+ * Reads the TSC and the perf cycle counters with rdpmc only (no syscall).
+ * The other counters are left at 0.
+ */
+void freq_tag_read_rdpmc(struct freq_tag *f, struct freq_counters *c)
+{
+	memset(c, 0, sizeof(*c));
+	c->tsc = __rdtsc();
+	if (f->perf_page != NULL && f->perf_ref_page != NULL) {
+		c->cycles = perf_rdpmc(f->perf_page);
+		c->ref_cycles = perf_rdpmc(f->perf_ref_page);
+	}
+}
+
+/**
+ * Computes the average core and uncore frequencies (0 if unknown) between two
+ * readings.
+ */
+void freq_tag_between(const struct freq_tag *f, const struct freq_counters *from, const struct freq_counters *to,
+					  uint32_t *core_mhz, uint32_t *uncore_mhz)
+{
+	uint64_t tsc = to->tsc - from->tsc, aperf = to->aperf - from->aperf, mperf = to->mperf - from->mperf;
+	uint64_t uclk = (to->uclk - from->uclk) & UCLK_MASK;
+	*core_mhz = mperf > 0 ? (uint32_t)((double)f->tsc_khz * aperf / mperf / 1000) : 0;
+	*uncore_mhz = f->backend == FREQ_MSR && tsc > 0 && uclk > 0 ? (uint32_t)((double)f->tsc_khz * uclk / tsc / 1000) : 0;
+}
+
+/*
+ * Returns the average core frequency between two rdpmc readings (0 if
+ * unknown).
+ */
+static uint32_t rdpmc_core_mhz(const struct freq_tag *f, const struct freq_counters *from,
+							   const struct freq_counters *to)
+{
+	uint64_t cycles = to->cycles - from->cycles, ref_cycles = to->ref_cycles - from->ref_cycles;
+	return ref_cycles > 0 ? (uint32_t)((double)f->tsc_khz * cycles / ref_cycles / 1000) : 0;
+}
+
+/**
+ * Starts tagging a trace from its sample 0.
+ */
+void freq_log_start(struct freq_log *log, struct freq_tag *f)
+{
+	log->tag = f;
+	log->first = 0;
+	log->nr_blocks = 0;
+	freq_tag_read(f, &log->start);
+	log->prev = log->start;
+}
+
+/*
+ * Closes the open block at sample end (excluded) with the counters now.
+ */
+static void close_block(struct freq_log *log, uint32_t end, const struct freq_counters *now, uint32_t core_mhz)
+{
+	struct freq_block *block = &log->blocks[log->nr_blocks++];
+	block->first = log->first;
+	block->last = end - 1;
+	block->core_mhz = core_mhz;
+	log->first = end;
+	log->prev = *now;
+}
+
+/**
+ * Ends the open block before the given sample and starts a new one, reading
+ * the counters with rdpmc only (nothing without rdpmc). When the log is full,
+ * the last block is left open until freq_log_finish.
+ */
+void freq_log_mark(struct freq_log *log, uint32_t sample)
+{
+	if (log->tag->backend == FREQ_NONE || log->tag->perf_page == NULL || log->tag->perf_ref_page == NULL ||
+		sample <= log->first || log->nr_blocks >= FREQ_MAX_BLOCKS - 1) {
+		return;
+	}
+	struct freq_counters now;
+	freq_tag_read_rdpmc(log->tag, &now);
+	close_block(log, sample, &now, rdpmc_core_mhz(log->tag, &log->prev, &now));
+}
+
+/**
+ * Closes the last block at the end of the trace (nr_samples samples), and
+ * sets the uncore frequency of all the blocks to the average over the trace.
+ */
+void freq_log_finish(struct freq_log *log, uint32_t nr_samples)
+{
+	if (log->tag->backend == FREQ_NONE || nr_samples <= log->first) {
+		return;
+	}
+	struct freq_counters now;
+	uint32_t core_mhz, uncore_mhz;
+	freq_tag_read(log->tag, &now);
+	freq_tag_between(log->tag, &log->start, &now, &core_mhz, &uncore_mhz);
+	if (log->nr_blocks > 0) {
+		core_mhz = rdpmc_core_mhz(log->tag, &log->prev, &now);
+	}
+	close_block(log, nr_samples, &now, core_mhz);
+	for (uint32_t i = 0; i < log->nr_blocks; i++) {
+		log->blocks[i].uncore_mhz = uncore_mhz;
+	}
+}
+
+/**
+ * Writes the blocks to filename (nothing without a frequency backend).
+ */
+void freq_log_write(const struct freq_log *log, const char *filename)
+{
+	if (log->tag->backend == FREQ_NONE) {
+		return;
+	}
+	FILE *f = fopen(filename, "w");
+	if (f == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	fprintf(f, "# first last core_mhz uncore_mhz (%s, TSC at %" PRIu64 " kHz)\n", freq_tag_name(log->tag),
+			log->tag->tsc_khz);
+	fprintf(f, "# clock %s\n", log->tag->clock == FREQ_CLOCK_CORE ? "core" : "tsc");
+	for (uint32_t i = 0; i < log->nr_blocks; i++) {
+		const struct freq_block *b = &log->blocks[i];
+		fprintf(f, "%" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 "\n", b->first, b->last, b->core_mhz, b->uncore_mhz);
+	}
+	fclose(f);
+}
@@ -0,0 +1,118 @@
+/**
+ * freq_tag.h
+ *
+ * Tagging of the probe samples with the core and uncore frequencies they
+ * were taken at.
+ *
+ * The latencies are measured in TSC cycles, which tick at a constant rate.
+ * Without the performance governor, with turbo and without a pinned uncore
+ * ratio (see setup.sh), the same load takes a varying number of TSC cycles and
+ * fixed latency thresholds stop working. The probe loops call freq_log_mark
+ * every FREQ_BLOCK_SAMPLES samples; each block of samples is tagged with
+ *
+ *  - the core frequency: TSC rate x delta APERF / delta MPERF (MPERF ticks at
+ *    the TSC rate, APERF at the actual clock, both only while the core runs),
+ *  - the uncore (mesh) frequency: TSC rate x delta UCLK / delta TSC, where UCLK
+ *    is the U-box fixed counter (the clock of CMS_CLOCKTICKS, without using a
+ *    CHA counter).
+ *
+ * The counters are read through the MSR transport (msr_transport.h) when it
+ * is available. Otherwise (e.g., an unprivileged monitor) the core frequency
+ * comes from the perf core cycles and reference cycles of the thread, which
+ * count like APERF and MPERF, and the uncore frequency is unknown (0). The
+ * blocks are written next to the trace (<trace>.freq, one "first last core_mhz
+ * uncore_mhz" line per block), and util/freq_tag.py normalizes the latencies
+ * to the frequencies of the latency profile (core_mhz and uncore_mhz, written
+ * by calibrate-latency).
+ *
+ * Only freq_log_start and freq_log_finish, at the trace boundaries, take
+ * syscalls. freq_log_mark reads the perf core and reference cycles with
+ * rdpmc, which takes a few dozen cycles and leaves no gap in the trace; the
+ * uncore frequency of the blocks it closes is the average over the trace. If
+ * rdpmc is not available, freq_log_mark does nothing and the whole trace is
+ * one block.
+ *
+ * The uncore frequency is therefore not tagged per block: all the blocks of a
+ * trace carry the same uncore frequency, and a change of the uncore ratio in
+ * the middle of a trace is only corrected on average (the samples before and
+ * after it are rescaled by the same factor). Traces taken with an unpinned
+ * uncore ratio keep that error; the decoders can drop the blocks that ran too
+ * far from the reference frequencies instead of rescaling them (see
+ * util/freq_tag.py), which catches the core frequency of each block but only
+ * the average uncore frequency of the trace.
+ *
+ * The latencies are in TSC cycles unless the caller sets clock to
+ * FREQ_CLOCK_CORE (loads timed with the core cycle counter, see timing.h);
+ * the clock is written in the header of the .freq file.
+ */
+
+#ifndef FREQ_TAG_H_
+#define FREQ_TAG_H_
+
+#include <stdint.h>
+#include <linux/perf_event.h>
+
+#include "msr_transport.h"
+
+#define FREQ_BLOCK_SAMPLES 1024	 /* Samples per tagged block */
+#define FREQ_MAX_BLOCKS 2048	 /* Blocks logged per trace (2M samples); later samples extend the last block */
+#define FREQ_SUFFIX ".freq"
+
+#define MSR_IA32_MPERF 0xe7
+#define MSR_IA32_APERF 0xe8
+
+enum freq_backend { FREQ_NONE, FREQ_MSR, FREQ_PERF };
+
+enum freq_clock { FREQ_CLOCK_TSC, FREQ_CLOCK_CORE };
+
+struct freq_counters {
+	uint64_t tsc;
+	uint64_t aperf;	/* Or core cycles with FREQ_PERF */
+	uint64_t mperf;	/* Or reference cycles with FREQ_PERF */
+	uint64_t uclk;	/* 0 with FREQ_PERF */
+	uint64_t cycles;	/* perf core cycles read with rdpmc (0 without rdpmc) */
+	uint64_t ref_cycles;	/* perf reference cycles read with rdpmc (0 without rdpmc) */
+};
+
+struct freq_tag {
+	enum freq_backend backend;
+	uint64_t tsc_khz;	/* Measured by freq_tag_init */
+	struct msr_transport *transport;
+	struct msr_batch *batch;
+	int perf_fd;		/* Group leader (core cycles), -1 if perf is not available */
+	int perf_ref_fd;
+	struct perf_event_mmap_page *perf_page;		/* rdpmc pages, NULL without rdpmc */
+	struct perf_event_mmap_page *perf_ref_page;
+	enum freq_clock clock;	/* Clock the latencies are measured in (FREQ_CLOCK_TSC by default) */
+};
+
+struct freq_block {
+	uint32_t first;		/* First sample of the block */
+	uint32_t last;		/* Last sample of the block */
+	uint32_t core_mhz;	/* 0 if unknown */
+	uint32_t uncore_mhz;	/* 0 if unknown */
+};
+
+struct freq_log {
+	struct freq_tag *tag;
+	struct freq_counters start;	/* At the start of the trace */
+	struct freq_counters prev;
+	uint32_t first;		/* First sample of the open block */
+	uint32_t nr_blocks;
+	struct freq_block blocks[FREQ_MAX_BLOCKS];
+};
+
+int freq_tag_init(struct freq_tag *f, int cpu);
+void freq_tag_close(struct freq_tag *f);
+const char *freq_tag_name(const struct freq_tag *f);
+void freq_tag_read(struct freq_tag *f, struct freq_counters *c);
+void freq_tag_read_rdpmc(struct freq_tag *f, struct freq_counters *c);
+void freq_tag_between(const struct freq_tag *f, const struct freq_counters *from, const struct freq_counters *to,
+					  uint32_t *core_mhz, uint32_t *uncore_mhz);
+
+void freq_log_start(struct freq_log *log, struct freq_tag *f);
+void freq_log_mark(struct freq_log *log, uint32_t sample);
+void freq_log_finish(struct freq_log *log, uint32_t nr_samples);
+void freq_log_write(const struct freq_log *log, const char *filename);
+
+#endif // FREQ_TAG_H_
@@ -0,0 +1,129 @@
+"""
+Readers for the .freq files written next to the monitor traces, and the
+normalization of the latencies to the frequencies of the latency profile.
+
+Each line of a .freq file is "<first> <last> <core_mhz> <uncore_mhz>": the
+samples first..last (inclusive) of the trace were taken at these average
+frequencies (0 when unknown). Lines starting with '#' are comments, except
+"# clock <tsc|core>", the clock the latencies were measured in. This mirrors
+util/freq_tag.c.
+
+A latency is partly spent in the core clock domain (the L1/L2 lookups and the
+way to the mesh) and partly in the uncore domain (the mesh and the LLC slice).
+With a share core_share of the latency spent in the core at the reference
+frequencies, a sample taken at (core, uncore) is divided by
+
+    core_share * ref_core / core + (1 - core_share) * ref_uncore / uncore
+
+if it is in TSC cycles, and by
+
+    core_share + (1 - core_share) * (core / ref_core) / (uncore / ref_uncore)
+
+if it is in core cycles (the core part then does not depend on the core
+frequency), to get the latency it would have had at the reference
+frequencies, i.e., the frequencies the thresholds of the latency profile were
+calibrated at. An unknown frequency is assumed to be at its reference.
+
+calibrate-latency measures core_share by changing the uncore frequency and
+writes it to the latency profile (core_share_pct); CORE_SHARE is the default
+when it could not.
+
+The core frequency is tagged per block, but the uncore frequency of all the
+blocks of a trace is its average over the trace (see util/freq_tag.h), so a
+change of the uncore frequency during a trace is only corrected on average.
+Instead of rescaling them, the decoders can drop the samples of the blocks
+whose frequencies are too far from the reference (reference_mask); for the
+uncore, this only checks the average of the trace.
+"""
+from host_profile import LATENCY, load_host_profile
+
+FREQ_SUFFIX = '.freq'
+CORE_SHARE = 0.5
+
+# Our machine with the frequencies pinned by setup.sh (no turbo, uncore ratio 22)
+DEFAULT_CORE_MHZ = 2200
+DEFAULT_UNCORE_MHZ = 2200
+
+
+def load_freq(trace_path):
+    """Return the (first, last, core_mhz, uncore_mhz) blocks of trace_path (empty if none)."""
+    blocks = []
+    try:
+        with open(trace_path + FREQ_SUFFIX) as f:
+            for line in f:
+                parts = line.split()
+                if len(parts) != 4 or parts[0].startswith('#'):
+                    continue
+                blocks.append(tuple(int(x) for x in parts))
+    except FileNotFoundError:
+        pass
+    return blocks
+
+
+def load_freq_clock(trace_path):
+    """Return the clock the latencies of trace_path are in ('tsc' or 'core')."""
+    try:
+        with open(trace_path + FREQ_SUFFIX) as f:
+            for line in f:
+                parts = line.split()
+                if parts[:2] == ['#', 'clock'] and len(parts) == 3:
+                    return parts[2]
+    except FileNotFoundError:
+        pass
+    return 'tsc'
+
+
+def reference_mhz():
+    """Return the (core, uncore) frequencies the latency profile was calibrated at."""
+    profile = load_host_profile(LATENCY, {'core_mhz': DEFAULT_CORE_MHZ, 'uncore_mhz': DEFAULT_UNCORE_MHZ})
+    return profile['core_mhz'], profile['uncore_mhz']
+
+
+def load_core_share():
+    """Return the share of the latency spent in the core clock domain at the
+    reference frequencies."""
+    profile = load_host_profile(LATENCY, {'core_share_pct': round(CORE_SHARE * 100)})
+    return profile['core_share_pct'] / 100
+
+
+def scale_factors(trace_path, num_samples, reference=None, core_share=None):
+    """Return a list of num_samples factors to divide the samples by (1 for untagged samples)."""
+    ref_core, ref_uncore = reference if reference is not None else reference_mhz()
+    if core_share is None:
+        core_share = load_core_share()
+    core_clock = load_freq_clock(trace_path) == 'core'
+    factors = [1.0] * num_samples
+    for first, last, core, uncore in load_freq(trace_path):
+        core_ratio = core / ref_core if core > 0 else 1
+        uncore_ratio = uncore / ref_uncore if uncore > 0 else 1
+        if core_clock:
+            factor = core_share + (1 - core_share) * core_ratio / uncore_ratio
+        else:
+            factor = core_share / core_ratio + (1 - core_share) / uncore_ratio
+        for i in range(first, min(last + 1, num_samples)):
+            factors[i] = factor
+    return factors
+
+
+def normalize(trace, trace_path, reference=None, core_share=None):
+    """Return the samples of trace_path rescaled to the reference frequencies
+    (trace itself if it has no .freq file)."""
+    if not load_freq(trace_path):
+        return trace
+    factors = scale_factors(trace_path, len(trace), reference, core_share)
+    return [t / f for t, f in zip(trace, factors)]
+
+
+def reference_mask(trace_path, num_samples, tolerance, reference=None):
+    """Return a list of num_samples booleans, False for the samples of the blocks
+    whose core or uncore frequency is more than tolerance (a fraction) away
+    from the reference (unknown frequencies and untagged samples are kept)."""
+    ref_core, ref_uncore = reference if reference is not None else reference_mhz()
+    mask = [True] * num_samples
+    for first, last, core, uncore in load_freq(trace_path):
+        off_core = core > 0 and abs(core / ref_core - 1) > tolerance
+        off_uncore = uncore > 0 and abs(uncore / ref_uncore - 1) > tolerance
+        if off_core or off_uncore:
+            for i in range(first, min(last + 1, num_samples)):
+                mask[i] = False
+    return mask
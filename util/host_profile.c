@@ -0,0 +1,246 @@
+/**
+ * host_profile.c
+ *
+ * Reading and writing of the per-host profiles (see host_profile.h).
+ */
+
+#include "host_profile.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Writes the path of the profile called name for this host into path.
+ * Returns 0 on success and -1 if the path does not fit.
+ */
+int host_profile_path(const char *name, char *path, size_t len)
+{
+	char hostname[64];
+	const char *dir = getenv(HOST_PROFILE_ENV);
+	if (dir == NULL || dir[0] == '\0') {
+		dir = HOST_PROFILE_DIR;
+	}
+
+	if (gethostname(hostname, sizeof(hostname)) != 0) {
+		strcpy(hostname, "localhost");
+	}
+	hostname[sizeof(hostname) - 1] = '\0';
+
+	int n = snprintf(path, len, "%s/%s/%s", dir, hostname, name);
+	return (n < 0 || (size_t)n >= len) ? -1 : 0;
+}
+
+/**
+ * Opens the profile called name for this host with the given fopen mode.
+ * When opening for writing, the host directory is created if needed.
+ * Returns NULL if the profile cannot be opened.
+ */
+FILE *host_profile_open(const char *name, const char *mode)
+{
+	char path[HOST_PROFILE_MAX_PATH];
+	if (host_profile_path(name, path, sizeof(path)) != 0) {
+		fprintf(stderr, "[ERROR] host profile path too long for %s\n", name);
+		return NULL;
+	}
+
+	if (mode[0] == 'w' || mode[0] == 'a') {
+		// Create every directory along the way (mkdir -p)
+		for (char *p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+			*p = '\0';
+			if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+				fprintf(stderr, "[ERROR] cannot create %s: %s\n", path, strerror(errno));
+				return NULL;
+			}
+			*p = '/';
+		}
+	}
+
+	return fopen(path, mode);
+}
+
+/**
+ * Looks up key in the profile called name.
+ * Returns 0 and stores the value on success, -1 if the profile or key is missing.
+ */
+int host_profile_get_int(const char *name, const char *key, int *value)
+{
+	FILE *f = host_profile_open(name, "r");
+	if (f == NULL) {
+		return -1;
+	}
+
+	char line[256], line_key[128];
+	int line_value, found = -1;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == '#') {
+			continue;
+		}
+		if (sscanf(line, "%127s %d", line_key, &line_value) == 2 && strcmp(line_key, key) == 0) {
+			*value = line_value;
+			found = 0;
+			break;
+		}
+	}
+
+	fclose(f);
+	return found;
+}
+
+/**
+ * Same as host_profile_get_int, but returns fallback if the key is missing.
+ */
+int host_profile_get_int_or(const char *name, const char *key, int fallback)
+{
+	int value;
+	if (host_profile_get_int(name, key, &value) != 0) {
+		return fallback;
+	}
+	return value;
+}
+
+/**
+ * Sets key to value in the profile called name, replacing the line of the key
+ * if there is one and appending it otherwise (the profile is created if it
+ * does not exist). The other lines are kept.
+ * Returns 0 on success and -1 if the profile cannot be written.
+ */
+int host_profile_set_int(const char *name, const char *key, int value)
+{
+	char path[HOST_PROFILE_MAX_PATH], tmp_path[HOST_PROFILE_MAX_PATH + 4];
+	if (host_profile_path(name, path, sizeof(path)) != 0) {
+		fprintf(stderr, "[ERROR] host profile path too long for %s\n", name);
+		return -1;
+	}
+	sprintf(tmp_path, "%s.tmp", path);
+
+	// Create the directories (and the profile) if needed
+	FILE *out = host_profile_open(name, "a");
+	if (out == NULL) {
+		return -1;
+	}
+	fclose(out);
+
+	FILE *in = fopen(path, "r");
+	out = fopen(tmp_path, "w");
+	if (in == NULL || out == NULL) {
+		if (in != NULL) {
+			fclose(in);
+		}
+		if (out != NULL) {
+			fclose(out);
+		}
+		return -1;
+	}
+
+	// Copy the profile, replacing the line of the key
+	char line[256], line_key[128];
+	int found = 0;
+	while (fgets(line, sizeof(line), in) != NULL) {
+		if (line[0] != '#' && sscanf(line, "%127s", line_key) == 1 && strcmp(line_key, key) == 0) {
+			if (!found) {
+				fprintf(out, "%s %d\n", key, value);
+				found = 1;
+			}
+			continue;
+		}
+		fputs(line, out);
+	}
+	if (!found) {
+		fprintf(out, "%s %d\n", key, value);
+	}
+	fclose(in);
+	fclose(out);
+
+	// Replace the profile at once, so that readers never see half of it
+	if (rename(tmp_path, path) != 0) {
+		fprintf(stderr, "[ERROR] cannot write %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Opens a new version of the profile called name for writing. The profile is
+ * only replaced by host_profile_commit.
+ * Returns NULL if it cannot be created.
+ */
+FILE *host_profile_begin(const char *name)
+{
+	char path[HOST_PROFILE_MAX_PATH], tmp_path[HOST_PROFILE_MAX_PATH + 4];
+	if (host_profile_path(name, path, sizeof(path)) != 0) {
+		fprintf(stderr, "[ERROR] host profile path too long for %s\n", name);
+		return NULL;
+	}
+	sprintf(tmp_path, "%s.tmp", path);
+
+	// Create the directories if needed
+	FILE *f = host_profile_open(name, "a");
+	if (f == NULL) {
+		return NULL;
+	}
+	fclose(f);
+	return fopen(tmp_path, "w+");
+}
+
+/*
+ * Returns whether key is one of the NULL-terminated keys (none if NULL).
+ */
+static int key_listed(const char *key, const char *const *keys)
+{
+	for (; keys != NULL && *keys != NULL; keys++) {
+		if (strcmp(key, *keys) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Replaces the profile called name with the new version f (from
+ * host_profile_begin), and closes f. The keys of the old profile that f does
+ * not set are appended to it, except those in drop_keys (NULL-terminated, or
+ * NULL), so that the keys other tools store in the same profile survive.
+ * Returns 0 on success and -1 if the profile cannot be written.
+ */
+int host_profile_commit(const char *name, FILE *f, const char *const *drop_keys)
+{
+	char path[HOST_PROFILE_MAX_PATH], tmp_path[HOST_PROFILE_MAX_PATH + 4];
+	if (host_profile_path(name, path, sizeof(path)) != 0) {
+		fclose(f);
+		return -1;
+	}
+	sprintf(tmp_path, "%s.tmp", path);
+
+	FILE *in = fopen(path, "r");
+	char line[256], line_key[128], new_line[256], new_key[128];
+	while (in != NULL && fgets(line, sizeof(line), in) != NULL) {
+		if (line[0] == '#' || sscanf(line, "%127s", line_key) != 1 || key_listed(line_key, drop_keys)) {
+			continue;
+		}
+
+		// Keep the line if the new version does not set its key
+		int found = 0;
+		rewind(f);
+		while (!found && fgets(new_line, sizeof(new_line), f) != NULL) {
+			found = new_line[0] != '#' && sscanf(new_line, "%127s", new_key) == 1 && strcmp(new_key, line_key) == 0;
+		}
+		fseek(f, 0, SEEK_END);
+		if (!found) {
+			fputs(line, f);
+		}
+	}
+	if (in != NULL) {
+		fclose(in);
+	}
+	fclose(f);
+
+	// Replace the profile at once, so that readers never see half of it
+	if (rename(tmp_path, path) != 0) {
+		fprintf(stderr, "[ERROR] cannot write %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
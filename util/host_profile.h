@@ -0,0 +1,38 @@
+/**
+ * host_profile.h
+ *
+ * Per-host profiles written by the tools in 00-host-profile and read by the
+ * experiments. A profile is a plain text file of "<key> <value>" lines (lines
+ * starting with '#' are comments) stored in <profile dir>/<hostname>/<name>.
+ *
+ * The profile directory defaults to HOST_PROFILE_DIR (relative to the
+ * experiment directories) and can be overridden with the environment variable
+ * named by HOST_PROFILE_ENV.
+ */
+
+#ifndef HOST_PROFILE_H_
+#define HOST_PROFILE_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define HOST_PROFILE_DIR "../profiles"
+#define HOST_PROFILE_ENV "DMA_PROFILE_DIR"
+#define HOST_PROFILE_MAX_PATH 256
+
+// Names of the profiles written by the calibration tools
+#define HOST_PROFILE_LATENCY "latency"
+#define HOST_PROFILE_TIMING "timing"
+#define HOST_PROFILE_TOPOLOGY "topology"
+#define HOST_PROFILE_LAYOUT "layout"
+#define HOST_PROFILE_BASELINE "baseline"
+
+int host_profile_path(const char *name, char *path, size_t len);
+FILE *host_profile_open(const char *name, const char *mode);
+int host_profile_get_int(const char *name, const char *key, int *value);
+int host_profile_get_int_or(const char *name, const char *key, int fallback);
+int host_profile_set_int(const char *name, const char *key, int value);
+FILE *host_profile_begin(const char *name);
+int host_profile_commit(const char *name, FILE *f, const char *const *drop_keys);
+
+#endif // HOST_PROFILE_H_
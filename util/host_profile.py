@@ -0,0 +1,83 @@
+"""
+Per-host profiles written by the tools in 00-host-profile.
+
+A profile is a plain text file of "<key> <value>" lines stored in
+<profile dir>/<hostname>/<name>. This mirrors util/host_profile.c.
+"""
+import os
+import socket
+
+HOST_PROFILE_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'profiles')
+HOST_PROFILE_ENV = 'DMA_PROFILE_DIR'
+
+LATENCY = 'latency'
+TIMING = 'timing'
+TOPOLOGY = 'topology'
+LAYOUT = 'layout'
+BASELINE = 'baseline'
+
+
+def host_profile_path(name):
+    """Return the path of the profile called name for this host."""
+    profile_dir = os.environ.get(HOST_PROFILE_ENV) or HOST_PROFILE_DIR
+    return os.path.join(profile_dir, socket.gethostname(), name)
+
+
+def load_host_profile(name, defaults=None):
+    """Load the profile called name into a dict of ints.
+
+    Keys missing from the profile (or all keys, if the profile does not exist)
+    are taken from defaults.
+    """
+    profile = dict(defaults or {})
+    try:
+        with open(host_profile_path(name)) as f:
+            for line in f:
+                parts = line.split()
+                if len(parts) != 2 or parts[0].startswith('#'):
+                    continue
+                profile[parts[0]] = int(parts[1])
+    except FileNotFoundError:
+        pass
+    return profile
+
+
+def write_host_profile(name, values, comment=None):
+    """Write a dict of ints as the profile called name for this host."""
+    path = host_profile_path(name)
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, 'w') as f:
+        if comment:
+            f.write('# {}\n'.format(comment))
+        for key, value in values.items():
+            f.write('{} {}\n'.format(key, value))
+    return path
+
+
+def load_die_layout(default):
+    """Return the die layout of this host as rows of CHA IDs (-1 for tiles
+    without a CHA), from the layout profile written by
+    00-host-profile/infer-layout.py, or default if there is none.
+    """
+    profile = load_host_profile(LAYOUT)
+    if 'rows' not in profile or 'cols' not in profile:
+        return default
+    layout = [[-1] * profile['cols'] for _ in range(profile['rows'])]
+    cha = 0
+    while 'cha_{}_row'.format(cha) in profile:
+        row, col = profile['cha_{}_row'.format(cha)], profile['cha_{}_col'.format(cha)]
+        if row >= 0 and col >= 0:
+            layout[row][col] = cha
+        cha += 1
+    return layout
+
+
+def load_active_cores(default):
+    """Return the CHA IDs of the tiles with an active core, from the topology
+    profile written by 00-host-profile/bin/discover-topology, or default if
+    there is none.
+    """
+    profile = load_host_profile(TOPOLOGY)
+    cores = sorted(int(key.split('_')[1]) for key, value in profile.items()
+                   if key.startswith('cha_') and key.endswith('_cpu') and value >= 0)
+    return cores or default
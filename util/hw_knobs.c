@@ -0,0 +1,210 @@
+/**
+ * hw_knobs.c
+ *
+ * Save, set and restore the prefetcher and uncore frequency MSRs (see
+ * hw_knobs.h).
+ */
+
+#include "hw_knobs.h"
+#include "msr_transport.h"
+#include "topology.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct saved_knob {
+	int saved;
+	uint64_t value;
+};
+
+// A transport per cpu, opened the first time one of its MSRs is accessed
+static struct msr_transport *transports[TOPOLOGY_MAX_CPUS];
+static struct msr_batch batch;
+static struct msr_batch restore_batch; /* Used by the signal handlers */
+
+static struct saved_knob prefetch[TOPOLOGY_MAX_CPUS];
+static struct saved_knob uncore[NUM_SOCKET];
+static int uncore_cpu[NUM_SOCKET]; /* cpu through which the MSR of each socket was saved */
+static int handlers_installed = 0;
+
+static const int restore_signals[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV};
+
+/*
+ * Returns the socket of an online cpu, or -1 if the cpu is offline or does
+ * not exist.
+ */
+static int cpu_socket(int cpu)
+{
+	char path[128];
+	int socket;
+	if (cpu < 0 || cpu >= TOPOLOGY_MAX_CPUS) {
+		return -1;
+	}
+	sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return -1;
+	}
+	int ok = fscanf(f, "%d", &socket) == 1;
+	fclose(f);
+	return ok && socket >= 0 && socket < NUM_SOCKET ? socket : -1;
+}
+
+static struct msr_transport *transport(int cpu)
+{
+	if (transports[cpu] == NULL) {
+		transports[cpu] = malloc(sizeof(*transports[cpu]));
+		if (transports[cpu] == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		msr_transport_open(transports[cpu], cpu, MSR_BACKEND_AUTO);
+	}
+	return transports[cpu];
+}
+
+static uint64_t read_msr(int cpu, uint32_t msr)
+{
+	uint64_t value;
+	msr_batch_init(&batch, transport(cpu));
+	msr_batch_read(&batch, msr, ~0UL, &value);
+	msr_batch_submit(&batch);
+	return value;
+}
+
+static void write_msr(struct msr_batch *b, int cpu, uint32_t msr, uint64_t value)
+{
+	msr_batch_init(b, transport(cpu));
+	msr_batch_write(b, msr, value);
+	msr_batch_submit(b);
+}
+
+static void handle_signal(int sig)
+{
+	hw_knobs_restore();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+/*
+ * Registers the restore at exit and on the termination and crash signals
+ * whose disposition is the default (a handler of the caller is kept, and the
+ * restore then runs when it exits).
+ */
+static void install_handlers(void)
+{
+	if (handlers_installed) {
+		return;
+	}
+	atexit(hw_knobs_restore);
+	for (unsigned int i = 0; i < sizeof(restore_signals) / sizeof(restore_signals[0]); i++) {
+		struct sigaction old, action = {0};
+		if (sigaction(restore_signals[i], NULL, &old) == 0 && old.sa_handler == SIG_DFL) {
+			action.sa_handler = handle_signal;
+			sigemptyset(&action.sa_mask);
+			sigaction(restore_signals[i], &action, NULL);
+		}
+	}
+	handlers_installed = 1;
+}
+
+/**
+ * Writes disable_bits (PREFETCH_*_DISABLE) to MSR_MISC_FEATURE_CONTROL of a
+ * cpu, after saving its value the first time.
+ * Returns 0, or -1 if the cpu is offline.
+ */
+int hw_knobs_set_prefetch(int cpu, uint64_t disable_bits)
+{
+	if (cpu_socket(cpu) < 0) {
+		fprintf(stderr, "[hw_knobs] cpu %d is offline\n", cpu);
+		return -1;
+	}
+	install_handlers();
+	if (!prefetch[cpu].saved) {
+		prefetch[cpu].value = read_msr(cpu, MSR_MISC_FEATURE_CONTROL);
+		prefetch[cpu].saved = 1;
+	}
+	write_msr(&batch, cpu, MSR_MISC_FEATURE_CONTROL, disable_bits);
+	return 0;
+}
+
+/**
+ * Sets the prefetchers of every online cpu, as wrmsr -a 0x1a4 does.
+ * Returns the number of cpus set.
+ */
+int hw_knobs_set_prefetch_all(uint64_t disable_bits)
+{
+	int n = 0;
+	for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++) {
+		if (cpu_socket(cpu) >= 0 && hw_knobs_set_prefetch(cpu, disable_bits) == 0) {
+			n++;
+		}
+	}
+	return n;
+}
+
+/**
+ * Returns the current value of MSR_MISC_FEATURE_CONTROL of a cpu.
+ */
+uint64_t hw_knobs_get_prefetch(int cpu)
+{
+	return read_msr(cpu, MSR_MISC_FEATURE_CONTROL);
+}
+
+/**
+ * Bounds the uncore frequency of the socket of cpu to [min_ratio, max_ratio]
+ * x 100 MHz (min_ratio = max_ratio pins it), after saving the range of the
+ * socket the first time.
+ * Returns 0, or -1 if the cpu is offline or the ratios are invalid.
+ */
+int hw_knobs_set_uncore_ratio(int cpu, int min_ratio, int max_ratio)
+{
+	int socket = cpu_socket(cpu);
+	if (socket < 0) {
+		fprintf(stderr, "[hw_knobs] cpu %d is offline\n", cpu);
+		return -1;
+	}
+	if (min_ratio <= 0 || max_ratio < min_ratio || (uint64_t)max_ratio > UNCORE_RATIO_MASK) {
+		fprintf(stderr, "[hw_knobs] invalid uncore ratio range %d-%d\n", min_ratio, max_ratio);
+		return -1;
+	}
+	install_handlers();
+	if (!uncore[socket].saved) {
+		uncore[socket].value = read_msr(cpu, MSR_UNCORE_RATIO_LIMIT);
+		uncore[socket].saved = 1;
+		uncore_cpu[socket] = cpu;
+	}
+	uint64_t value = read_msr(cpu, MSR_UNCORE_RATIO_LIMIT);
+	value &= ~((UNCORE_RATIO_MASK << UNCORE_RATIO_MIN_SHIFT) | (UNCORE_RATIO_MASK << UNCORE_RATIO_MAX_SHIFT));
+	value |= ((uint64_t)min_ratio << UNCORE_RATIO_MIN_SHIFT) | ((uint64_t)max_ratio << UNCORE_RATIO_MAX_SHIFT);
+	write_msr(&batch, cpu, MSR_UNCORE_RATIO_LIMIT, value);
+	return 0;
+}
+
+/**
+ * Returns the current value of MSR_UNCORE_RATIO_LIMIT of the socket of cpu.
+ */
+uint64_t hw_knobs_get_uncore_ratio(int cpu)
+{
+	return read_msr(cpu, MSR_UNCORE_RATIO_LIMIT);
+}
+
+/**
+ * Writes back every saved value. Later sets save the values again.
+ */
+void hw_knobs_restore(void)
+{
+	for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++) {
+		if (prefetch[cpu].saved) {
+			prefetch[cpu].saved = 0;
+			write_msr(&restore_batch, cpu, MSR_MISC_FEATURE_CONTROL, prefetch[cpu].value);
+		}
+	}
+	for (int socket = 0; socket < NUM_SOCKET; socket++) {
+		if (uncore[socket].saved) {
+			uncore[socket].saved = 0;
+			write_msr(&restore_batch, uncore_cpu[socket], MSR_UNCORE_RATIO_LIMIT, uncore[socket].value);
+		}
+	}
+}
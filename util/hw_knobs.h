@@ -0,0 +1,53 @@
+/**
+ * hw_knobs.h
+ *
+ * In-process control of the hardware prefetchers and of the uncore frequency,
+ * the two knobs setup.sh and cleanup.sh set with wrmsr for the whole machine.
+ *
+ *  - MSR 0x1a4 (MISC_FEATURE_CONTROL) disables the L2 and L1 (DCU)
+ *    prefetchers of a core. It is per core: setup.sh writes 15 on every cpu,
+ *    setup-prefetch-on.sh and cleanup.sh write 0.
+ *  - MSR 0x620 (UNCORE_RATIO_LIMIT) bounds the uncore (mesh) frequency of a
+ *    socket, in multiples of 100 MHz: the minimum ratio in bits 14:8 and the
+ *    maximum in bits 6:0. setup.sh pins it to 2.2 GHz (0x1616), cleanup.sh
+ *    restores the default range (0xc18).
+ *
+ * The first time a knob of a cpu or socket is set, its current value is
+ * saved; hw_knobs_restore writes back every saved value. The restore is
+ * registered with atexit and run from the handlers of the usual termination
+ * and crash signals (which then re-raise the signal), so a sweep that varies
+ * the knobs leaves the machine as it found it. A SIGKILL cannot be caught:
+ * cleanup.sh stays the fallback.
+ *
+ * The registers are accessed through the MSR transport (msr_transport.h), so
+ * DMA_MSR_BACKEND applies; with msr-safe, both MSRs have to be in its
+ * allowlist.
+ */
+
+#ifndef HW_KNOBS_H_
+#define HW_KNOBS_H_
+
+#include <stdint.h>
+
+#define MSR_MISC_FEATURE_CONTROL 0x1a4
+#define MSR_UNCORE_RATIO_LIMIT 0x620
+
+// Bits of MSR_MISC_FEATURE_CONTROL that disable each prefetcher
+#define PREFETCH_L2_HW_DISABLE (1UL << 0)		/* L2 hardware (streamer) prefetcher */
+#define PREFETCH_L2_ADJACENT_DISABLE (1UL << 1) /* L2 adjacent cache line prefetcher */
+#define PREFETCH_DCU_DISABLE (1UL << 2)			/* L1 data (DCU) next-line prefetcher */
+#define PREFETCH_DCU_IP_DISABLE (1UL << 3)		/* L1 data (DCU) IP prefetcher */
+#define PREFETCH_ALL_DISABLE 0xfUL				/* What setup.sh writes */
+
+#define UNCORE_RATIO_MAX_SHIFT 0
+#define UNCORE_RATIO_MIN_SHIFT 8
+#define UNCORE_RATIO_MASK 0x7fUL
+
+int hw_knobs_set_prefetch(int cpu, uint64_t disable_bits);
+int hw_knobs_set_prefetch_all(uint64_t disable_bits);
+uint64_t hw_knobs_get_prefetch(int cpu);
+int hw_knobs_set_uncore_ratio(int cpu, int min_ratio, int max_ratio);
+uint64_t hw_knobs_get_uncore_ratio(int cpu);
+void hw_knobs_restore(void);
+
+#endif // HW_KNOBS_H_
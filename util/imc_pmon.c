@@ -0,0 +1,304 @@
+/**
+ * imc_pmon.c
+ *
+ * IMC CAS and M2M read/write counters (see imc_pmon.h).
+ */
+
+#include "imc_pmon.h"
+#include "pmon_reg_defs.h"
+#include "pmon_utils.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PCI_DEVICES_DIR "/sys/bus/pci/devices"
+
+struct pci_device {
+	char address[16];
+	unsigned int domain, bus, dev, fn;
+};
+
+static int read_sysfs_hex(const char *address, const char *attribute, unsigned int *value)
+{
+	char path[320];
+	snprintf(path, sizeof(path), PCI_DEVICES_DIR "/%s/%s", address, attribute);
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return -1;
+	}
+	int ok = fscanf(f, "%x", value) == 1;
+	fclose(f);
+	return ok ? 0 : -1;
+}
+
+static int is_imc_channel(unsigned int device)
+{
+	return device == IMC_PCI_DEVICE_CH0 || device == IMC_PCI_DEVICE_CH1 || device == IMC_PCI_DEVICE_CH2;
+}
+
+static int compare_devices(const void *a, const void *b)
+{
+	const struct pci_device *x = a, *y = b;
+	if (x->domain != y->domain) {
+		return x->domain < y->domain ? -1 : 1;
+	}
+	if (x->bus != y->bus) {
+		return x->bus < y->bus ? -1 : 1;
+	}
+	if (x->dev != y->dev) {
+		return x->dev < y->dev ? -1 : 1;
+	}
+	return (x->fn > y->fn) - (x->fn < y->fn);
+}
+
+/*
+ * Finds the PCI devices with the given device ID(s) on the uncore bus of
+ * socket 0 (the lowest bus they are on), in device and function order.
+ * Returns how many were found.
+ */
+static int find_devices(int (*match)(unsigned int), struct pci_device *found, int max)
+{
+	DIR *dir = opendir(PCI_DEVICES_DIR);
+	if (dir == NULL) {
+		return 0;
+	}
+
+	struct pci_device all[64];
+	int n = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL && n < 64) {
+		struct pci_device d;
+		unsigned int vendor, device;
+		if (sscanf(entry->d_name, "%x:%x:%x.%x", &d.domain, &d.bus, &d.dev, &d.fn) != 4 ||
+			strlen(entry->d_name) >= sizeof(d.address)) {
+			continue;
+		}
+		strcpy(d.address, entry->d_name);
+		if (read_sysfs_hex(d.address, "vendor", &vendor) != 0 || vendor != PCI_VENDOR_INTEL ||
+			read_sysfs_hex(d.address, "device", &device) != 0 || !match(device)) {
+			continue;
+		}
+		all[n++] = d;
+	}
+	closedir(dir);
+
+	qsort(all, n, sizeof(all[0]), compare_devices);
+	int nr_found = 0;
+	for (int i = 0; i < n && nr_found < max; i++) {
+		if (all[i].domain == all[0].domain && all[i].bus == all[0].bus) {
+			found[nr_found++] = all[i];
+		}
+	}
+	return nr_found;
+}
+
+static int is_m2m_device(unsigned int device)
+{
+	return device == M2M_PCI_DEVICE;
+}
+
+static int open_boxes(int (*match)(unsigned int), struct imc_pmon_box *boxes, int max, int *next_fake_fd,
+					  const struct msr_transport *t)
+{
+	struct pci_device found[IMC_PMON_MAX_CHANNELS];
+	int n = find_devices(match, found, max);
+
+	// The fake backend never accesses the devices: it only needs distinct
+	// descriptors, and the boxes of our machine when the host has none
+	if (t->backend == MSR_BACKEND_FAKE) {
+		n = n > 0 ? n : max;
+		for (int i = 0; i < n; i++) {
+			boxes[i].fd = (*next_fake_fd)++;
+			sprintf(boxes[i].address, "fake%d", boxes[i].fd - IMC_PMON_FAKE_FD);
+		}
+		return n;
+	}
+
+	for (int i = 0; i < n; i++) {
+		char path[320];
+		snprintf(path, sizeof(path), PCI_DEVICES_DIR "/%s/config", found[i].address);
+		boxes[i].fd = open(path, O_RDWR);
+		if (boxes[i].fd == -1) {
+			perror(path);
+			for (int j = 0; j < i; j++) {
+				close(boxes[j].fd);
+			}
+			return -1;
+		}
+		strcpy(boxes[i].address, found[i].address);
+	}
+	return n;
+}
+
+/**
+ * Finds and opens the IMC channels and M2Ms of socket 0. The registers are
+ * accessed through batches of the transport t (with MSR_BACKEND_FAKE, the
+ * boxes of our machine are simulated if the host has none).
+ * Returns the number of IMC channels found: 0 (with a warning) if the host
+ * has none or they cannot be opened.
+ */
+int imc_pmon_open(struct imc_pmon *imc, const struct msr_transport *t)
+{
+	memset(imc, 0, sizeof(*imc));
+	int next_fake_fd = IMC_PMON_FAKE_FD;
+	int nr_channels = open_boxes(is_imc_channel, imc->channels, IMC_PMON_MAX_CHANNELS, &next_fake_fd, t);
+	int nr_m2m = nr_channels > 0 ? open_boxes(is_m2m_device, imc->m2m, IMC_PMON_MAX_M2M, &next_fake_fd, t) : 0;
+	if (nr_channels <= 0 || nr_m2m < 0) {
+		for (int i = 0; i < nr_channels; i++) {
+			close(imc->channels[i].fd);
+		}
+		fprintf(stderr, "[imc_pmon] no accessible IMC PMON devices, DRAM traffic is not counted\n");
+		return 0;
+	}
+	imc->nr_channels = nr_channels;
+	imc->nr_m2m = nr_m2m;
+	return nr_channels;
+}
+
+void imc_pmon_close(struct imc_pmon *imc)
+{
+	for (int i = 0; i < imc->nr_channels; i++) {
+		if (imc->channels[i].fd < IMC_PMON_FAKE_FD) {
+			close(imc->channels[i].fd);
+		}
+	}
+	for (int i = 0; i < imc->nr_m2m; i++) {
+		if (imc->m2m[i].fd < IMC_PMON_FAKE_FD) {
+			close(imc->m2m[i].fd);
+		}
+	}
+	imc->nr_channels = 0;
+	imc->nr_m2m = 0;
+}
+
+static uint64_t ctl_value(uint64_t event_code, uint64_t umask)
+{
+	return (1UL << PMON_CTL_en) | (umask << PMON_CTL_umask) | (event_code << PMON_CTL_ev_sel);
+}
+
+/**
+ * Queues the reset of the boxes, the programming of the CAS read/write and
+ * M2M read/write events, and the readout of the initial counter values.
+ */
+void imc_pmon_queue_start(struct imc_pmon *imc, struct msr_batch *b)
+{
+	uint64_t reset = (1UL << PCI_PMON_BOX_CTL_rst_ctrl) | (1UL << PCI_PMON_BOX_CTL_rst_ctrs);
+	for (int i = 0; i < imc->nr_channels; i++) {
+		int fd = imc->channels[i].fd;
+		msr_batch_pci_write(b, fd, IMC_PCI_PMON_BOX_CTL, 4, reset);
+		msr_batch_pci_write(b, fd, IMC_PCI_PMON_CTL(0), 4, ctl_value(CAS_COUNT, CAS_COUNT_RD));
+		msr_batch_pci_write(b, fd, IMC_PCI_PMON_CTL(1), 4, ctl_value(CAS_COUNT, CAS_COUNT_WR));
+		msr_batch_pci_read(b, fd, IMC_PCI_PMON_CTR(0), 8, PMON_CTR_MASK, &imc->prev_cas[i][0]);
+		msr_batch_pci_read(b, fd, IMC_PCI_PMON_CTR(1), 8, PMON_CTR_MASK, &imc->prev_cas[i][1]);
+	}
+	for (int i = 0; i < imc->nr_m2m; i++) {
+		int fd = imc->m2m[i].fd;
+		msr_batch_pci_write(b, fd, M2M_PCI_PMON_BOX_CTL, 4, reset);
+		msr_batch_pci_write(b, fd, M2M_PCI_PMON_CTL(0), 8, ctl_value(M2M_IMC_READS, M2M_IMC_READS_ALL));
+		msr_batch_pci_write(b, fd, M2M_PCI_PMON_CTL(1), 8, ctl_value(M2M_IMC_WRITES, M2M_IMC_WRITES_ALL));
+		msr_batch_pci_read(b, fd, M2M_PCI_PMON_CTR(0), 8, PMON_CTR_MASK, &imc->prev_m2m[i][0]);
+		msr_batch_pci_read(b, fd, M2M_PCI_PMON_CTR(1), 8, PMON_CTR_MASK, &imc->prev_m2m[i][1]);
+	}
+	imc_pmon_clear(imc);
+}
+
+/**
+ * Queues the readout of the counters. imc_pmon_update adds the deltas once
+ * the batch is submitted.
+ */
+void imc_pmon_queue_read(struct imc_pmon *imc, struct msr_batch *b)
+{
+	for (int i = 0; i < imc->nr_channels; i++) {
+		msr_batch_pci_read(b, imc->channels[i].fd, IMC_PCI_PMON_CTR(0), 8, PMON_CTR_MASK, &imc->now_cas[i][0]);
+		msr_batch_pci_read(b, imc->channels[i].fd, IMC_PCI_PMON_CTR(1), 8, PMON_CTR_MASK, &imc->now_cas[i][1]);
+	}
+	for (int i = 0; i < imc->nr_m2m; i++) {
+		msr_batch_pci_read(b, imc->m2m[i].fd, M2M_PCI_PMON_CTR(0), 8, PMON_CTR_MASK, &imc->now_m2m[i][0]);
+		msr_batch_pci_read(b, imc->m2m[i].fd, M2M_PCI_PMON_CTR(1), 8, PMON_CTR_MASK, &imc->now_m2m[i][1]);
+	}
+}
+
+void imc_pmon_update(struct imc_pmon *imc)
+{
+	for (int i = 0; i < imc->nr_channels; i++) {
+		imc->cas_reads[i] += (imc->now_cas[i][0] - imc->prev_cas[i][0]) & PMON_CTR_MASK;
+		imc->cas_writes[i] += (imc->now_cas[i][1] - imc->prev_cas[i][1]) & PMON_CTR_MASK;
+	}
+	for (int i = 0; i < imc->nr_m2m; i++) {
+		imc->m2m_reads[i] += (imc->now_m2m[i][0] - imc->prev_m2m[i][0]) & PMON_CTR_MASK;
+		imc->m2m_writes[i] += (imc->now_m2m[i][1] - imc->prev_m2m[i][1]) & PMON_CTR_MASK;
+	}
+	memcpy(imc->prev_cas, imc->now_cas, sizeof(imc->prev_cas));
+	memcpy(imc->prev_m2m, imc->now_m2m, sizeof(imc->prev_m2m));
+}
+
+/**
+ * Programs the boxes and starts counting, in one batch.
+ */
+void imc_pmon_start(struct imc_pmon *imc, struct msr_batch *b)
+{
+	imc_pmon_queue_start(imc, b);
+	msr_batch_submit(b);
+}
+
+/**
+ * Reads the counters and adds what they counted since the last readout.
+ */
+void imc_pmon_sample(struct imc_pmon *imc, struct msr_batch *b)
+{
+	imc_pmon_queue_read(imc, b);
+	msr_batch_submit(b);
+	imc_pmon_update(imc);
+}
+
+/**
+ * Clears the accumulated counts (the counters keep running).
+ */
+void imc_pmon_clear(struct imc_pmon *imc)
+{
+	memset(imc->cas_reads, 0, sizeof(imc->cas_reads));
+	memset(imc->cas_writes, 0, sizeof(imc->cas_writes));
+	memset(imc->m2m_reads, 0, sizeof(imc->m2m_reads));
+	memset(imc->m2m_writes, 0, sizeof(imc->m2m_writes));
+}
+
+/**
+ * Returns the read CAS commands of all channels: the lines read from DRAM.
+ */
+uint64_t imc_pmon_cas_reads(const struct imc_pmon *imc)
+{
+	uint64_t total = 0;
+	for (int i = 0; i < imc->nr_channels; i++) {
+		total += imc->cas_reads[i];
+	}
+	return total;
+}
+
+/**
+ * Returns the write CAS commands of all channels: the lines written to DRAM.
+ */
+uint64_t imc_pmon_cas_writes(const struct imc_pmon *imc)
+{
+	uint64_t total = 0;
+	for (int i = 0; i < imc->nr_channels; i++) {
+		total += imc->cas_writes[i];
+	}
+	return total;
+}
+
+/**
+ * Writes a "<prefix>box reads writes" line per IMC channel (ch<i>, CAS
+ * commands) and per M2M (m2m<i>, requests to the memory controller).
+ */
+void imc_pmon_write(const struct imc_pmon *imc, FILE *f, const char *prefix)
+{
+	for (int i = 0; i < imc->nr_channels; i++) {
+		fprintf(f, "%sch%d %" PRIu64 " %" PRIu64 "\n", prefix, i, imc->cas_reads[i], imc->cas_writes[i]);
+	}
+	for (int i = 0; i < imc->nr_m2m; i++) {
+		fprintf(f, "%sm2m%d %" PRIu64 " %" PRIu64 "\n", prefix, i, imc->m2m_reads[i], imc->m2m_writes[i]);
+	}
+}
@@ -0,0 +1,82 @@
+/**
+ * imc_pmon.h
+ *
+ * DRAM traffic counters: the CAS commands issued by each IMC channel and the
+ * reads and writes each M2M (mesh to memory) box sends to its memory
+ * controller.
+ *
+ * The EV accesses of the transmitter and receiver are meant to hit in the
+ * LLC. Those that miss go to memory and load the mesh (and the M2M and IMC
+ * tiles) with traffic that is not part of the signal. Each CAS command reads
+ * or writes a 64-byte line, so the CAS counts give the DRAM traffic and the
+ * number of loads that missed to memory.
+ *
+ * The boxes are in PCI configuration space. They are found by scanning
+ * /sys/bus/pci/devices for their device IDs, and their registers are queued
+ * on a struct msr_batch (msr_batch_pci_write/msr_batch_pci_read), so that they
+ * are read in the same burst as the CHA counters. Only the boxes of socket 0
+ * (the uncore bus with the lowest number), where the experiments run, are
+ * used. On a host without the devices (or without access to them),
+ * imc_pmon_open warns and finds no box: the counts stay at 0.
+ *
+ * Like the CHA multiplexer (pmon_events.h), the counters are never reset
+ * between readouts: the last values are kept and the deltas are accumulated
+ * modulo 2^48.
+ */
+
+#ifndef IMC_PMON_H_
+#define IMC_PMON_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "msr_transport.h"
+
+#define IMC_PMON_MAX_CHANNELS 6	 /* 2 memory controllers of 3 channels */
+#define IMC_PMON_MAX_M2M 2		 /* One M2M per memory controller */
+#define IMC_PMON_LINE_BYTES 64	 /* Bytes moved by a CAS command */
+#define IMC_PMON_FAKE_FD 0x100	 /* First fake descriptor used with MSR_BACKEND_FAKE */
+
+struct imc_pmon_box {
+	char address[16];	/* PCI address, e.g., 0000:3a:0a.2 */
+	int fd;				/* Config space file */
+};
+
+struct imc_pmon {
+	int nr_channels;
+	struct imc_pmon_box channels[IMC_PMON_MAX_CHANNELS];
+	int nr_m2m;
+	struct imc_pmon_box m2m[IMC_PMON_MAX_M2M];
+
+	// Last values read from the counters (0: reads, 1: writes), and read buffers
+	uint64_t prev_cas[IMC_PMON_MAX_CHANNELS][2];
+	uint64_t now_cas[IMC_PMON_MAX_CHANNELS][2];
+	uint64_t prev_m2m[IMC_PMON_MAX_M2M][2];
+	uint64_t now_m2m[IMC_PMON_MAX_M2M][2];
+
+	// Accumulated since imc_pmon_start or imc_pmon_clear
+	uint64_t cas_reads[IMC_PMON_MAX_CHANNELS];
+	uint64_t cas_writes[IMC_PMON_MAX_CHANNELS];
+	uint64_t m2m_reads[IMC_PMON_MAX_M2M];
+	uint64_t m2m_writes[IMC_PMON_MAX_M2M];
+};
+
+int imc_pmon_open(struct imc_pmon *imc, const struct msr_transport *t);
+void imc_pmon_close(struct imc_pmon *imc);
+
+// Queue on a batch (e.g., between a global freeze and unfreeze), then call
+// imc_pmon_update once the batch is submitted
+void imc_pmon_queue_start(struct imc_pmon *imc, struct msr_batch *b);
+void imc_pmon_queue_read(struct imc_pmon *imc, struct msr_batch *b);
+void imc_pmon_update(struct imc_pmon *imc);
+
+// Standalone versions, which submit the batch
+void imc_pmon_start(struct imc_pmon *imc, struct msr_batch *b);
+void imc_pmon_sample(struct imc_pmon *imc, struct msr_batch *b);
+
+void imc_pmon_clear(struct imc_pmon *imc);
+uint64_t imc_pmon_cas_reads(const struct imc_pmon *imc);
+uint64_t imc_pmon_cas_writes(const struct imc_pmon *imc);
+void imc_pmon_write(const struct imc_pmon *imc, FILE *f, const char *prefix);
+
+#endif // IMC_PMON_H_
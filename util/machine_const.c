@@ -14,3 +14,11 @@ const int cha_id_to_cpu[26] = {0, 13, 7, -1,
  * status.
  */
 const int cpu_on_socket[NUM_SOCKET] = {0, 24};
+
+// CHA ID on each tile of the die (-1 for the IMCs and fully disabled cores),
+// as in DIE_LAYOUT of 04-analytical-model/config.py
+const int die_layout[DIE_ROWS][DIE_COLS] = {{0, 4, 9, 13, 17, 22},
+                                            {-1, 5, 10, 14, 18, -1},
+                                            {1, 6, 11, 15, 19, 23},
+                                            {2, 7, 12, -1, 20, 24},
+                                            {3, 8, -1, 16, 21, 25}};
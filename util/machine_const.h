@@ -85,8 +85,13 @@
 #define NUM_LOG_CORES_PER_SOCKET    24
 #endif
 
+// Tiles of the die (including the IMCs and fully disabled cores)
+#define DIE_ROWS                    5
+#define DIE_COLS                    6
+
 extern const int cha_id_to_cpu[];
 extern const int cpu_on_socket[];
+extern const int die_layout[DIE_ROWS][DIE_COLS];
 
 /*
  * Memory related constants
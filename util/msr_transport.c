@@ -0,0 +1,380 @@
+/**
+ * msr_transport.c
+ *
+ * Backends of the batched MSR access (see msr_transport.h).
+ */
+
+#include "msr_transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+// Batch interface of the msr-safe driver (msr_batch.h in msr-safe)
+#define MSR_SAFE_BATCH_DEVICE "/dev/cpu/msr_batch"
+
+struct msr_safe_batch_op {
+	uint16_t cpu;		/* CPU to execute the rdmsr/wrmsr on */
+	uint16_t isrdmsr;	/* 0 = wrmsr, non-zero = rdmsr */
+	int32_t err;		/* Set if the operation failed */
+	uint32_t msr;		/* MSR address */
+	uint64_t msrdata;	/* Value to write or value read */
+	uint64_t wmask;		/* Write mask applied by the driver */
+};
+
+struct msr_safe_batch_array {
+	uint32_t numops;
+	struct msr_safe_batch_op *ops;
+};
+
+#define X86_IOC_MSR_BATCH _IOWR('c', 0xA2, struct msr_safe_batch_array)
+
+const char *msr_backend_name(enum msr_backend backend)
+{
+	switch (backend) {
+	case MSR_BACKEND_MSR_SAFE:
+		return "msr-safe";
+	case MSR_BACKEND_PREAD:
+		return "pread";
+	case MSR_BACKEND_FAKE:
+		return "fake";
+	default:
+		return "auto";
+	}
+}
+
+static void msr_transport_reset(struct msr_transport *t, int cpu, enum msr_backend backend)
+{
+	memset(t, 0, sizeof(*t));
+	t->backend = backend;
+	t->cpu = cpu;
+	t->fd = -1;
+}
+
+static int open_pread_device(int cpu)
+{
+	char filename[64];
+	sprintf(filename, "/dev/cpu/%d/msr", cpu);
+	int fd = open(filename, O_RDWR);
+	if (fd == -1) {
+		fprintf(stderr, "[ERROR] cannot open %s: %s\n", filename, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+/**
+ * Opens a transport to the MSRs of the given cpu (any cpu of a socket gives
+ * access to the uncore PMON registers of that socket).
+ * Exits if the requested backend cannot be opened.
+ * Returns the backend selected.
+ */
+int msr_transport_open(struct msr_transport *t, int cpu, enum msr_backend backend)
+{
+	if (backend == MSR_BACKEND_AUTO) {
+		const char *env = getenv(MSR_BACKEND_ENV);
+		if (env != NULL && env[0] != '\0') {
+			if (strcmp(env, "msr-safe") == 0) {
+				backend = MSR_BACKEND_MSR_SAFE;
+			} else if (strcmp(env, "pread") == 0) {
+				backend = MSR_BACKEND_PREAD;
+			} else if (strcmp(env, "fake") == 0) {
+				backend = MSR_BACKEND_FAKE;
+			} else {
+				fprintf(stderr, "[ERROR] unknown %s %s (use msr-safe, pread or fake)\n", MSR_BACKEND_ENV, env);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	msr_transport_reset(t, cpu, backend);
+	t->owns_fd = 1;
+	switch (backend) {
+	case MSR_BACKEND_AUTO:
+		t->fd = open(MSR_SAFE_BATCH_DEVICE, O_RDWR);
+		if (t->fd != -1) {
+			t->backend = MSR_BACKEND_MSR_SAFE;
+		} else {
+			t->backend = MSR_BACKEND_PREAD;
+			t->fd = open_pread_device(cpu);
+		}
+		break;
+	case MSR_BACKEND_MSR_SAFE:
+		t->fd = open(MSR_SAFE_BATCH_DEVICE, O_RDWR);
+		if (t->fd == -1) {
+			fprintf(stderr, "[ERROR] cannot open %s: %s\n", MSR_SAFE_BATCH_DEVICE, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		break;
+	case MSR_BACKEND_PREAD:
+		t->fd = open_pread_device(cpu);
+		break;
+	case MSR_BACKEND_FAKE:
+		t->owns_fd = 0;
+		break;
+	}
+
+	return t->backend;
+}
+
+/**
+ * Returns whether msr_transport_open(t, cpu, MSR_BACKEND_AUTO) would succeed:
+ * a backend is forced with MSR_BACKEND_ENV, or one of the devices can be
+ * opened.
+ */
+int msr_transport_available(int cpu)
+{
+	const char *env = getenv(MSR_BACKEND_ENV);
+	if (env != NULL && env[0] != '\0') {
+		return 1;
+	}
+	char filename[64];
+	sprintf(filename, "/dev/cpu/%d/msr", cpu);
+	return access(MSR_SAFE_BATCH_DEVICE, R_OK | W_OK) == 0 || access(filename, R_OK | W_OK) == 0;
+}
+
+/**
+ * Uses an already open /dev/cpu/<cpu>/msr file descriptor as a pread
+ * transport (or -1, for batches of PCI config space operations only). The
+ * descriptor is not closed by msr_transport_close.
+ */
+void msr_transport_wrap_fd(struct msr_transport *t, int cpu, int msr_fd)
+{
+	msr_transport_reset(t, cpu, MSR_BACKEND_PREAD);
+	t->fd = msr_fd;
+	t->owns_fd = 0;
+}
+
+void msr_transport_close(struct msr_transport *t)
+{
+	if (t->owns_fd && t->fd != -1) {
+		close(t->fd);
+	}
+	t->fd = -1;
+}
+
+void msr_batch_init(struct msr_batch *b, struct msr_transport *t)
+{
+	b->t = t;
+	b->nr_ops = 0;
+}
+
+static struct msr_op *msr_batch_next(struct msr_batch *b)
+{
+	// A full batch is submitted early: the caller's sequence is then split in
+	// two bursts, but stays in order
+	if (b->nr_ops == MSR_BATCH_MAX) {
+		msr_batch_submit(b);
+	}
+	return &b->ops[b->nr_ops++];
+}
+
+/**
+ * Queues a write of value to msr.
+ */
+void msr_batch_write(struct msr_batch *b, uint32_t msr, uint64_t value)
+{
+	struct msr_op *op = msr_batch_next(b);
+	op->msr = msr;
+	op->pci_fd = -1;
+	op->width = sizeof(value);
+	op->is_read = 0;
+	op->value = value;
+	op->mask = 0;
+	op->result = NULL;
+}
+
+/**
+ * Queues a read of msr. The value read, and-ed with mask, is stored in
+ * *result when the batch is submitted.
+ */
+void msr_batch_read(struct msr_batch *b, uint32_t msr, uint64_t mask, uint64_t *result)
+{
+	struct msr_op *op = msr_batch_next(b);
+	op->msr = msr;
+	op->pci_fd = -1;
+	op->width = sizeof(op->value);
+	op->is_read = 1;
+	op->value = 0;
+	op->mask = mask;
+	op->result = result;
+}
+
+/**
+ * Queues a write of the low width (4 or 8) bytes of value at offset in the
+ * PCI config space open as pci_fd.
+ */
+void msr_batch_pci_write(struct msr_batch *b, int pci_fd, uint32_t offset, int width, uint64_t value)
+{
+	msr_batch_write(b, offset, value);
+	b->ops[b->nr_ops - 1].pci_fd = pci_fd;
+	b->ops[b->nr_ops - 1].width = width;
+}
+
+/**
+ * Queues a read of width (4 or 8) bytes at offset in the PCI config space
+ * open as pci_fd. The value read, and-ed with mask, is stored in *result when
+ * the batch is submitted.
+ */
+void msr_batch_pci_read(struct msr_batch *b, int pci_fd, uint32_t offset, int width, uint64_t mask, uint64_t *result)
+{
+	msr_batch_read(b, offset, mask, result);
+	b->ops[b->nr_ops - 1].pci_fd = pci_fd;
+	b->ops[b->nr_ops - 1].width = width;
+}
+
+static uint64_t *fake_register(struct msr_transport *t, uint32_t msr)
+{
+	// Open addressing on the MSR address
+	for (int i = 0; i < MSR_FAKE_REGS; i++) {
+		int slot = (msr + i) % MSR_FAKE_REGS;
+		if (!t->fake[slot].used) {
+			t->fake[slot].used = 1;
+			t->fake[slot].msr = msr;
+			t->fake[slot].value = 0;
+		}
+		if (t->fake[slot].msr == msr) {
+			return &t->fake[slot].value;
+		}
+	}
+	fprintf(stderr, "[ERROR] fake MSR register file full\n");
+	exit(EXIT_FAILURE);
+}
+
+static void submit_fake(struct msr_batch *b)
+{
+	for (int i = 0; i < b->nr_ops; i++) {
+		struct msr_op *op = &b->ops[i];
+		// PCI registers are kept apart from the MSRs (the offsets are small)
+		uint32_t key = op->pci_fd < 0 ? op->msr : 0x80000000U | (uint32_t)op->pci_fd << 16 | op->msr;
+		uint64_t *reg = fake_register(b->t, key);
+		if (op->is_read) {
+			op->value = *reg;
+		} else {
+			*reg = op->value;
+		}
+	}
+}
+
+static void submit_pread_op(struct msr_transport *t, struct msr_op *op)
+{
+	// The value is little endian, so a 4-byte access uses its low half
+	int fd = op->pci_fd < 0 ? t->fd : op->pci_fd;
+	ssize_t ret;
+	if (op->is_read) {
+		op->value = 0;
+		ret = pread(fd, &op->value, op->width, op->msr);
+	} else {
+		ret = pwrite(fd, &op->value, op->width, op->msr);
+	}
+	if (ret != op->width) {
+		if (op->pci_fd < 0) {
+			fprintf(stderr, "[ERROR] cannot %s MSR 0x%x on cpu %d: %s\n", op->is_read ? "read" : "write",
+					op->msr, t->cpu, strerror(errno));
+		} else {
+			fprintf(stderr, "[ERROR] cannot %s PCI config offset 0x%x: %s\n", op->is_read ? "read" : "write",
+					op->msr, strerror(errno));
+		}
+		exit(EXIT_FAILURE);
+	}
+	t->syscalls++;
+}
+
+static void submit_pread(struct msr_batch *b)
+{
+	for (int i = 0; i < b->nr_ops; i++) {
+		submit_pread_op(b->t, &b->ops[i]);
+	}
+}
+
+/*
+ * Submits the MSR operations [first, last) of the batch in one ioctl.
+ */
+static void submit_msr_safe_run(struct msr_batch *b, int first, int last)
+{
+	struct msr_safe_batch_op ops[MSR_BATCH_MAX];
+	struct msr_safe_batch_array array = {.numops = last - first, .ops = ops};
+	for (int i = 0; i < last - first; i++) {
+		ops[i].cpu = b->t->cpu;
+		ops[i].isrdmsr = b->ops[first + i].is_read;
+		ops[i].err = 0;
+		ops[i].msr = b->ops[first + i].msr;
+		ops[i].msrdata = b->ops[first + i].value;
+		ops[i].wmask = 0;
+	}
+
+	int ret = ioctl(b->t->fd, X86_IOC_MSR_BATCH, &array);
+	b->t->syscalls++;
+	for (int i = 0; i < last - first; i++) {
+		if (ops[i].err != 0) {
+			fprintf(stderr, "[ERROR] cannot %s MSR 0x%x on cpu %d: %s\n", ops[i].isrdmsr ? "read" : "write",
+					ops[i].msr, b->t->cpu, strerror(-ops[i].err));
+			exit(EXIT_FAILURE);
+		}
+		b->ops[first + i].value = ops[i].msrdata;
+	}
+	if (ret != 0) {
+		fprintf(stderr, "[ERROR] msr-safe batch failed on cpu %d: %s\n", b->t->cpu, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void submit_msr_safe(struct msr_batch *b)
+{
+	// Runs of MSR operations go through the batch ioctl, PCI operations
+	// through pread/pwrite, in order
+	int i = 0;
+	while (i < b->nr_ops) {
+		if (b->ops[i].pci_fd >= 0) {
+			submit_pread_op(b->t, &b->ops[i++]);
+			continue;
+		}
+		int first = i;
+		while (i < b->nr_ops && b->ops[i].pci_fd < 0) {
+			i++;
+		}
+		submit_msr_safe_run(b, first, i);
+	}
+}
+
+/**
+ * Submits the queued operations in order and stores the values read.
+ * Exits if any operation fails.
+ * Returns the number of operations submitted.
+ */
+int msr_batch_submit(struct msr_batch *b)
+{
+	int nr_ops = b->nr_ops;
+	if (nr_ops == 0) {
+		return 0;
+	}
+
+	uint64_t start = __rdtsc();
+	switch (b->t->backend) {
+	case MSR_BACKEND_MSR_SAFE:
+		submit_msr_safe(b);
+		break;
+	case MSR_BACKEND_FAKE:
+		submit_fake(b);
+		break;
+	default:
+		submit_pread(b);
+		break;
+	}
+	b->t->last_submit_cycles = __rdtsc() - start;
+	b->t->submits++;
+
+	for (int i = 0; i < nr_ops; i++) {
+		if (b->ops[i].is_read && b->ops[i].result != NULL) {
+			*b->ops[i].result = b->ops[i].value & b->ops[i].mask;
+		}
+	}
+	b->nr_ops = 0;
+
+	return nr_ops;
+}
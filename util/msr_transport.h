@@ -0,0 +1,92 @@
+/**
+ * msr_transport.h
+ *
+ * Batched MSR access for programming and reading the uncore PMON registers.
+ *
+ * Register reads and writes are queued in a struct msr_batch and submitted
+ * together, so that a whole freeze -> program -> unfreeze -> read sequence is
+ * issued in one short burst instead of being interleaved with the caller's
+ * code. The transport behind a batch is one of:
+ *
+ *  - MSR_BACKEND_MSR_SAFE: the msr-safe driver's batch ioctl on
+ *    /dev/cpu/msr_batch (one syscall per batch). The uncore PMON MSRs have to
+ *    be in the msr-safe allowlist.
+ *  - MSR_BACKEND_PREAD: pread/pwrite on /dev/cpu/<cpu>/msr. The msr driver has
+ *    no vectored path (a longer read just re-reads the same MSR), so this is
+ *    still one syscall per register, but they are issued back to back.
+ *  - MSR_BACKEND_FAKE: an in-memory register file, to run the PMON code
+ *    without the msr driver (e.g., to check what it programs).
+ *
+ * MSR_BACKEND_AUTO uses the backend named by the environment variable
+ * MSR_BACKEND_ENV (msr-safe, pread or fake) if set, and otherwise msr-safe if
+ * its batch device can be opened and pread if not.
+ *
+ * Some uncore PMON boxes (the IMC channels and the M2Ms) are in PCI
+ * configuration space instead. Their registers can be queued on the same batch
+ * (msr_batch_pci_write/msr_batch_pci_read, on the descriptor of the device's
+ * sysfs config file), so that they are read in the same burst as the CHAs,
+ * e.g., between a global freeze and unfreeze. They are always accessed with
+ * pread/pwrite (msr-safe only does MSRs), in order with the MSR operations;
+ * the fake backend keeps them in its register file.
+ */
+
+#ifndef MSR_TRANSPORT_H_
+#define MSR_TRANSPORT_H_
+
+#include <stdint.h>
+
+#define MSR_BACKEND_ENV "DMA_MSR_BACKEND"
+#define MSR_BATCH_MAX 512	  /* Operations queued before a batch is submitted */
+#define MSR_FAKE_REGS 1024	  /* Registers in the fake register file */
+
+enum msr_backend { MSR_BACKEND_AUTO, MSR_BACKEND_MSR_SAFE, MSR_BACKEND_PREAD, MSR_BACKEND_FAKE };
+
+struct msr_transport {
+	enum msr_backend backend;
+	int cpu;	/* CPU whose MSRs are accessed */
+	int fd;		/* Batch or msr device (-1 with MSR_BACKEND_FAKE) */
+	int owns_fd;
+
+	// Statistics of the submitted batches
+	uint64_t submits;
+	uint64_t syscalls;
+	uint64_t last_submit_cycles; /* TSC cycles taken by the last submission */
+
+	// Register file of MSR_BACKEND_FAKE
+	struct {
+		uint32_t msr;
+		int used;
+		uint64_t value;
+	} fake[MSR_FAKE_REGS];
+};
+
+struct msr_op {
+	uint32_t msr;		/* MSR address, or offset in the PCI config space */
+	int pci_fd;			/* PCI config file of the register, or -1 for an MSR */
+	int width;			/* Bytes accessed in PCI config space (4 or 8) */
+	int is_read;
+	uint64_t value;		/* Value to write */
+	uint64_t mask;		/* Mask applied to the value read */
+	uint64_t *result;	/* Where the value read is stored on submission */
+};
+
+struct msr_batch {
+	struct msr_transport *t;
+	int nr_ops;
+	struct msr_op ops[MSR_BATCH_MAX];
+};
+
+int msr_transport_open(struct msr_transport *t, int cpu, enum msr_backend backend);
+int msr_transport_available(int cpu);
+void msr_transport_wrap_fd(struct msr_transport *t, int cpu, int msr_fd);
+void msr_transport_close(struct msr_transport *t);
+const char *msr_backend_name(enum msr_backend backend);
+
+void msr_batch_init(struct msr_batch *b, struct msr_transport *t);
+void msr_batch_write(struct msr_batch *b, uint32_t msr, uint64_t value);
+void msr_batch_read(struct msr_batch *b, uint32_t msr, uint64_t mask, uint64_t *result);
+void msr_batch_pci_write(struct msr_batch *b, int pci_fd, uint32_t offset, int width, uint64_t value);
+void msr_batch_pci_read(struct msr_batch *b, int pci_fd, uint32_t offset, int width, uint64_t mask, uint64_t *result);
+int msr_batch_submit(struct msr_batch *b);
+
+#endif // MSR_TRANSPORT_H_
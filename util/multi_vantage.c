@@ -0,0 +1,377 @@
+/**
+ * multi_vantage.c
+ *
+ * Multi-threaded sampling of several mesh paths (see multi_vantage.h).
+ */
+
+#include "multi_vantage.h"
+#include "machine_const.h"
+#include "topology.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <x86intrin.h>
+
+/**
+ * Parses a vantage given as "<core_ID>:<slice_ID>".
+ * Returns 0 on success and -1 if the vantage is malformed or out of range.
+ */
+int multi_vantage_parse(const char *arg, int *core, int *slice)
+{
+	if (sscanf(arg, "%d:%d", core, slice) != 2) {
+		return -1;
+	}
+	if (*core < 0 || *core >= NUM_CHA || cha_to_cpu(*core) < 0) {
+		return -1;
+	}
+	if (*slice < 0 || *slice >= LLC_CACHE_SLICES) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Brings the monitoring set into the LLC and evicts it from the private
+ * caches, like the single-path receivers do before sampling.
+ */
+static void vantage_prime(struct vantage *v)
+{
+	struct Node *curr_node = v->ms;
+	do {
+		maccess(curr_node->address);
+		curr_node = curr_node->next;
+	} while (curr_node != v->ms);
+
+	_mm_lfence();
+	for (int j = 0; j < 4; j++) {
+		curr_node = v->ev;
+		while (curr_node && curr_node->next && curr_node->next->next) {
+			maccess(curr_node->address);
+			maccess(curr_node->next->address);
+			maccess(curr_node->next->next->address);
+			maccess(curr_node->address);
+			maccess(curr_node->next->address);
+			maccess(curr_node->next->next->address);
+			curr_node = curr_node->next;
+		}
+	}
+}
+
+/*
+ * Samples until the end of the window: the end TSC is reached, the window is
+ * stopped, or the sample buffers are full.
+ */
+static void vantage_sample(struct vantage *v)
+{
+	struct multi_vantage *mv = v->mv;
+	struct Node *curr_node = v->ms;
+	uint64_t end = mv->end_tsc;
+	int i = 0;
+
+	gap_log_reset(&v->gaps);
+	gap_log_arm(&v->gaps, (uint32_t)get_time());
+
+	while (i < mv->max_samples) {
+		uint64_t start;
+		uint32_t latency;
+
+		if (mv->loads_per_sample == 4) {
+			asm volatile(
+				".align 16\n\t"
+				"lfence\n\t"
+				"rdtsc\n\t"				/* eax = TSC (timestamp counter) */
+				"shl $32, %%rdx\n\t"
+				"or %%rdx, %%rax\n\t"
+				"movq %%rax, %%r8\n\t"	/* r8 = rax; this is to back up rax into another register */
+
+				"movq (%2), %%r9\n\t"	/* r9 = *(curr_node->address); LOAD */
+				"movq (%3), %%r9\n\t"	/* r9 = *(curr_node->next->address); LOAD */
+				"movq (%4), %%r9\n\t"	/* r9 = *(curr_node->next->next->address); LOAD */
+				"movq (%5), %%r9\n\t"	/* r9 = *(curr_node->next->next->next->address); LOAD */
+
+				"rdtscp\n\t"			/* eax = TSC (timestamp counter) */
+				"shl $32, %%rdx\n\t"
+				"or %%rdx, %%rax\n\t"
+				"sub %%r8, %%rax\n\t"	/* rax = rax - r8; get timing difference between the second timestamp and the first one */
+
+				"movl %%eax, %0\n\t"	/* latency = eax */
+				"movq %%r8, %1\n\t"		/* start = r8 */
+				: "=rm"(latency), "=rm"(start) /* output */
+				: "r"(curr_node->address), "r"(curr_node->next->address), "r"(curr_node->next->next->address), "r"(curr_node->next->next->next->address)
+				: "rax", "rcx", "rdx", "r8", "r9", "memory");
+
+			curr_node = curr_node->next->next->next->next;
+		} else {
+			asm volatile(
+				".align 16\n\t"
+				"lfence\n\t"
+				"rdtsc\n\t"				/* eax = TSC (timestamp counter) */
+				"shl $32, %%rdx\n\t"
+				"or %%rdx, %%rax\n\t"
+				"movq %%rax, %%r8\n\t"	/* r8 = rax; this is to back up rax into another register */
+
+				"movq (%2), %%r9\n\t"	/* r9 = *(curr_node->address); LOAD */
+
+				"rdtscp\n\t"			/* eax = TSC (timestamp counter) */
+				"shl $32, %%rdx\n\t"
+				"or %%rdx, %%rax\n\t"
+				"sub %%r8, %%rax\n\t"	/* rax = rax - r8; get timing difference between the second timestamp and the first one */
+
+				"movl %%eax, %0\n\t"	/* latency = eax */
+				"movq %%r8, %1\n\t"		/* start = r8 */
+				: "=rm"(latency), "=rm"(start) /* output */
+				: "r"(curr_node->address)
+				: "rax", "rcx", "rdx", "r8", "r9", "memory");
+
+			curr_node = curr_node->next;
+		}
+
+		v->tsc[i] = start;
+		v->latency[i] = latency;
+		gap_check(&v->gaps, i, (uint32_t)start);
+		i++;
+
+		if (start >= end || mv->stop) {
+			break;
+		}
+	}
+
+	v->nr_samples = i;
+}
+
+static void *vantage_thread(void *arg)
+{
+	struct vantage *v = (struct vantage *)arg;
+	struct multi_vantage *mv = v->mv;
+
+	pin_cpu(cha_to_cpu(v->core));
+
+	while (1) {
+		// Wait to be armed (or terminated)
+		pthread_barrier_wait(&mv->barrier);
+		if (mv->quit) {
+			break;
+		}
+
+		// Get ready and wait for the window to start
+		vantage_prime(v);
+		while (!mv->go);
+		while (get_time() < mv->start_tsc);
+
+		vantage_sample(v);
+
+		// Signal that this vantage is done
+		pthread_barrier_wait(&mv->barrier);
+	}
+
+	return NULL;
+}
+
+/**
+ * Builds the sets of each vantage and spawns the probing threads.
+ *
+ * Each monitoring set has ms_size lines in each of nr_sets LLC sets (set,
+ * set + 2, ...) of its slice. If ev_size is greater than 0, each vantage also
+ * gets an EV with ev_size lines per set in the local slice of its core.
+ */
+void multi_vantage_init(struct multi_vantage *mv, int nr_vantages, const int *cores, const int *slices,
+						int set, int nr_sets, int ms_size, int ev_size, int loads_per_sample, int max_samples)
+{
+	if (nr_vantages < 1 || nr_vantages > MAX_VANTAGES) {
+		fprintf(stderr, "[ERROR] between 1 and %d vantages are supported\n", MAX_VANTAGES);
+		exit(1);
+	}
+	if ((loads_per_sample != 1 && loads_per_sample != 4) || nr_sets * ms_size < loads_per_sample) {
+		fprintf(stderr, "[ERROR] unsupported loads per sample: %d\n", loads_per_sample);
+		exit(1);
+	}
+
+	memset(mv, 0, sizeof(*mv));
+	mv->nr_vantages = nr_vantages;
+	mv->loads_per_sample = loads_per_sample;
+	mv->max_samples = max_samples;
+
+	// Allocate large buffer (pool of addresses), one region per vantage
+	mv->buffer_size = nr_vantages * VANTAGE_REGION_SIZE;
+	mv->buffer = mmap(NULL, mv->buffer_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+	if (mv->buffer == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	// Write data to the buffer so that any copy-on-write
+	// mechanisms will give us our own copies of the pages.
+	memset(mv->buffer, 0, mv->buffer_size);
+
+	uint32_t gap_bound = gap_bound_from_profile();
+	for (int i = 0; i < nr_vantages; i++) {
+		struct vantage *v = &mv->v[i];
+		char *region = (char *)mv->buffer + i * VANTAGE_REGION_SIZE;
+		v->core = cores[i];
+		v->slice = slices[i];
+		v->mv = mv;
+
+		// Prepare monitoring set (first half of the region)
+		for (int k = 0; k < nr_sets; k++) {
+			append_l2_congruent_set(&v->ms, region, v->slice, set + 2 * k, ms_size);
+		}
+
+		// Prepare EV (second half of the region)
+		for (int k = 0; ev_size > 0 && k < nr_sets; k++) {
+			append_l2_congruent_set(&v->ev, region + VANTAGE_REGION_SIZE / 2, v->core, set + 2 * k, ev_size);
+		}
+
+		// Flush monitoring set and make it loop back to the beginning
+		struct Node *curr_node = v->ms;
+		while (curr_node->next != NULL) {
+			_mm_clflush(curr_node->address);
+			curr_node = curr_node->next;
+		}
+		_mm_clflush(curr_node->address);
+		curr_node->next = v->ms;
+
+		v->tsc = (uint64_t *)malloc(sizeof(*v->tsc) * max_samples);
+		v->latency = (uint32_t *)malloc(sizeof(*v->latency) * max_samples);
+		if (v->tsc == NULL || v->latency == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		gap_log_init(&v->gaps, gap_bound, GAP_SETTLE_SAMPLES);
+	}
+
+	// Spawn the threads (the barrier also includes the calling thread)
+	pthread_barrier_init(&mv->barrier, NULL, nr_vantages + 1);
+	for (int i = 0; i < nr_vantages; i++) {
+		if (pthread_create(&mv->v[i].thread, NULL, vantage_thread, &mv->v[i]) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+}
+
+/**
+ * Prepares a new window: the threads prime their sets and wait for it to start.
+ */
+void multi_vantage_arm(struct multi_vantage *mv)
+{
+	mv->go = 0;
+	mv->stop = 0;
+	pthread_barrier_wait(&mv->barrier);
+}
+
+/**
+ * Starts the window. The threads begin sampling at start_tsc and stop at
+ * end_tsc (use UINT64_MAX to only stop with multi_vantage_stop).
+ */
+void multi_vantage_go(struct multi_vantage *mv, uint64_t start_tsc, uint64_t end_tsc)
+{
+	mv->start_tsc = start_tsc;
+	mv->end_tsc = end_tsc;
+	mv->go = 1;
+}
+
+/**
+ * Waits for all the threads to be done sampling (at the end TSC or with full
+ * sample buffers).
+ */
+void multi_vantage_wait(struct multi_vantage *mv)
+{
+	pthread_barrier_wait(&mv->barrier);
+}
+
+/**
+ * Ends the window and waits for all the threads to be done sampling.
+ */
+void multi_vantage_stop(struct multi_vantage *mv)
+{
+	mv->stop = 1;
+	multi_vantage_wait(mv);
+}
+
+/*
+ * Returns whether sample i of vantage v was hit by an interrupt.
+ * *range is a cursor into the (sorted) tagged ranges.
+ */
+static inline int is_tagged(struct vantage *v, int *range, int i)
+{
+	while (*range < v->gaps.nr_ranges && v->gaps.ranges[*range].last < (uint32_t)i) {
+		(*range)++;
+	}
+	return *range < v->gaps.nr_ranges && v->gaps.ranges[*range].first <= (uint32_t)i;
+}
+
+/**
+ * Writes the samples of the last window of all the vantages to f as
+ * "<tsc - base_tsc> <vantage> <latency>" lines, ordered by TSC.
+ * Returns the number of samples written.
+ */
+int multi_vantage_write_merged(struct multi_vantage *mv, FILE *f, uint64_t base_tsc)
+{
+	int next[MAX_VANTAGES] = {0}, range[MAX_VANTAGES] = {0};
+	int written = 0;
+
+	while (1) {
+		// Pick the vantage with the oldest pending sample
+		int best = -1;
+		for (int k = 0; k < mv->nr_vantages; k++) {
+			struct vantage *v = &mv->v[k];
+			while (next[k] < v->nr_samples && is_tagged(v, &range[k], next[k])) {
+				next[k]++;
+			}
+			if (next[k] < v->nr_samples && (best < 0 || v->tsc[next[k]] < mv->v[best].tsc[next[best]])) {
+				best = k;
+			}
+		}
+		if (best < 0) {
+			break;
+		}
+
+		struct vantage *v = &mv->v[best];
+		fprintf(f, "%" PRIu64 " %d %" PRIu32 "\n", v->tsc[next[best]] - base_tsc, best, v->latency[next[best]]);
+		next[best]++;
+		written++;
+	}
+
+	return written;
+}
+
+/**
+ * Returns the number of gaps detected by all the vantages in the last window.
+ */
+int multi_vantage_gaps(struct multi_vantage *mv)
+{
+	int gaps = 0;
+	for (int k = 0; k < mv->nr_vantages; k++) {
+		gaps += mv->v[k].gaps.count;
+	}
+	return gaps;
+}
+
+/**
+ * Terminates the threads and frees everything.
+ */
+void multi_vantage_destroy(struct multi_vantage *mv)
+{
+	mv->quit = 1;
+	pthread_barrier_wait(&mv->barrier);
+
+	for (int k = 0; k < mv->nr_vantages; k++) {
+		struct vantage *v = &mv->v[k];
+		pthread_join(v->thread, NULL);
+
+		// Break the loop of the monitoring set before freeing it
+		struct Node *curr_node = v->ms, *tmp = NULL;
+		while (curr_node->next != v->ms) {
+			curr_node = curr_node->next;
+		}
+		curr_node->next = NULL;
+		for (curr_node = v->ms; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+		for (curr_node = v->ev; curr_node != NULL; tmp = curr_node, curr_node = curr_node->next, free(tmp));
+
+		free(v->tsc);
+		free(v->latency);
+	}
+
+	pthread_barrier_destroy(&mv->barrier);
+	munmap(mv->buffer, mv->buffer_size);
+}
@@ -0,0 +1,80 @@
+/**
+ * multi_vantage.h
+ *
+ * Sampling several mesh paths at once. Each vantage is a probing thread pinned
+ * to a core (CHA ID) with its own monitoring set on a slice. All the threads
+ * time their loads like the single-path receivers and timestamp each sample
+ * with the invariant TSC, which is shared by all the cores, so the per-thread
+ * traces can be merged into one "<tsc> <vantage> <latency>" trace.
+ *
+ * The threads are kept alive across sampling windows:
+ *
+ *   multi_vantage_init(...);           // build the sets and spawn the threads
+ *   for (...) {
+ *       multi_vantage_arm(mv);         // threads prime their sets and spin
+ *       multi_vantage_go(mv, start, end);
+ *       ...                            // e.g., wait for the victim
+ *       multi_vantage_stop(mv);        // end the window and wait for the threads
+ *                                      // (or multi_vantage_wait to let it run to end)
+ *       multi_vantage_write_merged(mv, f, start);
+ *   }
+ *   multi_vantage_destroy(mv);
+ *
+ * Samples hit by interrupts (see sample_guard.h) are left out of the merged
+ * trace; the timestamps keep the remaining samples aligned.
+ */
+
+#ifndef MULTI_VANTAGE_H_
+#define MULTI_VANTAGE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "util.h"
+#include "sample_guard.h"
+
+#define MAX_VANTAGES 8
+#define VANTAGE_REGION_SIZE (128 * 1024UL * 1024) /* Buffer space for the sets of one vantage */
+
+struct multi_vantage;
+
+struct vantage {
+	int core;				  /* CHA ID of the core the thread runs on */
+	int slice;				  /* Slice of the monitoring set */
+	struct Node *ms;		  /* Monitoring set (circular) */
+	struct Node *ev;		  /* EV in the local slice, accessed before each window (may be NULL) */
+	uint64_t *tsc;			  /* Start TSC of each sample */
+	uint32_t *latency;		  /* Latency of each sample */
+	int nr_samples;			  /* Samples taken in the last window */
+	struct gap_log gaps;
+	pthread_t thread;
+	struct multi_vantage *mv;
+};
+
+struct multi_vantage {
+	int nr_vantages;
+	int loads_per_sample; /* 1 or 4 loads timed per sample */
+	int max_samples;	  /* Samples per vantage per window */
+	void *buffer;
+	uint64_t buffer_size;
+	pthread_barrier_t barrier;
+	volatile int go;	  /* Set to start the window */
+	volatile int stop;	  /* Set to end the window early */
+	volatile int quit;	  /* Set to terminate the threads */
+	volatile uint64_t start_tsc, end_tsc;
+	struct vantage v[MAX_VANTAGES];
+};
+
+int multi_vantage_parse(const char *arg, int *core, int *slice);
+void multi_vantage_init(struct multi_vantage *mv, int nr_vantages, const int *cores, const int *slices,
+						int set, int nr_sets, int ms_size, int ev_size, int loads_per_sample, int max_samples);
+void multi_vantage_arm(struct multi_vantage *mv);
+void multi_vantage_go(struct multi_vantage *mv, uint64_t start_tsc, uint64_t end_tsc);
+void multi_vantage_wait(struct multi_vantage *mv);
+void multi_vantage_stop(struct multi_vantage *mv);
+int multi_vantage_write_merged(struct multi_vantage *mv, FILE *f, uint64_t base_tsc);
+int multi_vantage_gaps(struct multi_vantage *mv);
+void multi_vantage_destroy(struct multi_vantage *mv);
+
+#endif // MULTI_VANTAGE_H_
@@ -0,0 +1,288 @@
+/**
+ * pmon_events.c
+ *
+ * Table of named CHA PMON events and the event multiplexer (see
+ * pmon_events.h).
+ */
+
+#include "pmon_events.h"
+#include "pmon_reg_defs.h"
+#include "pmon_utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define RING_EVENT(name, code, umask) {name, code, umask, 0, PMON_FILTER0_NONE, PMON_FILTER1_NONE}
+
+// Directions of the ring-in-use events (UPMRM 2.2.3): the umasks select the
+// up/down (vertical) or left/right (horizontal) rings, even and odd
+#define RING_EVENTS(ring, vert, horz)                      \
+	RING_EVENT(ring "_up", vert, 0x3UL),                   \
+	RING_EVENT(ring "_down", vert, 0xcUL),                 \
+	RING_EVENT(ring "_left", horz, 0x3UL),                 \
+	RING_EVENT(ring "_right", horz, 0xcUL),                \
+	RING_EVENT(ring "_up_even", vert, 0x1UL),              \
+	RING_EVENT(ring "_up_odd", vert, 0x2UL),               \
+	RING_EVENT(ring "_down_even", vert, 0x4UL),            \
+	RING_EVENT(ring "_down_odd", vert, 0x8UL),             \
+	RING_EVENT(ring "_left_even", horz, 0x1UL),            \
+	RING_EVENT(ring "_left_odd", horz, 0x2UL),             \
+	RING_EVENT(ring "_right_even", horz, 0x4UL),           \
+	RING_EVENT(ring "_right_odd", horz, 0x8UL)
+
+static const struct pmon_event pmon_events[] = {
+	RING_EVENTS("ad", VERT_RING_AD_IN_USE, HORZ_RING_AD_IN_USE),
+	RING_EVENTS("ak", VERT_RING_AK_IN_USE, HORZ_RING_AK_IN_USE),
+	RING_EVENTS("bl", VERT_RING_BL_IN_USE, HORZ_RING_BL_IN_USE),
+
+	// The IV ring has no even/odd split
+	RING_EVENT("iv_up", VERT_RING_IV_IN_USE, 0x1UL),
+	RING_EVENT("iv_down", VERT_RING_IV_IN_USE, 0x4UL),
+	RING_EVENT("iv_left", HORZ_RING_IV_IN_USE, 0x1UL),
+	RING_EVENT("iv_right", HORZ_RING_IV_IN_USE, 0x4UL),
+
+	RING_EVENT("cms_clockticks", CMS_CLOCKTICKS, 0x0UL),
+
+	// Same setup as get_corresponding_cha_no_msr: data reads in any state
+	{"llc_lookup_data_read", LLC_LOOKUP, 0x3UL, 1, 0xFFUL << CHA_MSR_PMON_FILTER0_state, PMON_FILTER1_NONE},
+};
+
+#define NR_PMON_EVENTS (int)(sizeof(pmon_events) / sizeof(pmon_events[0]))
+
+/**
+ * Returns the event called name, or NULL if there is none.
+ */
+const struct pmon_event *pmon_event_find(const char *name)
+{
+	for (int i = 0; i < NR_PMON_EVENTS; i++) {
+		if (strcmp(pmon_events[i].name, name) == 0) {
+			return &pmon_events[i];
+		}
+	}
+	return NULL;
+}
+
+static int filters_conflict(const struct pmon_event *a, const struct pmon_event *b)
+{
+	return a->uses_filters && b->uses_filters && (a->filter0 != b->filter0 || a->filter1 != b->filter1);
+}
+
+/**
+ * Sets up the multiplexer to count the named events. The events are grouped
+ * in the given order: a new group starts when the current one has 4 events
+ * or when the next event needs different filters.
+ * Returns the number of groups, or -1 if an event is unknown or there are
+ * too many events.
+ */
+int pmon_mux_init(struct pmon_mux *mux, const char *const names[], int nr_names)
+{
+	memset(mux, 0, sizeof(*mux));
+	if (nr_names <= 0 || nr_names > PMON_MUX_MAX_EVENTS) {
+		fprintf(stderr, "[ERROR] between 1 and %d PMON events can be multiplexed\n", PMON_MUX_MAX_EVENTS);
+		return -1;
+	}
+
+	for (int i = 0; i < nr_names; i++) {
+		const struct pmon_event *event = pmon_event_find(names[i]);
+		if (event == NULL) {
+			fprintf(stderr, "[ERROR] unknown PMON event %s\n", names[i]);
+			return -1;
+		}
+
+		// Start a new group if this event does not fit in the current one
+		int start = mux->group_start[mux->nr_groups];
+		int conflict = i - start == PMON_CTRS_PER_BOX;
+		for (int j = start; j < i && !conflict; j++) {
+			conflict = filters_conflict(mux->events[j], event);
+		}
+		if (i == 0 || conflict) {
+			if (i > 0) {
+				mux->nr_groups++;
+			}
+			mux->group_start[mux->nr_groups] = i;
+		}
+		mux->events[i] = event;
+	}
+	mux->nr_events = nr_names;
+	mux->nr_groups++;
+	mux->group_start[mux->nr_groups] = nr_names;
+
+	return mux->nr_groups;
+}
+
+/**
+ * Returns the index of the event called name in the multiplexer, or -1.
+ */
+int pmon_mux_find(const struct pmon_mux *mux, const char *name)
+{
+	for (int i = 0; i < mux->nr_events; i++) {
+		if (strcmp(mux->events[i]->name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Reads the DRAM traffic counters imc (opened with imc_pmon_open) with the
+ * CHA counters of the multiplexer (initialized with pmon_mux_init), from the
+ * next pmon_mux_start on.
+ */
+void pmon_mux_attach_imc(struct pmon_mux *mux, struct imc_pmon *imc)
+{
+	mux->imc = imc;
+}
+
+/*
+ * Queues the programming of the counters and filters of all CHAs for group g.
+ * Unused counters are disabled.
+ */
+static void queue_group(struct pmon_mux *mux, struct msr_batch *b, int g)
+{
+	int start = mux->group_start[g], size = mux->group_start[g + 1] - start;
+	uint64_t filter0 = PMON_FILTER0_NONE, filter1 = PMON_FILTER1_NONE;
+	for (int i = 0; i < size; i++) {
+		if (mux->events[start + i]->uses_filters) {
+			filter0 = mux->events[start + i]->filter0;
+			filter1 = mux->events[start + i]->filter1;
+		}
+	}
+
+	for (int cha = 0; cha < NUM_CHA; cha++) {
+		for (int i = 0; i < PMON_CTRS_PER_BOX; i++) {
+			if (i < size) {
+				batch_pmon_cha_msr_ctr_ctrl_reg(b, CHA_MSR_PMON_CTRL(cha, i), mux->events[start + i]->event_code,
+												mux->events[start + i]->umask);
+			} else {
+				msr_batch_write(b, CHA_MSR_PMON_CTRL(cha, i), 0);
+			}
+		}
+		msr_batch_write(b, CHA_MSR_PMON_FILTER0_BASE + cha * 0x10UL, filter0);
+		msr_batch_write(b, CHA_MSR_PMON_FILTER1_BASE + cha * 0x10UL, filter1);
+	}
+}
+
+/**
+ * Resets the counters of all CHAs and starts counting the first group.
+ */
+void pmon_mux_start(struct pmon_mux *mux, struct msr_batch *b)
+{
+	batch_freeze_all_counters(b);
+	msr_batch_write(b, U_MSR_PMON_UCLK_FIXED_CTL, 1UL << PMON_CTL_en);
+	for (int cha = 0; cha < NUM_CHA; cha++) {
+		batch_reset_counters(b, cha);
+	}
+	queue_group(mux, b, 0);
+	msr_batch_read(b, U_MSR_PMON_UCLK_FIXED_CTR, PMON_CTR_MASK, &mux->prev_uclk);
+	if (mux->imc != NULL) {
+		imc_pmon_queue_start(mux->imc, b);
+	}
+	batch_unfreeze_all_counters(b);
+	msr_batch_submit(b);
+
+	memset(mux->prev_ctr, 0, sizeof(mux->prev_ctr));
+	mux->current = 0;
+	mux->rotations = 0;
+	pmon_mux_clear(mux);
+}
+
+/*
+ * Freezes the counters and adds what the current group counted since the
+ * last readout. If next >= 0, the counters are then programmed for group next
+ * and unfrozen, in the same batch.
+ */
+static void readout(struct pmon_mux *mux, struct msr_batch *b, int next)
+{
+	batch_freeze_all_counters(b);
+	for (int cha = 0; cha < NUM_CHA; cha++) {
+		for (int i = 0; i < PMON_CTRS_PER_BOX; i++) {
+			batch_read_pmon_cha_msr_ctr_reg(b, cha, i, &mux->now_ctr[cha][i]);
+		}
+	}
+	msr_batch_read(b, U_MSR_PMON_UCLK_FIXED_CTR, PMON_CTR_MASK, &mux->now_uclk);
+	if (mux->imc != NULL) {
+		imc_pmon_queue_read(mux->imc, b);
+	}
+	if (next >= 0) {
+		if (next != mux->current) {
+			queue_group(mux, b, next);
+		}
+		batch_unfreeze_all_counters(b);
+	}
+	msr_batch_submit(b);
+	if (mux->imc != NULL) {
+		imc_pmon_update(mux->imc);
+	}
+
+	// The counters are 48 bits wide: deltas modulo 2^48 survive a wraparound
+	uint64_t ticks = (mux->now_uclk - mux->prev_uclk) & PMON_CTR_MASK;
+	int start = mux->group_start[mux->current], size = mux->group_start[mux->current + 1] - start;
+	for (int cha = 0; cha < NUM_CHA; cha++) {
+		for (int i = 0; i < size; i++) {
+			mux->counts[cha][start + i] += (mux->now_ctr[cha][i] - mux->prev_ctr[cha][i]) & PMON_CTR_MASK;
+		}
+	}
+	for (int i = 0; i < size; i++) {
+		mux->enabled[start + i] += ticks;
+	}
+	mux->elapsed += ticks;
+
+	memcpy(mux->prev_ctr, mux->now_ctr, sizeof(mux->prev_ctr));
+	mux->prev_uclk = mux->now_uclk;
+}
+
+/**
+ * Reads out the current group and switches to the next one, in one batch.
+ */
+void pmon_mux_rotate(struct pmon_mux *mux, struct msr_batch *b)
+{
+	int next = (mux->current + 1) % mux->nr_groups;
+	readout(mux, b, next);
+	mux->current = next;
+	mux->rotations++;
+}
+
+/**
+ * Reads out the current group and leaves the counters frozen.
+ */
+void pmon_mux_stop(struct pmon_mux *mux, struct msr_batch *b)
+{
+	readout(mux, b, -1);
+}
+
+/**
+ * Clears the accumulated counts (the counters keep running).
+ */
+void pmon_mux_clear(struct pmon_mux *mux)
+{
+	memset(mux->counts, 0, sizeof(mux->counts));
+	memset(mux->enabled, 0, sizeof(mux->enabled));
+	mux->elapsed = 0;
+	if (mux->imc != NULL) {
+		imc_pmon_clear(mux->imc);
+	}
+}
+
+/**
+ * Returns the count of an event at a CHA, scaled from the time the event was
+ * counted for to the whole time (as perf does).
+ */
+double pmon_mux_scaled(const struct pmon_mux *mux, int cha, int event)
+{
+	if (mux->enabled[event] == 0) {
+		return 0;
+	}
+	return (double)mux->counts[cha][event] * mux->elapsed / mux->enabled[event];
+}
+
+/**
+ * Returns the count of an event at a CHA per uncore clock tick it was
+ * counted for.
+ */
+double pmon_mux_rate(const struct pmon_mux *mux, int cha, int event)
+{
+	if (mux->enabled[event] == 0) {
+		return 0;
+	}
+	return (double)mux->counts[cha][event] / mux->enabled[event];
+}
@@ -0,0 +1,91 @@
+/**
+ * pmon_events.h
+ *
+ * Named CHA PMON events and a multiplexer that counts more events than a CHA
+ * has counters.
+ *
+ * Each CHA PMON box has 4 counters and one pair of filter registers. The
+ * multiplexer splits the requested events into groups of up to 4 events with
+ * compatible filters, counts one group at a time on all CHAs and rotates to
+ * the next group each time pmon_mux_rotate is called, the way perf multiplexes
+ * core events. Like perf, it keeps how long each event was counted for, so
+ * that its count can be scaled to the whole run (pmon_mux_scaled).
+ *
+ * The time base is the U-box fixed counter of the uncore clock, read in the
+ * same batch as the CHA counters: "enabled" and "elapsed" are in uncore clock
+ * ticks, so pmon_mux_rate of a ring-in-use event is the ring utilization.
+ *
+ * The counters are never reset between rotations: the multiplexer keeps the
+ * last value of each counter and accumulates the deltas modulo 2^48, so a
+ * counter wrapping around does not corrupt the counts.
+ *
+ * The DRAM traffic counters of imc_pmon.h can be attached to a multiplexer
+ * (pmon_mux_attach_imc): they are then started, read and cleared with the CHA
+ * counters, in the same bursts and freeze windows.
+ */
+
+#ifndef PMON_EVENTS_H_
+#define PMON_EVENTS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "imc_pmon.h"
+#include "machine_const.h"
+#include "msr_transport.h"
+
+#define PMON_CTRS_PER_BOX 4
+#define PMON_MUX_MAX_EVENTS 64
+#define PMON_MUX_MAX_GROUPS PMON_MUX_MAX_EVENTS
+
+// Filter register values of the events that do not filter (2.2.6.2)
+#define PMON_FILTER0_NONE 0x0UL
+#define PMON_FILTER1_NONE 0x3BUL
+
+struct pmon_event {
+	const char *name;
+	uint64_t event_code;
+	uint64_t umask;
+	int uses_filters; /* Whether the event depends on the filter registers */
+	uint64_t filter0;
+	uint64_t filter1;
+};
+
+const struct pmon_event *pmon_event_find(const char *name);
+
+struct pmon_mux {
+	int nr_events;
+	const struct pmon_event *events[PMON_MUX_MAX_EVENTS];
+
+	// Group g has the events [group_start[g], group_start[g + 1]); the
+	// i-th event of a group is counted on counter i
+	int nr_groups;
+	int group_start[PMON_MUX_MAX_GROUPS + 1];
+	int current;		/* Group being counted */
+	uint64_t rotations;
+
+	// Last values read from the counters, and read buffers
+	uint64_t prev_ctr[NUM_CHA][PMON_CTRS_PER_BOX];
+	uint64_t prev_uclk;
+	uint64_t now_ctr[NUM_CHA][PMON_CTRS_PER_BOX];
+	uint64_t now_uclk;
+
+	// Accumulated since pmon_mux_start or pmon_mux_clear
+	uint64_t counts[NUM_CHA][PMON_MUX_MAX_EVENTS];
+	uint64_t enabled[PMON_MUX_MAX_EVENTS];	/* Uncore clock ticks each event was counted for */
+	uint64_t elapsed;						/* Uncore clock ticks in total */
+
+	struct imc_pmon *imc;	/* DRAM traffic counters read with the CHAs, or NULL */
+};
+
+int pmon_mux_init(struct pmon_mux *mux, const char *const names[], int nr_names);
+int pmon_mux_find(const struct pmon_mux *mux, const char *name);
+void pmon_mux_attach_imc(struct pmon_mux *mux, struct imc_pmon *imc);
+void pmon_mux_start(struct pmon_mux *mux, struct msr_batch *b);
+void pmon_mux_rotate(struct pmon_mux *mux, struct msr_batch *b);
+void pmon_mux_stop(struct pmon_mux *mux, struct msr_batch *b);
+void pmon_mux_clear(struct pmon_mux *mux);
+double pmon_mux_scaled(const struct pmon_mux *mux, int cha, int event);
+double pmon_mux_rate(const struct pmon_mux *mux, int cha, int event);
+
+#endif // PMON_EVENTS_H_
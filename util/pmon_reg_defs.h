@@ -18,6 +18,12 @@
 #define U_MSR_PMON_GLOBAL_CTL_frz_all   63L      // freeze all counters
 #define U_MSR_PMON_GLOBAL_CTL_unfrz_all 61L      // unfreeze all counters
 
+// U-box fixed counter of the uncore clock (UCLK), UPMRM Section 2.8
+// The mesh (CMS) runs on the uncore clock, so this counts the same ticks as
+// the CMS_CLOCKTICKS event without using one of the 4 counters of a CHA
+#define U_MSR_PMON_UCLK_FIXED_CTL   0x0703L      // only the enable bit (PMON_CTL_en) is used
+#define U_MSR_PMON_UCLK_FIXED_CTR   0x0704L
+
 // PMON Counter Control Register Bit Offsets
 // UPMRM Section 1.4.1
 #define PMON_CTL_en     22L     // enable counter
@@ -67,4 +73,41 @@
 #define BYPASS_CHA_IMC 0x57UL
 #define IMC_READS_COUNT 0x59UL
 
+// The IMC and M2M boxes are in PCI configuration space (UPMRM 1.8.2), on the
+// uncore bus of each socket. Their counters are 48 bits wide in 64-bit
+// registers, and they are frozen by the global control (U_MSR_PMON_GLOBAL_CTL)
+#define PCI_VENDOR_INTEL 0x8086
+
+// Box control bits (UPMRM 1.4.2), same as the 0x3 written to the CHA unit control
+#define PCI_PMON_BOX_CTL_rst_ctrl 0L    // reset the control registers
+#define PCI_PMON_BOX_CTL_rst_ctrs 1L    // reset the counters
+
+// IMC channels, UPMRM Section 2.3: 2 memory controllers of 3 channels each.
+// The three channels of a controller have different device IDs
+#define IMC_PCI_DEVICE_CH0 0x2042
+#define IMC_PCI_DEVICE_CH1 0x2046
+#define IMC_PCI_DEVICE_CH2 0x204a
+#define IMC_PCI_PMON_BOX_CTL 0xF4
+#define IMC_PCI_PMON_CTL(n) (0xD8 + 4 * (n))   // 32-bit
+#define IMC_PCI_PMON_CTR(n) (0xA0 + 8 * (n))   // 64-bit
+#define IMC_PCI_PMON_FIXED_CTL 0xF0
+#define IMC_PCI_PMON_FIXED_CTR 0xD0            // DRAM clock ticks
+
+// PMON IMC Performance Monitoring Events, UPMRM 2.3.6
+#define CAS_COUNT 0x04UL
+#define CAS_COUNT_RD 0x03UL     // read CAS commands (regular and underfill)
+#define CAS_COUNT_WR 0x0CUL     // write CAS commands (in read and write major modes)
+
+// M2M (mesh to memory), UPMRM Section 2.4: one per memory controller
+#define M2M_PCI_DEVICE 0x2066
+#define M2M_PCI_PMON_BOX_CTL 0x258
+#define M2M_PCI_PMON_CTL(n) (0x228 + 8 * (n))  // 64-bit
+#define M2M_PCI_PMON_CTR(n) (0x200 + 8 * (n))  // 64-bit
+
+// PMON M2M Performance Monitoring Events, UPMRM 2.4.5
+#define M2M_IMC_READS 0x37UL
+#define M2M_IMC_READS_ALL 0x04UL
+#define M2M_IMC_WRITES 0x38UL
+#define M2M_IMC_WRITES_ALL 0x10UL
+
 #endif // PMON_REG_DEFS_H_
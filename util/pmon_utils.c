@@ -52,7 +52,36 @@ uint64_t read_pmon_cha_msr_ctr_reg(int msr_fd, int core, int n) {
     uint64_t msr_val;
     READ_MSR(msr_fd, CHA_MSR_PMON_CTR(core, n), msr_val);
     // Mask out lower 48 bits; higher order bits are reserved (1.4.1, Table 1-7)
-    return msr_val & 0xFFFFFFFFFFFFul; 
+    return msr_val & PMON_CTR_MASK;
+}
+
+/**
+ * Queues the write of a counter control register within a PMON unit
+ * (batched version of set_pmon_cha_msr_ctr_ctrl_reg).
+ */
+void batch_pmon_cha_msr_ctr_ctrl_reg(struct msr_batch *b, uint64_t msr_addr,
+                            uint64_t event_code, uint64_t umask) {
+    uint64_t msr_val = 1UL << PMON_CTL_en |             // enable counter
+                       event_code << PMON_CTL_ev_sel |  // select event
+                       umask << PMON_CTL_umask;         // set umask
+    msr_batch_write(b, msr_addr, msr_val);
+}
+
+/**
+ * Queues the read of a counter register within a PMON unit. The counter value
+ * (lower 48 bits) is stored in *value when the batch is submitted.
+ */
+void batch_read_pmon_cha_msr_ctr_reg(struct msr_batch *b, int core, int n, uint64_t *value) {
+    msr_batch_read(b, CHA_MSR_PMON_CTR(core, n), PMON_CTR_MASK, value);
+}
+
+/**
+ * Queues the reset of the pmon counter registers in a particular box
+ * (batched version of reset_counters).
+ */
+void batch_reset_counters(struct msr_batch *b, int core) {
+    // 1.9.2.d Reset Counters in a box
+    msr_batch_write(b, CHA_MSR_PMON_UNIT_CTRL(core), 0x3);
 }
 
 /**
@@ -164,6 +193,19 @@ void unfreeze_all_counters(int msr_fd) {
     }
 }
 
+/**
+ * Queue the freeze (or unfreeze) of all uncore counters on a batch
+ */
+void batch_freeze_all_counters(struct msr_batch *b) {
+    // 1.3.2.1 - Freeze all uncore counters by setting
+    //  U_MSR_PMON_GLOBAL_CTL.frz_all to 1
+    msr_batch_write(b, U_MSR_PMON_GLOBAL_CTL, 1UL << U_MSR_PMON_GLOBAL_CTL_frz_all);
+}
+
+void batch_unfreeze_all_counters(struct msr_batch *b) {
+    msr_batch_write(b, U_MSR_PMON_GLOBAL_CTL, 1UL << U_MSR_PMON_GLOBAL_CTL_unfrz_all);
+}
+
 int get_corresponding_cha(void *virtual_address) {
     int nr_cpus = get_active_cpus();
     // printf("DEBUG: found %d active cpus\n", nr_cpus);
@@ -182,14 +224,20 @@ int get_corresponding_cha_no_msr(void *virtual_address, int msr_fd[NUM_LOG_CORES
 
     #define CHA_TEST_REPS   10000   // Use 10k accesses to test for CHA association
 
-    int msr_readouts[NUM_LOG_CORES_PER_SOCKET * NUM_SOCKET]; // Values read from each core
+    uint64_t msr_readouts[NUM_CHA]; // Values read from each CHA
     volatile int result;
 
     uint64_t msr_num, msr_val;
     // Set up a counter in each CHA
     int core = 0; // these msrs can be accessed through any core's driver. Core 0 chosen arbitrariliy
+    // The whole setup is submitted as one batch, and so is the readout
+    static struct msr_transport transport;
+    static struct msr_batch batch;
+    msr_transport_wrap_fd(&transport, core, msr_fd[core]);
+    msr_batch_init(&batch, &transport);
+
     // 1.9.2.a - Freeze all uncore counters 
-    freeze_all_counters(msr_fd[core]);
+    batch_freeze_all_counters(&batch);
 
     for (int cha = 0; cha < NUM_CHA; cha++) {
         // Calculate all offsets (1.8.1)
@@ -201,7 +249,7 @@ int get_corresponding_cha_no_msr(void *virtual_address, int msr_fd[NUM_LOG_CORES
         // 1.9.2.d Reset counters in each box
         msr_val = 0x3;
         msr_num = cha_msr_pmon_unit_ctrl;
-        WRITE_MSR(msr_fd[core], msr_num, msr_val);
+        msr_batch_write(&batch, msr_num, msr_val);
 
         // 1.9.2.b Enable counting for each monitor
         // 1.9.2.c Select event to monitor (i.e. program event control register umask and ev_sel bits)
@@ -212,22 +260,23 @@ int get_corresponding_cha_no_msr(void *virtual_address, int msr_fd[NUM_LOG_CORES
         // #ifdef DEBUG
         // printf("DEBUG: Write cha%02d_msr_pmon_ctrl0 (0x%lx): 0x%lx\n", cha, msr_num, msr_val);
         // #endif
-        WRITE_MSR(msr_fd[core], msr_num, msr_val);
+        msr_batch_write(&batch, msr_num, msr_val);
 
         // Set CHAFilter0[26:17] (2.2.6.2)
         // 0xFF = count all states
         msr_val = 0xFFUL << CHA_MSR_PMON_FILTER0_state;
         msr_num = cha_msr_pmon_filter0;
-        WRITE_MSR(msr_fd[core], msr_num, msr_val);
+        msr_batch_write(&batch, msr_num, msr_val);
 
         // Turn off Filter1 (2.2.6.2, see Note under Table 2-54)
         msr_val = 0x3BUL;
         msr_num = cha_msr_pmon_filter1;
-        WRITE_MSR(msr_fd[core], msr_num, msr_val);
+        msr_batch_write(&batch, msr_num, msr_val);
     }
 
     // 1.9.2.f Enable counting on global level 
-    unfreeze_all_counters(msr_fd[core]);
+    batch_unfreeze_all_counters(&batch);
+    msr_batch_submit(&batch);
 
     // counting has started
 
@@ -237,9 +286,13 @@ int get_corresponding_cha_no_msr(void *virtual_address, int msr_fd[NUM_LOG_CORES
     }
 
     // 1.9.3.a Freeze values globally
-    freeze_all_counters(msr_fd[core]);
+    // and read value from all CHAs from Ctr0
+    batch_freeze_all_counters(&batch);
+    for (int cha = 0; cha < NUM_CHA; cha++) {
+        batch_read_pmon_cha_msr_ctr_reg(&batch, cha, 0, &msr_readouts[cha]);
+    }
+    msr_batch_submit(&batch);
 
-    // Read value from all CHAs from Ctr0
     // Store the highest count and the second highest count from the counters
     int max_count = 0;
     int max_count_cha = 0;
@@ -247,11 +300,7 @@ int get_corresponding_cha_no_msr(void *virtual_address, int msr_fd[NUM_LOG_CORES
     int second_max_count_cha = 0;
 
     for (int cha = 0; cha < NUM_CHA; cha++) {
-        uint64_t cha_msr_pmon_ctr0 = CHA_MSR_PMON_CTR_BASE + cha * 0x10;
-        msr_num = cha_msr_pmon_ctr0;
-        READ_MSR(msr_fd[core], msr_num, msr_val);
-        // mask out lower 48 bits; higher order bits are reserved (1.4.1, Table 1-7)
-        msr_val &= 0xFFFFFFFFFFFF; 
+        msr_val = msr_readouts[cha];
 
         if (msr_val > max_count) {
             second_max_count = max_count;
@@ -310,23 +359,29 @@ void *get_addr_in_core(int core, void *buf, long buf_size) {
     return (void *)target;
 }
 
+/*
+ * The set_*_ring_monitoring helpers below queue the writes of the 4 counter
+ * control registers of a core on a batch; submit the batch (together with the
+ * freeze, reset and unfreeze writes) to program the counters.
+ */
+
 /**
  * Sets all 4 counters on a core to measure the four directions of the AD ring.
  */
-void set_ad_ring_monitoring(int msr_fd, int core) {
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+void set_ad_ring_monitoring(struct msr_batch *b, int core) {
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 0), 
                                     VERT_RING_AD_IN_USE, 
                                     0x3UL); // 0x3 = umask for up ring (even and odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 1),
                                     VERT_RING_AD_IN_USE, 
                                     0xcUL); // 0xc = umask for down ring (even and odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 2),
                                     HORZ_RING_AD_IN_USE, 
                                     0x3UL); // 0x3 = umask for left ring (even and odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 3),
                                     HORZ_RING_AD_IN_USE, 
                                     0xcUL); // 0xc = umask for right ring (even and odd)
@@ -335,20 +390,20 @@ void set_ad_ring_monitoring(int msr_fd, int core) {
 /**
  * Sets all 4 counters on a core to measure the vertical directions of the AD ring.
  */
-void set_ad_vert_ring_monitoring(int msr_fd, int core) {
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+void set_ad_vert_ring_monitoring(struct msr_batch *b, int core) {
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 0), 
                                     VERT_RING_AD_IN_USE, 
                                     0x1UL); // 0x1 = umask for up ring (even)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 1),
                                     VERT_RING_AD_IN_USE, 
                                     0x2UL); // 0x2 = umask for up ring (odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 2),
                                     VERT_RING_AD_IN_USE, 
                                     0x4UL); // 0x4 = umask for down ring (even)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 3),
                                     VERT_RING_AD_IN_USE, 
                                     0x8UL); // 0x8 = umask for down ring (odd)
@@ -357,20 +412,20 @@ void set_ad_vert_ring_monitoring(int msr_fd, int core) {
 /**
  * Sets all 4 counters on a core to measure the vertical directions of the AD ring.
  */
-void set_ad_horz_ring_monitoring(int msr_fd, int core) {
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+void set_ad_horz_ring_monitoring(struct msr_batch *b, int core) {
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 0), 
                                     HORZ_RING_AD_IN_USE, 
                                     0x1UL); // 0x1 = umask for up ring (even)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 1),
                                     HORZ_RING_AD_IN_USE, 
                                     0x2UL); // 0x2 = umask for up ring (odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 2),
                                     HORZ_RING_AD_IN_USE, 
                                     0x4UL); // 0x4 = umask for down ring (even)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 3),
                                     HORZ_RING_AD_IN_USE, 
                                     0x8UL); // 0x8 = umask for down ring (odd)
@@ -379,20 +434,20 @@ void set_ad_horz_ring_monitoring(int msr_fd, int core) {
 /**
  * Sets all 4 counters on a core to measure the four directions of the IV ring.
  */
-void set_iv_ring_monitoring(int msr_fd, int core) {
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+void set_iv_ring_monitoring(struct msr_batch *b, int core) {
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 0), 
                                     VERT_RING_IV_IN_USE, 
                                     0x1UL); // 0x1 = umask for up ring
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 1),
                                     VERT_RING_IV_IN_USE, 
                                     0x4UL); // 0x4 = umask for down ring
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 2),
                                     HORZ_RING_IV_IN_USE, 
                                     0x1UL); // 0x1 = umask for left ring
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 3),
                                     HORZ_RING_IV_IN_USE, 
                                     0x4UL); // 0x4 = umask for right ring
@@ -401,20 +456,20 @@ void set_iv_ring_monitoring(int msr_fd, int core) {
 /**
  * Sets all 4 counters on a core to measure the four directions of the AK ring.
  */
-void set_ak_ring_monitoring(int msr_fd, int core) {
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+void set_ak_ring_monitoring(struct msr_batch *b, int core) {
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 0), 
                                     VERT_RING_AK_IN_USE, 
                                     0x3UL); // 0x3 = umask for up ring (even and odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 1),
                                     VERT_RING_AK_IN_USE, 
                                     0xcUL); // 0xc = umask for down ring (even and odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 2),
                                     HORZ_RING_AK_IN_USE, 
                                     0x3UL); // 0x3 = umask for left ring (even and odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 3),
                                     HORZ_RING_AK_IN_USE, 
                                     0xcUL); // 0xc = umask for right ring (even and odd)
@@ -422,20 +477,20 @@ void set_ak_ring_monitoring(int msr_fd, int core) {
 /**
  * Sets all 4 counters on a core to measure the horizontal direction of the AK ring.
  */
-void set_ak_horz_ring_monitoring(int msr_fd, int core) {
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+void set_ak_horz_ring_monitoring(struct msr_batch *b, int core) {
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 0), 
                                     HORZ_RING_AK_IN_USE, 
                                     0x1UL); // 0x1 = umask for left even
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 1),
                                     HORZ_RING_AK_IN_USE, 
                                     0x2UL); // 0xc = umask for left odd
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 2),
                                     HORZ_RING_AK_IN_USE, 
                                     0x4UL); // 0x3 = umask for right even
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 3),
                                     HORZ_RING_AK_IN_USE, 
                                     0x8UL); // 0xc = umask for right odd
@@ -444,20 +499,20 @@ void set_ak_horz_ring_monitoring(int msr_fd, int core) {
 /**
  * Sets all 4 counters on a core to measure the vertical direction of the AK ring.
  */
-void set_ak_vert_ring_monitoring(int msr_fd, int core) {
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+void set_ak_vert_ring_monitoring(struct msr_batch *b, int core) {
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 0), 
                                     VERT_RING_AK_IN_USE, 
                                     0x1UL); // 0x1 = umask for up even
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 1),
                                     VERT_RING_AK_IN_USE, 
                                     0x2UL); // 0xc = umask for up odd
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 2),
                                     VERT_RING_AK_IN_USE, 
                                     0x4UL); // 0x3 = umask for down even
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 3),
                                     VERT_RING_AK_IN_USE, 
                                     0x8UL); // 0xc = umask for down odd
@@ -466,20 +521,20 @@ void set_ak_vert_ring_monitoring(int msr_fd, int core) {
 /**
  * Sets all 4 counters on a core to measure the four directions of the BL ring.
  */
-void set_bl_ring_monitoring(int msr_fd, int core) {
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+void set_bl_ring_monitoring(struct msr_batch *b, int core) {
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 0), 
                                     VERT_RING_BL_IN_USE, 
                                     0x3UL); // 0x3 = umask for up ring (even and odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 1),
                                     VERT_RING_BL_IN_USE, 
                                     0xcUL); // 0xc = umask for down ring (even and odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 2),
                                     HORZ_RING_BL_IN_USE, 
                                     0x3UL); // 0x3 = umask for left ring (even and odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 3),
                                     HORZ_RING_BL_IN_USE, 
                                     0xcUL); // 0xc = umask for right ring (even and odd)
@@ -488,20 +543,20 @@ void set_bl_ring_monitoring(int msr_fd, int core) {
 /**
  * Sets all 4 counters on a core to measure the vertical directions of the BL ring.
  */
-void set_bl_vert_ring_monitoring(int msr_fd, int core) {
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+void set_bl_vert_ring_monitoring(struct msr_batch *b, int core) {
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 0), 
                                     VERT_RING_BL_IN_USE, 
                                     0x1UL); // 0x1 = umask for up ring (even)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 1),
                                     VERT_RING_BL_IN_USE, 
                                     0x2UL); // 0x2 = umask for up ring (odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 2),
                                     VERT_RING_BL_IN_USE, 
                                     0x4UL); // 0x4 = umask for down ring (even)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 3),
                                     VERT_RING_BL_IN_USE, 
                                     0x8UL); // 0x8 = umask for down ring (odd)
@@ -509,20 +564,20 @@ void set_bl_vert_ring_monitoring(int msr_fd, int core) {
 /**
  * Sets all 4 counters on a core to measure the vert and horiz AD and BL traffic
  */
-void set_ad_bl_ring_monitoring(int msr_fd, int core) {
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+void set_ad_bl_ring_monitoring(struct msr_batch *b, int core) {
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 0), 
                                     VERT_RING_AD_IN_USE, 
                                     0xfUL); // 0xf = umask for up and down ring
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 1),
                                     HORZ_RING_AD_IN_USE, 
                                     0xfUL); // 0xf = umask for left and right ring
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 2),
                                     VERT_RING_BL_IN_USE, 
                                     0xfUL); // 0xf = umask for up and down ring
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 3),
                                     HORZ_RING_BL_IN_USE, 
                                     0xfUL); // 0xf = umask for left and right ring
@@ -531,20 +586,20 @@ void set_ad_bl_ring_monitoring(int msr_fd, int core) {
 /**
  * Sets all 4 counters on a core to measure the horizontal directions of the BL ring.
  */
-void set_bl_horz_ring_monitoring(int msr_fd, int core) {
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+void set_bl_horz_ring_monitoring(struct msr_batch *b, int core) {
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 0), 
                                     HORZ_RING_BL_IN_USE, 
                                     0x1UL); // 0x1 = umask for left ring (even)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 1),
                                     HORZ_RING_BL_IN_USE, 
                                     0x2UL); // 0x2 = umask for left ring (odd)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 2),
                                     HORZ_RING_BL_IN_USE, 
                                     0x4UL); // 0x4 = umask for right ring (even)
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 3),
                                     HORZ_RING_BL_IN_USE, 
                                     0x8UL); // 0x8 = umask for right ring (odd)
@@ -553,20 +608,20 @@ void set_bl_horz_ring_monitoring(int msr_fd, int core) {
 /**
  * Sets all 4 counters on a core to measure the vert and horiz AK and IV traffic
  */
-void set_ak_iv_ring_monitoring(int msr_fd, int core) {
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+void set_ak_iv_ring_monitoring(struct msr_batch *b, int core) {
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 0), 
                                     VERT_RING_AK_IN_USE, 
                                     0xfUL); // 0xf = umask for up and down ring
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 1),
                                     HORZ_RING_AK_IN_USE, 
                                     0xfUL); // 0xf = umask for left and right ring
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 2),
                                     VERT_RING_IV_IN_USE, 
                                     0x5UL); // 0x5 = umask for up and down ring
-    set_pmon_cha_msr_ctr_ctrl_reg(msr_fd, 
+    batch_pmon_cha_msr_ctr_ctrl_reg(b, 
                                     CHA_MSR_PMON_CTRL(core, 3),
                                     HORZ_RING_IV_IN_USE, 
                                     0x5UL); // 0x5 = umask for left and right ring
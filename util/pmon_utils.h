@@ -16,8 +16,10 @@
 #include <stdlib.h>
 #include "pmon_reg_defs.h"
 #include "machine_const.h"
+#include "msr_transport.h"
 
 #define MAX_FILENAME_LEN 100
+#define PMON_CTR_MASK 0xFFFFFFFFFFFFul  // counters are 48 bits wide; higher order bits are reserved (1.4.1, Table 1-7)
 
 #define WRITE_MSR(msr_fd, offset, value) pwrite(msr_fd, &value, sizeof(value), offset)
 #define READ_MSR(msr_fd, offset, value) pread(msr_fd, &value, sizeof(value), offset)
@@ -27,6 +29,15 @@ void set_pmon_cha_msr_ctr_ctrl_reg(int msr_fd, uint64_t msr_addr,
                             uint64_t event_code, uint64_t umask);
 uint64_t read_pmon_cha_msr_ctr_reg(int msr_fd, int core, int n);
 
+// Batched versions (see msr_transport.h): these queue the register accesses
+// on a batch, and take effect when the batch is submitted
+void batch_pmon_cha_msr_ctr_ctrl_reg(struct msr_batch *b, uint64_t msr_addr,
+                            uint64_t event_code, uint64_t umask);
+void batch_read_pmon_cha_msr_ctr_reg(struct msr_batch *b, int core, int n, uint64_t *value);
+void batch_reset_counters(struct msr_batch *b, int core);
+void batch_freeze_all_counters(struct msr_batch *b);
+void batch_unfreeze_all_counters(struct msr_batch *b);
+
 int cpu_to_core(int cpu);
 int core_to_cpu(int core);
 int get_active_cpus(void);
@@ -54,17 +65,17 @@ int get_corresponding_cha_no_msr(void *virtual_address, int msr_fd[NUM_LOG_CORES
 int get_corresponding_cha(void *virtual_address);
 void *get_addr_in_core(int core, void *buf, long buf_size);
 enum Ring {AD, IV, AK, BL};
-void set_ad_ring_monitoring(int msr_fd, int core);
-void set_ad_vert_ring_monitoring(int msr_fd, int core);
-void set_ad_horz_ring_monitoring(int msr_fd, int core);
-void set_iv_ring_monitoring(int msr_fd, int core);
-void set_ak_ring_monitoring(int msr_fd, int core);
-void set_ak_horz_ring_monitoring(int msr_fd, int core);
-void set_ak_vert_ring_monitoring(int msr_fd, int core);
-void set_bl_ring_monitoring(int msr_fd, int core);
-void set_bl_vert_ring_monitoring(int msr_fd, int core);
-void set_bl_horz_ring_monitoring(int msr_fd, int core);
-void set_ad_bl_ring_monitoring(int msr_fd, int core);
-void set_ak_iv_ring_monitoring(int msr_fd, int core);
+void set_ad_ring_monitoring(struct msr_batch *b, int core);
+void set_ad_vert_ring_monitoring(struct msr_batch *b, int core);
+void set_ad_horz_ring_monitoring(struct msr_batch *b, int core);
+void set_iv_ring_monitoring(struct msr_batch *b, int core);
+void set_ak_ring_monitoring(struct msr_batch *b, int core);
+void set_ak_horz_ring_monitoring(struct msr_batch *b, int core);
+void set_ak_vert_ring_monitoring(struct msr_batch *b, int core);
+void set_bl_ring_monitoring(struct msr_batch *b, int core);
+void set_bl_vert_ring_monitoring(struct msr_batch *b, int core);
+void set_bl_horz_ring_monitoring(struct msr_batch *b, int core);
+void set_ad_bl_ring_monitoring(struct msr_batch *b, int core);
+void set_ak_iv_ring_monitoring(struct msr_batch *b, int core);
 
 #endif // PMON_UTILS_H_
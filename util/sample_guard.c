@@ -0,0 +1,202 @@
+/**
+ * sample_guard.c
+ *
+ * Gap logging and /proc/interrupts snapshots (see sample_guard.h).
+ */
+
+#include "sample_guard.h"
+#include "host_profile.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define IRQ_LINE_LEN 4096
+
+/**
+ * Returns the gap bound of this host from the latency profile,
+ * or GAP_DEFAULT_BOUND if the host has not been calibrated.
+ */
+uint32_t gap_bound_from_profile(void)
+{
+	return host_profile_get_int_or(HOST_PROFILE_LATENCY, "gap_bound", GAP_DEFAULT_BOUND);
+}
+
+void gap_log_init(struct gap_log *log, uint32_t bound, uint32_t settle)
+{
+	log->bound = bound;
+	log->settle = settle > 0 ? settle : 1;
+	log->prev = 0;
+	log->period = UINT32_MAX;
+	gap_log_reset(log);
+}
+
+/**
+ * Tags the samples [index, index + settle) as affected by a gap of the given
+ * length. Overlapping or adjacent ranges are merged. When the log is full, the
+ * last range is extended up to the new one, so that no sample hit by a gap is
+ * left untagged (the samples in between are dropped with them).
+ */
+void gap_log_record(struct gap_log *log, uint32_t index, uint32_t cycles)
+{
+	uint32_t last = index + log->settle - 1;
+	log->count++;
+
+	if (log->nr_ranges > 0) {
+		struct gap_range *range = &log->ranges[log->nr_ranges - 1];
+		if (index <= range->last + 1) {
+			if (last > range->last) {
+				range->last = last;
+			}
+			if (cycles > range->cycles) {
+				range->cycles = cycles;
+			}
+			return;
+		}
+	}
+
+	if (log->nr_ranges < GAP_MAX_RANGES) {
+		log->ranges[log->nr_ranges].first = index;
+		log->ranges[log->nr_ranges].last = last;
+		log->ranges[log->nr_ranges].cycles = cycles;
+		log->nr_ranges++;
+	} else {
+		struct gap_range *range = &log->ranges[log->nr_ranges - 1];
+		range->last = last;
+		if (cycles > range->cycles) {
+			range->cycles = cycles;
+		}
+	}
+}
+
+/**
+ * Writes the tagged ranges to filename as "<first> <last> <gap cycles>" lines.
+ * If given, the interrupts between the two snapshots are written as comments.
+ * Returns 0 on success and -1 if the file cannot be written.
+ */
+int gap_log_write(const struct gap_log *log, const char *filename,
+				  const struct irq_snapshot *before, const struct irq_snapshot *after)
+{
+	FILE *f = fopen(filename, "w");
+	if (f == NULL) {
+		perror("fopen gap log");
+		return -1;
+	}
+
+	fprintf(f, "# gap_bound %" PRIu32 " gaps %d\n", log->bound, log->count);
+	if (before != NULL && after != NULL) {
+		irq_snapshot_report(f, "# ", before, after);
+	}
+	for (int i = 0; i < log->nr_ranges; i++) {
+		fprintf(f, "%" PRIu32 " %" PRIu32 " %" PRIu32 "\n",
+				log->ranges[i].first, log->ranges[i].last, log->ranges[i].cycles);
+	}
+
+	fclose(f);
+	return 0;
+}
+
+/**
+ * Reads the interrupt counters of the given CPU from /proc/interrupts.
+ * Returns 0 on success and -1 if the file cannot be parsed.
+ */
+int irq_snapshot_take(int cpu, struct irq_snapshot *snap)
+{
+	static char line[IRQ_LINE_LEN];
+	snap->cpu = cpu;
+	snap->nr_sources = 0;
+
+	FILE *f = fopen("/proc/interrupts", "r");
+	if (f == NULL) {
+		perror("fopen /proc/interrupts");
+		return -1;
+	}
+
+	// The header lists the online CPUs, which are not necessarily contiguous
+	int column = -1, nr_columns = 0;
+	if (fgets(line, sizeof(line), f) == NULL) {
+		fclose(f);
+		return -1;
+	}
+	for (char *tok = strtok(line, " \t\n"); tok != NULL; tok = strtok(NULL, " \t\n"), nr_columns++) {
+		int id;
+		if (sscanf(tok, "CPU%d", &id) == 1 && id == cpu) {
+			column = nr_columns;
+		}
+	}
+	if (column < 0) {
+		fprintf(stderr, "[ERROR] cpu %d not found in /proc/interrupts\n", cpu);
+		fclose(f);
+		return -1;
+	}
+
+	// Each line is "<name>: <count per CPU> <description>"; some lines
+	// (e.g., ERR and MIS) only have one count
+	while (fgets(line, sizeof(line), f) != NULL && snap->nr_sources < IRQ_MAX_SOURCES) {
+		char *colon = strchr(line, ':');
+		if (colon == NULL) {
+			continue;
+		}
+		*colon = '\0';
+
+		char *name = line;
+		while (*name == ' ') {
+			name++;
+		}
+
+		char *p = colon + 1, *end;
+		uint64_t count = 0;
+		int i;
+		for (i = 0; i <= column; i++) {
+			count = strtoull(p, &end, 10);
+			if (end == p) {
+				break;
+			}
+			p = end;
+		}
+		if (i <= column) {
+			continue;
+		}
+
+		snprintf(snap->names[snap->nr_sources], sizeof(snap->names[snap->nr_sources]), "%.*s", IRQ_NAME_LEN - 1, name);
+		snap->counts[snap->nr_sources] = count;
+		snap->nr_sources++;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+/**
+ * Prints the interrupts the CPU received between two snapshots as
+ * "<prefix>interrupts on cpu <cpu>: <total> (<name> <count>, ...)".
+ * Returns the total number of interrupts.
+ */
+uint64_t irq_snapshot_report(FILE *f, const char *prefix, const struct irq_snapshot *before, const struct irq_snapshot *after)
+{
+	uint64_t total = 0;
+	for (int i = 0; i < after->nr_sources; i++) {
+		for (int j = 0; j < before->nr_sources; j++) {
+			if (strcmp(after->names[i], before->names[j]) == 0) {
+				total += after->counts[i] - before->counts[j];
+				break;
+			}
+		}
+	}
+
+	fprintf(f, "%sinterrupts on cpu %d: %" PRIu64, prefix, after->cpu, total);
+	const char *sep = " (";
+	for (int i = 0; i < after->nr_sources; i++) {
+		for (int j = 0; j < before->nr_sources; j++) {
+			if (strcmp(after->names[i], before->names[j]) == 0) {
+				if (after->counts[i] != before->counts[j]) {
+					fprintf(f, "%s%s %" PRIu64, sep, after->names[i], after->counts[i] - before->counts[j]);
+					sep = ", ";
+				}
+				break;
+			}
+		}
+	}
+	fprintf(f, "%s\n", total > 0 ? ")" : "");
+
+	return total;
+}
@@ -0,0 +1,114 @@
+/**
+ * sample_guard.h
+ *
+ * Detection of samples corrupted by interrupts, SMIs or preemption.
+ *
+ * The probe loops record the TSC at the start of each sample. When the core
+ * is taken away from us, the time between two consecutive samples jumps by
+ * thousands of cycles. gap_check compares that time against the fastest
+ * iteration seen so far and logs a gap when the excess is above a bound
+ * calibrated by 00-host-profile/calibrate-latency (gap_bound in the latency
+ * profile). Each gap tags a range of samples that post-processing can drop
+ * (or that the caller can re-take).
+ *
+ * The irq_snapshot functions read the per-CPU counters in /proc/interrupts so
+ * that a run can report which interrupts hit its core.
+ */
+
+#ifndef SAMPLE_GUARD_H_
+#define SAMPLE_GUARD_H_
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#define GAP_DEFAULT_BOUND 2000	 /* Used when the host has no latency profile */
+#define GAP_SETTLE_SAMPLES 16	 /* Samples after a gap that are still affected (e.g., by cache pollution) */
+#define GAP_MAX_RANGES 4096		 /* Ranges logged per run; further gaps extend the last range */
+
+#define IRQ_MAX_SOURCES 1024
+#define IRQ_NAME_LEN 16
+
+struct gap_range {
+	uint32_t first;	 /* First tagged sample */
+	uint32_t last;	 /* Last tagged sample */
+	uint32_t cycles; /* Largest gap in the range */
+};
+
+struct gap_log {
+	uint32_t bound;	 /* Excess cycles over the fastest iteration that count as a gap */
+	uint32_t settle; /* Samples tagged after each gap */
+	uint32_t prev;	 /* Start TSC of the previous sample */
+	uint32_t period; /* Fastest iteration seen so far */
+	int count;		 /* Gaps detected (including those not logged) */
+	int nr_ranges;
+	struct gap_range ranges[GAP_MAX_RANGES];
+};
+
+struct irq_snapshot {
+	int cpu;
+	int nr_sources;
+	char names[IRQ_MAX_SOURCES][IRQ_NAME_LEN];
+	uint64_t counts[IRQ_MAX_SOURCES];
+};
+
+uint32_t gap_bound_from_profile(void);
+void gap_log_init(struct gap_log *log, uint32_t bound, uint32_t settle);
+void gap_log_record(struct gap_log *log, uint32_t index, uint32_t cycles);
+
+/*
+ * Starts (or restarts) gap detection; start is the TSC right before the loop.
+ * The ranges logged so far are kept.
+ */
+static inline void gap_log_arm(struct gap_log *log, uint32_t start)
+{
+	log->prev = start;
+	log->period = UINT32_MAX;
+}
+
+/*
+ * Resumes gap detection after the caller spent time between two samples on
+ * purpose (e.g., reading counters): the next sample is checked as if the
+ * previous one had started one fastest iteration earlier.
+ */
+static inline void gap_log_resume(struct gap_log *log, uint32_t now)
+{
+	log->prev = log->period == UINT32_MAX ? now : now - log->period;
+}
+
+/*
+ * Drops all the ranges logged so far (e.g., when a window is re-taken).
+ */
+static inline void gap_log_reset(struct gap_log *log)
+{
+	log->count = 0;
+	log->nr_ranges = 0;
+}
+
+/*
+ * Checks the start TSC of sample index against the previous one.
+ * Returns 1 (and logs the range) if a gap was detected, 0 otherwise.
+ * The gap happened after the start of the previous sample, so the tagged
+ * range starts there: the interrupt may have hit its timed load.
+ * Only 32-bit arithmetic is used so the low half of the TSC is enough.
+ */
+static inline int gap_check(struct gap_log *log, uint32_t index, uint32_t start)
+{
+	uint32_t gap = start - log->prev;
+	log->prev = start;
+	if (gap < log->period) {
+		log->period = gap;
+	}
+	if (__builtin_expect(gap - log->period > log->bound, 0)) {
+		gap_log_record(log, index > 0 ? index - 1 : 0, gap);
+		return 1;
+	}
+	return 0;
+}
+
+int irq_snapshot_take(int cpu, struct irq_snapshot *snap);
+uint64_t irq_snapshot_report(FILE *f, const char *prefix, const struct irq_snapshot *before, const struct irq_snapshot *after);
+
+int gap_log_write(const struct gap_log *log, const char *filename,
+				  const struct irq_snapshot *before, const struct irq_snapshot *after);
+
+#endif // SAMPLE_GUARD_H_
@@ -0,0 +1,40 @@
+"""
+Readers for the .gaps files written next to the receiver traces.
+
+Each line of a .gaps file is "<first> <last> <gap cycles>": the samples
+first..last (inclusive) of the trace were hit by an interrupt, SMI or
+preemption. Lines starting with '#' are comments. This mirrors
+util/sample_guard.c.
+"""
+import os
+
+GAPS_SUFFIX = '.gaps'
+
+
+def load_gaps(trace_path):
+    """Return the (first, last) ranges tagged for trace_path (empty if none)."""
+    ranges = []
+    try:
+        with open(trace_path + GAPS_SUFFIX) as f:
+            for line in f:
+                parts = line.split()
+                if len(parts) != 3 or parts[0].startswith('#'):
+                    continue
+                ranges.append((int(parts[0]), int(parts[1])))
+    except FileNotFoundError:
+        pass
+    return ranges
+
+
+def has_gaps(trace_path):
+    """Return whether any sample of trace_path was tagged."""
+    return os.path.exists(trace_path + GAPS_SUFFIX) and len(load_gaps(trace_path)) > 0
+
+
+def gap_mask(trace_path, num_samples):
+    """Return a list of num_samples bools, False for the tagged samples."""
+    mask = [True] * num_samples
+    for first, last in load_gaps(trace_path):
+        for i in range(first, min(last + 1, num_samples)):
+            mask[i] = False
+    return mask
@@ -0,0 +1,99 @@
+/**
+ * tests.c
+ *
+ * Tests of the helpers in this folder that do not need the hardware.
+ * Build and run with `make tests`.
+ */
+
+#include "host_profile.h"
+#include "sample_guard.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int failed = 0;
+
+static void test_int(const char *label, long expected, long actual)
+{
+	if (expected == actual) {
+		printf("%s: PASSED\n", label);
+	} else {
+		printf("%s: FAILED; expected %ld, got %ld\n", label, expected, actual);
+		failed = 1;
+	}
+}
+
+/*
+ * Feeds the start times of a loop with the given period to gap_check, with
+ * an extra delay before sample gap_at.
+ */
+static void run_loop(struct gap_log *log, uint32_t period, uint32_t gap_at, uint32_t delay, uint32_t samples)
+{
+	uint32_t now = 1000;
+	gap_log_init(log, 500, GAP_SETTLE_SAMPLES);
+	gap_log_arm(log, now - period);
+	for (uint32_t i = 0; i < samples; i++) {
+		if (i == gap_at) {
+			now += delay;
+		}
+		gap_check(log, i, now);
+		now += period;
+	}
+}
+
+int main(void)
+{
+	static struct gap_log log;
+
+	// No gap
+	run_loop(&log, 100, UINT32_MAX, 0, 1000);
+	test_int("gap-none-count", 0, log.count);
+	test_int("gap-none-ranges", 0, log.nr_ranges);
+
+	// An interrupt between the starts of samples 99 and 100 may have hit the
+	// load of sample 99: the range starts there
+	run_loop(&log, 100, 100, 5000, 1000);
+	test_int("gap-one-count", 1, log.count);
+	test_int("gap-one-ranges", 1, log.nr_ranges);
+	test_int("gap-one-first", 99, log.ranges[0].first);
+	test_int("gap-one-last", 99 + GAP_SETTLE_SAMPLES - 1, log.ranges[0].last);
+
+	// Below the bound
+	run_loop(&log, 100, 100, 400, 1000);
+	test_int("gap-below-bound", 0, log.nr_ranges);
+
+	// A gap right after the first sample tags it
+	run_loop(&log, 100, 1, 5000, 1000);
+	test_int("gap-second-sample", 0, log.ranges[0].first);
+
+	// Rewriting a profile keeps the keys of the other tools and drops the
+	// listed ones
+	char profile_dir[] = "/tmp/host-profile-test-XXXXXX";
+	if (mkdtemp(profile_dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	setenv(HOST_PROFILE_ENV, profile_dir, 1);
+	static const char *const drop_keys[] = {"dropped", NULL};
+	host_profile_set_int("test", "kept", 1);
+	host_profile_set_int("test", "dropped", 2);
+	host_profile_set_int("test", "rewritten", 3);
+	FILE *profile = host_profile_begin("test");
+	fprintf(profile, "# Written by tests\nrewritten 4\n");
+	test_int("profile-commit", 0, host_profile_commit("test", profile, drop_keys));
+	test_int("profile-kept", 1, host_profile_get_int_or("test", "kept", -1));
+	test_int("profile-dropped", -1, host_profile_get_int_or("test", "dropped", -1));
+	test_int("profile-rewritten", 4, host_profile_get_int_or("test", "rewritten", -1));
+	host_profile_set_int("test", "kept", 5);
+	test_int("profile-set", 5, host_profile_get_int_or("test", "kept", -1));
+
+	char path[HOST_PROFILE_MAX_PATH];
+	host_profile_path("test", path, sizeof(path));
+	unlink(path);
+	*strrchr(path, '/') = '\0';
+	rmdir(path);
+	rmdir(profile_dir);
+
+	return failed;
+}
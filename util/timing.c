@@ -0,0 +1,107 @@
+/**
+ * timing.c
+ *
+ * Setup of the rdpmc timing backend (see timing.h).
+ */
+
+#include "timing.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// L1D_PEND_MISS.PENDING on Skylake-SP / Cascade Lake (event 0x48, umask 0x01)
+#define L1D_PEND_MISS_PENDING 0x0148
+
+static void timing_fallback(struct timing *t, const char *reason)
+{
+	fprintf(stderr, "[timing] rdpmc unavailable (%s), falling back to TSC\n", reason);
+	if (t->page != NULL) {
+		munmap(t->page, sysconf(_SC_PAGESIZE));
+	}
+	if (t->fd >= 0) {
+		close(t->fd);
+	}
+	t->backend = TIMING_TSC;
+	t->fd = -1;
+	t->page = NULL;
+}
+
+/**
+ * Sets up the rdpmc backend for the calling thread, counting the given event.
+ * Falls back to the TSC backend if rdpmc cannot be used.
+ * Returns the backend selected.
+ */
+int timing_init(struct timing *t, enum timing_event event)
+{
+	t->backend = TIMING_RDPMC;
+	t->event = event;
+	t->fd = -1;
+	t->page = NULL;
+
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.pinned = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	if (event == TIMING_EVENT_L1D_PEND_MISS) {
+		attr.type = PERF_TYPE_RAW;
+		attr.config = L1D_PEND_MISS_PENDING;
+	} else {
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	}
+
+	// Count for this thread on whatever CPU it runs on
+	t->fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (t->fd < 0) {
+		timing_fallback(t, strerror(errno));
+		return t->backend;
+	}
+
+	// The first page of the mmap tells us whether rdpmc is allowed and
+	// which counter the event was scheduled on
+	t->page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, t->fd, 0);
+	if (t->page == MAP_FAILED) {
+		t->page = NULL;
+		timing_fallback(t, strerror(errno));
+		return t->backend;
+	}
+	if (!t->page->cap_user_rdpmc) {
+		timing_fallback(t, "rdpmc disabled for user space");
+		return t->backend;
+	}
+
+	// The counter of the event is looked up on each read (timing_index);
+	// check that it is scheduled now
+	if (timing_index(t) == 0) {
+		timing_fallback(t, "event not scheduled");
+		return t->backend;
+	}
+
+	return t->backend;
+}
+
+void timing_close(struct timing *t)
+{
+	if (t->page != NULL) {
+		munmap(t->page, sysconf(_SC_PAGESIZE));
+	}
+	if (t->fd >= 0) {
+		close(t->fd);
+	}
+	t->page = NULL;
+	t->fd = -1;
+}
+
+const char *timing_name(const struct timing *t)
+{
+	if (t->backend == TIMING_TSC) {
+		return "tsc";
+	}
+	return t->event == TIMING_EVENT_L1D_PEND_MISS ? "rdpmc-l1d-pend-miss" : "rdpmc-cycles";
+}
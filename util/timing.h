@@ -0,0 +1,155 @@
+/**
+ * timing.h
+ *
+ * Timing backends for the probe loops.
+ *
+ * TIMING_TSC times loads with the lfence; rdtsc ... rdtscp sequence used by
+ * the receivers (see time_load in util.h). TIMING_RDPMC enables user-space
+ * rdpmc through perf_event_open and times loads with a core PMU counter
+ * instead: the core cycle counter (a fixed counter) or a programmable event
+ * such as the cycles with an L1D miss pending, which only counts while the
+ * load is actually waiting on the uncore.
+ *
+ * timing_init falls back to TIMING_TSC when rdpmc is not available (e.g.,
+ * perf_event_paranoid too high, /sys/bus/event_source/devices/cpu/rdpmc set
+ * to 0, or no PMU in a VM), so callers can always use timing_load.
+ *
+ * The PMU counters are per thread and only count while the thread runs, so
+ * they do not show interrupts and preemption: gap detection (sample_guard.h)
+ * should keep using the TSC.
+ */
+
+#ifndef TIMING_H_
+#define TIMING_H_
+
+#include <stdint.h>
+#include <linux/perf_event.h>
+
+#include "util.h"
+
+enum timing_backend { TIMING_TSC, TIMING_RDPMC };
+
+enum timing_event {
+	TIMING_EVENT_CYCLES,		/* Core cycles (fixed counter) */
+	TIMING_EVENT_L1D_PEND_MISS, /* L1D_PEND_MISS.PENDING: cycles with an L1D miss outstanding */
+};
+
+struct timing {
+	enum timing_backend backend;
+	enum timing_event event;
+	int fd;								/* perf event (-1 with TIMING_TSC) */
+	struct perf_event_mmap_page *page;	/* perf mmap page (NULL with TIMING_TSC) */
+};
+
+int timing_init(struct timing *t, enum timing_event event);
+void timing_close(struct timing *t);
+const char *timing_name(const struct timing *t);
+
+/*
+ * Times a single load from p with rdpmc on the given counter.
+ * The lfences keep the counter reads from being reordered with the load.
+ */
+static inline uint32_t rdpmc_time_load(uint32_t counter, void *p)
+{
+	uint32_t latency;
+	asm volatile(
+		"movl %2, %%ecx\n\t"	/* ecx = counter index */
+		"lfence\n\t"
+		"rdpmc\n\t"				/* eax = PMC (low 32 bits) */
+		"movl %%eax, %%r8d\n\t"	/* r8d = eax */
+		"movq (%1), %%r9\n\t"	/* r9 = *p; LOAD */
+		"lfence\n\t"
+		"rdpmc\n\t"				/* eax = PMC (low 32 bits) */
+		"sub %%r8d, %%eax\n\t"	/* eax = eax - r8d */
+		"movl %%eax, %0\n\t"
+		: "=rm"(latency) /* output */
+		: "r"(p), "r"(counter)
+		: "rax", "rcx", "rdx", "r8", "r9", "memory");
+	return latency;
+}
+
+/*
+ * Returns the counter delta of an empty timed region (the backend overhead).
+ */
+static inline uint32_t rdpmc_time_empty(uint32_t counter)
+{
+	uint32_t latency;
+	asm volatile(
+		"movl %1, %%ecx\n\t"
+		"lfence\n\t"
+		"rdpmc\n\t"
+		"movl %%eax, %%r8d\n\t"
+		"lfence\n\t"
+		"rdpmc\n\t"
+		"sub %%r8d, %%eax\n\t"
+		"movl %%eax, %0\n\t"
+		: "=rm"(latency) /* output */
+		: "r"(counter)
+		: "rax", "rcx", "rdx", "r8", "memory");
+	return latency;
+}
+
+static inline uint32_t tsc_time_empty(void)
+{
+	uint32_t latency;
+	asm volatile(
+		"lfence\n\t"
+		"rdtsc\n\t"
+		"movl %%eax, %%r8d\n\t"
+		"rdtscp\n\t"
+		"sub %%r8d, %%eax\n\t"
+		"movl %%eax, %0\n\t"
+		: "=rm"(latency) /* output */
+		:
+		: "rax", "rcx", "rdx", "r8", "memory");
+	return latency;
+}
+
+/*
+ * Returns the index of the counter the event is scheduled on plus one (0 if
+ * it is not scheduled). The kernel may move the event to another counter
+ * whenever it reschedules it, so the index is read on every use, under the
+ * sequence lock of the perf page as the perf ABI requires.
+ */
+static inline uint32_t timing_index(const struct timing *t)
+{
+	uint32_t seq, index;
+	do {
+		seq = t->page->lock;
+		asm volatile("" ::: "memory");
+		index = t->page->index;
+		asm volatile("" ::: "memory");
+	} while (t->page->lock != seq);
+	return index;
+}
+
+/*
+ * Times a single load from p with the backend selected by timing_init. Only
+ * the deltas of the counter are used, so the offset of the perf page is not
+ * needed. The event can only be rescheduled during the load if the thread is
+ * interrupted, which gap detection tags. If the event is not scheduled, the
+ * load is timed with the TSC.
+ */
+static inline uint32_t timing_load(const struct timing *t, void *p)
+{
+	if (t->backend == TIMING_RDPMC) {
+		uint32_t index = timing_index(t);
+		if (index != 0) {
+			return rdpmc_time_load(index - 1, p);
+		}
+	}
+	return time_load(p);
+}
+
+static inline uint32_t timing_empty(const struct timing *t)
+{
+	if (t->backend == TIMING_RDPMC) {
+		uint32_t index = timing_index(t);
+		if (index != 0) {
+			return rdpmc_time_empty(index - 1);
+		}
+	}
+	return tsc_time_empty();
+}
+
+#endif // TIMING_H_
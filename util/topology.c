@@ -0,0 +1,137 @@
+/**
+ * topology.c
+ *
+ * Runtime CHA to CPU mapping (see topology.h).
+ */
+
+#include "topology.h"
+#include "host_profile.h"
+
+#include <stdio.h>
+
+static int loaded = 0;
+static int cha_cpu[NUM_CHA];
+static int cpu_cha[TOPOLOGY_MAX_CPUS];
+static int layout_loaded = 0;
+static int cha_row[NUM_CHA], cha_col[NUM_CHA];
+
+static void topology_load(void)
+{
+	char key[32];
+	int value, from_profile = 1;
+	for (int cha = 0; cha < NUM_CHA; cha++) {
+		sprintf(key, "cha_%d_cpu", cha);
+		if (host_profile_get_int(HOST_PROFILE_TOPOLOGY, key, &value) != 0) {
+			from_profile = 0;
+			break;
+		}
+		cha_cpu[cha] = value;
+	}
+
+	if (!from_profile) {
+		fprintf(stderr, "[topology] no %s profile for this host, using the built-in CHA to CPU table\n",
+				HOST_PROFILE_TOPOLOGY);
+		for (int cha = 0; cha < NUM_CHA; cha++) {
+			cha_cpu[cha] = cha_id_to_cpu[cha];
+		}
+	}
+
+	for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++) {
+		cpu_cha[cpu] = -1;
+		if (from_profile) {
+			sprintf(key, "cpu_%d_cha", cpu);
+			cpu_cha[cpu] = host_profile_get_int_or(HOST_PROFILE_TOPOLOGY, key, -1);
+		}
+	}
+	for (int cha = 0; cha < NUM_CHA; cha++) {
+		if (cha_cpu[cha] >= 0 && cha_cpu[cha] < TOPOLOGY_MAX_CPUS && cpu_cha[cha_cpu[cha]] < 0) {
+			cpu_cha[cha_cpu[cha]] = cha;
+		}
+	}
+
+	loaded = 1;
+}
+
+/**
+ * Returns the (lowest) CPU of the core on the tile of the given CHA, or -1 if
+ * the tile has no active core.
+ */
+int cha_to_cpu(int cha)
+{
+	if (!loaded) {
+		topology_load();
+	}
+	if (cha < 0 || cha >= NUM_CHA) {
+		return -1;
+	}
+	return cha_cpu[cha];
+}
+
+/**
+ * Returns the CHA on the tile of the given CPU, or -1 if unknown (e.g., a CPU
+ * of the other socket).
+ */
+int cpu_to_cha(int cpu)
+{
+	if (!loaded) {
+		topology_load();
+	}
+	if (cpu < 0 || cpu >= TOPOLOGY_MAX_CPUS) {
+		return -1;
+	}
+	return cpu_cha[cpu];
+}
+
+static void layout_load(void)
+{
+	char key[32];
+	int rows;
+	if (host_profile_get_int(HOST_PROFILE_LAYOUT, "rows", &rows) == 0) {
+		for (int cha = 0; cha < NUM_CHA; cha++) {
+			sprintf(key, "cha_%d_row", cha);
+			cha_row[cha] = host_profile_get_int_or(HOST_PROFILE_LAYOUT, key, -1);
+			sprintf(key, "cha_%d_col", cha);
+			cha_col[cha] = host_profile_get_int_or(HOST_PROFILE_LAYOUT, key, -1);
+
+			// The tools size their tables for the compiled die, so a tile
+			// outside of it is not placed
+			if (cha_row[cha] >= DIE_ROWS || cha_col[cha] >= DIE_COLS) {
+				fprintf(stderr, "[topology] CHA %d is at (%d, %d) in the %s profile, outside of the %dx%d die; ignoring it\n",
+						cha, cha_row[cha], cha_col[cha], HOST_PROFILE_LAYOUT, DIE_ROWS, DIE_COLS);
+				cha_row[cha] = cha_col[cha] = -1;
+			}
+		}
+	} else {
+		fprintf(stderr, "[topology] no %s profile for this host, using the built-in die layout\n", HOST_PROFILE_LAYOUT);
+		for (int cha = 0; cha < NUM_CHA; cha++) {
+			cha_row[cha] = cha_col[cha] = -1;
+		}
+		for (int row = 0; row < DIE_ROWS; row++) {
+			for (int col = 0; col < DIE_COLS; col++) {
+				if (die_layout[row][col] >= 0) {
+					cha_row[die_layout[row][col]] = row;
+					cha_col[die_layout[row][col]] = col;
+				}
+			}
+		}
+	}
+	layout_loaded = 1;
+}
+
+/**
+ * Stores the row and column (origin in the top left) of the tile of the given
+ * CHA on the die.
+ * Returns 0 on success, or -1 if the layout does not place the CHA.
+ */
+int cha_to_tile(int cha, int *row, int *col)
+{
+	if (!layout_loaded) {
+		layout_load();
+	}
+	if (cha < 0 || cha >= NUM_CHA || cha_row[cha] < 0 || cha_col[cha] < 0) {
+		return -1;
+	}
+	*row = cha_row[cha];
+	*col = cha_col[cha];
+	return 0;
+}
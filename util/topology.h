@@ -0,0 +1,32 @@
+/**
+ * topology.h
+ *
+ * Mapping between the CHAs (mesh tiles) and the CPUs of the socket the
+ * experiments run on.
+ *
+ * The mapping is read at runtime from the topology profile of the host,
+ * written by 00-host-profile/bin/discover-topology. Hosts of the same model
+ * fuse off different cores, so a CHA ID does not map to the same CPU on every
+ * host. Without a profile, the built-in cha_id_to_cpu table of our machine
+ * (machine_const.c) is used and a warning is printed.
+ *
+ * The 2D coordinates of the tiles are read from the layout profile, written
+ * by 00-host-profile/infer-layout.py from the latency matrix of
+ * discover-topology. Without a profile, the built-in die_layout of our
+ * machine (machine_const.c) is used and a warning is printed. Tiles of the
+ * profile outside of the DIE_ROWS x DIE_COLS grid are ignored (with a
+ * warning), as if the profile did not place their CHA.
+ */
+
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include "machine_const.h"
+
+#define TOPOLOGY_MAX_CPUS (NUM_SOCKET * NUM_LOG_CORES_PER_SOCKET * 2)
+
+int cha_to_cpu(int cha);
+int cpu_to_cha(int cpu);
+int cha_to_tile(int cha, int *row, int *col);
+
+#endif // TOPOLOGY_H_
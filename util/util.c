@@ -80,6 +80,47 @@ void append_string_to_linked_list(struct Node **head, void *addr)
 	}
 }
 
+/*
+ * Appends size addresses to the linked list pointed to by head. The addresses
+ * reside in the given LLC slice and share their L1 and L2 set indexes with the
+ * first address found in that slice at the given LLC set. This is how the
+ * monitoring sets and EVs of the receivers are built: the addresses distribute
+ * across 2 LLC sets.
+ *
+ * Returns the first node appended.
+ */
+struct Node *append_l2_congruent_set(struct Node **head, void *buffer, int slice, int llc_set, int size)
+{
+	// Find first address in our desired slice and given set
+	uint64_t offset = find_next_address_on_slice_and_set(buffer, slice, llc_set);
+	append_string_to_linked_list(head, (void *)((uint64_t)buffer + offset));
+
+	struct Node *first = *head;
+	while (first->next != NULL) {
+		first = first->next;
+	}
+
+	// Get the L1 and L2 cache set indexes of the first address
+	uint64_t index2 = get_cache_set_index((uint64_t)first->address, 2);
+	uint64_t index1 = get_cache_set_index((uint64_t)first->address, 1);
+
+	// Find next addresses which are residing in the desired slice and the same sets in L2/L1
+	struct Node *curr_node = first;
+	for (int i = 1; i < size; i++) {
+		offset = L2_INDEX_STRIDE; // skip to the next address with the same L2 cache set index
+		while (index1 != get_cache_set_index((uint64_t)curr_node->address + offset, 1) ||
+			   index2 != get_cache_set_index((uint64_t)curr_node->address + offset, 2) ||
+			   slice != get_cache_slice_index((void *)((uint64_t)curr_node->address + offset))) {
+			offset += L2_INDEX_STRIDE;
+		}
+
+		append_string_to_linked_list(head, (void *)((uint64_t)curr_node->address + offset));
+		curr_node = curr_node->next;
+	}
+
+	return first;
+}
+
 /*
  * The argument addr should be the physical address, but in some cases it can be
  * the virtual address and this will still work. Here is why.
@@ -47,12 +47,34 @@ inline void maccess(void *p)
 				 : "rax");
 }
 
+/*
+ * Times a single load from p using the same lfence; rdtsc ... rdtscp
+ * sequence as the receivers' hot loops. Returns the latency in cycles.
+ */
+static inline uint32_t time_load(void *p)
+{
+	uint32_t latency;
+	asm volatile(
+		"lfence\n\t"
+		"rdtsc\n\t"				/* eax = TSC (timestamp counter) */
+		"movl %%eax, %%r8d\n\t"	/* r8d = eax */
+		"movq (%1), %%r9\n\t"		/* r9 = *p; LOAD */
+		"rdtscp\n\t"				/* eax = TSC (timestamp counter) */
+		"sub %%r8d, %%eax\n\t"		/* eax = eax - r8d */
+		"movl %%eax, %0\n\t"
+		: "=rm"(latency) /* output */
+		: "r"(p)
+		: "rax", "rcx", "rdx", "r8", "r9", "memory");
+	return latency;
+}
+
 struct Node {
 	void *address;
 	struct Node *next;
 };
 
 void append_string_to_linked_list(struct Node **head, void *addr);
+struct Node *append_l2_congruent_set(struct Node **head, void *buffer, int slice, int llc_set, int size);
 
 int get_cpu_on_socket(int socket); 
 uint64_t get_physical_address(void *address);